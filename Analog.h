@@ -0,0 +1,216 @@
+/*
+ *  Analog inputs
+ *
+ *  The ADC runs free on its own, every finished conversion raises ADC_vect. The
+ *  interrupt sums ANALOG_OVERSAMPLING samples of a pin, stores the average in
+ *  analog_values and moves on to the next configured pin. Reading an input from
+ *  the loop only copies a value, there is no busy wait for a conversion like
+ *  analogRead() has (don't mix the two, analogRead() stops the free running mode).
+ *
+ *  An input is mapped to:
+ *
+ *  - light channel:    the level follows the input (potentiometer), only when it
+ *                      moved more than ANALOG_HYSTERESIS so a level set by a button
+ *                      or the web isn't overruled by noise.
+ *  - switch channel:   on above on_level, off below off_level (light or temperature
+ *                      sensor), levels in between keep the current state.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define NR_ANALOG_INPUTS        4       // maximum number of analog inputs
+#define ANALOG_OVERSAMPLING     16      // samples averaged per value, power of 2
+#define ANALOG_HYSTERESIS       8       // change of a value needed to move a light channel
+
+enum ANALOG_TARGET {
+  ANALOG_LIGHT,                         // level of light channel follows the input
+  ANALOG_SWITCH                         // switch channel on / off at levels
+};
+
+struct AnalogInput
+{
+  byte pin;                             // analog pin, 0 .. 15
+  enum ANALOG_TARGET target;
+  int channel;
+  int on_level;                         // ANALOG_SWITCH only
+  int off_level;
+  int last_value;                       // value that was last applied to the channel
+};
+
+AnalogInput analog_inputs[ NR_ANALOG_INPUTS ];
+int nr_analog_inputs = 0;
+
+// Written by the interrupt
+//
+volatile unsigned int  analog_values[ NR_ANALOG_INPUTS ];   // average per input, 0 .. MAX_ANALOG_IN_VALUE
+volatile unsigned long analog_scans = 0;                    // nr of times all inputs were sampled
+
+volatile byte         analog_index = 0;
+volatile byte         analog_count = 0;
+volatile byte         analog_skip  = 0;
+volatile unsigned int analog_sum   = 0;
+
+// -------------------------------------------------------- //
+
+void addAnalogInput( byte pin, enum ANALOG_TARGET target, int channel, int on_level, int off_level )
+{
+  if ( NR_ANALOG_INPUTS <= nr_analog_inputs ) { return; }
+
+  AnalogInput *a = &analog_inputs[nr_analog_inputs++];
+
+  a->pin        = pin;
+  a->target     = target;
+  a->channel    = channel;
+  a->on_level   = on_level;
+  a->off_level  = off_level;
+  a->last_value = -1;
+}
+
+// -------------------------------------------------------- //
+
+// Select the pin of the next conversion, AVcc as reference
+//
+void analogSelect( byte pin )
+{
+  ADMUX = _BV( REFS0 ) | ( pin & 0x07 );
+
+  if ( 8 <= pin )
+  {
+    ADCSRB |= _BV( MUX5 );
+  }
+  else
+  {
+    ADCSRB &= ~_BV( MUX5 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+ISR( ADC_vect )
+{
+  unsigned int sample = ADC;
+
+  // The conversion that was already running when the pin changed
+  // still belongs to the previous pin
+  //
+  if ( 0 < analog_skip )
+  {
+    analog_skip--;
+    return;
+  }
+
+  analog_sum += sample;
+
+  if ( ANALOG_OVERSAMPLING > ++analog_count ) { return; }
+
+  analog_values[analog_index] = analog_sum / ANALOG_OVERSAMPLING;
+
+  analog_sum   = 0;
+  analog_count = 0;
+
+  if ( nr_analog_inputs <= ++analog_index )
+  {
+    analog_index = 0;
+    analog_scans++;
+  }
+
+  if ( 1 < nr_analog_inputs )
+  {
+    analogSelect( analog_inputs[analog_index].pin );
+    analog_skip = 1;
+  }
+}
+
+// -------------------------------------------------------- //
+
+int getAnalogValue( int input )
+{
+  cli();
+  int value = analog_values[input];
+  sei();
+
+  return value;
+}
+
+// -------------------------------------------------------- //
+
+void setupAnalog()
+{
+  // Inputs
+  //
+  addAnalogInput( 0, ANALOG_LIGHT,  5, 0, 0 );       // POT - Gang
+  addAnalogInput( 1, ANALOG_SWITCH, 1, 200, 150 );   // LDR - Buiten, MV - 3 on when dark
+
+  if ( 0 == nr_analog_inputs ) { return; }
+
+  // Digital input buffers of analog pins only waste power
+  //
+  for ( int i = 0; i < nr_analog_inputs; i++ )
+  {
+    byte pin = analog_inputs[i].pin;
+
+    if ( 8 > pin ) { DIDR0 |= _BV( pin ); } else { DIDR2 |= _BV( pin - 8 ); }
+  }
+
+  analogSelect( analog_inputs[0].pin );
+
+  // Free running (ADTS = 0), interrupt per conversion and 16 MHz / 128 = 125 kHz ADC clock,
+  // a conversion takes 13 ADC clocks so ~9600 samples per second
+  //
+  ADCSRB &= ~0x07;
+  ADCSRA  = _BV( ADEN ) | _BV( ADSC ) | _BV( ADATE ) | _BV( ADIE ) | _BV( ADPS2 ) | _BV( ADPS1 ) | _BV( ADPS0 );
+}
+
+// -------------------------------------------------------- //
+
+void loopAnalog()
+{
+  // Nothing to apply before every input has a value
+  //
+  cli();
+  boolean sampled = ( 0 < analog_scans );
+  sei();
+
+  if ( !sampled ) { return; }
+
+  for ( int i = 0; i < nr_analog_inputs; i++ )
+  {
+    AnalogInput *a = &analog_inputs[i];
+
+    int value = getAnalogValue( i );
+
+    switch ( a->target )
+    {
+      case ( ANALOG_LIGHT ):
+        if ( 0 <= a->last_value && ANALOG_HYSTERESIS > abs( value - a->last_value ) ) { break; }
+
+        a->last_value = value;
+
+        setLightTargetValue( a->channel, map( value, 0, MAX_ANALOG_IN_VALUE, 0, MAX_LIGHT_VALUE ), 2 );
+
+        if ( DIMMER_SERIAL_DEBUGGING > 1 )
+          Serial << "Analog input [" << i << "] value: [" << value << "] light channel: [" << a->channel << "]\n";
+        break;
+
+      case ( ANALOG_SWITCH ):
+        if ( HIGH != a->last_value && a->on_level <= value )
+        {
+          a->last_value = HIGH;
+        }
+        else if ( LOW != a->last_value && a->off_level >= value )
+        {
+          a->last_value = LOW;
+        }
+        else
+        {
+          break;
+        }
+
+        setSwitchTargetState( a->channel, a->last_value );
+
+        if ( DIMMER_SERIAL_DEBUGGING )
+          Serial << "Analog input [" << i << "] value: [" << value << "] switch channel: [" << a->channel << "] state: [" << a->last_value << "]\n";
+        break;
+    }
+  }
+}
@@ -0,0 +1,308 @@
+/*
+ *  Cluster of DoDuino nodes on the same LAN
+ *
+ *  Every node has a NODE_ID, a channel is addressed cluster wide by the node owning
+ *  the output and its channel number on that node (see CLUSTER_ADDRESS). Remote
+ *  channels are configured in remoteLights / remoteSwitches and can be attached to
+ *  buttons like any local channel.
+ *
+ *  All traffic is UDP broadcast on CLUSTER_PORT:
+ *
+ *  - hello:    every CLUSTER_HELLO_TIME ms, nodes learn about each other
+ *  - update:   list of entries, collected during a tick and sent as one datagram
+ *      - set:    remote channel changed on this node, the owner applies it
+ *      - state:  output of a local channel changed, nodes with a remote
+ *                channel pointing to it follow
+ *
+ *  Datagram: 'D', type, node, nr of entries, then per entry: kind, node, channel, value
+ */
+
+// ----------------------------------------------------------------- //
+
+#define CLUSTER_PORT            8266    // UDP port used by all nodes
+#define CLUSTER_MAX_NODES       8       // node id's 0 .. CLUSTER_MAX_NODES - 1
+#define CLUSTER_HELLO_TIME      5000    // ms between two hello's
+#define CLUSTER_NODE_TIMEOUT    15000   // ms without hello before a node is considered gone
+#define CLUSTER_MAX_ENTRIES     32      // entries in a single update datagram
+
+#define CLUSTER_MAGIC           'D'
+#define CLUSTER_HELLO           0
+#define CLUSTER_UPDATE          1
+
+#define CLUSTER_SET_LIGHT       0       // Kind of update entry
+#define CLUSTER_SET_SWITCH      1
+#define CLUSTER_STATE_LIGHT     2
+#define CLUSTER_STATE_SWITCH    3
+
+#define CLUSTER_HEADER_LENGTH   4
+#define CLUSTER_ENTRY_LENGTH    4
+
+// ----------------------------------------------------------------- //
+
+struct ClusterNode
+{
+  byte ip[4];
+  unsigned long last_seen;
+  boolean alive;
+};
+
+ClusterNode cluster_nodes[ CLUSTER_MAX_NODES ];
+
+SOCKET cluster_socket = MAX_SOCK_NUM;
+
+int cluster_nodes_alive = 0;
+
+unsigned long cluster_last_hello = 0;
+
+// Outgoing entries of the current tick
+//
+int  cluster_nr_entries = 0;
+byte cluster_buffer[ CLUSTER_HEADER_LENGTH + CLUSTER_MAX_ENTRIES * CLUSTER_ENTRY_LENGTH ];
+
+void clusterFlush();
+
+// -------------------------------------------------------- //
+
+void clusterAddEntry( byte kind, byte node, byte channel, byte value )
+{
+  if ( CLUSTER_MAX_ENTRIES <= cluster_nr_entries )
+  {
+    clusterFlush();
+  }
+
+  byte *e = &cluster_buffer[ CLUSTER_HEADER_LENGTH + cluster_nr_entries++ * CLUSTER_ENTRY_LENGTH ];
+
+  e[0] = kind;
+  e[1] = node;
+  e[2] = channel;
+  e[3] = value;
+}
+
+// -------------------------------------------------------- //
+
+void clusterSendDatagram( byte type, int entries )
+{
+  byte broadcast[4];
+
+  if ( MAX_SOCK_NUM == cluster_socket ) { return; }
+
+  cluster_buffer[0] = CLUSTER_MAGIC;
+  cluster_buffer[1] = type;
+  cluster_buffer[2] = NODE_ID;
+  cluster_buffer[3] = entries;
+
+  getBroadcastIp( broadcast );
+
+  sendto( cluster_socket, cluster_buffer, CLUSTER_HEADER_LENGTH + entries * CLUSTER_ENTRY_LENGTH, broadcast, CLUSTER_PORT );
+}
+
+// -------------------------------------------------------- //
+
+// Send all entries collected so far in one datagram
+//
+void clusterFlush()
+{
+  if ( 0 == cluster_nr_entries ) { return; }
+
+  clusterSendDatagram( CLUSTER_UPDATE, cluster_nr_entries );
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "Cluster update sent, entries: [" << cluster_nr_entries << "]\n";
+
+  cluster_nr_entries = 0;
+}
+
+// -------------------------------------------------------- //
+
+// Called by the dimmer when the output of a remote channel changes
+//
+void clusterSend( int kind, int address, int value )
+{
+  byte entryKind = ( CHANGE_LIGHT == kind ) ? CLUSTER_SET_LIGHT : CLUSTER_SET_SWITCH;
+
+  clusterAddEntry( entryKind, CLUSTER_NODE( address ), CLUSTER_CHANNEL( address ), value );
+}
+
+// -------------------------------------------------------- //
+
+// Change listener, let the other nodes know a local output changed
+//
+void clusterChanged( int kind, int id, int value )
+{
+  if ( 0 == cluster_nodes_alive ) { return; }
+
+  if ( CHANGE_LIGHT == kind && CHANNEL_OUTPUT_REMOTE != l_channels[id].output )
+  {
+    clusterAddEntry( CLUSTER_STATE_LIGHT, NODE_ID, id, value );
+  }
+  else if ( CHANGE_SWITCH == kind && CHANNEL_OUTPUT_PIN == sw_channels[id].output )
+  {
+    clusterAddEntry( CLUSTER_STATE_SWITCH, NODE_ID, id, value );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Queue the state of all local channels, used when a new node shows up
+//
+void clusterSendState()
+{
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    clusterChanged( CHANGE_LIGHT, i, l_channels[i].light_value );
+  }
+
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
+  {
+    clusterChanged( CHANGE_SWITCH, i, sw_channels[i].state );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void clusterApplyEntry( byte *e )
+{
+  int address = CLUSTER_ADDRESS( e[1], e[2] );
+  int channel = e[2];
+
+  switch ( e[0] )
+  {
+    // Set commands are only for the node owning the output
+    //
+    case ( CLUSTER_SET_LIGHT ):
+      if ( NODE_ID == e[1] && NR_LIGHT_CHANNELS > channel && CHANNEL_OUTPUT_REMOTE != l_channels[channel].output )
+      {
+        commandLightValue( channel, e[3], 2 );
+      }
+      break;
+
+    case ( CLUSTER_SET_SWITCH ):
+      if ( NODE_ID == e[1] && NR_SWITCH_CHANNELS > channel && CHANNEL_OUTPUT_PIN == sw_channels[channel].output )
+      {
+        setSwitchTargetState( channel, e[3] ? HIGH : LOW );
+      }
+      break;
+
+    // Follow the state of the owner, value and target are both set so the
+    // change is not sent back
+    //
+    case ( CLUSTER_STATE_LIGHT ):
+      for ( int i = NR_PWM_LIGHT_CHANNELS; i < NR_PWM_LIGHT_CHANNELS + NR_REMOTE_LIGHT_CHANNELS; i++ )
+      {
+        LightChannel *c = &l_channels[i];
+
+        if ( address == c->address && c->light_value != e[3] )
+        {
+          c->light_value = c->target_light_value = e[3];
+          c->last_value_change = now;
+
+          notifyChange( CHANGE_LIGHT, i, c->light_value );
+        }
+      }
+      break;
+
+    case ( CLUSTER_STATE_SWITCH ):
+      for ( int i = NR_RELAY_SWITCH_CHANNELS; i < NR_SWITCH_CHANNELS; i++ )
+      {
+        SwitchChannel *s = &sw_channels[i];
+
+        if ( address == s->address && s->state != e[3] )
+        {
+          s->state = s->target_state = e[3];
+          s->last_state_change = now;
+
+          notifyChange( CHANGE_SWITCH, i, s->state );
+        }
+      }
+      break;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void clusterReceive()
+{
+  byte buf[ CLUSTER_HEADER_LENGTH + CLUSTER_MAX_ENTRIES * CLUSTER_ENTRY_LENGTH ];
+  byte addr[4];
+  uint16_t port;
+  int len;
+
+  while ( 0 < ( len = readUdp( cluster_socket, buf, sizeof( buf ), addr, &port )))
+  {
+    len = min( len, (int)sizeof( buf ) );
+
+    if ( CLUSTER_HEADER_LENGTH > len || CLUSTER_MAGIC != buf[0] ) { continue; }
+
+    byte node = buf[2];
+
+    if ( NODE_ID == node || CLUSTER_MAX_NODES <= node ) { continue; }
+
+    ClusterNode *n = &cluster_nodes[node];
+
+    memcpy( n->ip, addr, 4 );
+    n->last_seen = now;
+
+    if ( !n->alive )
+    {
+      n->alive = true;
+      cluster_nodes_alive++;
+
+      if ( NETWORK_SERIAL_DEBUGGING )
+        Serial << "Cluster node [" << (int)node << "] joined\n";
+
+      // Make sure the new node starts with the right state of our channels
+      //
+      clusterSendState();
+    }
+
+    if ( CLUSTER_UPDATE != buf[1] ) { continue; }
+
+    int entries = min( (int)buf[3], ( len - CLUSTER_HEADER_LENGTH ) / CLUSTER_ENTRY_LENGTH );
+
+    for ( int i = 0; i < entries; i++ )
+    {
+      clusterApplyEntry( &buf[ CLUSTER_HEADER_LENGTH + i * CLUSTER_ENTRY_LENGTH ] );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupCluster()
+{
+  cluster_socket = openUdp( CLUSTER_PORT );
+
+  addChangeListener( &clusterChanged );
+}
+
+// -------------------------------------------------------- //
+
+void loopCluster()
+{
+  if ( MAX_SOCK_NUM == cluster_socket ) { return; }
+
+  clusterReceive();
+
+  for ( int i = 0; i < CLUSTER_MAX_NODES; i++ )
+  {
+    ClusterNode *n = &cluster_nodes[i];
+
+    if ( n->alive && CLUSTER_NODE_TIMEOUT < now - n->last_seen )
+    {
+      n->alive = false;
+      cluster_nodes_alive--;
+
+      if ( NETWORK_SERIAL_DEBUGGING )
+        Serial << "Cluster node [" << i << "] gone\n";
+    }
+  }
+
+  if ( CLUSTER_HELLO_TIME <= now - cluster_last_hello )
+  {
+    clusterSendDatagram( CLUSTER_HELLO, 0 );
+
+    cluster_last_hello = now;
+  }
+
+  clusterFlush();
+}
@@ -5,21 +5,47 @@
  *      physical buttons that can set a PIN to HIGH or LOW. 
  *      Buttons can control 0 or more light channels and/or 0 or more switch channels.
  *
+ *  - gesture:
+ *      what the user did with a button (press, double tap, long press, ...). Gestures are
+ *      detected by a table driven state machine and each button can map every gesture 
+ *      to its own action on the light channels.
+ *
  *  - switch (channel):  
  *      digital output PIN, primarily used to control relais.
  *      Switches can be controller by attaching them to a button or directly using 
  *  - light (channel):   analog output PIN, primarily used to control dimmers
+ *
+ *  - remote (channel):
+ *      light or switch channel that lives on another DoDuino in the cluster. Locally it 
+ *      behaves like any other channel, changes are sent to the node owning the output.
+ *
+ *  - dmx (channel):
+ *      light channel on a DMX512 dimmer, see Dmx.h. Follows the remote channels and
+ *      behaves like any other channel, the value is put in its slot of the DMX frame.
+ *
+ *  - i2c (channel):
+ *      light channel on an output of a PCA9685 PWM expander, see Pca9685.h. Follows the 
+ *      DMX channels, changes are written to the chips once per output tick.
  */
 
 // ----------------------------------------------------------------- //
 
 #define STEP_TIME               20      // minimal ms per step, lower is faster level change
 #define PULSE_TIME              250     // ms to consider button state change to be a pulse
+#define LONG_PRESS_TIME         1000    // ms a button has to be held to be a long press
 
 // ----------------------------------------------------------------- //
 
-#define NR_LIGHT_CHANNELS       12      // number of PWM output channels used for dimmers
-#define NR_SWITCH_CHANNELS      10      // nr of digital output channels used for relais
+#define NR_PWM_LIGHT_CHANNELS   12      // number of PWM output channels used for dimmers
+#define NR_REMOTE_LIGHT_CHANNELS 0      // nr of light channels on other cluster nodes, see remoteLights
+#define NR_DMX_LIGHT_CHANNELS   0       // nr of light channels on DMX512 dimmers, see dmxLights
+#define NR_I2C_LIGHT_CHANNELS   0       // nr of light channels on PCA9685 expanders, see i2cLights
+#define NR_LIGHT_CHANNELS       ( NR_PWM_LIGHT_CHANNELS + NR_REMOTE_LIGHT_CHANNELS + NR_DMX_LIGHT_CHANNELS + NR_I2C_LIGHT_CHANNELS )
+
+#define NR_RELAY_SWITCH_CHANNELS 10     // nr of digital output channels used for relais
+#define NR_REMOTE_SWITCH_CHANNELS 0     // nr of switch channels on other cluster nodes, see remoteSwitches
+#define NR_SWITCH_CHANNELS      ( NR_RELAY_SWITCH_CHANNELS + NR_REMOTE_SWITCH_CHANNELS )
+
 #define NR_BUTTONS              10      // nr of digital input buttons
 
 #define NR_CHANNELS_PER_BUTTON  8       // maximum number of channels that a single button can control
@@ -31,14 +57,37 @@
 #define MAX_LIGHT_VALUE         255     // the maximum value a PWM output can have
 #define MAX_ANALOG_IN_VALUE     1023    // the maximum value of a analogue input
 
+#define NR_CHANGE_LISTENERS     4       // maximum number of functions notified of output changes
+#define NR_OUTPUT_PORTS         4       // maximum number of ports the relais are spread over
+
+#define CHANGE_LIGHT            0       // Kind of output change passed to the listeners
+#define CHANGE_SWITCH           1
+
+// Global channel address in the cluster, the channel number on the node owning the output
+//
+#define CLUSTER_ADDRESS( node, channel )  ( ( (node) << 8 ) | (channel) )
+#define CLUSTER_NODE( address )           ( (address) >> 8 )
+#define CLUSTER_CHANNEL( address )        ( (address) & 0xFF )
+
+// Output of a light channel on a PCA9685 expander
+//
+#define PCA9685_ADDRESS( chip, output )   ( ( (chip) << 4 ) | (output) )
+#define PCA9685_CHIP( address )           ( (address) >> 4 )
+#define PCA9685_OUTPUT( address )         ( (address) & 0x0F )
+
+// Length of a configuration array for n channels, at least 1 as C++ has no zero
+// length arrays (GCC allows them, other compilers don't)
+//
+#define CONFIG_LENGTH( n )                ( (n) > 0 ? (n) : 1 )
+
 // ------------------------------------------------------------------------- //
 // PIN CONFIGURATION
 //
-int lightPins[NR_LIGHT_CHANNELS] = {    // MEGA pins used for PWM output to control dimmers
+int lightPins[NR_PWM_LIGHT_CHANNELS] = {    // MEGA pins used for PWM output to control dimmers
   2,3,4,5,6,7,8,9,10,11,12,13
 };
 
-int switchPins[NR_SWITCH_CHANNELS] = {  // MEGA pins used for digital output to control relais
+int switchPins[NR_RELAY_SWITCH_CHANNELS] = {  // MEGA pins used for digital output to control relais
   30,31,32,33,34,35,36,37,38,39
 };
 
@@ -46,6 +95,18 @@ int buttonPins[NR_BUTTONS] = {          // MEGA pins used for digital input
   40,41,42,43,44,45,46,47,48,49
 };
 
+int remoteLights[CONFIG_LENGTH(NR_REMOTE_LIGHT_CHANNELS)] = {     // CLUSTER_ADDRESS of the light channels following the PWM channels
+};
+
+int remoteSwitches[CONFIG_LENGTH(NR_REMOTE_SWITCH_CHANNELS)] = {  // CLUSTER_ADDRESS of the switch channels following the relais
+};
+
+int dmxLights[CONFIG_LENGTH(NR_DMX_LIGHT_CHANNELS)] = {           // DMX slot (1 .. 512) of the light channels following the remote channels
+};
+
+int i2cLights[CONFIG_LENGTH(NR_I2C_LIGHT_CHANNELS)] = {           // PCA9685_ADDRESS of the light channels following the DMX channels
+};
+
 // ------------------------------------------------------------------------- //
 // Forward declerations
 //
@@ -53,20 +114,140 @@ struct Button;
 struct LightChannel;
 struct SwitchChannel;
 
+void inputDimmer();
+void timersDimmer();
+void outputDimmer();
 void handleInput( int id );
+void handleGesture( Button *b, byte gesture );
+void fadeButton( Button *b );
+void setButtonTarget( LightChannel *c, int target );
+int  readButton( Button *b );
+void checkGesture( int id, byte state, byte gesture );
+void checkInvariant( boolean ok, const char *rule );
 void processLightTarget( int id );
 void processSwitchTarget( int id );
 void queueSwitch( SwitchChannel *c );
 void processSwitchQueue();
 void processSwitchUp( SwitchChannel *c );
 void processSwitchDown( SwitchChannel *c );
+void notifyChange( int kind, int id, int value );
+void clusterSend( int kind, int address, int value );
+void dmxSet( int slot, int value );
+void pca9685Set( int address, int value );
+void pca9685Flush();
+void commitOutputs();
+int  outputPort( int pin );
+void setupPwm( int id );
+void setGroup( int group, int value, int speedFactor );
+void toggleGroup( int group );
+
+// ------------------------------------------------------------------------- //
+// Gesture state machine
+//
+// Every tick a button has at most one input event (pressed, released or the 
+// time of the current state has passed). The event and current state select the 
+// next state and the gesture to handle from gestureTransitions, so the cost per 
+// button per tick does not depend on the number of gestures.
+//
+// Every tap is a press, like the buttons always worked: the second tap toggles
+// back what the first one toggled. A double or triple tap then acts on top of 
+// that at the release. A tap and hold fades from where the second tap left the
+// light: the level before the first tap, unless that was max.
+//
+enum GESTURE_STATE {
+  GS_IDLE,                              // released
+  GS_DOWN,                              // pressed
+  GS_UP,                                // released shortly after a press, a second tap may follow
+  GS_DOWN2,                             // second tap
+  GS_UP2,                               // released after the second tap, a third tap may follow
+  GS_DOWN3,                             // third tap
+  GS_LONG,                              // held after a long press
+  GS_FADE,                              // fading while held
+  GS_FADE_UP,                           // released while fading, a tap reverses the fade
+  NR_GESTURE_STATES
+};
+
+enum INPUT_EVENT {
+  INPUT_PRESS,
+  INPUT_RELEASE,
+  INPUT_TIMEOUT,
+  NR_INPUT_EVENTS,
+  INPUT_NONE
+};
+
+enum GESTURE {
+  GESTURE_NONE,
+  GESTURE_PRESS,                        // button pressed, every tap of a double or triple tap too
+  GESTURE_DOUBLE,                       // released after two taps
+  GESTURE_TRIPLE,                       // released after three taps
+  GESTURE_LONG,                         // held for LONG_PRESS_TIME
+  GESTURE_FADE,                         // tap and hold
+  GESTURE_REVERSE,                      // tapped again shortly after a fade
+  NR_GESTURES
+};
+
+enum GESTURE_ACTION {
+  ACTION_NONE,
+  ACTION_TOGGLE,                        // off when on, back to the last value when off or at max
+  ACTION_MAX_TOGGLE,                    // to max, or off when already at max
+  ACTION_IDLE,                          // to the idle value of the channel
+  ACTION_OFF,
+  ACTION_FADE,                          // start fading, away from the border when at one
+  ACTION_REVERSE,                       // fade into the oposite direction
+  ACTION_GROUP_TOGGLE,                  // all channels of the group of the button off when any is on, else on
+  ACTION_GROUP_OFF                      // all channels of the group of the button off
+};
+
+struct GestureTransition
+{
+  byte next;                            // GESTURE_STATE
+  byte gesture;                         // GESTURE
+};
+
+// Next state and gesture per state and input event
+//
+const GestureTransition gestureTransitions[ NR_GESTURE_STATES ][ NR_INPUT_EVENTS ] PROGMEM = {
+  //   INPUT_PRESS                       INPUT_RELEASE                      INPUT_TIMEOUT
+  { { GS_DOWN,    GESTURE_PRESS   }, { GS_IDLE,    GESTURE_NONE    }, { GS_IDLE,    GESTURE_NONE    } },   // GS_IDLE
+  { { GS_DOWN,    GESTURE_NONE    }, { GS_UP,      GESTURE_NONE    }, { GS_LONG,    GESTURE_LONG    } },   // GS_DOWN
+  { { GS_DOWN2,   GESTURE_PRESS   }, { GS_UP,      GESTURE_NONE    }, { GS_IDLE,    GESTURE_NONE    } },   // GS_UP
+  { { GS_DOWN2,   GESTURE_NONE    }, { GS_UP2,     GESTURE_DOUBLE  }, { GS_FADE,    GESTURE_FADE    } },   // GS_DOWN2
+  { { GS_DOWN3,   GESTURE_PRESS   }, { GS_UP2,     GESTURE_NONE    }, { GS_IDLE,    GESTURE_NONE    } },   // GS_UP2
+  { { GS_DOWN3,   GESTURE_NONE    }, { GS_IDLE,    GESTURE_TRIPLE  }, { GS_FADE,    GESTURE_FADE    } },   // GS_DOWN3
+  { { GS_LONG,    GESTURE_NONE    }, { GS_IDLE,    GESTURE_NONE    }, { GS_LONG,    GESTURE_NONE    } },   // GS_LONG
+  { { GS_FADE,    GESTURE_NONE    }, { GS_FADE_UP, GESTURE_NONE    }, { GS_FADE,    GESTURE_NONE    } },   // GS_FADE
+  { { GS_FADE,    GESTURE_REVERSE }, { GS_FADE_UP, GESTURE_NONE    }, { GS_IDLE,    GESTURE_NONE    } }    // GS_FADE_UP
+};
+
+// ms after which a state gets the INPUT_TIMEOUT event, 0 for never
+//
+const unsigned int gestureTimeouts[ NR_GESTURE_STATES ] PROGMEM = {
+  0,                                    // GS_IDLE
+  LONG_PRESS_TIME,                      // GS_DOWN
+  PULSE_TIME,                           // GS_UP
+  PULSE_TIME,                           // GS_DOWN2
+  PULSE_TIME,                           // GS_UP2
+  PULSE_TIME,                           // GS_DOWN3
+  0,                                    // GS_LONG
+  0,                                    // GS_FADE
+  PULSE_TIME                            // GS_FADE_UP
+};
 
 // ------------------------------------------------------------------------- //
 // Data structures
 //
+enum CHANNEL_OUTPUT {
+  CHANNEL_OUTPUT_PIN,                   // output on a pin of this board
+  CHANNEL_OUTPUT_REMOTE,                // output on another node in the cluster, see address
+  CHANNEL_OUTPUT_DMX,                   // output in DMX slot address
+  CHANNEL_OUTPUT_I2C                    // output on a PCA9685 expander, see address
+};
+
 struct LightChannel
 {
   int pin;
+  enum CHANNEL_OUTPUT output;
+  int address;                          // CLUSTER_ADDRESS for remote, slot for DMX, PCA9685_ADDRESS for I2C channels
   int light_value;
   int last_light_value;
   int idle_light_value;
@@ -75,6 +256,12 @@ struct LightChannel
   int speed_factor;
   unsigned long last_value_change;
   unsigned long last_target_change; 
+  int pending_value;                    // latest value commanded over the network, -1 for none
+  int pending_speed_factor;
+  unsigned long on_time;                // seconds with a non 0 output, see accountLight
+  unsigned long energy;                 // seconds at full output
+  byte energy_rest;                     // value x seconds not yet a full second at full output
+  unsigned long accounted_time;         // on_time and energy are counted up to here
   Button *button;
   boolean has_button;
 };
@@ -90,6 +277,8 @@ enum SWITCH_TYPE {
 struct SwitchChannel 
 {
   int pin;
+  enum CHANNEL_OUTPUT output;
+  int address;                          // CLUSTER_ADDRESS for remote channels
   int state;
   int target_state;
   enum SWITCH_TYPE switch_type;
@@ -97,6 +286,10 @@ struct SwitchChannel
   unsigned long last_target_change;     // used to control queue timings
   int duration;
   int start_delay;
+  int port;                             // index in output_ports of a relais, -1 when it is written directly
+  byte bit;                             // bit of the relais in its port
+  unsigned long on_time;                // seconds switched on, see accountSwitch
+  unsigned long accounted_time;         // on_time is counted up to here
   Button *button;
   boolean has_button;
   boolean always_on;                    // when true, this switch is turned on whenever any lightchannel has a non-0 value
@@ -107,14 +300,14 @@ struct Button
   int pin;
   int prev_state;                      // used for debounce detection
   int last_state;                      // used for state detection
-  unsigned long last_change;
-  unsigned long start_time;
-  unsigned long stop_time;
+  unsigned long last_change;           // time the gesture state was entered
+  byte state;                          // GESTURE_STATE
+  byte actions[NR_GESTURES];           // GESTURE_ACTION per gesture
   LightChannel *l_channels[NR_CHANNELS_PER_BUTTON];
   int nr_l_channels;
   SwitchChannel *sw_channels[NR_CHANNELS_PER_BUTTON];
   int nr_sw_channels;
-  boolean fading;  
+  int group;                           // group of the group actions, -1 for none
 };
 
 // Maintain 1:n button => light channel relation 
@@ -139,6 +332,81 @@ Button         buttons[     NR_BUTTONS         ];
 int queued_sw_channels_length = 0;
 SwitchChannel *queued_sw_channels[NR_SWITCH_CHANNELS];
 
+// Functions called whenever the output of a light or switch channel changes,
+// so other parts (like the cluster) can follow without polling the channels
+//
+typedef void ChangeListener( int kind, int id, int value );
+
+int nr_change_listeners = 0;
+ChangeListener *change_listeners[NR_CHANGE_LISTENERS];
+
+// Invariant checking
+//
+// With DIMMER_INVARIANT_CHECKING enabled handleInput compares the light targets
+// before and after the gestures of a button against the rules the gesture logic 
+// has to obey, and keeps track of the time spent per button event:
+//
+// - a second tap undoes the first, unless max was involved (toggling from or
+//   back to max turns the light off), see invariant_targets
+// - a double tap goes to max, or to 0 when the taps left the light at max, so
+//   the target always changes
+//
+// The host harness in tools/host checks these with the rules it can only see
+// from the outside (targets in range, fades turn at the borders) over generated 
+// and recorded edge sequences.
+//
+unsigned int  invariant_violations = 0;
+unsigned long input_events         = 0;  // handleInput calls that saw a button state change
+unsigned long input_event_time     = 0;  // total us spent on those calls
+unsigned long input_event_time_max = 0;  // worst case us for a single call
+
+// Targets at the first tap per button and channel, -1 when the second tap can't 
+// be checked against them. Only takes RAM with the checks enabled.
+//
+int invariant_targets[ DIMMER_INVARIANT_CHECKING ? NR_BUTTONS : 1 ][ NR_CHANNELS_PER_BUTTON ];
+
+// Commands for light channels received over the network (web, cluster, MQTT) only
+// take the pending slot of the channel, the latest one is applied once per output
+// tick. A slider flooding requests can't make the dimmers hunt that way.
+//
+unsigned long light_commands_received = 0;
+unsigned long light_commands_applied  = 0;
+
+// Output commit
+//
+// Relais and PWM outputs are not written when their channel changes, only marked. 
+// commitOutputs writes them at the end of the output tick, so all outputs of a 
+// tick change together: every port with changed relais in a single write, and the 
+// compare register of every changed PWM channel. analogWrite is only needed to 
+// connect or disconnect the timer from a pin, at 0 and MAX_LIGHT_VALUE.
+//
+struct OutputPort
+{
+  volatile uint8_t *reg;
+  byte mask;                            // bits of the relais on this port
+  byte image;                           // state of those bits, written at the commit
+};
+
+struct PwmOutput
+{
+  volatile uint8_t *ocr;                // compare register of the timer on the pin, NULL when unknown
+  boolean wide;                         // 16 bit timer
+  boolean connected;                    // timer drives the pin, the last value was not 0 or MAX_LIGHT_VALUE
+};
+
+OutputPort output_ports[ NR_OUTPUT_PORTS ];
+int  nr_output_ports = 0;
+byte output_ports_dirty = 0;            // bit per port with a changed image
+
+PwmOutput pwm_outputs[ NR_PWM_LIGHT_CHANNELS ];
+word      pwm_dirty = 0;                // bit per PWM channel with a changed value, at most 16 channels
+
+// Counts since the last metrics were sent, see Metrics.h
+//
+unsigned int button_events = 0;         // presses and releases
+unsigned int gesture_counts[ NR_GESTURES ];
+int          switch_queue_max = 0;      // deepest switch queue seen by timersDimmer
+
 // -------------------------------------------------------- //
 
 void setLightTargetValue( int channel, int value, int speedFactor )
@@ -160,6 +428,20 @@ void setLightTargetValue( int channel, int value, int speedFactor )
 
 // -------------------------------------------------------- //
 
+// Light value commanded over the network, last write wins
+//
+void commandLightValue( int channel, int value, int speedFactor )
+{
+  LightChannel *c = &l_channels[channel];
+  
+  c->pending_value        = value;
+  c->pending_speed_factor = speedFactor;
+  
+  light_commands_received++;
+}
+
+// -------------------------------------------------------- //
+
 void setLightIdleValue( int channel )
 {
   LightChannel *c = &l_channels[channel];
@@ -216,6 +498,26 @@ void setSwitchState( int channel, int state, int start_delay, int duration )
 
 // -------------------------------------------------------- //
 
+void addChangeListener( ChangeListener *listener )
+{
+  if ( NR_CHANGE_LISTENERS > nr_change_listeners )
+  {
+    change_listeners[nr_change_listeners++] = listener;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void notifyChange( int kind, int id, int value )
+{
+  for ( int i = 0; i < nr_change_listeners; i++ )
+  {
+    change_listeners[i]( kind, id, value );
+  }
+}
+
+// -------------------------------------------------------- //
+
 int getSwitchTargetState( int channel ) 
 {
   return sw_channels[channel].target_state;
@@ -330,7 +632,35 @@ void setupDimmer()
   {    
     LightChannel *c = &l_channels[i];
 
-    c->pin = lightPins[i];    
+    if ( NR_PWM_LIGHT_CHANNELS > i )
+    {
+      c->pin     = lightPins[i];
+      c->output  = CHANNEL_OUTPUT_PIN;
+      c->address = 0;
+      
+      setupPwm( i );
+   
+      pinMode( c->pin, OUTPUT );
+    }
+    else if ( NR_PWM_LIGHT_CHANNELS + NR_REMOTE_LIGHT_CHANNELS > i )
+    {
+      c->pin     = -1;
+      c->output  = CHANNEL_OUTPUT_REMOTE;
+      c->address = remoteLights[i - NR_PWM_LIGHT_CHANNELS];
+    }
+    else if ( NR_PWM_LIGHT_CHANNELS + NR_REMOTE_LIGHT_CHANNELS + NR_DMX_LIGHT_CHANNELS > i )
+    {
+      c->pin     = -1;
+      c->output  = CHANNEL_OUTPUT_DMX;
+      c->address = dmxLights[i - NR_PWM_LIGHT_CHANNELS - NR_REMOTE_LIGHT_CHANNELS];
+    }
+    else
+    {
+      c->pin     = -1;
+      c->output  = CHANNEL_OUTPUT_I2C;
+      c->address = i2cLights[i - NR_PWM_LIGHT_CHANNELS - NR_REMOTE_LIGHT_CHANNELS - NR_DMX_LIGHT_CHANNELS];
+    }
+    
     c->light_value = 0;
     c->target_light_value = 0;
     c->last_light_value = 0;    
@@ -339,10 +669,15 @@ void setupDimmer()
     
     c->last_value_change  = now;
     c->last_target_change = now;
+    
+    c->pending_value = -1;
+    
+    c->on_time        = 0;
+    c->energy         = 0;
+    c->energy_rest    = 0;
+    c->accounted_time = now;
    
     c->has_button = false;
-   
-    pinMode( c->pin, OUTPUT );
   }
   
   // SWITCH - Initialize the per-channel datastructures
@@ -351,18 +686,35 @@ void setupDimmer()
   {    
     SwitchChannel *s = &sw_channels[i];
 
-    s->pin = switchPins[i];    
+    if ( NR_RELAY_SWITCH_CHANNELS > i )
+    {
+      s->pin     = switchPins[i];
+      s->output  = CHANNEL_OUTPUT_PIN;
+      s->address = 0;
+      s->port    = outputPort( s->pin );
+      s->bit     = digitalPinToBitMask( s->pin );
+   
+      pinMode( s->pin, OUTPUT );
+    }
+    else
+    {
+      s->pin     = -1;
+      s->port    = -1;
+      s->output  = CHANNEL_OUTPUT_REMOTE;
+      s->address = remoteSwitches[i - NR_RELAY_SWITCH_CHANNELS];
+    }
     
     s->state        = 0;
     s->target_state = 0;
     
     s->last_state_change  = now;
     s->last_target_change = now;
+    
+    s->on_time        = 0;
+    s->accounted_time = now;
    
     s->has_button = false;
     s->always_on = false;
-   
-    pinMode( s->pin, OUTPUT );
   }
   
   // Turn on floor led, and flip to always_on to make sure it will follow lights
@@ -377,11 +729,20 @@ void setupDimmer()
     Button *b = &buttons[i];
     
     b->pin = buttonPins[i];
-    b->start_time = now;
-    b->stop_time  = now;
     b->last_change = now;
     b->last_state = LOW;
-    b->fading = false;
+    b->state = GS_IDLE;
+    b->group = -1;
+    
+    // Default gesture actions
+    //
+    b->actions[ GESTURE_NONE    ] = ACTION_NONE;
+    b->actions[ GESTURE_PRESS   ] = ACTION_TOGGLE;
+    b->actions[ GESTURE_DOUBLE  ] = ACTION_MAX_TOGGLE;
+    b->actions[ GESTURE_TRIPLE  ] = ACTION_MAX_TOGGLE;
+    b->actions[ GESTURE_LONG    ] = ACTION_NONE;
+    b->actions[ GESTURE_FADE    ] = ACTION_FADE;
+    b->actions[ GESTURE_REVERSE ] = ACTION_REVERSE;
 
     // Attach the light channels    
     b->nr_l_channels = buttonLights[i][0];
@@ -405,22 +766,93 @@ void setupDimmer()
     
     pinMode( b->pin, INPUT );    
   }
- 
+  
+  // Gesture actions that differ from the defaults go here, e.g.
+  //
+  //   buttons[ 0 ].actions[ GESTURE_LONG ] = ACTION_IDLE;
+  
   if ( DIMMER_SERIAL_DEBUGGING ) 
     Serial << "Dimmer setup done\n";  
 }
 
 // -------------------------------------------------------- //
 
+// The dimmer work is split in three parts that can be run at their own rate 
+// by the scheduler, loopDimmer runs them all in a row
+//
 void loopDimmer() 
 {   
-  // Process the possible changes per group
-  //
+  inputDimmer();
+  
+  timersDimmer();
+  
+  outputDimmer();
+}
+
+// -------------------------------------------------------- //
+
+// Sample the buttons and process the possible changes per group
+//
+void inputDimmer()
+{
   for ( int i = 0; i < NR_BUTTONS; i++ )
   {
-    handleInput( i );    
+    int lastInput = buttons[i].last_state;
+    unsigned long cycles = profileStart();
+    
+    if ( DIMMER_INVARIANT_CHECKING )
+    {
+      int lastState = buttons[i].last_state;
+      unsigned long start = micros();
+      
+      handleInput( i );
+      
+      if ( lastState != buttons[i].last_state )
+      {
+        unsigned long spent = micros() - start;
+        
+        input_events++;
+        input_event_time += spent;
+        input_event_time_max = max( input_event_time_max, spent );
+      }
+    }
+    else
+    {
+      handleInput( i );
+    }
+    
+    if ( PROFILE_ENABLED )
+    {
+      int point = ( GS_FADE == buttons[i].state )           ? PROFILE_INPUT_FADE  :
+                  ( lastInput != buttons[i].last_state )    ? PROFILE_INPUT_EVENT : PROFILE_INPUT_IDLE;
+      
+      profileStop( point, cycles );
+    }
   }
+}
+
+// -------------------------------------------------------- //
+
+// Process the queue of switches with a delayed start or stop
+//
+void timersDimmer()
+{
+  int depth = queued_sw_channels_length;
+  unsigned long cycles = profileStart();
+  
+  switch_queue_max = max( switch_queue_max, depth );
+  
+  processSwitchQueue();
   
+  profileStop( ( 0 == depth ) ? PROFILE_SWITCH_QUEUE_EMPTY : ( 1 == depth ) ? PROFILE_SWITCH_QUEUE_1 : PROFILE_SWITCH_QUEUE_N, cycles );
+}
+
+// -------------------------------------------------------- //
+
+// Bring all outputs to their set targets
+//
+void outputDimmer()
+{
   // Check if there is any lightchannel on
   //
   boolean any_on = false;
@@ -446,21 +878,63 @@ void loopDimmer()
     }
   }
 
-  // Process the queue of switches
+  // Apply the latest commanded value of every channel
   //
-  processSwitchQueue();
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    LightChannel *c = &l_channels[i];
+    
+    if ( 0 > c->pending_value ) { continue; }
+    
+    setLightTargetValue( i, c->pending_value, c->pending_speed_factor );
+    
+    c->pending_value = -1;
+    light_commands_applied++;
+  }
   
   // Process all set targets
   //
   for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
   { 
-    processLightTarget( i );
+    if ( PROFILE_ENABLED && l_channels[i].light_value != l_channels[i].target_light_value )
+    {
+      unsigned long cycles = profileStart();
+      
+      processLightTarget( i );
+      
+      profileStop( PROFILE_LIGHT_TARGET, cycles );
+    }
+    else
+    {
+      processLightTarget( i );
+    }
+  }
+  
+  // Write the changed I2C channels of this tick in bursts, the bus is only
+  // set up with PCA9685_ENABLED
+  //
+  if ( PCA9685_ENABLED && 0 < NR_I2C_LIGHT_CHANNELS )
+  {
+    pca9685Flush();
   }
   
   for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
   { 
-    processSwitchTarget( i );
+    if ( PROFILE_ENABLED && sw_channels[i].state != sw_channels[i].target_state )
+    {
+      unsigned long cycles = profileStart();
+      
+      processSwitchTarget( i );
+      
+      profileStop( PROFILE_SWITCH_TARGET, cycles );
+    }
+    else
+    {
+      processSwitchTarget( i );
+    }
   }  
+  
+  commitOutputs();
 }
 
 // -------------------------------------------------------- //
@@ -472,9 +946,9 @@ void handleInput( int id )
   
   // Stop if there are no light or switchchannels attached to this button
   //
-  if ( 0 == b->nr_l_channels && 0 == b->nr_sw_channels ) { return; }
+  if ( 0 == b->nr_l_channels && 0 == b->nr_sw_channels && 0 > b->group ) { return; }
 
-  int btnState = digitalRead( b->pin );  
+  int btnState = readButton( b );  
   
   // Only process buttonstates that are the same for two loops, debouncing
   //
@@ -484,176 +958,298 @@ void handleInput( int id )
     return;
   }
 
-  unsigned long interval = now - b->last_change;
-
-  // Only process input every STEP_TIME
-  //  
-  if ( STEP_TIME > interval ) { return; } 
-
-  // Save current light channel targets for change detection
-  //
-  int targets[b->nr_l_channels];
-  for ( int i = 0; i < b->nr_l_channels; i++ )
-  {
-    targets[i] = b->l_channels[i]->target_light_value;
-  }
+  byte event = INPUT_NONE;
   
   // Is the button pressed now while it wasn't the last time I checked? (same for released)
+  // Switches follow the flanks of the button directly
   //
   if ( b->last_state != btnState )
   {
-     b->last_state = btnState;
+    b->last_state = btnState;
     
-    // It is a button state change, but was it short enough to be a pulse?
-    //  
     if ( HIGH == btnState )
     {
-      // Set the time the HIGH state was started for pulse detection
-      //
-      b->start_time = now;
-      
-      boolean pulse = ( PULSE_TIME > ( now - b->stop_time ));
-      
-      // Stop fading when not pulsed
-      //
-      if ( b->fading && !pulse )
-      {
-        b->fading = false;
-      }      
-
-      if ( DIMMER_SERIAL_DEBUGGING ) 
-        Serial << "Pulse: " << ( pulse ? "true" : "false" ) << " stop_time: " << b->stop_time << "\n";      
-      
-      for ( int i = 0; i < b->nr_l_channels; i++ )
-      {
-        LightChannel *c = b->l_channels[i];       
-        
-        // Always return to previous value on UP flank
-        //
-  
-        // change fade direction when in fade and pulsed
-        //      
-        if ( b->fading )
-        {
-          c->dir = pulse ? !c->dir : DIR_UP;          
-
-          if ( DIMMER_SERIAL_DEBUGGING ) 
-            Serial << "Continue fading into oposite direction\n";
-        }
-        else if ( 0 == c->light_value || MAX_LIGHT_VALUE == c->light_value )
-        {
-          if ( DIMMER_SERIAL_DEBUGGING ) 
-            Serial << "Returning to last value, current value: [" << c->light_value << "] last light value: [" << c->last_light_value << "]\n";
-          
-          targets[i] = c->last_light_value;
-        }      
-        else
-        {
-          // Off on UP flank when on and not MAX
-          //
-          c->last_light_value = c->light_value;
-          targets[i] = 0;
-        }
-      }      
+      event = INPUT_PRESS;
       
       for ( int i = 0; i < b->nr_sw_channels; i++ )
       {
         processSwitchUp( b->sw_channels[i] );
       }      
-    }   
-    else // it is a change to btnState LOW
+    }
+    else
     {
-      unsigned long prevStopTime = b->stop_time;
-      
-      // Set the time the LOW state was started for pulse detection
-      //
-      b->stop_time = now;
-      
-      boolean pulse       =       PULSE_TIME   > ( b->stop_time - b->start_time );      
-      boolean doublePulse = ( 2 * PULSE_TIME ) > ( b->stop_time - prevStopTime  );
+      event = INPUT_RELEASE;
       
-      if ( DIMMER_SERIAL_DEBUGGING ) 
-        Serial << "Button to LOW, pulse: [" << ( pulse ? "true" : "false" ) << "] doublePulse: [" << ( doublePulse ? "true" : "false" ) << "]\n";
-      
-      // When double pulsed go to max value, and when already at max, go to 0
-      //
-      if ( doublePulse )
-      {      
-          for ( int i = 0; i < b->nr_l_channels; i++ )
-          {
-            int prevTarget =  targets[i];
-            
-            targets[i] = ( targets[i] == MAX_LIGHT_VALUE ) ? 0 : MAX_LIGHT_VALUE;
-            
-            if ( DIMMER_SERIAL_DEBUGGING ) 
-              Serial << "DoublePulse stop_time: [" << b->stop_time << "] prevStopTime: [" << prevStopTime  <<"], going from: [" << prevTarget << "] to: [" << targets[i] << "]\n";            
-          }
-      }      
-      
-      // Set switches of type 'pulse' to off
-      //
       for ( int i = 0; i < b->nr_sw_channels; i++ )
       {
         processSwitchDown( b->sw_channels[i] );
       }            
     }
   }
-  // Enter or continue fading
-  //
-  else if ( HIGH == btnState && ( b->fading || PULSE_TIME > ( now - b->stop_time )))  
-  { 
-    // Start fading UP
+  else
+  {
+    unsigned int timeout = pgm_read_word( &gestureTimeouts[ b->state ] );
     
-    if ( !b->fading )
+    if ( 0 != timeout && timeout <= now - b->last_change )
+    {
+      event = INPUT_TIMEOUT;
+    }
+  }
+  
+  if ( INPUT_NONE != event )
+  {
+    if ( INPUT_TIMEOUT != event )
     {
-      int dir = DIR_UP;  
-      b->fading = true;
+      button_events++;
     }
     
-    for ( int i = 0; i < b->nr_l_channels; i++ )
-    {        
-      LightChannel *c = b->l_channels[i];
+    byte state = b->state;
+    const GestureTransition *t = &gestureTransitions[ state ][ event ];
     
-      // Continue in the same direction as we already where going
-      //
-      if ( c->last_target_change < ( now - (2*STEP_TIME) ) )
+    byte next    = pgm_read_byte( &t->next );
+    byte gesture = pgm_read_byte( &t->gesture );
+    
+    if ( next != b->state )
+    {
+      if ( DIMMER_SERIAL_DEBUGGING > 1 ) 
+        Serial << "Button [" << id << "] state: [" << (int)b->state << "] event: [" << (int)event << "] next: [" << (int)next << "]\n";
+      
+      b->state = next;
+      b->last_change = now;
+    }
+    
+    if ( GESTURE_NONE != gesture )
+    {
+      gesture_counts[ gesture ]++;
+      
+      if ( DIMMER_INVARIANT_CHECKING )
       {
-        targets[i] = c->dir ? targets[i] + 1 : targets[i] - 1;      
+        checkGesture( id, state, gesture );
+      }
+      else
+      {
+        handleGesture( b, gesture );
+      }
+    }
+  }
+  
+  // Continue fading
+  //
+  if ( GS_FADE == b->state )
+  {
+    fadeButton( b );
+  }
+}
+
+// -------------------------------------------------------- //
 
-        // Flip direction when border reached
-        //        
-        if ( targets[ i ] < 0 )
+// Apply the action the button has for the gesture to its light channels
+//
+void handleGesture( Button *b, byte gesture )
+{
+  byte action = b->actions[ gesture ];
+  
+  if ( DIMMER_SERIAL_DEBUGGING ) 
+    Serial << "Gesture: [" << (int)gesture << "] action: [" << (int)action << "]\n";
+  
+  // Group actions apply to the group as a whole, not per channel
+  //
+  if ( ACTION_GROUP_TOGGLE == action || ACTION_GROUP_OFF == action )
+  {
+    if ( 0 > b->group ) { return; }
+    
+    if ( ACTION_GROUP_TOGGLE == action )
+    {
+      toggleGroup( b->group );
+    }
+    else
+    {
+      setGroup( b->group, 0, 2 );
+    }
+    
+    return;
+  }
+  
+  for ( int i = 0; i < b->nr_l_channels; i++ )
+  {
+    LightChannel *c = b->l_channels[i];
+    
+    int target = c->target_light_value;
+    
+    switch ( action )
+    {
+      case ( ACTION_NONE ):
+        break;
+        
+      case ( ACTION_TOGGLE ):
+        if ( 0 == c->light_value || MAX_LIGHT_VALUE == c->light_value )
+        {
+          if ( DIMMER_SERIAL_DEBUGGING ) 
+            Serial << "Returning to last value, current value: [" << c->light_value << "] last light value: [" << c->last_light_value << "]\n";
+          
+          target = c->last_light_value;
+        }
+        else
+        {
+          c->last_light_value = c->light_value;
+          target = 0;
+        }
+        break;
+        
+      case ( ACTION_MAX_TOGGLE ):
+        target = ( MAX_LIGHT_VALUE == target ) ? 0 : MAX_LIGHT_VALUE;
+        break;
+        
+      case ( ACTION_IDLE ):
+        setLightIdleValue( c - l_channels );
+        target = c->target_light_value;
+        break;
+        
+      case ( ACTION_OFF ):
+        target = 0;
+        break;
+        
+      case ( ACTION_FADE ):
+        if ( 0 == target ) 
         {
           c->dir = DIR_UP;
         }
-        else if ( targets[ i ] > MAX_LIGHT_VALUE )
+        else if ( MAX_LIGHT_VALUE == target )
         {
           c->dir = DIR_DOWN;
         }
+        break;
         
-        if ( DIMMER_SERIAL_DEBUGGING > 1 ) 
-          Serial << "Fading channel [" << i << "] into direction: [" << c->dir << "] new target: [" << targets[i] << "]\n";        
-      }
+      case ( ACTION_REVERSE ):
+        c->dir = !c->dir;
+        
+        if ( DIMMER_SERIAL_DEBUGGING ) 
+          Serial << "Continue fading into oposite direction\n";
+        break;
     }
-  } 
- 
-  // Process all changes made above to light value targets
-  // 
+    
+    setButtonTarget( c, target );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Step the light channels of a button that is held into their fade direction
+//
+void fadeButton( Button *b )
+{
   for ( int i = 0; i < b->nr_l_channels; i++ )
   {        
-    LightChannel *c = b->l_channels[i];  
+    LightChannel *c = b->l_channels[i];
+  
+    // Continue in the same direction as we already where going
+    //
+    if ( c->last_target_change < ( now - (2*STEP_TIME) ) )
+    {
+      int target = c->dir ? c->target_light_value + 1 : c->target_light_value - 1;      
+
+      // Flip direction when border reached
+      //        
+      if ( target < 0 )
+      {
+        c->dir = DIR_UP;
+      }
+      else if ( target > MAX_LIGHT_VALUE )
+      {
+        c->dir = DIR_DOWN;
+      }
+      
+      if ( DIMMER_SERIAL_DEBUGGING > 1 ) 
+        Serial << "Fading channel [" << i << "] into direction: [" << c->dir << "] new target: [" << target << "]\n";        
+      
+      setButtonTarget( c, target );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setButtonTarget( LightChannel *c, int target )
+{
+  target = constrain( target, 0, MAX_LIGHT_VALUE );
+  
+  if ( c->target_light_value != target )
+  {
+    c->target_light_value = target;
+    c->speed_factor = 2;
+    c->last_target_change = now;
+  }    
+}
+
+// -------------------------------------------------------- //
 
-    targets[i] = constrain( targets[i], 0, MAX_LIGHT_VALUE );
+// Single point where buttons are sampled, the host harness feeds its edge 
+// sequences in through the digitalRead of its stand-in HAL
+//
+int readButton( Button *b )
+{
+  return digitalRead( b->pin );
+}
+
+// -------------------------------------------------------- //
+
+// Handle the gesture of button id, seen in state, and check the light targets 
+// against the ones before the gesture and before the first tap
+//
+void checkGesture( int id, byte state, byte gesture )
+{
+  Button *b = &buttons[id];
+  int *tapTargets = invariant_targets[id];
+  int before[ NR_CHANNELS_PER_BUTTON ];
+  boolean settled[ NR_CHANNELS_PER_BUTTON ];
+  
+  for ( int i = 0; i < b->nr_l_channels; i++ )
+  {
+    LightChannel *c = b->l_channels[i];
     
-    if ( c->target_light_value != targets[i] )
+    before[i]  = c->target_light_value;
+    settled[i] = c->light_value == c->target_light_value && 0 > c->pending_value;
+    
+    // First tap, the second one should bring the light back to this target
+    //
+    if ( GESTURE_PRESS == gesture && GS_IDLE == state )
     {
-      c->target_light_value = targets[i];
-      c->speed_factor = 2;
-      c->last_target_change = now;
-    }    
+      boolean maxInvolved = MAX_LIGHT_VALUE == before[i] || MAX_LIGHT_VALUE == c->last_light_value;
+      
+      tapTargets[i] = ( settled[i] && !maxInvolved ) ? before[i] : -1;
+    }
   }
   
-  b->prev_state = btnState;
+  handleGesture( b, gesture );
+  
+  byte action = b->actions[ gesture ];
+  
+  for ( int i = 0; i < b->nr_l_channels; i++ )
+  {
+    int after = b->l_channels[i]->target_light_value;
+    
+    if ( GESTURE_PRESS == gesture && GS_UP == state && ACTION_TOGGLE == action && 0 <= tapTargets[i] && settled[i] )
+    {
+      checkInvariant( tapTargets[i] == after, "second tap undoes the first" );
+    }
+    
+    if ( GESTURE_DOUBLE == gesture && ACTION_MAX_TOGGLE == action )
+    {
+      checkInvariant( ( 0 == after || MAX_LIGHT_VALUE == after ) && before[i] != after, "double tap goes to max or off" );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+void checkInvariant( boolean ok, const char *rule )
+{
+  if ( ok ) { return; }
+  
+  invariant_violations++;
+  
+  Serial << "Invariant violated: [" << rule << "] at: [" << now << "] violations: [" << invariant_violations << "]" 
+         << " events: [" << input_events << "] max us: [" << input_event_time_max << "]\n";
 }
 
 // -------------------------------------------------------- //
@@ -760,7 +1356,7 @@ void processSwitchQueue()
     switch ( c->switch_type )
     {
       case ( SWITCH_TYPE_DELAYED_STOP ):
-        if ( ( now - c->last_target_change ) > ( c->duration * 1000 ) )
+        if ( ( now - c->last_target_change ) > ( c->duration * 1000UL ) )
         {
           c->target_state = LOW;
           
@@ -774,7 +1370,7 @@ void processSwitchQueue()
         break;      
         
       case ( SWITCH_TYPE_DELAYED_START ):
-        if ( now - c->last_target_change > ( c->start_delay * 1000 ) )
+        if ( now - c->last_target_change > ( c->start_delay * 1000UL ) )
         {
           c->target_state = HIGH;
 
@@ -784,7 +1380,7 @@ void processSwitchQueue()
         break;        
         
       case ( SWITCH_TYPE_DELAYED_START_STOP ):
-        if ( now - c->last_target_change > ( ( c->duration + c->start_delay ) * 1000  ))
+        if ( now - c->last_target_change > ( ( c->duration + c->start_delay ) * 1000UL ))
         {
           c->target_state = LOW;
           
@@ -795,7 +1391,7 @@ void processSwitchQueue()
           //
           remove[ remove_length++ ] = i;          
         }      
-        else if ( now - c->last_target_change > ( c->start_delay * 1000 ) )
+        else if ( now - c->last_target_change > ( c->start_delay * 1000UL ) )
         {
           c->target_state = HIGH;
 
@@ -803,6 +1399,11 @@ void processSwitchQueue()
             Serial << "Start_delay passed, switching to HIGH\n";          
         }      
         break;
+        
+      // Only the delayed types get queued
+      //
+      default:
+        break;
     }  
   }
   
@@ -810,30 +1411,26 @@ void processSwitchQueue()
   //
   if ( 0 < remove_length )
   {
-    SwitchChannel *tmp[NR_SWITCH_CHANNELS];   
-    
     if ( DIMMER_SERIAL_DEBUGGING ) 
       Serial << "Removing [" << remove_length << "] elements from queue\n";    
     
-    int j = 0; // index of element in queue array
+    int j = 0; // index of the next element kept
+    int r = 0; // index in remove, ascending like the queue
   
-    for ( int i = 0; i < remove_length; i++ )
+    // Shift the elements kept to the front, in order
+    //
+    for ( int i = 0; i < queued_sw_channels_length; i++ )
     {
-      while ( remove[i] > j )
+      if ( r < remove_length && remove[r] == i )
       {
-        tmp[j - i] = queued_sw_channels[j];
-        j++;
+        r++;
+        continue;
       }
+      
+      queued_sw_channels[j++] = queued_sw_channels[i];
     }
     
-    queued_sw_channels_length -= remove_length;
-
-    // copy over the tmp array to queue
-    //
-    for ( int i = 0; i < queued_sw_channels_length; i++ )
-    {
-      queued_sw_channels[i] = tmp[i];
-    }
+    queued_sw_channels_length = j;
     
     if ( DIMMER_SERIAL_DEBUGGING ) 
       Serial << "Queue length [" << queued_sw_channels_length << "]\n";
@@ -842,16 +1439,70 @@ void processSwitchQueue()
 
 // -------------------------------------------------------- //
 
+// On time and energy are only counted when an output changes: the time since 
+// the last change is added at the value the output had during that time. Whole 
+// seconds are counted, the rest stays with the next period. Remote channels are 
+// counted by the node that owns them.
+//
+void accountLight( LightChannel *c )
+{
+  unsigned long seconds = ( now - c->accounted_time ) / 1000;
+
+  c->accounted_time += seconds * 1000;
+
+  if ( 0 == c->light_value || CHANNEL_OUTPUT_REMOTE == c->output ) { return; }
+
+  unsigned long level = seconds * c->light_value + c->energy_rest;
+
+  c->on_time    += seconds;
+  c->energy     += level / MAX_LIGHT_VALUE;
+  c->energy_rest = level % MAX_LIGHT_VALUE;
+}
+
+// -------------------------------------------------------- //
+
+void accountSwitch( SwitchChannel *c )
+{
+  unsigned long seconds = ( now - c->accounted_time ) / 1000;
+
+  c->accounted_time += seconds * 1000;
+
+  if ( 0 == c->state || CHANNEL_OUTPUT_REMOTE == c->output ) { return; }
+
+  c->on_time += seconds;
+}
+
+// -------------------------------------------------------- //
+
 void processSwitchTarget( int id )
 {
   SwitchChannel *c = &sw_channels[id];
    
   if ( c->state == c->target_state ) { return; }
   
-  digitalWrite( c->pin, c->target_state );
+  if ( CHANNEL_OUTPUT_REMOTE == c->output )
+  {
+    clusterSend( CHANGE_SWITCH, c->address, c->target_state );
+  }
+  else if ( 0 <= c->port )
+  {
+    OutputPort *p = &output_ports[ c->port ];
+    
+    p->image = c->target_state ? ( p->image | c->bit ) : ( p->image & ~c->bit );
+    
+    bitSet( output_ports_dirty, c->port );
+  }
+  else
+  {
+    digitalWrite( c->pin, c->target_state );
+  }
+  
+  accountSwitch( c );
   
   c->state = c->target_state;
   c->last_state_change = now;  
+  
+  notifyChange( CHANGE_SWITCH, id, c->state );
 }
 
 // -------------------------------------------------------- //
@@ -869,6 +1520,8 @@ void processLightTarget( int id )
 //  unsigned long stopInterval = ( c->has_button ) ? now - c->button->stop_time : 0;
   
   if ( c->light_value == c->target_light_value  ) { return; }
+  
+  accountLight( c );
     
   /*
   if ( c->light_value > c->target_light_value )
@@ -891,10 +1544,158 @@ void processLightTarget( int id )
   
   //Serial << "P " << c->pin << " V " << c->light_value << "\n";
   
-  analogWrite( c->pin, c->light_value );
+  if ( CHANNEL_OUTPUT_REMOTE == c->output )
+  {
+    clusterSend( CHANGE_LIGHT, c->address, c->light_value );
+  }
+  else if ( CHANNEL_OUTPUT_DMX == c->output )
+  {
+    dmxSet( c->address, c->light_value );
+  }
+  else if ( CHANNEL_OUTPUT_I2C == c->output )
+  {
+    pca9685Set( c->address, c->light_value );
+  }
+  else
+  {
+    bitSet( pwm_dirty, id );
+  }
   
   // ---------------------------------------------- //
 
   c->last_value_change = now;
+  
+  notifyChange( CHANGE_LIGHT, id, c->light_value );
+}
+
+// -------------------------------------------------------- //
+
+// Index in output_ports of the port of a relais pin, the port is added when
+// it is new. -1 when there are more than NR_OUTPUT_PORTS ports.
+//
+int outputPort( int pin )
+{
+  volatile uint8_t *reg = portOutputRegister( digitalPinToPort( pin ) );
+  
+  for ( int i = 0; i < nr_output_ports; i++ )
+  {
+    if ( reg == output_ports[i].reg )
+    {
+      output_ports[i].mask |= digitalPinToBitMask( pin );
+      return i;
+    }
+  }
+  
+  if ( NR_OUTPUT_PORTS <= nr_output_ports ) { return -1; }
+  
+  OutputPort *p = &output_ports[ nr_output_ports ];
+  
+  p->reg   = reg;
+  p->mask  = digitalPinToBitMask( pin );
+  p->image = 0;
+  
+  return nr_output_ports++;
+}
+
+// -------------------------------------------------------- //
+
+// Find the compare register of the timer on the pin of a PWM channel, the same
+// timers analogWrite uses
+//
+void setupPwm( int id )
+{
+  PwmOutput *p = &pwm_outputs[id];
+  
+  p->wide      = true;
+  p->connected = false;
+  
+  switch ( digitalPinToTimer( lightPins[id] ) )
+  {
+    case ( TIMER0A ): p->ocr = &OCR0A; p->wide = false; break;
+    case ( TIMER0B ): p->ocr = &OCR0B; p->wide = false; break;
+    case ( TIMER2A ): p->ocr = &OCR2A; p->wide = false; break;
+    case ( TIMER2B ): p->ocr = &OCR2B; p->wide = false; break;
+    case ( TIMER1A ): p->ocr = (volatile uint8_t *)&OCR1A; break;
+    case ( TIMER1B ): p->ocr = (volatile uint8_t *)&OCR1B; break;
+    case ( TIMER3A ): p->ocr = (volatile uint8_t *)&OCR3A; break;
+    case ( TIMER3B ): p->ocr = (volatile uint8_t *)&OCR3B; break;
+    case ( TIMER3C ): p->ocr = (volatile uint8_t *)&OCR3C; break;
+    case ( TIMER4A ): p->ocr = (volatile uint8_t *)&OCR4A; break;
+    case ( TIMER4B ): p->ocr = (volatile uint8_t *)&OCR4B; break;
+    case ( TIMER4C ): p->ocr = (volatile uint8_t *)&OCR4C; break;
+    case ( TIMER5A ): p->ocr = (volatile uint8_t *)&OCR5A; break;
+    case ( TIMER5B ): p->ocr = (volatile uint8_t *)&OCR5B; break;
+    case ( TIMER5C ): p->ocr = (volatile uint8_t *)&OCR5C; break;
+    default:          p->ocr = NULL;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void writePwm( int id, int value )
+{
+  PwmOutput *p = &pwm_outputs[id];
+  
+  boolean pwm = 0 < value && MAX_LIGHT_VALUE > value;
+  
+  // Timer already drives the pin, only the compare value changes
+  //
+  if ( pwm && p->connected && NULL != p->ocr )
+  {
+    if ( p->wide )
+    {
+      // The high byte goes through the shared TEMP register of the 16 bit timers
+      //
+      byte sreg = SREG;
+      cli();
+      
+      *(volatile uint16_t *)p->ocr = value;
+      
+      SREG = sreg;
+    }
+    else
+    {
+      *p->ocr = value;
+    }
+    
+    return;
+  }
+  
+  analogWrite( l_channels[id].pin, value );
+  
+  p->connected = pwm;
 }
 
+// -------------------------------------------------------- //
+
+// Write all relais and PWM outputs that changed in this output tick
+//
+void commitOutputs()
+{
+  for ( int i = 0; i < nr_output_ports; i++ )
+  {
+    if ( !bitRead( output_ports_dirty, i ) ) { continue; }
+    
+    OutputPort *p = &output_ports[i];
+    
+    // Interrupts off, a pin of the port could change in between the read and write
+    //
+    byte sreg = SREG;
+    cli();
+    
+    *p->reg = ( *p->reg & ~p->mask ) | p->image;
+    
+    SREG = sreg;
+  }
+  
+  output_ports_dirty = 0;
+  
+  for ( word bits = pwm_dirty; 0 != bits; bits &= bits - 1 )
+  {
+    int id = __builtin_ctz( bits );
+    
+    writePwm( id, l_channels[id].light_value );
+  }
+  
+  pwm_dirty = 0;
+}
@@ -0,0 +1,115 @@
+/*
+ *  DMX512 output
+ *
+ *  A universe of DMX_SLOTS dimmer slots is sent over UART1 (TX1, pin 18 of the MEGA,
+ *  into an RS485 driver) again and again, the interrupts of the UART keep it going
+ *  without any work in loop():
+ *
+ *  - break:    a 0 sent at DMX_BREAK_BAUD, the start bit and 8 data bits keep the line
+ *              low for ~99 us and the stop bits make the mark after break (~22 us)
+ *  - data:     start code and slots at 250 kbaud 8N2, UDRE refills the UART per slot
+ *  - TX complete of the last slot starts the next break
+ *
+ *  A full universe is a frame every ~23 ms (~44 per second). dmxSet only patches the
+ *  slot of a changed light channel in the frame, it goes out with the next frame.
+ *
+ *  Arduino 0022 only uses the receive interrupt of Serial1, don't use Serial1 when
+ *  DMX is enabled.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define DMX_SLOTS               512     // slots in the universe, less gives a higher frame rate
+#define DMX_BAUD                250000
+#define DMX_BREAK_BAUD          90909   // a 0 at this rate is a break followed by the mark after break
+#define DMX_START_CODE          0       // dimmer data
+
+#define DMX_UBRR( baud )        ( ( F_CPU / 16 + (baud) / 2 ) / (baud) - 1 )
+
+enum DMX_STATE {
+  DMX_BREAK,                            // waiting for the last slot to go out
+  DMX_MARK,                             // break and mark after break being sent
+  DMX_DATA                              // sending start code and slots
+};
+
+// ----------------------------------------------------------------- //
+
+volatile byte dmx_frame[ 1 + DMX_SLOTS ];       // start code followed by the slots
+volatile int  dmx_index = 0;
+volatile enum DMX_STATE dmx_state = DMX_BREAK;
+volatile unsigned long dmx_frames = 0;          // nr of frames sent
+
+// -------------------------------------------------------- //
+
+// Called by the dimmer when the output of a DMX channel changes
+//
+void dmxSet( int slot, int value )
+{
+  if ( 1 > slot || DMX_SLOTS < slot ) { return; }
+
+  dmx_frame[slot] = value;
+}
+
+// -------------------------------------------------------- //
+
+// Transmission complete, either the last slot or the break is out
+//
+ISR( USART1_TX_vect )
+{
+  if ( DMX_BREAK == dmx_state )
+  {
+    UBRR1     = DMX_UBRR( DMX_BREAK_BAUD );
+    dmx_state = DMX_MARK;
+    UDR1      = 0;
+  }
+  else
+  {
+    UBRR1     = DMX_UBRR( DMX_BAUD );
+    dmx_index = 0;
+    dmx_state = DMX_DATA;
+    UCSR1B    = _BV( TXEN1 ) | _BV( UDRIE1 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Room for the next slot
+//
+ISR( USART1_UDRE_vect )
+{
+  UDR1 = dmx_frame[dmx_index++];
+
+  if ( 1 + DMX_SLOTS <= dmx_index )
+  {
+    dmx_state = DMX_BREAK;
+    dmx_frames++;
+
+    // Break only after the last slot has left the shift register
+    //
+    UCSR1A |= _BV( TXC1 );
+    UCSR1B  = _BV( TXEN1 ) | _BV( TXCIE1 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupDmx()
+{
+  memset( (void *)dmx_frame, 0, sizeof( dmx_frame ) );
+  dmx_frame[0] = DMX_START_CODE;
+
+  pinMode( 18, OUTPUT );
+
+  // 8 data bits, no parity, 2 stop bits, start with the first break
+  //
+  UCSR1A = 0;
+  UCSR1C = _BV( USBS1 ) | _BV( UCSZ11 ) | _BV( UCSZ10 );
+  UBRR1  = DMX_UBRR( DMX_BREAK_BAUD );
+  UCSR1B = _BV( TXEN1 ) | _BV( TXCIE1 );
+
+  dmx_state = DMX_MARK;
+  UDR1      = 0;
+
+  if ( DIMMER_SERIAL_DEBUGGING )
+    Serial << "DMX started, slots: [" << DMX_SLOTS << "]\n";
+}
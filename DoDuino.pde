@@ -3,46 +3,169 @@
 #define WEBDUINO_SERIAL_DEBUGGING    0
 #define DIMMER_SERIAL_DEBUGGING      1
 #define NETWORK_SERIAL_DEBUGGING     0
+#define SCHEDULER_SERIAL_DEBUGGING   0
+#define DIMMER_INVARIANT_CHECKING    0    // check button gesture rules and time handleInput
+#define PROFILE_ENABLED              0    // count cycles of the hot paths, see Profile.h
+#define TASK_COST_ENABLED            0    // run time histogram per task, see Scheduler.h
+
+// Features
+//
+#define CLUSTER_ENABLED              0    // share channels with other DoDuino nodes, see Cluster.h
+#define SCHEDULE_ENABLED             0    // time of day rules, see Schedule.h
+#define MQTT_ENABLED                 0    // publish changes and take commands over MQTT, see Mqtt.h
+#define ANALOG_ENABLED               0    // potentiometers and sensors on the analog pins, see Analog.h
+#define DMX_ENABLED                  0    // DMX512 light channels on UART1, see Dmx.h
+#define PCA9685_ENABLED              0    // light channels on I2C PWM expanders, see Pca9685.h
+#define WEBSOCKET_ENABLED            0    // binary control and state pushes over a WebSocket, see WebSocket.h
+#define METRICS_ENABLED              0    // push counters and gauges to a statsd collector, see Metrics.h
+#define ENERGY_ENABLED               0    // keep the on time and energy counters in EEPROM, see Energy.h
+
+// The W5100 has 4 sockets. The web server keeps one, the WebSocket two (server and
+// client), MQTT and the cluster one each. One has to stay free for the web requests,
+// DHCP, NTP and metrics, they take turns on it. So the WebSocket goes with neither
+// MQTT nor the cluster, setup says so when too many are enabled (see SOCKETS_KEPT).
+
+// Webduino keeps 8 commands unless told otherwise and silently drops every
+// addCommand past that, setupWeb in Web.h registers 16
+//
+#define WEBDUINO_COMMANDS_COUNT      16
+
+#define NODE_ID                      0    // unique per DoDuino in the cluster, like the mac
 
 static byte mac[]     = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xDD };
 
-// Use the following config when not DHCP
+// Use the following config until a DHCP server answered, or when none does
 //
 static byte ip[]      = { 192, 168, 0, 5 };
 static byte netmask[] = { 255, 255, 255, 0 };
 static byte gateway[] = { 192, 168, 0, 1 };
 
+// (S)NTP server used to set the clock for the schedules
+//
+static byte timeserver[] = { 192, 168, 0, 1 };
+
+// MQTT broker
+//
+static byte mqttserver[] = { 192, 168, 0, 2 };
+
+// Statsd collector for the metrics
+//
+static byte metricsserver[] = { 192, 168, 0, 2 };
+
 // Globally defined variable to store millis() in every loop
 //
 unsigned long now;
 
 #include "WProgram.h"
 #include "Utils.h"
+#include "Scheduler.h"
+#include "EEPROM.h"
+#include "Wire.h"
 #include "Ethernet.h"
 #include "WebServer.h"
+#include "Template.h"
+#include "Profile.h"
+#include "WebUi.h"
 #include "Network.h"
 #include "Dimmer.h"
+#include "Analog.h"
+#include "Dmx.h"
+#include "Pca9685.h"
+#include "Groups.h"
+#include "Energy.h"
+#include "Cluster.h"
+#include "Schedule.h"
+#include "Mqtt.h"
+#include "WebSocket.h"
 #include "Web.h"
+#include "Metrics.h"
+
+// Low priority periodic work
+//
+void housekeeping()
+{
+  if ( SCHEDULER_SERIAL_DEBUGGING ) 
+    printTasks( Serial );
+  
+  if ( PROFILE_ENABLED && SCHEDULER_SERIAL_DEBUGGING )
+    printProfile( Serial );
+}
 
 void setup()
 {
   Serial.begin( 9600 );
   Serial.println( "Starting DoDuino" );
   
+  if ( PROFILE_ENABLED )
+    setupProfile();
+  
   setupNetwork();  
 
   setupWeb();
   
   setupDimmer();
+  
+  setupGroups();
+  
+  if ( ENERGY_ENABLED )
+    setupEnergy();
+  
+  if ( DMX_ENABLED )
+    setupDmx();
+  
+  if ( PCA9685_ENABLED )
+    setupPca9685();
+  
+  if ( CLUSTER_ENABLED )
+    setupCluster();
+  
+  if ( SCHEDULE_ENABLED )
+    setupSchedule();
+  
+  if ( MQTT_ENABLED )
+    setupMqtt();
+  
+  if ( WEBSOCKET_ENABLED )
+    setupWebSocket();
+  
+  if ( ANALOG_ENABLED )
+    setupAnalog();
+  
+  // Tasks in order of importance, button sampling has to keep its rate
+  // for pulse detection while the web server can wait a bit
+  //
+  addTask( "input",        &inputDimmer,  5, 0 );
+  addTask( "timers",       &timersDimmer, 100, 1 );
+  
+  if ( ANALOG_ENABLED )
+    addTask( "analog",     &loopAnalog,   20, 1 );
+  addTask( "output",       &outputDimmer, 10, 2 );
+  
+  if ( CLUSTER_ENABLED )
+    addTask( "cluster",    &loopCluster,  5, 2 );
+  
+  addTask( "network",      &loopNetwork,  100, 3 );
+  addTask( "web",          &loopWeb,      5, 3 );
+  
+  if ( MQTT_ENABLED )
+    addTask( "mqtt",       &loopMqtt,     20, 3 );
+  
+  if ( WEBSOCKET_ENABLED )
+    addTask( "websocket",  &loopWebSocket, 5, 3 );
+  
+  if ( METRICS_ENABLED )
+    addTask( "metrics",    &loopMetrics,  METRICS_INTERVAL, 4 );
+  
+  if ( SCHEDULE_ENABLED )
+    addTask( "schedule",   &loopSchedule, 1000, 4 );
+  
+  if ( ENERGY_ENABLED )
+    addTask( "energy",     &saveEnergy,   ENERGY_WRITE_TIME, 4 );
+
+  addTask( "housekeeping", &housekeeping, 1000, 4 );
 }
 
 void loop()
 {
-  now = millis();
-      
-  loopWeb();
-  
-  loopDimmer();
+  loopScheduler();
 }
-
-
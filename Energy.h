@@ -0,0 +1,167 @@
+/*
+ *  On time and energy per channel
+ *
+ *  The dimmer counts on time and energy of a channel when its output changes (see
+ *  accountLight / accountSwitch), a channel that does not change costs nothing.
+ *  Energy is in seconds at full output, multiply by the power of the lamp for Ws.
+ *
+ *  Every ENERGY_SAVE_TIME the channels are counted up to now and the counters are
+ *  saved in EEPROM, at most that much is lost at a power cut. Only bytes that changed
+ *  are written, an EEPROM cell lasts ~100.000 writes. A write takes 3.3 ms, so the
+ *  energy task writes ENERGY_WRITES_PER_RUN bytes per run and goes on with the next
+ *  byte at its next run, the input task keeps its 5 ms. A counter is taken once
+ *  when its first byte is due, a save never mixes the bytes of two values. Loading
+ *  and saving only happen with ENERGY_ENABLED, without it getEnergy counts from the
+ *  last boot.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define ENERGY_SAVE_TIME        3600000 // ms between two saves of the counters
+#define ENERGY_WRITE_TIME       10      // ms between two runs of the energy task
+#define ENERGY_WRITES_PER_RUN   1       // EEPROM bytes written per run of the energy task
+#define EEPROM_ENERGY_MAGIC     0xE1
+
+#define EEPROM_ENERGY_LENGTH    ( 1 + 8 * NR_LIGHT_CHANNELS + 4 * NR_SWITCH_CHANNELS )
+
+#if EEPROM_LEASE + EEPROM_LEASE_LENGTH > EEPROM_ENERGY
+#error "The energy counters overlap the DHCP lease in EEPROM, see EEPROM_ENERGY in Network.h"
+#endif
+
+#if EEPROM_ENERGY + EEPROM_ENERGY_LENGTH > E2END + 1
+#error "The energy counters don't fit in EEPROM, see EEPROM_ENERGY in Network.h"
+#endif
+
+// ----------------------------------------------------------------- //
+
+int energy_address = -1;                // EEPROM address while loading / saving, -1 between saves
+unsigned long energy_value;             // counter energy_address is in, taken at its first byte
+unsigned long energy_save_start = 0;    // ms the last save started
+int energy_written;                     // bytes written by the current save
+
+// -------------------------------------------------------- //
+
+unsigned long energyRead()
+{
+  unsigned long value = 0;
+
+  for ( int i = 0; i < 4; i++ )
+  {
+    value |= (unsigned long)EEPROM.read( energy_address++ ) << ( 8 * i );
+  }
+
+  return value;
+}
+
+// -------------------------------------------------------- //
+
+// Counter at byte offset of the energy block, behind the magic
+//
+unsigned long energyValue( int offset )
+{
+  if ( 8 * NR_LIGHT_CHANNELS > offset )
+  {
+    LightChannel *c = &l_channels[ offset / 8 ];
+
+    return ( 4 > offset % 8 ) ? c->on_time : c->energy;
+  }
+
+  return sw_channels[ ( offset - 8 * NR_LIGHT_CHANNELS ) / 4 ].on_time;
+}
+
+// -------------------------------------------------------- //
+
+void loadEnergy()
+{
+  if ( EEPROM_ENERGY_MAGIC != EEPROM.read( EEPROM_ENERGY ) ) { return; }
+
+  energy_address = EEPROM_ENERGY + 1;
+
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    l_channels[i].on_time = energyRead();
+    l_channels[i].energy  = energyRead();
+  }
+
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
+  {
+    sw_channels[i].on_time = energyRead();
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Energy task, every ENERGY_SAVE_TIME count all channels up to now and save the
+// counters, ENERGY_WRITES_PER_RUN bytes per run
+//
+void saveEnergy()
+{
+  if ( 0 > energy_address )
+  {
+    if ( ENERGY_SAVE_TIME > now - energy_save_start ) { return; }
+
+    energy_save_start = now;
+    energy_address    = EEPROM_ENERGY + 1;
+    energy_written    = 0;
+
+    for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+    {
+      accountLight( &l_channels[i] );
+    }
+
+    for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
+    {
+      accountSwitch( &sw_channels[i] );
+    }
+  }
+
+  int writes = 0;
+
+  while ( EEPROM_ENERGY + EEPROM_ENERGY_LENGTH > energy_address )
+  {
+    int offset = energy_address - EEPROM_ENERGY - 1;
+
+    if ( 0 == offset % 4 )
+    {
+      energy_value = energyValue( offset );
+    }
+
+    byte b = energy_value >> ( 8 * ( offset % 4 ) );
+
+    // Only write what changed, EEPROM cells wear out
+    //
+    if ( b != EEPROM.read( energy_address ) )
+    {
+      if ( ENERGY_WRITES_PER_RUN <= writes ) { return; }
+
+      EEPROM.write( energy_address, b );
+      writes++;
+      energy_written++;
+    }
+
+    energy_address++;
+  }
+
+  if ( EEPROM_ENERGY_MAGIC != EEPROM.read( EEPROM_ENERGY ) )
+  {
+    if ( ENERGY_WRITES_PER_RUN <= writes ) { return; }
+
+    EEPROM.write( EEPROM_ENERGY, EEPROM_ENERGY_MAGIC );
+    energy_written++;
+  }
+
+  energy_address = -1;
+
+  if ( DIMMER_SERIAL_DEBUGGING )
+    Serial << "Energy saved: [" << energy_written << "] bytes written\n";
+}
+
+// -------------------------------------------------------- //
+
+void setupEnergy()
+{
+  loadEnergy();
+
+  energy_address    = -1;
+  energy_save_start = millis();
+}
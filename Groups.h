@@ -0,0 +1,263 @@
+/*
+ *  Channel groups
+ *
+ *  A group is a named set of light and switch channels, stored as a bitmask with a bit
+ *  per channel (LIGHT_MASK_WORDS / SWITCH_MASK_WORDS words). A change listener keeps
+ *  a mask of the channels that are on, so "is anything in this group on" is an AND
+ *  of a few words, no matter how many channels are in the group.
+ *
+ *  Group commands (set, fade, toggle) work a mask word at a time: the group mask
+ *  is combined with channels_on first, so switching off only walks the members that
+ *  are on and switching back on only the members that are off. A word without bits
+ *  is skipped as a whole. Switching a group off keeps the level of every light that
+ *  was on, switching it back on restores those levels as long as the lights stayed
+ *  off. Buttons use a group through the group actions, see Button.group.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define NR_GROUPS               8       // maximum number of groups
+#define MASK_BITS               16      // bits per mask word
+
+#define LIGHT_MASK_WORDS        ( ( NR_LIGHT_CHANNELS  + MASK_BITS - 1 ) / MASK_BITS )
+#define SWITCH_MASK_WORDS       ( ( NR_SWITCH_CHANNELS + MASK_BITS - 1 ) / MASK_BITS )
+
+// ----------------------------------------------------------------- //
+
+struct ChannelMask
+{
+  word lights[ LIGHT_MASK_WORDS ];
+  word switches[ SWITCH_MASK_WORDS ];
+};
+
+struct Group
+{
+  const char *name;
+  ChannelMask mask;
+};
+
+Group groups[ NR_GROUPS ];
+int   nr_groups = 0;
+
+ChannelMask channels_on;                // channels with a non 0 output
+
+byte group_light_values[ NR_LIGHT_CHANNELS ];   // level of a light when a group switched it off, 0 for none
+
+// -------------------------------------------------------- //
+
+void maskSet( word *mask, int bit, boolean on )
+{
+  if ( on )
+  {
+    mask[ bit / MASK_BITS ] |= _BV( bit % MASK_BITS );
+  }
+  else
+  {
+    mask[ bit / MASK_BITS ] &= ~_BV( bit % MASK_BITS );
+  }
+}
+
+// -------------------------------------------------------- //
+
+int addGroup( const char *name )
+{
+  if ( NR_GROUPS <= nr_groups ) { return -1; }
+
+  Group *g = &groups[nr_groups];
+
+  g->name = name;
+  memset( &g->mask, 0, sizeof( g->mask ) );
+
+  return nr_groups++;
+}
+
+// -------------------------------------------------------- //
+
+void groupAddLight( int group, int channel )
+{
+  maskSet( groups[group].mask.lights, channel, true );
+}
+
+// -------------------------------------------------------- //
+
+void groupAddSwitch( int group, int channel )
+{
+  maskSet( groups[group].mask.switches, channel, true );
+}
+
+// -------------------------------------------------------- //
+
+// Group by number or by name, -1 when there is none
+//
+int findGroup( const char *s )
+{
+  if ( '0' <= *s && '9' >= *s )
+  {
+    int group = atoi( s );
+
+    return ( nr_groups > group ) ? group : -1;
+  }
+
+  for ( int i = 0; i < nr_groups; i++ )
+  {
+    int length = strlen( groups[i].name );
+
+    if ( 0 == strncmp( s, groups[i].name, length ) && ( '\0' == s[length] || '/' == s[length] ) )
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// -------------------------------------------------------- //
+
+boolean groupAnyOn( int group )
+{
+  ChannelMask *m = &groups[group].mask;
+  word on = 0;
+
+  for ( int i = 0; i < LIGHT_MASK_WORDS; i++ )
+  {
+    on |= m->lights[i] & channels_on.lights[i];
+  }
+
+  for ( int i = 0; i < SWITCH_MASK_WORDS; i++ )
+  {
+    on |= m->switches[i] & channels_on.switches[i];
+  }
+
+  return 0 != on;
+}
+
+// -------------------------------------------------------- //
+
+// Does a light of the group that is off have a level kept by setGroup
+//
+boolean groupHasLevels( int group )
+{
+  ChannelMask *m = &groups[group].mask;
+
+  for ( int i = 0; i < LIGHT_MASK_WORDS; i++ )
+  {
+    for ( word bits = m->lights[i] & ~channels_on.lights[i]; 0 != bits; bits &= bits - 1 )
+    {
+      if ( 0 != group_light_values[ i * MASK_BITS + __builtin_ctz( bits ) ] ) { return true; }
+    }
+  }
+
+  return false;
+}
+
+// -------------------------------------------------------- //
+
+// Set all lights of the group to value, switches go on for any value above 0.
+// Switching off keeps the level of the lights that were on. A negative value 
+// brings those lights back to their level, when there are none all lights go
+// to their last value (max when that was 0).
+//
+void setGroup( int group, int value, int speedFactor )
+{
+  ChannelMask *m = &groups[group].mask;
+  boolean restore = ( 0 > value ) && groupHasLevels( group );
+
+  for ( int i = 0; i < LIGHT_MASK_WORDS; i++ )
+  {
+    word bits = m->lights[i];
+
+    if ( 0 == value ) { bits &= channels_on.lights[i]; }
+    if ( 0 > value )  { bits &= ~channels_on.lights[i]; }
+
+    for ( ; 0 != bits; bits &= bits - 1 )
+    {
+      int channel = i * MASK_BITS + __builtin_ctz( bits );
+      int target  = value;
+
+      if ( 0 == value )
+      {
+        group_light_values[channel] = l_channels[channel].light_value;
+      }
+      else if ( restore )
+      {
+        target = group_light_values[channel];
+
+        if ( 0 == target ) { continue; }
+      }
+      else if ( 0 > value )
+      {
+        target = l_channels[channel].last_light_value;
+        target = ( 0 == target ) ? MAX_LIGHT_VALUE : target;
+      }
+
+      setLightTargetValue( channel, target, speedFactor );
+    }
+  }
+
+  for ( int i = 0; i < SWITCH_MASK_WORDS; i++ )
+  {
+    word bits = m->switches[i] & ( ( 0 == value ) ? channels_on.switches[i] : ~channels_on.switches[i] );
+
+    for ( ; 0 != bits; bits &= bits - 1 )
+    {
+      setSwitchTargetState( i * MASK_BITS + __builtin_ctz( bits ), ( 0 != value ) ? HIGH : LOW );
+    }
+  }
+
+  if ( DIMMER_SERIAL_DEBUGGING )
+    Serial << "Group [" << groups[group].name << "] value: [" << value << "]\n";
+}
+
+// -------------------------------------------------------- //
+
+void toggleGroup( int group )
+{
+  setGroup( group, groupAnyOn( group ) ? 0 : -1, 2 );
+}
+
+// -------------------------------------------------------- //
+
+// Change listener, keep channels_on up to date. A light that goes on has no
+// level to restore anymore.
+//
+void groupsChanged( int kind, int id, int value )
+{
+  maskSet( ( CHANGE_LIGHT == kind ) ? channels_on.lights : channels_on.switches, id, 0 != value );
+
+  if ( CHANGE_LIGHT == kind && 0 != value )
+  {
+    group_light_values[id] = 0;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupGroups()
+{
+  int g;
+
+  g = addGroup( "downstairs" );  // GRP - Beneden
+  groupAddLight( g, 1 );         // LC  - links raam
+  groupAddLight( g, 2 );         // LC  - a/v
+  groupAddLight( g, 3 );         // LC  - links a/v
+  groupAddLight( g, 4 );         // LC  - midden raam
+  groupAddLight( g, 7 );         // LC  - keuken 1
+  groupAddLight( g, 8 );         // LC  - keuken 2
+
+  // A button for the group, e.g. everything downstairs on / off:
+  //
+  // buttons[ 9].group = g;
+  // buttons[ 9].actions[ GESTURE_PRESS ] = ACTION_GROUP_TOGGLE;
+
+  g = addGroup( "all" );         // GRP - Alles
+
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    groupAddLight( g, i );
+  }
+
+  buttons[ 0].group = g;         // BTN - Gang, everything off when leaving
+  buttons[ 0].actions[ GESTURE_TRIPLE ] = ACTION_GROUP_OFF;
+
+  addChangeListener( &groupsChanged );
+}
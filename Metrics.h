@@ -0,0 +1,155 @@
+/*
+ *  Metrics pushed to a statsd collector
+ *
+ *  Counters and gauges are kept on the node and sent every METRICS_INTERVAL to
+ *  metricsserver as statsd lines ("doduino.<node>.<name>:<value>|c" or "|g"), so
+ *  nothing has to poll the web server for them. Counters are reset after sending
+ *  and left out while 0, the lines go in as few datagrams as fit METRICS_BUFFER_LENGTH,
+ *  one for a quiet node.
+ *
+ *  - loops, loopMax:       passes of loop() and the worst case us of a pass
+ *  - load:                 scheduler load in percent
+ *  - buttons:              button presses and releases
+ *  - gesture.<name>:       gestures recognized by handleInput
+ *  - switchQueue(Max):     delayed switches queued now and the deepest queue seen
+ *  - http.<command>:       requests per web command
+ *  - freeRam:              bytes between the heap and the stack
+ */
+
+// ----------------------------------------------------------------- //
+
+#define METRICS_INTERVAL        10000   // ms between two pushes
+#define METRICS_PORT            8125    // statsd
+#define METRICS_LOCAL_PORT      8126
+#define METRICS_BUFFER_LENGTH   192     // bytes per datagram
+#define METRICS_LINE_LENGTH     48
+
+// Gesture names in order of GESTURE, from GESTURE_PRESS on
+//
+P( metricsGestureNames ) =
+  "press\0double\0triple\0long\0fade\0reverse\0";
+
+// ----------------------------------------------------------------- //
+
+SOCKET metrics_socket = MAX_SOCK_NUM;
+
+int  metrics_length = 0;
+byte metrics_buffer[ METRICS_BUFFER_LENGTH ];
+
+extern int __heap_start, *__brkval;
+
+// -------------------------------------------------------- //
+
+int freeMemory()
+{
+  int top;
+
+  return (size_t)&top - (size_t)( ( 0 == __brkval ) ? &__heap_start : __brkval );
+}
+
+// -------------------------------------------------------- //
+
+void metricsFlush()
+{
+  if ( 0 == metrics_length ) { return; }
+
+  sendto( metrics_socket, metrics_buffer, metrics_length, metricsserver, METRICS_PORT );
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "Metrics sent: [" << metrics_length << "] bytes\n";
+
+  metrics_length = 0;
+}
+
+// -------------------------------------------------------- //
+
+// Add a line, type is "c" for a counter and "g" for a gauge
+//
+void metricsAdd( const char *name, long value, const char *type )
+{
+  char line[ METRICS_LINE_LENGTH ];
+
+  strcpy( line, "doduino." );
+  itoa( NODE_ID, &line[ strlen( line ) ], 10 );
+  strcat( line, "." );
+  strncat( line, name, METRICS_LINE_LENGTH - 16 - strlen( line ) );
+  strcat( line, ":" );
+  ltoa( value, &line[ strlen( line ) ], 10 );
+  strcat( line, "|" );
+  strcat( line, type );
+  strcat( line, "\n" );
+
+  int length = strlen( line );
+
+  if ( METRICS_BUFFER_LENGTH < metrics_length + length )
+  {
+    metricsFlush();
+  }
+
+  memcpy( &metrics_buffer[ metrics_length ], line, length );
+  metrics_length += length;
+}
+
+// -------------------------------------------------------- //
+
+// Counter with its name in a list in flash, left out while 0
+//
+void metricsAddCount( const char *prefix, const prog_uchar *names, int n, long value )
+{
+  char name[ METRICS_LINE_LENGTH ];
+
+  if ( 0 == value ) { return; }
+
+  int length = strlen( prefix );
+
+  strcpy( name, prefix );
+  strncpy_P( &name[ length ], (const char *)nameAt( names, n ), METRICS_LINE_LENGTH - length );
+  name[ METRICS_LINE_LENGTH - 1 ] = '\0';
+
+  metricsAdd( name, value, "c" );
+}
+
+// -------------------------------------------------------- //
+
+// Metrics task, send everything and start counting over. A socket is only
+// open while sending, the W5100 has 4 sockets to share.
+//
+void loopMetrics()
+{
+  metrics_socket = openUdp( METRICS_LOCAL_PORT );
+
+  if ( MAX_SOCK_NUM == metrics_socket ) { return; }
+
+  metricsAdd( "loops",   scheduler_passes,   "c" );
+  metricsAdd( "loopMax", scheduler_pass_max, "g" );
+  metricsAdd( "load",    scheduler_load,     "g" );
+  metricsAdd( "buttons", button_events,      "c" );
+
+  for ( int i = GESTURE_PRESS; i < NR_GESTURES; i++ )
+  {
+    metricsAddCount( "gesture.", metricsGestureNames, i - GESTURE_PRESS, gesture_counts[i] );
+  }
+
+  metricsAdd( "switchQueue",    queued_sw_channels_length, "g" );
+  metricsAdd( "switchQueueMax", switch_queue_max,          "g" );
+
+  for ( int i = 0; i < NR_WEB_COMMANDS; i++ )
+  {
+    metricsAddCount( "http.", webCommandNames, i, web_command_requests[i] );
+  }
+
+  metricsAdd( "freeRam", freeMemory(), "g" );
+
+  metricsFlush();
+
+  close( metrics_socket );
+  metrics_socket = MAX_SOCK_NUM;
+
+  scheduler_passes   = 0;
+  scheduler_pass_max = 0;
+  button_events      = 0;
+  switch_queue_max   = queued_sw_channels_length;
+
+  memset( gesture_counts, 0, sizeof( gesture_counts ) );
+  memset( web_command_requests, 0, sizeof( web_command_requests ) );
+}
@@ -0,0 +1,474 @@
+/*
+ *  MQTT client
+ *
+ *  Keeps one connection to the broker in mqttserver open and:
+ *
+ *  - publishes the value of a channel as a retained message whenever its output
+ *    changes (and all of them after connecting):
+ *      doduino/<node>/light/<channel>      value 0 .. MAX_LIGHT_VALUE
+ *      doduino/<node>/switch/<channel>     state 0 or 1
+ *
+ *  - applies the commands published by others on:
+ *      doduino/<node>/light/<channel>/set
+ *      doduino/<node>/switch/<channel>/set
+ *
+ *  Only MQTT 3.1.1 with QoS 0 is used, messages that don't fit in the buffer are skipped.
+ *
+ *  The connection is made without waiting: the TCP connect is started on a free
+ *  socket and polled from the task, the subscriptions follow the connack. A broker
+ *  that refuses the connection or a subscription gets the connection dropped, the
+ *  next attempt is made after MQTT_RETRY_TIME.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define MQTT_PORT               1883
+#define MQTT_KEEP_ALIVE         60      // seconds, a ping is sent every half of it
+#define MQTT_RETRY_TIME         10000   // ms between two connection attempts
+#define MQTT_CONNECT_TIMEOUT    5000    // ms to wait for the connection and the connack
+#define MQTT_BUFFER_LENGTH      64      // maximum length of a received message
+#define MQTT_TOPIC_LENGTH       32      // maximum length of a topic
+
+#define MQTT_CONNECT            0x10    // Packet types
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_SUBSCRIBE          0x82
+#define MQTT_SUBACK             0x90
+#define MQTT_PINGREQ            0xC0
+
+#define MQTT_RETAIN             0x01
+
+enum MQTT_STATE {
+  MQTT_STATE_IDLE,                      // no connection, waiting for the next attempt
+  MQTT_STATE_CONNECTING,                // TCP connect started, waiting for it to be established
+  MQTT_STATE_CONNACK,                   // connect sent, waiting for the connack
+  MQTT_STATE_CONNECTED                  // connack received, subscriptions sent
+};
+
+enum MQTT_READ_STATE {
+  MQTT_READ_TYPE,                       // waiting for the first byte of a packet
+  MQTT_READ_LENGTH,                     // reading the remaining length
+  MQTT_READ_DATA                        // reading the rest of the packet
+};
+
+// ----------------------------------------------------------------- //
+
+Client mqttClient( MAX_SOCK_NUM );     // on the socket of the connection, once there is one
+
+enum MQTT_STATE mqtt_state = MQTT_STATE_IDLE;
+
+unsigned long mqtt_last_attempt = 0;    // ms of the last connection attempt
+uint16_t      mqtt_local_port   = 49152; // changes with every attempt, like the Client of the Ethernet library does
+unsigned long mqtt_last_send    = 0;    // ms of the last packet sent, for the keep alive
+
+// Channels with a changed output that still have to be published
+//
+boolean mqtt_dirty_lights[   NR_LIGHT_CHANNELS  ];
+boolean mqtt_dirty_switches[ NR_SWITCH_CHANNELS ];
+int     mqtt_nr_dirty = 0;
+
+// Received packet
+//
+enum MQTT_READ_STATE mqtt_read_state = MQTT_READ_TYPE;
+byte mqtt_type;
+long mqtt_length;
+long mqtt_received;
+int  mqtt_shift;
+byte mqtt_buffer[ MQTT_BUFFER_LENGTH ];
+
+// -------------------------------------------------------- //
+
+// Change listener, remember what to publish
+//
+void mqttChanged( int kind, int id, int value )
+{
+  boolean *dirty = ( CHANGE_LIGHT == kind ) ? &mqtt_dirty_lights[id] : &mqtt_dirty_switches[id];
+
+  if ( !*dirty )
+  {
+    *dirty = true;
+    mqtt_nr_dirty++;
+  }
+}
+
+// -------------------------------------------------------- //
+
+byte *mqttString( byte *p, const char *s )
+{
+  int length = strlen( s );
+
+  *p++ = length >> 8;
+  *p++ = length;
+  memcpy( p, s, length );
+
+  return p + length;
+}
+
+// -------------------------------------------------------- //
+
+// Send a packet, the remaining length is always below 128 and fits in a single byte
+//
+void mqttSend( byte type, byte *data, int length )
+{
+  byte header[2] = { type, (byte)length };
+
+  mqttClient.write( header, 2 );
+  mqttClient.write( data, length );
+
+  mqtt_last_send = now;
+}
+
+// -------------------------------------------------------- //
+
+void mqttTopic( char *topic, const char *kind, int channel, const char *suffix )
+{
+  char buf[8];
+
+  strcpy( topic, "doduino/" );
+  strcat( topic, itoa( NODE_ID, buf, 10 ) );
+  strcat( topic, kind );
+  strcat( topic, itoa( channel, buf, 10 ) );
+  strcat( topic, suffix );
+}
+
+// -------------------------------------------------------- //
+
+void mqttPublish( const char *kind, int channel, int value )
+{
+  byte packet[ MQTT_TOPIC_LENGTH + 8 ];
+  char topic[ MQTT_TOPIC_LENGTH ];
+  char payload[8];
+
+  mqttTopic( topic, kind, channel, "" );
+  itoa( value, payload, 10 );
+
+  byte *p = mqttString( packet, topic );
+
+  memcpy( p, payload, strlen( payload ) );
+  p += strlen( payload );
+
+  mqttSend( MQTT_PUBLISH | MQTT_RETAIN, packet, p - packet );
+}
+
+// -------------------------------------------------------- //
+
+void mqttDisconnect( const char *reason )
+{
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "MQTT disconnected: [" << reason << "]\n";
+
+  mqttClient.stop();
+  mqtt_state = MQTT_STATE_IDLE;
+}
+
+// -------------------------------------------------------- //
+
+// Start the TCP connect, loopMqtt polls the socket until it is established
+//
+void mqttConnect()
+{
+  SOCKET s = freeSocket();
+
+  mqtt_last_attempt = now;
+
+  if ( MAX_SOCK_NUM == s )
+  {
+    if ( NETWORK_SERIAL_DEBUGGING )
+      Serial << "MQTT connect failed: [no free socket]\n";
+
+    return;
+  }
+
+  if ( ++mqtt_local_port < 49152 ) { mqtt_local_port = 49152; }
+
+  socket( s, SnMR::TCP, mqtt_local_port, 0 );
+  connect( s, mqttserver, MQTT_PORT );
+
+  mqttClient = Client( s );
+  mqtt_state = MQTT_STATE_CONNECTING;
+}
+
+// -------------------------------------------------------- //
+
+// The connection is established, say hello
+//
+void mqttSendConnect()
+{
+  byte packet[ 12 + MQTT_TOPIC_LENGTH ];
+  char id[ MQTT_TOPIC_LENGTH ];
+  char buf[8];
+
+  strcpy( id, "doduino-" );
+  strcat( id, itoa( NODE_ID, buf, 10 ) );
+
+  byte *p = mqttString( packet, "MQTT" );
+
+  *p++ = 4;                             // protocol level 3.1.1
+  *p++ = 0x02;                          // clean session
+  *p++ = 0;
+  *p++ = MQTT_KEEP_ALIVE;
+
+  p = mqttString( p, id );
+
+  mqtt_read_state = MQTT_READ_TYPE;
+  mqtt_state      = MQTT_STATE_CONNACK;
+
+  mqttSend( MQTT_CONNECT, packet, p - packet );
+}
+
+// -------------------------------------------------------- //
+
+// The broker accepted the connection, subscribe to the commands and publish
+// all current values
+//
+void mqttConnected()
+{
+  byte packet[ 12 + MQTT_TOPIC_LENGTH ];
+  char buf[8];
+
+  mqtt_state = MQTT_STATE_CONNECTED;
+
+  for ( int i = 0; i < 2; i++ )
+  {
+    char topic[ MQTT_TOPIC_LENGTH ];
+
+    strcpy( topic, "doduino/" );
+    strcat( topic, itoa( NODE_ID, buf, 10 ) );
+    strcat( topic, ( 0 == i ) ? "/light/+/set" : "/switch/+/set" );
+
+    byte *p = packet;
+    *p++ = 0;                           // packet id
+    *p++ = i + 1;
+    p = mqttString( p, topic );
+    *p++ = 0;                           // QoS 0
+
+    mqttSend( MQTT_SUBSCRIBE, packet, p - packet );
+  }
+
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    mqttChanged( CHANGE_LIGHT, i, 0 );
+  }
+
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
+  {
+    mqttChanged( CHANGE_SWITCH, i, 0 );
+  }
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "MQTT connected\n";
+}
+
+// -------------------------------------------------------- //
+
+// Apply a command received on doduino/<node>/<kind>/<channel>/set
+//
+void mqttCommand( char *topic, int topicLength, char *payload, int payloadLength )
+{
+  char prefix[ MQTT_TOPIC_LENGTH ];
+  char buf[8];
+
+  topic[topicLength] = '\0';
+  payload[payloadLength] = '\0';
+
+  strcpy( prefix, "doduino/" );
+  strcat( prefix, itoa( NODE_ID, buf, 10 ) );
+  strcat( prefix, "/" );
+
+  if ( 0 != strncmp( topic, prefix, strlen( prefix ) ) ) { return; }
+
+  topic += strlen( prefix );
+
+  int value = atoi( payload );
+
+  if ( 0 == strncmp( topic, "light/", 6 ) )
+  {
+    int channel = atoi( topic + 6 );
+
+    if ( 0 <= channel && NR_LIGHT_CHANNELS > channel && 0 <= value && MAX_LIGHT_VALUE >= value )
+    {
+      commandLightValue( channel, value, 2 );
+    }
+  }
+  else if ( 0 == strncmp( topic, "switch/", 7 ) )
+  {
+    int channel = atoi( topic + 7 );
+
+    if ( 0 <= channel && NR_SWITCH_CHANNELS > channel && 0 <= value && 1 >= value )
+    {
+      setSwitchState( channel, value, 0, 0 );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Handle a complete packet in mqtt_buffer. The connack and suback are checked,
+// of the rest only publishes are of interest
+//
+void mqttPacket()
+{
+  if ( MQTT_CONNACK == mqtt_type && MQTT_STATE_CONNACK == mqtt_state )
+  {
+    if ( 2 != mqtt_length || 0 != mqtt_buffer[1] ) { mqttDisconnect( "connection refused" ); return; }
+
+    mqttConnected();
+    return;
+  }
+
+  if ( MQTT_SUBACK == mqtt_type )
+  {
+    for ( int i = 2; i < mqtt_length; i++ )
+    {
+      if ( 0 != mqtt_buffer[i] ) { mqttDisconnect( "subscription refused" ); return; }
+    }
+
+    return;
+  }
+
+  if ( MQTT_PUBLISH != ( mqtt_type & 0xF0 ) || 2 > mqtt_length ) { return; }
+
+  int topicLength = ( mqtt_buffer[0] << 8 ) | mqtt_buffer[1];
+  int offset      = 2 + topicLength;
+
+  // Packet id in front of the payload when QoS > 0
+  //
+  if ( 0 != ( mqtt_type & 0x06 ) ) { offset += 2; }
+
+  if ( offset >= mqtt_length || MQTT_TOPIC_LENGTH <= topicLength ) { return; }
+
+  // Zero terminate the topic in place of the first byte that follows it,
+  // the payload is copied out of the way first
+  //
+  char payload[8];
+  int payloadLength = min( mqtt_length - offset, 7 );
+
+  memcpy( payload, &mqtt_buffer[offset], payloadLength );
+
+  mqttCommand( (char *)&mqtt_buffer[2], topicLength, payload, payloadLength );
+}
+
+// -------------------------------------------------------- //
+
+void mqttReceive()
+{
+  while ( MQTT_STATE_IDLE != mqtt_state && mqttClient.available() )
+  {
+    byte b = mqttClient.read();
+
+    switch ( mqtt_read_state )
+    {
+      case ( MQTT_READ_TYPE ):
+        mqtt_type       = b;
+        mqtt_length     = 0;
+        mqtt_received   = 0;
+        mqtt_shift      = 0;
+        mqtt_read_state = MQTT_READ_LENGTH;
+        break;
+
+      case ( MQTT_READ_LENGTH ):
+        mqtt_length |= (long)( b & 0x7F ) << mqtt_shift;
+        mqtt_shift  += 7;
+
+        if ( 0 == ( b & 0x80 ) )
+        {
+          mqtt_read_state = ( 0 == mqtt_length ) ? MQTT_READ_TYPE : MQTT_READ_DATA;
+        }
+        break;
+
+      case ( MQTT_READ_DATA ):
+        if ( MQTT_BUFFER_LENGTH > mqtt_received )
+        {
+          mqtt_buffer[mqtt_received] = b;
+        }
+
+        if ( ++mqtt_received == mqtt_length )
+        {
+          if ( MQTT_BUFFER_LENGTH >= mqtt_length )
+          {
+            mqttPacket();
+          }
+
+          mqtt_read_state = MQTT_READ_TYPE;
+        }
+        break;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupMqtt()
+{
+  addChangeListener( &mqttChanged );
+}
+
+// -------------------------------------------------------- //
+
+void loopMqtt()
+{
+  switch ( mqtt_state )
+  {
+    case ( MQTT_STATE_IDLE ):
+      if ( MQTT_RETRY_TIME <= now - mqtt_last_attempt )
+      {
+        mqttConnect();
+      }
+      return;
+
+    case ( MQTT_STATE_CONNECTING ):
+      if ( SnSR::ESTABLISHED == mqttClient.status() )
+      {
+        mqttSendConnect();
+      }
+      else if ( SnSR::CLOSED == mqttClient.status() || MQTT_CONNECT_TIMEOUT <= now - mqtt_last_attempt )
+      {
+        mqttDisconnect( "connect failed" );
+      }
+      return;
+
+    default:
+      break;
+  }
+
+  if ( !mqttClient.connected() )
+  {
+    mqttDisconnect( "connection lost" );
+    return;
+  }
+
+  mqttReceive();
+
+  if ( MQTT_STATE_CONNACK == mqtt_state )
+  {
+    if ( MQTT_CONNECT_TIMEOUT <= now - mqtt_last_attempt ) { mqttDisconnect( "no connack" ); }
+    return;
+  }
+
+  if ( MQTT_STATE_CONNECTED != mqtt_state ) { return; }
+
+  for ( int i = 0; 0 < mqtt_nr_dirty && i < NR_LIGHT_CHANNELS; i++ )
+  {
+    if ( mqtt_dirty_lights[i] )
+    {
+      mqttPublish( "/light/", i, l_channels[i].light_value );
+      mqtt_dirty_lights[i] = false;
+      mqtt_nr_dirty--;
+    }
+  }
+
+  for ( int i = 0; 0 < mqtt_nr_dirty && i < NR_SWITCH_CHANNELS; i++ )
+  {
+    if ( mqtt_dirty_switches[i] )
+    {
+      mqttPublish( "/switch/", i, sw_channels[i].state );
+      mqtt_dirty_switches[i] = false;
+      mqtt_nr_dirty--;
+    }
+  }
+
+  if ( ( MQTT_KEEP_ALIVE * 500UL ) <= now - mqtt_last_send )
+  {
+    mqttSend( MQTT_PINGREQ, NULL, 0 );
+  }
+}
@@ -1,3 +1,77 @@
+#include "utility/w5100.h"
+#include "utility/socket.h"
+
+#define UDP_HEADER_LENGTH       8       // address, port and length the W5100 puts in front of every datagram
+
+// Sockets the enabled features keep open, see the features in DoDuino.pde
+//
+#define SOCKETS_KEPT            ( 1 + ( WEBSOCKET_ENABLED ? 2 : 0 ) + ( MQTT_ENABLED ? 1 : 0 ) + ( CLUSTER_ENABLED ? 1 : 0 ) )
+
+// DHCP
+//
+// The lease is cached in EEPROM, at boot the cached address is used right away and 
+// the lease is confirmed in the background. Without cache the static config in ip, 
+// netmask and gateway is used until a DHCP server answers, and stays in use when
+// none does. A lease that can't be renewed before it expires is dropped, a new
+// one is looked for from scratch.
+//
+#define DHCP_TIMEOUT            4000    // ms to wait for an answer of the server
+#define DHCP_RETRIES            3       // nr of requests before giving up for now
+#define DHCP_RETRY_TIME         60000   // ms before trying again after giving up
+#define DHCP_BUFFER_LENGTH      350     // bytes of a DHCP message that are read, options past this are ignored
+
+#define DHCP_CLIENT_PORT        68
+#define DHCP_SERVER_PORT        67
+#define DHCP_HEADER_LENGTH      240     // fixed part up to and including the magic cookie
+
+#define DHCP_DISCOVER           1       // DHCP message types
+#define DHCP_OFFER              2
+#define DHCP_REQUEST            3
+#define DHCP_ACK                5
+#define DHCP_NAK                6
+
+#define DHCP_OPT_PAD            0       // DHCP options
+#define DHCP_OPT_NETMASK        1
+#define DHCP_OPT_ROUTER         3
+#define DHCP_OPT_REQUESTED_IP   50
+#define DHCP_OPT_LEASE_TIME     51
+#define DHCP_OPT_MESSAGE_TYPE   53
+#define DHCP_OPT_SERVER_ID      54
+#define DHCP_OPT_PARAMETERS     55
+#define DHCP_OPT_END            255
+
+// EEPROM usage
+//
+#define EEPROM_LEASE            0       // magic, ip, netmask, gateway of the cached lease
+#define EEPROM_LEASE_LENGTH     13
+#define EEPROM_LEASE_MAGIC      0xD1
+#define EEPROM_ENERGY           16      // magic, on time and energy per channel, see Energy.h
+
+enum DHCP_STATE {
+  DHCP_STATE_SELECTING,                 // discover sent, waiting for an offer
+  DHCP_STATE_REQUESTING,                // request for an offer sent, waiting for the ack
+  DHCP_STATE_BOUND,                     // lease is valid until it has to be renewed
+  DHCP_STATE_FAILED,                    // no answer, static (or cached) config in use
+  DHCP_STATE_REBOOTING,                 // request for the cached lease sent, waiting for the ack
+  DHCP_STATE_RENEWING                   // request for the bound lease sent, waiting for the ack
+};
+
+enum DHCP_STATE dhcp_state = DHCP_STATE_FAILED;
+
+SOCKET        dhcp_socket     = MAX_SOCK_NUM;
+unsigned long dhcp_xid        = 0;      // transaction id of the current exchange
+unsigned long dhcp_time       = 0;      // ms of the last state change or message sent
+unsigned long dhcp_bound_time = 0;      // ms the lease was bound
+unsigned long dhcp_renew_time = 0;      // ms after binding to renew the lease
+unsigned long dhcp_lease_time = 0;      // ms after binding the lease expires
+int           dhcp_tries      = 0;
+
+byte dhcp_offered_ip[4];
+byte dhcp_server_id[4];
+
+boolean loadLease();
+void startDhcp( enum DHCP_STATE state );
+
 void setIp()
 {
   Ethernet.begin( mac, ip, gateway, netmask );   
@@ -12,6 +86,424 @@ void setIp()
 
 void setupNetwork()
 {  
+  boolean cached = loadLease();
+  
+  // Without a free socket the web requests, DHCP, NTP and metrics starve
+  //
+  if ( MAX_SOCK_NUM <= SOCKETS_KEPT )
+  {
+    Serial << "Socket budget: [" << SOCKETS_KEPT << "] of [" << MAX_SOCK_NUM << "] sockets kept open, none left for "
+           << "web requests, DHCP, NTP and metrics. Disable the WebSocket, MQTT or the cluster\n";
+  }
+  
   setIp();
+  
+  // Confirm the cached address or start looking for a server, either way
+  // without waiting for the answer
+  //
+  startDhcp( cached ? DHCP_STATE_REBOOTING : DHCP_STATE_SELECTING );
+}
+
+// -------------------------------------------------------- //
+
+// First free W5100 socket, MAX_SOCK_NUM when all sockets are in use
+//
+SOCKET freeSocket()
+{
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    if ( SnSR::CLOSED == W5100.readSnSR( s ) ) { return s; }
+  }
+
+  return MAX_SOCK_NUM;
+}
+
+// -------------------------------------------------------- //
+
+// Open a UDP socket on the first free W5100 socket, returns MAX_SOCK_NUM
+// when all sockets are in use
+//
+SOCKET openUdp( uint16_t port )
+{
+  SOCKET s = freeSocket();
+
+  if ( MAX_SOCK_NUM == s )
+  {
+    if ( NETWORK_SERIAL_DEBUGGING )
+      Serial << "No free socket for UDP port [" << port << "]\n";
+
+    return s;
+  }
+
+  socket( s, SnMR::UDP, port, 0 );
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "UDP socket [" << (int)s << "] open on port [" << port << "]\n";
+
+  return s;
+}
+
+// -------------------------------------------------------- //
+
+// Read the next datagram, at most len bytes are copied into buf and the rest
+// of the datagram is skipped. Returns the length of the datagram, 0 when
+// there is none.
+//
+int readUdp( SOCKET s, byte *buf, int len, byte *addr, uint16_t *port )
+{
+  if ( UDP_HEADER_LENGTH > W5100.getRXReceivedSize( s ) ) { return 0; }
+
+  byte head[UDP_HEADER_LENGTH];
+
+  W5100.recv_data_processing( s, head, UDP_HEADER_LENGTH );
+
+  memcpy( addr, head, 4 );
+  *port = ( head[4] << 8 ) | head[5];
+
+  int data_len = ( head[6] << 8 ) | head[7];
+  int copy_len = min( len, data_len );
+
+  W5100.recv_data_processing( s, buf, copy_len );
+
+  // Skip whatever did not fit into the buffer
+  //
+  if ( data_len > copy_len )
+  {
+    W5100.writeSnRX_RD( s, W5100.readSnRX_RD( s ) + ( data_len - copy_len ));
+  }
+
+  W5100.execCmdSn( s, Sock_RECV );
+
+  return data_len;
 }
 
+// -------------------------------------------------------- //
+
+void getBroadcastIp( byte *addr )
+{
+  for ( int i = 0; i < 4; i++ )
+  {
+    addr[i] = ip[i] | ~netmask[i];
+  }
+}
+
+// -------------------------------------------------------- //
+
+boolean loadLease()
+{
+  if ( EEPROM_LEASE_MAGIC != EEPROM.read( EEPROM_LEASE ) ) { return false; }
+  
+  for ( int i = 0; i < 4; i++ )
+  {
+    ip[i]      = EEPROM.read( EEPROM_LEASE + 1 + i );
+    netmask[i] = EEPROM.read( EEPROM_LEASE + 5 + i );
+    gateway[i] = EEPROM.read( EEPROM_LEASE + 9 + i );
+    
+    dhcp_offered_ip[i] = ip[i];
+  }
+  
+  return true;
+}
+
+// -------------------------------------------------------- //
+
+void saveLease()
+{
+  byte lease[ EEPROM_LEASE_LENGTH ];
+  
+  lease[0] = EEPROM_LEASE_MAGIC;
+  memcpy( &lease[1], ip,      4 );
+  memcpy( &lease[5], netmask, 4 );
+  memcpy( &lease[9], gateway, 4 );
+  
+  // Only write what changed, EEPROM cells wear out
+  //
+  for ( int i = 0; i < EEPROM_LEASE_LENGTH; i++ )
+  {
+    if ( lease[i] != EEPROM.read( EEPROM_LEASE + i ) )
+    {
+      EEPROM.write( EEPROM_LEASE + i, lease[i] );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+byte *dhcpOption( byte *p, byte option, byte length, const byte *data )
+{
+  *p++ = option;
+  *p++ = length;
+  memcpy( p, data, length );
+  
+  return p + length;
+}
+
+// -------------------------------------------------------- //
+
+void sendDhcp( byte type )
+{
+  byte packet[ DHCP_HEADER_LENGTH + 24 ];
+  byte broadcast[4] = { 255, 255, 255, 255 };
+  byte parameters[] = { DHCP_OPT_NETMASK, DHCP_OPT_ROUTER, DHCP_OPT_LEASE_TIME };
+  
+  memset( packet, 0, sizeof( packet ) );
+  
+  packet[0]  = 1;               // boot request
+  packet[1]  = 1;               // ethernet
+  packet[2]  = 6;               // hardware address length
+  
+  packet[4]  = dhcp_xid >> 24;
+  packet[5]  = dhcp_xid >> 16;
+  packet[6]  = dhcp_xid >> 8;
+  packet[7]  = dhcp_xid;
+  
+  packet[10] = 0x80;            // ask for broadcast answers, the address in use might not be ours yet
+  
+  // Renewing a lease we are bound to, the address is known to be ours
+  //
+  if ( DHCP_STATE_RENEWING == dhcp_state )
+  {
+    memcpy( &packet[12], ip, 4 );
+  }
+  
+  memcpy( &packet[28], mac, 6 );
+  
+  packet[236] = 99;             // magic cookie
+  packet[237] = 130;
+  packet[238] = 83;
+  packet[239] = 99;
+  
+  byte *p = dhcpOption( &packet[ DHCP_HEADER_LENGTH ], DHCP_OPT_MESSAGE_TYPE, 1, &type );
+  
+  if ( DHCP_REQUEST == type && DHCP_STATE_RENEWING != dhcp_state )
+  {
+    p = dhcpOption( p, DHCP_OPT_REQUESTED_IP, 4, dhcp_offered_ip );
+    
+    // Only when requesting an offer, also on the retries, not when confirming
+    // a cached lease
+    //
+    if ( DHCP_STATE_REQUESTING == dhcp_state )
+    {
+      p = dhcpOption( p, DHCP_OPT_SERVER_ID, 4, dhcp_server_id );
+    }
+  }
+  
+  p = dhcpOption( p, DHCP_OPT_PARAMETERS, sizeof( parameters ), parameters );
+  *p++ = DHCP_OPT_END;
+  
+  sendto( dhcp_socket, packet, p - packet, broadcast, DHCP_SERVER_PORT );
+  
+  dhcp_time = now;
+  dhcp_tries++;
+  
+  if ( NETWORK_SERIAL_DEBUGGING ) 
+    Serial << "DHCP message sent, type: [" << (int)type << "] try: [" << dhcp_tries << "]\n";
+}
+
+// -------------------------------------------------------- //
+
+void startDhcp( enum DHCP_STATE state )
+{
+  if ( MAX_SOCK_NUM == dhcp_socket )
+  {
+    dhcp_socket = openUdp( DHCP_CLIENT_PORT );
+  }
+  
+  if ( MAX_SOCK_NUM == dhcp_socket ) 
+  { 
+    dhcp_state = DHCP_STATE_FAILED;
+    dhcp_time  = now;
+    return; 
+  }
+  
+  dhcp_xid   = ( (unsigned long)mac[4] << 24 ) ^ ( (unsigned long)mac[5] << 16 ) ^ micros();
+  dhcp_tries = 0;
+  dhcp_state = state;
+  
+  sendDhcp( DHCP_STATE_SELECTING == state ? DHCP_DISCOVER : DHCP_REQUEST );
+}
+
+// -------------------------------------------------------- //
+
+void stopDhcp( enum DHCP_STATE state )
+{
+  dhcp_state = state;
+  dhcp_time  = now;
+  
+  close( dhcp_socket );
+  dhcp_socket = MAX_SOCK_NUM;
+}
+
+// -------------------------------------------------------- //
+
+// Find option in the first len bytes of packet, returns its data when it has at
+// least length bytes, 0 when it is missing, too short or runs past len
+//
+byte *dhcpFindOption( byte *packet, int len, byte option, byte length )
+{
+  int i = DHCP_HEADER_LENGTH;
+  
+  while ( i < len && DHCP_OPT_END != packet[i] )
+  {
+    if ( DHCP_OPT_PAD == packet[i] ) { i++; continue; }
+    
+    if ( i + 2 > len || i + 2 + packet[i + 1] > len ) { return 0; }
+    
+    if ( option == packet[i] ) 
+    { 
+      return ( length <= packet[i + 1] ) ? &packet[i + 2] : 0; 
+    }
+    
+    i += 2 + packet[i + 1];
+  }
+  
+  return 0;
+}
+
+// -------------------------------------------------------- //
+
+// Take the address and options of an ack into use
+//
+void bindDhcp( byte *packet, int len )
+{
+  byte *data;
+  unsigned long lease = 0;
+  
+  if (( data = dhcpFindOption( packet, len, DHCP_OPT_NETMASK, 4 ))) { memcpy( netmask, data, 4 ); }
+  if (( data = dhcpFindOption( packet, len, DHCP_OPT_ROUTER,  4 ))) { memcpy( gateway, data, 4 ); }
+  
+  if (( data = dhcpFindOption( packet, len, DHCP_OPT_LEASE_TIME, 4 )))
+  {
+    lease = (unsigned long)data[0] << 24 | (unsigned long)data[1] << 16 | (unsigned long)data[2] << 8 | data[3];
+  }
+  
+  memcpy( ip, &packet[16], 4 );
+  memcpy( dhcp_offered_ip, ip, 4 );
+  
+  W5100.setIPAddress( ip );
+  W5100.setSubnetMask( netmask );
+  W5100.setGatewayIp( gateway );
+  
+  saveLease();
+  
+  // Renew halfway the lease, in ms and within what millis() can wait for
+  //
+  lease = min( lease, 4000000UL );
+  dhcp_lease_time = max( lease, 120UL ) * 1000;
+  dhcp_renew_time = dhcp_lease_time / 2;
+  
+  stopDhcp( DHCP_STATE_BOUND );
+  
+  dhcp_bound_time = now;
+  
+  if ( NETWORK_SERIAL_DEBUGGING ) 
+  {
+    Serial << "DHCP bound: ["; 
+    printArray( &Serial, ".", ip, 4, 10);
+    Serial << "] lease: [" << lease << "]\n"; 
+  }
+}
+
+// -------------------------------------------------------- //
+
+void receiveDhcp()
+{
+  byte packet[ DHCP_BUFFER_LENGTH ];
+  byte addr[4];
+  uint16_t port;
+  
+  int len = readUdp( dhcp_socket, packet, DHCP_BUFFER_LENGTH, addr, &port );
+  
+  len = min( len, DHCP_BUFFER_LENGTH );
+  
+  if ( DHCP_HEADER_LENGTH > len || 2 != packet[0] ) { return; }
+  
+  unsigned long xid = (unsigned long)packet[4] << 24 | (unsigned long)packet[5] << 16 | (unsigned long)packet[6] << 8 | packet[7];
+  
+  if ( xid != dhcp_xid || 0 != memcmp( &packet[28], mac, 6 ) ) { return; }
+  
+  byte *data = dhcpFindOption( packet, len, DHCP_OPT_MESSAGE_TYPE, 1 );
+  byte *server = dhcpFindOption( packet, len, DHCP_OPT_SERVER_ID, 4 );
+  byte type = data ? *data : 0;
+  
+  // An offer without server id can't be requested
+  //
+  if ( DHCP_OFFER == type && DHCP_STATE_SELECTING == dhcp_state && server )
+  {
+    memcpy( dhcp_offered_ip, &packet[16], 4 );
+    memcpy( dhcp_server_id, server, 4 );
+    
+    dhcp_tries = 0;
+    dhcp_state = DHCP_STATE_REQUESTING;
+    sendDhcp( DHCP_REQUEST );
+  }
+  else if ( DHCP_ACK == type && DHCP_STATE_SELECTING != dhcp_state )
+  {
+    bindDhcp( packet, len );
+  }
+  else if ( DHCP_NAK == type )
+  {
+    if ( NETWORK_SERIAL_DEBUGGING ) 
+      Serial << "DHCP nak, starting over\n";
+    
+    startDhcp( DHCP_STATE_SELECTING );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void loopNetwork()
+{
+  switch ( dhcp_state )
+  {
+    case ( DHCP_STATE_SELECTING ):
+    case ( DHCP_STATE_REQUESTING ):
+    case ( DHCP_STATE_REBOOTING ):
+    case ( DHCP_STATE_RENEWING ):
+      receiveDhcp();
+      
+      if ( DHCP_TIMEOUT > now - dhcp_time || DHCP_STATE_BOUND == dhcp_state ) { break; }
+      
+      if ( DHCP_RETRIES > dhcp_tries )
+      {
+        sendDhcp( DHCP_STATE_SELECTING == dhcp_state ? DHCP_DISCOVER : DHCP_REQUEST );
+      }
+      else if ( DHCP_STATE_RENEWING == dhcp_state && dhcp_lease_time > now - dhcp_bound_time )
+      {
+        // Still bound, try again later but not after the lease expired
+        //
+        stopDhcp( DHCP_STATE_BOUND );
+        
+        dhcp_renew_time = min( now - dhcp_bound_time + DHCP_RETRY_TIME, dhcp_lease_time );
+      }
+      else if ( DHCP_STATE_RENEWING == dhcp_state )
+      {
+        if ( NETWORK_SERIAL_DEBUGGING ) 
+          Serial << "DHCP lease expired, looking for a new one\n";
+        
+        startDhcp( DHCP_STATE_SELECTING );
+      }
+      else
+      {
+        if ( NETWORK_SERIAL_DEBUGGING ) 
+          Serial << "No answer from DHCP server, keeping current config\n";
+        
+        stopDhcp( DHCP_STATE_FAILED );
+      }
+      break;
+      
+    case ( DHCP_STATE_BOUND ):
+      if ( dhcp_renew_time <= now - dhcp_bound_time )
+      {
+        startDhcp( DHCP_STATE_RENEWING );
+      }
+      break;
+      
+    case ( DHCP_STATE_FAILED ):
+      if ( DHCP_RETRY_TIME <= now - dhcp_time )
+      {
+        startDhcp( DHCP_STATE_SELECTING );
+      }
+      break;
+  }
+}
@@ -0,0 +1,182 @@
+/*
+ *  PCA9685 I2C PWM expanders
+ *
+ *  Every chip has 16 PWM outputs, up to PCA9685_MAX_CHIPS chips share the bus at
+ *  addresses PCA9685_BASE_ADDRESS and up. A light channel on a chip has the chip and
+ *  output in its address (see PCA9685_ADDRESS).
+ *
+ *  Changed channels are only marked in pca9685Set, pca9685Flush writes them once per
+ *  output tick. The chips auto increment the register address, so every run of
+ *  neighbouring changed outputs is a single transaction with 4 registers per output.
+ *  A run is cut at PCA9685_BURST outputs to fit the 32 byte buffer of Wire.
+ *
+ *  At 100 kHz a byte is ~90 us on the bus, so a burst of n outputs costs
+ *  (2 + 4 * n) bytes instead of 6 * n bytes for separate writes.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define PCA9685_MAX_CHIPS       4
+#define PCA9685_BASE_ADDRESS    0x40
+#define PCA9685_OUTPUTS         16
+#define PCA9685_BURST           7       // outputs per transaction, 1 + 7 * 4 bytes fit in BUFFER_LENGTH
+#define PCA9685_PWM_FREQUENCY   200     // Hz
+
+#define PCA9685_MODE1           0x00    // Registers
+#define PCA9685_MODE2           0x01
+#define PCA9685_LED0_ON_L       0x06
+#define PCA9685_PRESCALE        0xFE
+
+#define PCA9685_SLEEP           0x10    // MODE1
+#define PCA9685_AI              0x20
+#define PCA9685_OUTDRV          0x04    // MODE2
+#define PCA9685_FULL            0x10    // bit 4 of LEDn_ON_H / LEDn_OFF_H
+
+// ----------------------------------------------------------------- //
+
+byte pca9685_values[ PCA9685_MAX_CHIPS ][ PCA9685_OUTPUTS ];
+word pca9685_dirty[ PCA9685_MAX_CHIPS ];        // bit per output with a changed value
+int  pca9685_nr_chips = 0;
+
+unsigned long pca9685_transactions  = 0;
+unsigned long pca9685_bytes         = 0;        // bytes written on the bus, address included
+unsigned long pca9685_flush_time_max = 0;       // worst case us for a flush
+
+// -------------------------------------------------------- //
+
+// Called by the dimmer when the output of an I2C channel changes
+//
+void pca9685Set( int address, int value )
+{
+  int chip   = PCA9685_CHIP( address );
+  int output = PCA9685_OUTPUT( address );
+
+  if ( PCA9685_MAX_CHIPS <= chip ) { return; }
+
+  pca9685_values[chip][output] = value;
+  pca9685_dirty[chip] |= _BV( output );
+}
+
+// -------------------------------------------------------- //
+
+void pca9685Write( int chip, byte reg, byte value )
+{
+  Wire.beginTransmission( PCA9685_BASE_ADDRESS + chip );
+  Wire.send( reg );
+  Wire.send( value );
+  Wire.endTransmission();
+}
+
+// -------------------------------------------------------- //
+
+// Write outputs first .. first + count - 1 of a chip in one transaction
+//
+void pca9685Burst( int chip, int first, int count )
+{
+  Wire.beginTransmission( PCA9685_BASE_ADDRESS + chip );
+  Wire.send( PCA9685_LED0_ON_L + 4 * first );
+
+  for ( int i = first; i < first + count; i++ )
+  {
+    byte value = pca9685_values[chip][i];
+
+    // 8 to 12 bits, 255 becomes 4095. Fully on and off have their own bit,
+    // without them there is always a tiny pulse
+    //
+    word off = ( (word)value << 4 ) | ( value >> 4 );
+
+    Wire.send( 0 );
+    Wire.send( ( MAX_LIGHT_VALUE == value ) ? PCA9685_FULL : 0 );
+    Wire.send( lowByte( off ) );
+    Wire.send( ( 0 == value ) ? PCA9685_FULL : highByte( off ) );
+  }
+
+  Wire.endTransmission();
+
+  pca9685_transactions++;
+  pca9685_bytes += 2 + 4 * count;
+}
+
+// -------------------------------------------------------- //
+
+// Write all changed outputs, called at the end of every output tick
+//
+void pca9685Flush()
+{
+  unsigned long start = micros();
+  boolean flushed = false;
+
+  for ( int chip = 0; chip < pca9685_nr_chips; chip++ )
+  {
+    word dirty = pca9685_dirty[chip];
+
+    if ( 0 == dirty ) { continue; }
+
+    pca9685_dirty[chip] = 0;
+    flushed = true;
+
+    for ( int i = 0; i < PCA9685_OUTPUTS; )
+    {
+      if ( !bitRead( dirty, i ) ) { i++; continue; }
+
+      int count = 1;
+
+      while ( i + count < PCA9685_OUTPUTS && PCA9685_BURST > count && bitRead( dirty, i + count ) )
+      {
+        count++;
+      }
+
+      pca9685Burst( chip, i, count );
+
+      i += count;
+    }
+  }
+
+  if ( !flushed ) { return; }
+
+  unsigned long time = micros() - start;
+
+  if ( time > pca9685_flush_time_max )
+  {
+    pca9685_flush_time_max = time;
+
+    if ( DIMMER_SERIAL_DEBUGGING )
+      Serial << "PCA9685 flush: [" << time << "] us, transactions: [" << pca9685_transactions << "] bytes: [" << pca9685_bytes << "]\n";
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupPca9685()
+{
+  // Chips in use follow from the channels on them
+  //
+  for ( int i = 0; i < NR_I2C_LIGHT_CHANNELS; i++ )
+  {
+    pca9685_nr_chips = max( pca9685_nr_chips, PCA9685_CHIP( i2cLights[i] ) + 1 );
+  }
+
+  pca9685_nr_chips = min( pca9685_nr_chips, PCA9685_MAX_CHIPS );
+
+  Wire.begin();
+
+  for ( int chip = 0; chip < pca9685_nr_chips; chip++ )
+  {
+    // The prescaler can only be set while sleeping, 25 MHz internal clock
+    //
+    pca9685Write( chip, PCA9685_MODE1, PCA9685_SLEEP );
+    pca9685Write( chip, PCA9685_PRESCALE, 25000000L / ( 4096L * PCA9685_PWM_FREQUENCY ) - 1 );
+    pca9685Write( chip, PCA9685_MODE1, PCA9685_AI );
+    pca9685Write( chip, PCA9685_MODE2, PCA9685_OUTDRV );
+
+    // The oscillator needs 500 us to start after waking up
+    //
+    delayMicroseconds( 500 );
+
+    // Start with all outputs off
+    //
+    pca9685_dirty[chip] = 0xFFFF;
+  }
+
+  pca9685Flush();
+}
@@ -0,0 +1,209 @@
+/*
+ *  Cycle profiling of the hot paths
+ *
+ *  Timer5 runs at the CPU clock (prescaler 1) with an overflow counter on top, so
+ *  profileCycles() reads the exact nr of CPU cycles, ~10 cycles of overhead included.
+ *  Timer5 only drives the PWM of pins 44 .. 46, these are button inputs here.
+ *
+ *  Per profile point the nr of runs, the total and the worst case cycles are kept.
+ *  The mean is compared with the baseline in profileBaselines, a point more than
+ *  PROFILE_TOLERANCE percent slower is a regression. A point with a baseline of 0
+ *  has the status noBaseline instead of passing, setupProfile lists them as well.
+ *
+ *  The baselines come from a known good build: tools/profile.py --save writes the
+ *  means of getProfile to a JSON file, --compare checks a build against that file
+ *  and --header prints profileBaselines for it.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define PROFILE_TOLERANCE       10      // percent a mean may exceed its baseline
+
+enum PROFILE_POINT {
+  PROFILE_INPUT_IDLE,                   // handleInput, nothing changed
+  PROFILE_INPUT_EVENT,                  // handleInput, button pressed or released
+  PROFILE_INPUT_FADE,                   // handleInput, fading
+  PROFILE_SWITCH_QUEUE_EMPTY,           // processSwitchQueue, empty queue
+  PROFILE_SWITCH_QUEUE_1,               // processSwitchQueue, one switch queued
+  PROFILE_SWITCH_QUEUE_N,               // processSwitchQueue, more switches queued
+  PROFILE_LIGHT_TARGET,                 // processLightTarget, value changed
+  PROFILE_SWITCH_TARGET,                // processSwitchTarget, state changed
+  PROFILE_SET_LIGHT_URL,                // url parsing of setLightCmd
+  PROFILE_SET_SWITCH_URL,               // url parsing of setSwitchCmd
+  PROFILE_LIGHTS_SNAPSHOT,              // getAllLightsCmd, any format
+  PROFILE_SWITCHES_SNAPSHOT,            // getAllSwitchesCmd, any format
+  PROFILE_TASKS_XML,                    // getTasksCmd
+  NR_PROFILE_POINTS
+};
+
+enum PROFILE_STATUS {
+  PROFILE_OK,                           // mean within the tolerance of the baseline
+  PROFILE_REGRESSION,                   // mean above it
+  PROFILE_NO_BASELINE                   // baseline of 0, nothing to compare with
+};
+
+struct ProfilePoint
+{
+  unsigned long runs;
+  unsigned long cycles;                 // total
+  unsigned long cycles_max;
+};
+
+// Names and baseline mean cycles, in order of PROFILE_POINT
+//
+P( profileNames ) =
+  "inputIdle\0inputEvent\0inputFade\0"
+  "switchQueueEmpty\0switchQueue1\0switchQueueN\0"
+  "lightTarget\0switchTarget\0"
+  "setLightUrl\0setSwitchUrl\0"
+  "lightsSnapshot\0switchesSnapshot\0tasksXml\0";
+
+P( profileStatusNames ) = "ok\0regression\0noBaseline\0";
+
+const unsigned long profileBaselines[ NR_PROFILE_POINTS ] PROGMEM = {
+  0, 0, 0,
+  0, 0, 0,
+  0, 0,
+  0, 0,
+  0, 0, 0
+};
+
+ProfilePoint profile_points[ NR_PROFILE_POINTS ];
+
+volatile unsigned int profile_overflows = 0;
+
+// -------------------------------------------------------- //
+
+ISR( TIMER5_OVF_vect )
+{
+  profile_overflows++;
+}
+
+// -------------------------------------------------------- //
+
+unsigned long profileCycles()
+{
+  byte sreg = SREG;
+  cli();
+
+  unsigned int high = profile_overflows;
+  unsigned int low  = TCNT5;
+
+  // Overflow that happened while interrupts were off
+  //
+  if ( bit_is_set( TIFR5, TOV5 ) && 0x8000 > low )
+  {
+    high++;
+  }
+
+  SREG = sreg;
+
+  return ( (unsigned long)high << 16 ) | low;
+}
+
+// -------------------------------------------------------- //
+
+unsigned long profileStart()
+{
+  return PROFILE_ENABLED ? profileCycles() : 0;
+}
+
+// -------------------------------------------------------- //
+
+void profileStop( int point, unsigned long start )
+{
+  if ( !PROFILE_ENABLED ) { return; }
+
+  unsigned long cycles = profileCycles() - start;
+
+  ProfilePoint *p = &profile_points[point];
+
+  p->runs++;
+  p->cycles += cycles;
+  p->cycles_max = max( p->cycles_max, cycles );
+}
+
+// -------------------------------------------------------- //
+
+const prog_uchar *profileName( int point )
+{
+  return nameAt( profileNames, point );
+}
+
+// -------------------------------------------------------- //
+
+unsigned long profileMean( int point )
+{
+  ProfilePoint *p = &profile_points[point];
+
+  return ( 0 == p->runs ) ? 0 : p->cycles / p->runs;
+}
+
+// -------------------------------------------------------- //
+
+unsigned long profileBaseline( int point )
+{
+  return pgm_read_dword( &profileBaselines[point] );
+}
+
+// -------------------------------------------------------- //
+
+int profileStatus( int point )
+{
+  unsigned long baseline = profileBaseline( point );
+
+  if ( 0 == baseline ) { return PROFILE_NO_BASELINE; }
+
+  return ( profileMean( point ) * 100 > baseline * ( 100 + PROFILE_TOLERANCE ) ) ? PROFILE_REGRESSION : PROFILE_OK;
+}
+
+// -------------------------------------------------------- //
+
+const prog_uchar *profileStatusName( int point )
+{
+  return nameAt( profileStatusNames, profileStatus( point ) );
+}
+
+// -------------------------------------------------------- //
+
+// One line per point: name runs mean max baseline status
+//
+void printProfile( Print &output )
+{
+  char name[24];
+  char status[12];
+
+  for ( int i = 0; i < NR_PROFILE_POINTS; i++ )
+  {
+    strncpy_P( name, (const char *)profileName( i ), sizeof( name ) );
+    name[ sizeof( name ) - 1 ] = '\0';
+
+    strcpy_P( status, (const char *)profileStatusName( i ) );
+
+    output << "Profile " << name << " " << profile_points[i].runs << " " << profileMean( i ) << " "
+           << profile_points[i].cycles_max << " " << profileBaseline( i ) << " " << status << "\n";
+  }
+}
+
+// -------------------------------------------------------- //
+
+void setupProfile()
+{
+  char name[24];
+
+  TCCR5A = 0;
+  TCCR5B = _BV( CS50 );
+  TIMSK5 = _BV( TOIE5 );
+
+  // Say so when there is nothing to compare with, these never pass
+  //
+  for ( int i = 0; i < NR_PROFILE_POINTS; i++ )
+  {
+    if ( 0 != profileBaseline( i ) ) { continue; }
+
+    strncpy_P( name, (const char *)profileName( i ), sizeof( name ) );
+    name[ sizeof( name ) - 1 ] = '\0';
+
+    Serial << "Profile " << name << ": no baseline, see tools/profile.py\n";
+  }
+}
@@ -0,0 +1,382 @@
+/*
+ *  Time of day schedules
+ *
+ *  - clock:
+ *      wall clock in seconds (local time), kept running on millis() and synced
+ *      with the (S)NTP server in timeserver every CLOCK_SYNC_TIME. It can be set
+ *      from the web API as well (setClock). With SUMMER_TIME the clock moves an
+ *      hour at the switches by itself. Of the rules in the hour skipped in spring
+ *      only the first fires, late at 03:00. The rules in the hour that repeats in
+ *      autumn fire once.
+ *
+ *  - rule:
+ *      on the days in the mask, at minute of the day, set a light channel, switch
+ *      channel or scene. Rules only fire when the clock is set.
+ *
+ *  - scene:
+ *      set of light channel values applied together
+ *
+ *  Only the time of the first rule to fire is kept, checking the schedule is a single
+ *  comparison no matter how many rules there are. The next one is searched when it fired
+ *  or when the clock is changed.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define NR_RULES                16      // maximum number of schedule rules
+#define NR_SCENES               4       // nr of scenes
+#define NR_CHANNELS_PER_SCENE   8       // maximum number of light channels in a scene
+
+#define TIME_ZONE_OFFSET        3600    // seconds to add to UTC for local (standard) time
+#define SUMMER_TIME             1       // 1 for EU summer time, an hour ahead from the last sunday of
+                                        // march to the last sunday of october, 01:00 UTC. 0 for none,
+                                        // other rules (like the US ones) aren't supported.
+#define CLOCK_SYNC_TIME         3600000 // ms between two syncs with the time server
+#define CLOCK_SYNC_RETRY        60000   // ms before trying again when the sync failed
+#define CLOCK_SYNC_TIMEOUT      2000    // ms to wait for an answer of the time server
+
+#define NTP_PORT                123
+#define NTP_LOCAL_PORT          8123
+#define NTP_PACKET_LENGTH       48
+#define NTP_UNIX_OFFSET         2208988800UL // seconds between 1900 and 1970
+
+#define SECONDS_PER_DAY         86400UL
+
+#define DAYS_ALL                0x7F    // Day masks, bit 0 is sunday
+#define DAYS_WEEK               0x3E
+#define DAYS_WEEKEND            0x41
+
+// ----------------------------------------------------------------- //
+
+enum SCHEDULE_ACTION {
+  SCHEDULE_LIGHT,                       // set light channel to value
+  SCHEDULE_SWITCH,                      // set switch channel to value (0 or 1)
+  SCHEDULE_SCENE                        // apply scene in channel
+};
+
+struct Rule
+{
+  byte days;
+  int minute;
+  enum SCHEDULE_ACTION action;
+  int channel;
+  int value;
+};
+
+Rule rules[ NR_RULES ];
+int  nr_rules = 0;
+
+// Scene => light channel values
+//
+// Index 0 specifies the number of channels in the scene
+// Index 1 and next are pairs of channel and value
+//
+int sceneLights[ NR_SCENES ][ 1 + 2 * NR_CHANNELS_PER_SCENE ];
+
+unsigned long clock_seconds = 0;        // local time in seconds since 1970, 0 when not set
+unsigned long clock_millis  = 0;        // millis() that belongs to clock_seconds
+boolean       clock_summer  = false;    // clock_seconds includes the hour of summer time
+
+unsigned long next_rule_time = 0;       // clock_seconds at which the first rule fires, 0 for none
+
+SOCKET        clock_socket    = MAX_SOCK_NUM;
+unsigned long clock_sync_time = 0;      // ms when the last sync was started
+unsigned long clock_sync_wait = 0;      // ms to wait before starting the next sync
+
+// -------------------------------------------------------- //
+
+void addRule( byte days, int hour, int minute, enum SCHEDULE_ACTION action, int channel, int value )
+{
+  if ( NR_RULES <= nr_rules ) { return; }
+
+  Rule *r = &rules[nr_rules++];
+
+  r->days    = days;
+  r->minute  = hour * 60 + minute;
+  r->action  = action;
+  r->channel = channel;
+  r->value   = value;
+}
+
+// -------------------------------------------------------- //
+
+void applyScene( int scene )
+{
+  for ( int i = 0; i < sceneLights[scene][0]; i++ )
+  {
+    setLightTargetValue( sceneLights[scene][2*i + 1], sceneLights[scene][2*i + 2], 2 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Seconds at which the rule fires next, after time t
+//
+unsigned long ruleNextTime( Rule *r, unsigned long t )
+{
+  unsigned long day = t / SECONDS_PER_DAY;
+
+  for ( int i = 0; i <= 7; i++ )
+  {
+    int weekday = ( day + i + 4 ) % 7;   // 1-1-1970 was a thursday
+
+    unsigned long fire = ( day + i ) * SECONDS_PER_DAY + r->minute * 60UL;
+
+    if ( bitRead( r->days, weekday ) && fire > t )
+    {
+      return fire;
+    }
+  }
+
+  return 0;
+}
+
+// -------------------------------------------------------- //
+
+void findNextRule()
+{
+  next_rule_time = 0;
+
+  if ( 0 == clock_seconds ) { return; }
+
+  for ( int i = 0; i < nr_rules; i++ )
+  {
+    unsigned long fire = ruleNextTime( &rules[i], clock_seconds );
+
+    if ( 0 != fire && ( 0 == next_rule_time || fire < next_rule_time ))
+    {
+      next_rule_time = fire;
+    }
+  }
+
+  if ( DIMMER_SERIAL_DEBUGGING )
+    Serial << "Next rule at: [" << next_rule_time << "]\n";
+}
+
+// -------------------------------------------------------- //
+
+void fireRules()
+{
+  int minute = ( next_rule_time % SECONDS_PER_DAY ) / 60;
+  int weekday = ( next_rule_time / SECONDS_PER_DAY + 4 ) % 7;
+
+  for ( int i = 0; i < nr_rules; i++ )
+  {
+    Rule *r = &rules[i];
+
+    if ( r->minute != minute || !bitRead( r->days, weekday ) ) { continue; }
+
+    if ( DIMMER_SERIAL_DEBUGGING )
+      Serial << "Rule [" << i << "] fired, action: [" << r->action << "] channel: [" << r->channel << "] value: [" << r->value << "]\n";
+
+    switch ( r->action )
+    {
+      case ( SCHEDULE_LIGHT ):
+        setLightTargetValue( r->channel, r->value, 2 );
+        break;
+
+      case ( SCHEDULE_SWITCH ):
+        setSwitchTargetState( r->channel, r->value ? HIGH : LOW );
+        break;
+
+      case ( SCHEDULE_SCENE ):
+        applyScene( r->channel );
+        break;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+boolean leapYear( int year )
+{
+  return 0 == year % 4 && ( 0 != year % 100 || 0 == year % 400 );
+}
+
+// -------------------------------------------------------- //
+
+// Day (since 1970) of the sunday on or before day
+//
+unsigned long sundayBefore( unsigned long day )
+{
+  return day - ( day + 4 ) % 7;         // 1-1-1970 was a thursday
+}
+
+// -------------------------------------------------------- //
+
+// Is it EU summer time at utc (seconds since 1970), from the last sunday of 
+// march to the last sunday of october, both at 01:00 UTC
+//
+boolean summerTime( unsigned long utc )
+{
+  if ( !SUMMER_TIME ) { return false; }
+  
+  unsigned long day       = utc / SECONDS_PER_DAY;
+  unsigned long yearStart = 0;
+  int year = 1970;
+  
+  while ( yearStart + ( leapYear( year ) ? 366 : 365 ) <= day )
+  {
+    yearStart += leapYear( year ) ? 366 : 365;
+    year++;
+  }
+  
+  int leap = leapYear( year ) ? 1 : 0;
+  
+  unsigned long start = sundayBefore( yearStart + 89 + leap )  * SECONDS_PER_DAY + 3600;   // 31 march
+  unsigned long end   = sundayBefore( yearStart + 303 + leap ) * SECONDS_PER_DAY + 3600;   // 31 october
+  
+  return start <= utc && end > utc;
+}
+
+// -------------------------------------------------------- //
+
+// Set the local time, it is taken as summer time when that is in effect at that
+// time. The hour that repeats in autumn is taken as summer time.
+//
+void setClock( unsigned long seconds )
+{
+  clock_seconds = seconds;
+  clock_millis  = now;
+  clock_summer  = summerTime( seconds - TIME_ZONE_OFFSET - 3600 );
+
+  findNextRule();
+}
+
+// -------------------------------------------------------- //
+
+// Keep the clock running on millis(), the unsigned subtraction survives
+// the rollover of millis() after ~50 days
+//
+void updateClock()
+{
+  if ( 0 == clock_seconds ) { return; }
+
+  unsigned long elapsed = ( now - clock_millis ) / 1000;
+
+  clock_seconds += elapsed;
+  clock_millis  += elapsed * 1000;
+  
+  // Move the clock at the summer time switches, the next rule stays so no rule
+  // fires twice when the clock goes back
+  //
+  boolean summer = summerTime( clock_seconds - TIME_ZONE_OFFSET - ( clock_summer ? 3600 : 0 ) );
+  
+  if ( summer != clock_summer )
+  {
+    clock_seconds = summer ? clock_seconds + 3600 : clock_seconds - 3600;
+    clock_summer  = summer;
+    
+    if ( DIMMER_SERIAL_DEBUGGING )
+      Serial << "Summer time: [" << ( summer ? "on" : "off" ) << "] clock: [" << clock_seconds << "]\n";
+  }
+}
+
+// -------------------------------------------------------- //
+
+void startClockSync()
+{
+  byte packet[ NTP_PACKET_LENGTH ];
+
+  clock_sync_time = now;
+  clock_sync_wait = CLOCK_SYNC_RETRY;
+
+  clock_socket = openUdp( NTP_LOCAL_PORT );
+
+  if ( MAX_SOCK_NUM == clock_socket ) { return; }
+
+  memset( packet, 0, NTP_PACKET_LENGTH );
+  packet[0] = 0x1B;     // no leap warning, version 3, client
+
+  sendto( clock_socket, packet, NTP_PACKET_LENGTH, timeserver, NTP_PORT );
+}
+
+// -------------------------------------------------------- //
+
+void checkClockSync()
+{
+  byte packet[ NTP_PACKET_LENGTH ];
+  byte addr[4];
+  uint16_t port;
+
+  if ( NTP_PACKET_LENGTH <= readUdp( clock_socket, packet, NTP_PACKET_LENGTH, addr, &port ))
+  {
+    // Transmit timestamp, seconds since 1900
+    //
+    unsigned long seconds = (unsigned long)packet[40] << 24 | (unsigned long)packet[41] << 16 |
+                            (unsigned long)packet[42] << 8  | (unsigned long)packet[43];
+
+    seconds -= NTP_UNIX_OFFSET;
+    
+    boolean summer = summerTime( seconds );
+    
+    setClock( seconds + TIME_ZONE_OFFSET + ( summer ? 3600 : 0 ) );
+    clock_summer = summer;
+
+    clock_sync_wait = CLOCK_SYNC_TIME;
+
+    if ( DIMMER_SERIAL_DEBUGGING )
+      Serial << "Clock synced: [" << clock_seconds << "]\n";
+  }
+  else if ( CLOCK_SYNC_TIMEOUT > now - clock_sync_time )
+  {
+    return;
+  }
+
+  close( clock_socket );
+  clock_socket = MAX_SOCK_NUM;
+}
+
+// -------------------------------------------------------- //
+
+void setupSchedule()
+{
+  // Scene => light channel values
+  //
+  sceneLights[ 0][0]  =  2;    // SCENE - Avond
+  sceneLights[ 0][1]  =  1;    // LC  - links raam
+  sceneLights[ 0][2]  = 80;
+  sceneLights[ 0][3]  =  4;    // LC  - midden raam
+  sceneLights[ 0][4]  = 80;
+
+  sceneLights[ 1][0]  =  2;    // SCENE - Avond uit
+  sceneLights[ 1][1]  =  1;    // LC  - links raam
+  sceneLights[ 1][2]  =  0;
+  sceneLights[ 1][3]  =  4;    // LC  - midden raam
+  sceneLights[ 1][4]  =  0;
+
+  sceneLights[ 2][0]  =  0;    // Unassigned
+  sceneLights[ 3][0]  =  0;    // Unassigned
+
+  // Rules, none by default. Examples:
+  //
+  // addRule( DAYS_WEEK,    7,  0, SCHEDULE_SWITCH, 1, 1 );   // switch 1 on at 7:00 on week days
+  // addRule( DAYS_WEEK,    7, 30, SCHEDULE_SWITCH, 1, 0 );   // and off at 7:30
+  // addRule( DAYS_WEEKEND, 9,  0, SCHEDULE_SWITCH, 1, 1 );
+  // addRule( DAYS_WEEKEND, 9, 30, SCHEDULE_SWITCH, 1, 0 );
+  //
+  // addRule( DAYS_ALL,    19,  0, SCHEDULE_SCENE,  0, 0 );   // scene 0 every evening
+  // addRule( DAYS_ALL,    23, 30, SCHEDULE_SCENE,  1, 0 );   // scene 1, the same lights off
+}
+
+// -------------------------------------------------------- //
+
+void loopSchedule()
+{
+  if ( MAX_SOCK_NUM != clock_socket )
+  {
+    checkClockSync();
+  }
+  else if ( clock_sync_wait <= now - clock_sync_time )
+  {
+    startClockSync();
+  }
+
+  updateClock();
+
+  if ( 0 == next_rule_time || clock_seconds < next_rule_time ) { return; }
+
+  fireRules();
+
+  findNextRule();
+}
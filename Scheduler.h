@@ -0,0 +1,240 @@
+/*
+ *  Cooperative task scheduler
+ *
+ *  Tasks are registered with a period and a priority. Every pass of loop() 
+ *  runs the most important task that is due, so time critical work like 
+ *  button sampling keeps its rate no matter how long the web server takes.
+ *
+ *  - period:     ms between two runs of the task
+ *  - priority:   lower value wins when more than one task is due
+ *  - misses:     runs that started more than a full period too late
+ *  - gap:        worst case ms between the starts of two runs, for the input task 
+ *                this is how late a button press can be noticed
+ *  - cost:       histogram of the run times, bucket b counts runs shorter than 
+ *                TASK_COST_BASE << b us, the last bucket counts the rest. When a 
+ *                bucket is full all buckets of the task are halved, the shape stays.
+ *                Only with TASK_COST_ENABLED, it takes 16 bytes per task.
+ *
+ *  Time spent inside tasks is measured per window, the remainder is idle time 
+ *  and shows the CPU headroom that is left.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define NR_TASKS                14      // maximum number of tasks that can be registered
+#define LOAD_WINDOW             1000    // ms over which the load is measured
+#define TASK_COST_BUCKETS       8
+#define TASK_COST_BASE          32      // us, upper bound of the first bucket
+
+// ----------------------------------------------------------------- //
+
+typedef void TaskFunction();
+
+struct Task
+{
+  const char *name;
+  TaskFunction *function;
+  unsigned long period;
+  int priority;
+  unsigned long last_run;
+  unsigned int misses;
+  unsigned long run_time_max;           // worst case us of a single run
+  unsigned long last_start;             // ms the last run started
+  unsigned long gap_max;                // worst case ms between the start of two runs
+};
+
+Task tasks[ NR_TASKS ];
+int  nr_tasks = 0;
+
+unsigned int task_costs[ TASK_COST_ENABLED ? NR_TASKS : 1 ][ TASK_COST_BUCKETS ];   // per task, in the order of tasks
+
+unsigned long load_window_start  = 0;   // ms
+unsigned long load_busy_time     = 0;   // us spent in tasks in the current window
+int           scheduler_load     = 0;   // percentage of the last window spent in tasks
+unsigned long scheduler_passes   = 0;   // passes of loop(), since the last metrics were sent
+unsigned long scheduler_pass_max = 0;   // worst case us of a pass, since the last metrics were sent
+
+// -------------------------------------------------------- //
+
+// Add a task, the list is kept sorted on priority so the first task found 
+// due is the one to run
+//
+void addTask( const char *name, TaskFunction *function, unsigned long period, int priority )
+{
+  if ( NR_TASKS <= nr_tasks ) { return; }
+  
+  int i = nr_tasks++;
+  
+  while ( 0 < i && tasks[i - 1].priority > priority )
+  {
+    tasks[i] = tasks[i - 1];
+    i--;
+  }
+  
+  Task *t = &tasks[i];
+  
+  t->name         = name;
+  t->function     = function;
+  t->period       = period;
+  t->priority     = priority;
+  t->last_run     = millis();
+  t->misses       = 0;
+  t->run_time_max = 0;
+  t->last_start   = t->last_run;
+  t->gap_max      = 0;
+}
+
+// -------------------------------------------------------- //
+
+// Start measuring misses and worst cases over again, e.g. between two load tests
+//
+void resetTasks()
+{
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    Task *t = &tasks[i];
+    
+    t->misses       = 0;
+    t->run_time_max = 0;
+    t->last_start   = now;
+    t->gap_max      = 0;
+  }
+  
+  memset( task_costs, 0, sizeof( task_costs ) );
+}
+
+// -------------------------------------------------------- //
+
+void countTaskCost( Task *t, unsigned long spent )
+{
+  unsigned int *cost = task_costs[ t - tasks ];
+  int b = 0;
+  
+  while ( TASK_COST_BUCKETS - 1 > b && ( (unsigned long)TASK_COST_BASE << b ) <= spent )
+  {
+    b++;
+  }
+  
+  if ( 0xFFFF == cost[b] )
+  {
+    for ( int i = 0; i < TASK_COST_BUCKETS; i++ )
+    {
+      cost[i] >>= 1;
+    }
+  }
+  
+  cost[b]++;
+}
+
+// -------------------------------------------------------- //
+
+// Run time in us that percent of the runs stay below, the upper bound of the 
+// bucket it falls in (the worst case for the last bucket). 0 without 
+// TASK_COST_ENABLED.
+//
+unsigned long taskCostPercentile( Task *t, int percent )
+{
+  if ( !TASK_COST_ENABLED ) { return 0; }
+  
+  unsigned int *cost = task_costs[ t - tasks ];
+  unsigned long runs = 0;
+  
+  for ( int i = 0; i < TASK_COST_BUCKETS; i++ )
+  {
+    runs += cost[i];
+  }
+  
+  unsigned long count = 0;
+  
+  for ( int i = 0; i < TASK_COST_BUCKETS - 1; i++ )
+  {
+    count += cost[i];
+    
+    if ( 0 < count && count * 100 >= runs * percent )
+    {
+      return (unsigned long)TASK_COST_BASE << i;
+    }
+  }
+  
+  return t->run_time_max;
+}
+
+// -------------------------------------------------------- //
+
+void loopScheduler()
+{
+  now = millis();
+  
+  scheduler_passes++;
+  
+  if ( LOAD_WINDOW <= now - load_window_start )
+  {
+    scheduler_load    = ( load_busy_time / 10 ) / ( now - load_window_start );
+    scheduler_load    = constrain( scheduler_load, 0, 100 );
+    load_busy_time    = 0;
+    load_window_start = now;
+  }
+  
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    Task *t = &tasks[i];
+    
+    unsigned long late = now - t->last_run;
+    
+    if ( t->period > late ) { continue; }
+    
+    // Keep the original phase unless a whole period was missed, 
+    // in that case count the miss and start over from now
+    //
+    if ( 2 * t->period <= late )
+    {
+      t->misses++;
+      t->last_run = now;
+    }
+    else
+    {
+      t->last_run += t->period;
+    }
+    
+    t->gap_max    = max( t->gap_max, now - t->last_start );
+    t->last_start = now;
+    
+    unsigned long start = micros();
+    
+    t->function();
+    
+    unsigned long spent = micros() - start;
+    
+    load_busy_time += spent;
+    t->run_time_max = max( t->run_time_max, spent );
+    
+    if ( TASK_COST_ENABLED )
+      countTaskCost( t, spent );
+    
+    scheduler_pass_max = max( scheduler_pass_max, spent );
+    
+    // Only one task per pass, so a task with a higher priority that became due 
+    // in the mean time is picked up first
+    //
+    return;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void printTasks( Print &output )
+{
+  output << "Load: [" << scheduler_load << "%]\n";
+  
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    Task *t = &tasks[i];
+    
+    output << "Task [" << t->name << "] period: [" << t->period << "] misses: [" << t->misses << "] max us: [" << t->run_time_max << "] max gap: [" << t->gap_max << "]";
+    
+    if ( TASK_COST_ENABLED )
+      output << " p50 us: [" << taskCostPercentile( t, 50 ) << "] p99 us: [" << taskCostPercentile( t, 99 ) << "]";
+    
+    output << "\n";
+  }
+}
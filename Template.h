@@ -0,0 +1,305 @@
+/*
+ *  Response templates
+ *
+ *  The text of a response lives in flash (PROGMEM) with placeholders for the values:
+ *
+ *  - TPL_NUMBER:   long, printed in decimal
+ *  - TPL_TEXT:     zero terminated string in RAM
+ *  - TPL_IP:       4 byte address, printed dotted
+ *  - TPL_BYTE:     long, written as a single raw byte, for binary responses
+ *
+ *  Templates are rendered straight into a small send buffer. The length of the text
+ *  without placeholders and the placeholder types are read once, after that the 
+ *  Content-Length of a response only costs the length of the values and the response
+ *  is rendered a single time. A template with more than TEMPLATE_MAX_VALUES
+ *  placeholders fails when it is read, it renders as templateError from then on.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define TEMPLATE_BUFFER_LENGTH  64      // bytes collected before writing them to the client
+#define TEMPLATE_MAX_VALUES     8       // maximum number of placeholders in a template
+
+#define TPL_NUMBER              "\x01"  // Placeholders, to be used in the template text
+#define TPL_TEXT                "\x02"
+#define TPL_IP                  "\x03"
+#define TPL_BYTE                "\x04"
+
+#define TPL_NUMBER_CHAR         0x01    // Placeholders as found in the template
+#define TPL_TEXT_CHAR           0x02
+#define TPL_IP_CHAR             0x03
+#define TPL_BYTE_CHAR           0x04
+
+// Define a template, the text is stored in flash and the counts in RAM, 13 bytes
+// per template on the AVR
+//
+#define TEMPLATE( name, text )  P( name##_text ) = text; Template name = { name##_text, -1, 0, { 0 } };
+
+// ----------------------------------------------------------------- //
+
+struct Template
+{
+  const prog_uchar *text;
+  int length;                           // length of the text without placeholders, -1 until counted
+  byte nr_values;
+  byte types[ TEMPLATE_MAX_VALUES ];    // placeholders in order of appearance
+};
+
+union TemplateValue
+{
+  long number;
+  const char *text;
+  const byte *ip;
+};
+
+struct TemplateWriter
+{
+  Print *output;
+  int length;
+  char buffer[ TEMPLATE_BUFFER_LENGTH ];
+};
+
+P( templateError_text ) = "Template error: too many values";
+
+// -------------------------------------------------------- //
+
+// Name n of a list of zero terminated names in flash, e.g. "one\0two\0"
+//
+const prog_uchar *nameAt( const prog_uchar *names, int n )
+{
+  while ( 0 < n-- )
+  {
+    while ( 0 != pgm_read_byte( names++ ));
+  }
+
+  return names;
+}
+
+// -------------------------------------------------------- //
+
+int numberLength( long number )
+{
+  int length = 1;
+  unsigned long n = number;
+
+  if ( 0 > number )
+  {
+    n = -n;
+    length++;
+  }
+
+  // Up to 10 digits, stop before the power overflows
+  //
+  for ( unsigned long power = 10; n >= power; power *= 10 )
+  {
+    length++;
+
+    if ( 1000000000UL == power ) { break; }
+  }
+
+  return length;
+}
+
+// -------------------------------------------------------- //
+
+int ipLength( const byte *ip )
+{
+  int length = 3;   // dots
+
+  for ( int i = 0; i < 4; i++ )
+  {
+    length += numberLength( ip[i] );
+  }
+
+  return length;
+}
+
+// -------------------------------------------------------- //
+
+// Read the length of the fixed part and the placeholders, a template with too
+// many placeholders is replaced by the error text
+//
+void parseTemplate( Template &t )
+{
+  const prog_uchar *p = t.text;
+  byte ch;
+
+  t.length = 0;
+  t.nr_values = 0;
+
+  while ( 0 != ( ch = pgm_read_byte( p++ )))
+  {
+    if ( TPL_BYTE_CHAR < ch )
+    {
+      t.length++;
+    }
+    else if ( TEMPLATE_MAX_VALUES > t.nr_values )
+    {
+      t.types[t.nr_values++] = ch;
+    }
+    else
+    {
+      if ( DIMMER_SERIAL_DEBUGGING )
+        Serial << "Template with more than [" << TEMPLATE_MAX_VALUES << "] values\n";
+
+      t.text = templateError_text;
+      parseTemplate( t );
+      return;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Length of the template rendered with the given values
+//
+int templateLength( Template &t, const TemplateValue *values )
+{
+  int length = 0;
+
+  // Read the fixed part once
+  //
+  if ( 0 > t.length )
+  {
+    parseTemplate( t );
+  }
+
+  for ( int i = 0; i < t.nr_values; i++ )
+  {
+    switch ( t.types[i] )
+    {
+      case ( TPL_NUMBER_CHAR ): length += numberLength( values[i].number ); break;
+      case ( TPL_TEXT_CHAR ):   length += strlen( values[i].text );         break;
+      case ( TPL_IP_CHAR ):     length += ipLength( values[i].ip );         break;
+      case ( TPL_BYTE_CHAR ):   length += 1;                                break;
+    }
+  }
+
+  return t.length + length;
+}
+
+// -------------------------------------------------------- //
+
+void beginTemplates( TemplateWriter &w, Print &output )
+{
+  w.output = &output;
+  w.length = 0;
+}
+
+// -------------------------------------------------------- //
+
+void flushTemplates( TemplateWriter &w )
+{
+  if ( 0 == w.length ) { return; }
+
+  w.output->write( (const uint8_t *)w.buffer, w.length );
+  w.length = 0;
+}
+
+// -------------------------------------------------------- //
+
+void templateWrite( TemplateWriter &w, const char *text, int length )
+{
+  while ( 0 < length )
+  {
+    if ( TEMPLATE_BUFFER_LENGTH == w.length )
+    {
+      flushTemplates( w );
+    }
+
+    int part = min( length, TEMPLATE_BUFFER_LENGTH - w.length );
+
+    memcpy( &w.buffer[w.length], text, part );
+
+    w.length += part;
+    text     += part;
+    length   -= part;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void templateNumber( TemplateWriter &w, long number )
+{
+  char buf[12];
+
+  ltoa( number, buf, 10 );
+  templateWrite( w, buf, strlen( buf ) );
+}
+
+// -------------------------------------------------------- //
+
+void renderTemplate( TemplateWriter &w, Template &t, const TemplateValue *values )
+{
+  const prog_uchar *p = t.text;
+  byte ch;
+
+  while ( 0 != ( ch = pgm_read_byte( p++ )))
+  {
+    if ( TEMPLATE_BUFFER_LENGTH == w.length )
+    {
+      flushTemplates( w );
+    }
+
+    switch ( ch )
+    {
+      case ( TPL_NUMBER_CHAR ):
+        templateNumber( w, values->number );
+        values++;
+        break;
+
+      case ( TPL_TEXT_CHAR ):
+        templateWrite( w, values->text, strlen( values->text ) );
+        values++;
+        break;
+
+      case ( TPL_IP_CHAR ):
+        for ( int i = 0; i < 4; i++ )
+        {
+          if ( 0 != i ) { templateWrite( w, ".", 1 ); }
+
+          templateNumber( w, values->ip[i] );
+        }
+        values++;
+        break;
+
+      case ( TPL_BYTE_CHAR ):
+        w.buffer[w.length++] = values->number;
+        values++;
+        break;
+
+      default:
+        w.buffer[w.length++] = ch;
+        break;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Response headers including the Content-Length
+//
+void templateSuccess( WebServer &server, const char *contentType, int length )
+{
+  char headers[32] = "Content-Length: ";
+
+  itoa( length, &headers[16], 10 );
+  strcat( headers, "\r\n" );
+
+  server.httpSuccess( contentType, headers );
+}
+
+// -------------------------------------------------------- //
+
+// Complete response made of a single template
+//
+void sendTemplate( WebServer &server, const char *contentType, Template &t, const TemplateValue *values )
+{
+  TemplateWriter w;
+
+  templateSuccess( server, contentType, templateLength( t, values ) );
+
+  beginTemplates( w, server );
+  renderTemplate( w, t, values );
+  flushTemplates( w );
+}
@@ -7,7 +7,7 @@ inline Print &operator <<(Print &obj, T arg)
   return obj; 
 }
 
-void printArray(Print *output, char* delimeter, byte* data, int len, int base)
+void printArray(Print *output, const char* delimeter, byte* data, int len, int base)
 {
   char buf[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
   
@@ -2,60 +2,842 @@
 
 boolean webSetup = false;
 
+enum WEB_COMMAND {
+  WEB_INDEX,
+  WEB_GET_LIGHTS,
+  WEB_GET_SWITCHES,
+  WEB_GET_TASKS,
+  WEB_GET_PROFILE,
+  WEB_GET_NODES,
+  WEB_GET_CLOCK,
+  WEB_GET_NETWORK,
+  WEB_SET_LIGHT,
+  WEB_SET_SWITCH,
+  WEB_SET_CLOCK,
+  WEB_GET_GROUPS,
+  WEB_SET_GROUP,
+  WEB_TOGGLE_GROUP,
+  WEB_GET_ENERGY,
+  WEB_GET_FORMATS,
+  WEB_CROSSDOMAIN,
+  NR_WEB_COMMANDS
+};
+
+// Command names in order of WEB_COMMAND, for the request counts
+//
+P( webCommandNames ) =
+    "index\0getLightChannels\0getSwitchChannels\0getTasks\0getProfile\0"
+    "getClusterNodes\0getClock\0getNetwork\0setLightChannel\0setSwitchChannel\0"
+    "setClock\0getGroups\0setGroup\0toggleGroup\0getEnergy\0getFormats\0"
+    "crossdomain\0";
+
+unsigned long first_request_time = 0;   // ms after power on the first request was served
+unsigned long web_requests       = 0;   // nr of requests served
+unsigned long web_service_max    = 0;   // worst case us to serve a request
+unsigned int  web_command_requests[ NR_WEB_COMMANDS ];  // per command, since the last metrics were sent
+
 WebServer webserver(PREFIX, 80);
 
-P(crossdomain) = 
+#define WEBUI_CHUNK_LENGTH      64      // bytes of the web UI copied from flash per write
+
+// Web UI, gzipped in flash, browsers may keep it for a year. The headers go out
+// from flash as they are, httpSuccess would need them copied to RAM first
+//
+P(webuiHeaders) = 
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Encoding: gzip\r\n"
+    "Cache-Control: public, max-age=31536000\r\n"
+    "Content-Length: ";
+
+// Response templates, see Template.h
+//
+TEMPLATE( crossdomain, 
     "<?xml version='1.0'?>"
     "<!DOCTYPE cross-domain-policy SYSTEM 'http://www.macromedia.com/xml/dtds/cross-domain-policy.dtd'>"
     "<cross-domain-policy>"
     "<allow-access-from domain='*' />"
-    "</cross-domain-policy>";
+    "</cross-domain-policy>\n" )
 
-P(index) = "DoDuino Web API";
+TEMPLATE( channelsHead, 
+    "<?xml version='1.0'?>"
+    "<Channels>" )
 
-void getAllLightsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+TEMPLATE( channelsFoot, 
+    "</Channels>" )
+
+TEMPLATE( lightChannel, 
+    "<Channel nr='" TPL_NUMBER "'>"
+    "<Value>" TPL_NUMBER "</Value>"
+    "<SpeedFactor>" TPL_NUMBER "</SpeedFactor>"
+    "</Channel>\n" )
+
+TEMPLATE( switchChannel, 
+    "<Channel nr='" TPL_NUMBER "'>"
+    "<State>" TPL_NUMBER "</State>"
+    "</Channel>\n" )
+
+TEMPLATE( nothing, "" )
+
+TEMPLATE( jsonHead, "[" )
+TEMPLATE( jsonSeparator, "," )
+TEMPLATE( jsonFoot, "]" )
+
+TEMPLATE( jsonLight, 
+    "[" TPL_NUMBER "," TPL_NUMBER "]" )
+
+TEMPLATE( jsonSwitch, 
+    TPL_NUMBER )
+
+TEMPLATE( binaryLightsHead, 
+    "DL" TPL_BYTE )
+
+TEMPLATE( binarySwitchesHead, 
+    "DS" TPL_BYTE )
+
+TEMPLATE( binaryLight, 
+    TPL_BYTE TPL_BYTE )
+
+TEMPLATE( binarySwitch, 
+    TPL_BYTE )
+
+TEMPLATE( formatsHead, 
+    "<?xml version='1.0'?>"
+    "<Formats>" )
+
+TEMPLATE( formatsFoot, 
+    "</Formats>" )
+
+TEMPLATE( formatStats, 
+    "<Format name='" TPL_TEXT "' channels='" TPL_TEXT "'>"
+    "<Requests>" TPL_NUMBER "</Requests>"
+    "<Bytes>" TPL_NUMBER "</Bytes>"
+    "<MaxRenderTime>" TPL_NUMBER "</MaxRenderTime>"
+    "</Format>\n" )
+
+TEMPLATE( tasksHead, 
+    "<?xml version='1.0'?>"
+    "<Tasks load='" TPL_NUMBER "' requests='" TPL_NUMBER "' maxService='" TPL_NUMBER "'"
+    " lightCommands='" TPL_NUMBER "' lightCommandsApplied='" TPL_NUMBER "'>" )
+
+TEMPLATE( tasksFoot, 
+    "</Tasks>" )
+
+TEMPLATE( task, 
+    "<Task name='" TPL_TEXT "'>"
+    "<Period>" TPL_NUMBER "</Period>"
+    "<Priority>" TPL_NUMBER "</Priority>"
+    "<Misses>" TPL_NUMBER "</Misses>"
+    "<MaxRunTime>" TPL_NUMBER "</MaxRunTime>"
+    "<MaxGap>" TPL_NUMBER "</MaxGap>"
+    "<RunTimeP50>" TPL_NUMBER "</RunTimeP50>"
+    "<RunTimeP99>" TPL_NUMBER "</RunTimeP99>"
+    "</Task>\n" )
+
+TEMPLATE( profileHead, 
+    "<?xml version='1.0'?>"
+    "<Profile tolerance='" TPL_NUMBER "'>" )
+
+TEMPLATE( profileFoot, 
+    "</Profile>" )
+
+TEMPLATE( profilePoint, 
+    "<Point name='" TPL_TEXT "'>"
+    "<Runs>" TPL_NUMBER "</Runs>"
+    "<Mean>" TPL_NUMBER "</Mean>"
+    "<Max>" TPL_NUMBER "</Max>"
+    "<Baseline>" TPL_NUMBER "</Baseline>"
+    "<Status>" TPL_TEXT "</Status>"
+    "</Point>\n" )
+
+TEMPLATE( groupsHead, 
+    "<?xml version='1.0'?>"
+    "<Groups>" )
+
+TEMPLATE( groupsFoot, 
+    "</Groups>" )
+
+TEMPLATE( group, 
+    "<Group nr='" TPL_NUMBER "' name='" TPL_TEXT "'>"
+    "<On>" TPL_NUMBER "</On>"
+    "</Group>\n" )
+
+TEMPLATE( energyHead, 
+    "<?xml version='1.0'?>"
+    "<Energy>" )
+
+TEMPLATE( energyFoot, 
+    "</Energy>" )
+
+TEMPLATE( energyLight, 
+    "<Light nr='" TPL_NUMBER "'>"
+    "<OnTime>" TPL_NUMBER "</OnTime>"
+    "<Energy>" TPL_NUMBER "</Energy>"
+    "</Light>\n" )
+
+TEMPLATE( energySwitch, 
+    "<Switch nr='" TPL_NUMBER "'>"
+    "<OnTime>" TPL_NUMBER "</OnTime>"
+    "</Switch>\n" )
+
+TEMPLATE( nodesHead, 
+    "<?xml version='1.0'?>"
+    "<Nodes self='" TPL_NUMBER "'>" )
+
+TEMPLATE( nodesFoot, 
+    "</Nodes>" )
+
+TEMPLATE( clusterNode, 
+    "<Node nr='" TPL_NUMBER "'>"
+    "<Ip>" TPL_IP "</Ip>"
+    "<LastSeen>" TPL_NUMBER "</LastSeen>"
+    "</Node>\n" )
+
+TEMPLATE( clockInfo, 
+    "<?xml version='1.0'?>"
+    "<Clock>"
+    "<Time>" TPL_NUMBER "</Time>"
+    "<NextRule>" TPL_NUMBER "</NextRule>"
+    "</Clock>" )
+
+TEMPLATE( networkInfo, 
+    "<?xml version='1.0'?>"
+    "<Network>"
+    "<Ip>" TPL_IP "</Ip>"
+    "<DhcpState>" TPL_NUMBER "</DhcpState>"
+    "<FirstRequest>" TPL_NUMBER "</FirstRequest>"
+    "</Network>" )
+
+// Called by every command to keep track of the served requests
+//
+void webRequest( int command )
+{
+  web_requests++;
+  web_command_requests[ command ]++;
+  
+  if ( 0 == first_request_time )
+  {
+    first_request_time = millis();
+    
+    if ( NETWORK_SERIAL_DEBUGGING ) 
+      Serial << "First request after: [" << first_request_time << "] ms\n";
+  }
+}
+
+// Channel snapshots
+//
+// getLightChannels and getSwitchChannels answer in XML, or in JSON or binary with 
+// the suffix .json or .bin (/json, ?json work as well). Webduino only splits the
+// verb at '/' and '?', a suffixed verb reaches snapshotSuffixCmd. Every format is
+// a set of templates, sendSnapshot is the one encoder for all of them:
+//
+// - json:    lights [[value,speedFactor],...], switches [state,...], the index is the channel nr
+// - binary:  'D', 'L' or 'S', nr of channels, then per light a byte for the value and 
+//            the speed factor, per switch a byte for the state
+//
+enum SNAPSHOT_FORMAT {
+  SNAPSHOT_XML,
+  SNAPSHOT_JSON,
+  SNAPSHOT_BINARY,
+  NR_SNAPSHOT_FORMATS
+};
+
+struct Snapshot
+{
+  Template *head;                       // value: nr of channels
+  Template *channel;                    // values: nr, value / state, speed factor, from first_value on
+  Template *separator;                  // between two channels
+  Template *foot;
+  byte first_value;
+};
+
+struct SnapshotStats
+{
+  unsigned long requests;
+  unsigned long bytes;                  // of the last response
+  unsigned long render_time_max;        // worst case us, sending included
+};
+
+const char *snapshotNames[ NR_SNAPSHOT_FORMATS ] = { "xml", "json", "binary" };
+const char *snapshotTypes[ NR_SNAPSHOT_FORMATS ] = { "text/xml", "application/json", "application/octet-stream" };
+
+// Per kind of channel (CHANGE_LIGHT, CHANGE_SWITCH) and format
+//
+Snapshot snapshots[2][ NR_SNAPSHOT_FORMATS ] = {
+  {
+    { &channelsHead,       &lightChannel,  &nothing,       &channelsFoot, 0 },
+    { &jsonHead,           &jsonLight,     &jsonSeparator, &jsonFoot,     1 },
+    { &binaryLightsHead,   &binaryLight,   &nothing,       &nothing,      1 }
+  },
+  {
+    { &channelsHead,       &switchChannel, &nothing,       &channelsFoot, 0 },
+    { &jsonHead,           &jsonSwitch,    &jsonSeparator, &jsonFoot,     1 },
+    { &binarySwitchesHead, &binarySwitch,  &nothing,       &nothing,      1 }
+  }
+};
+
+SnapshotStats snapshot_stats[2][ NR_SNAPSHOT_FORMATS ];
+
+const char *snapshotSuffixes[ NR_SNAPSHOT_FORMATS ] = { "xml", "json", "bin" };
+
+int snapshotFormat( const char *url_tail )
 {
-  server.httpSuccess( "text/xml" );
+  if ( NULL != strstr( url_tail, "json" ) ) { return SNAPSHOT_JSON; }
+  if ( NULL != strstr( url_tail, "bin" ) )  { return SNAPSHOT_BINARY; }
   
-  server << 
-  "<?xml version='1.0'?>"
-  "<Channels>";
+  return SNAPSHOT_XML;
+}
+
+void snapshotValues( int kind, int i, TemplateValue *v )
+{
+  v[0].number = i;
   
-  for ( int i = 0; i <= NR_LIGHT_CHANNELS; ++i)
+  if ( CHANGE_LIGHT == kind )
   {
-    server << 
-    "<Channel nr='" << i << "'>" <<  
-    "<Value>" << getLightTargetValue( i ) << "</Value>" <<
-    "<SpeedFactor>" << getSpeedFactor( i ) << "</SpeedFactor>" <<
-    "</Channel>\n";
+    v[1].number = getLightTargetValue( i );
+    v[2].number = getSpeedFactor( i );
+  }
+  else
+  {
+    v[1].number = getSwitchTargetState( i );
+  }
+}
+
+void sendSnapshot( WebServer &server, int kind, char *url_tail )
+{
+  unsigned long start = micros();
+  
+  int format = snapshotFormat( url_tail );
+  int count  = ( CHANGE_LIGHT == kind ) ? NR_LIGHT_CHANNELS : NR_SWITCH_CHANNELS;
+  
+  Snapshot      *s     = &snapshots[kind][format];
+  SnapshotStats *stats = &snapshot_stats[kind][format];
+  
+  TemplateWriter w;
+  TemplateValue v[3];
+  
+  v[0].number = count;
+  
+  int length = templateLength( *s->head, v ) + templateLength( *s->foot, NULL );
+  
+  for ( int i = 0; i < count; ++i)
+  {
+    if ( 0 < i ) { length += templateLength( *s->separator, NULL ); }
+    
+    snapshotValues( kind, i, v );
+    length += templateLength( *s->channel, &v[ s->first_value ] );
   }
   
-  server << 
-  "</Channels>";  
+  templateSuccess( server, snapshotTypes[format], length );
+  
+  beginTemplates( w, server );
+  
+  v[0].number = count;
+  renderTemplate( w, *s->head, v );
+  
+  for ( int i = 0; i < count; ++i)
+  {
+    if ( 0 < i ) { renderTemplate( w, *s->separator, NULL ); }
+    
+    snapshotValues( kind, i, v );
+    renderTemplate( w, *s->channel, &v[ s->first_value ] );
+  }
+  
+  renderTemplate( w, *s->foot, NULL );
+  flushTemplates( w );
+  
+  stats->requests++;
+  stats->bytes = length;
+  stats->render_time_max = max( stats->render_time_max, micros() - start );
+}
+
+void getAllLightsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_LIGHTS );
+  
+  unsigned long cycles = profileStart();
+  
+  sendSnapshot( server, CHANGE_LIGHT, url_tail );
+  
+  profileStop( PROFILE_LIGHTS_SNAPSHOT, cycles );
 }
 
 void getAllSwitchesCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
 {
-  server.httpSuccess( "text/xml" );
+  webRequest( WEB_GET_SWITCHES );
+  
+  unsigned long cycles = profileStart();
+  
+  sendSnapshot( server, CHANGE_SWITCH, url_tail );
+  
+  profileStop( PROFILE_SWITCHES_SNAPSHOT, cycles );
+}
+
+// Failure command, Webduino passes the whole path of a request no command took. A
+// snapshot verb with a known suffix runs with the suffix as url tail, anything
+// else fails like before
+//
+const char *snapshotVerbs[2] = { "getLightChannels", "getSwitchChannels" };
+
+WebServer::Command *snapshotCommands[2] = { &getAllLightsCmd, &getAllSwitchesCmd };
+
+void snapshotSuffixCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  char *verb = ( '/' == *url_tail ) ? url_tail + 1 : url_tail;
+  char *dot  = strchr( verb, '.' );
+  
+  if ( NULL != dot )
+  {
+    int verb_length   = dot - verb;
+    int suffix_length = strcspn( dot + 1, "/?" );
+    
+    for ( int i = 0; i < NR_SNAPSHOT_FORMATS; i++ )
+    {
+      if ( (int)strlen( snapshotSuffixes[i] ) != suffix_length || 0 != strncmp( dot + 1, snapshotSuffixes[i], suffix_length ) ) { continue; }
+      
+      for ( int kind = 0; kind < 2; kind++ )
+      {
+        if ( (int)strlen( snapshotVerbs[kind] ) == verb_length && 0 == strncmp( verb, snapshotVerbs[kind], verb_length ) )
+        {
+          snapshotCommands[kind]( server, type, dot + 1, tail_complete );
+          return;
+        }
+      }
+    }
+  }
+  
+  server.httpFail();
+}
+
+void formatValues( int kind, int format, TemplateValue *v )
+{
+  SnapshotStats *stats = &snapshot_stats[kind][format];
+  
+  v[0].text   = snapshotNames[format];
+  v[1].text   = ( CHANGE_LIGHT == kind ) ? "lights" : "switches";
+  v[2].number = stats->requests;
+  v[3].number = stats->bytes;
+  v[4].number = stats->render_time_max;
+}
+
+// Size and render time of the snapshots per format
+//
+void getFormatsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_FORMATS );
+  
+  TemplateWriter w;
+  TemplateValue v[5];
+  
+  int length = templateLength( formatsHead, NULL ) + templateLength( formatsFoot, NULL );
+  
+  for ( int kind = 0; kind < 2; kind++ )
+  {
+    for ( int i = 0; i < NR_SNAPSHOT_FORMATS; ++i)
+    {
+      formatValues( kind, i, v );
+      length += templateLength( formatStats, v );
+    }
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  renderTemplate( w, formatsHead, NULL );
+  
+  for ( int kind = 0; kind < 2; kind++ )
+  {
+    for ( int i = 0; i < NR_SNAPSHOT_FORMATS; ++i)
+    {
+      formatValues( kind, i, v );
+      renderTemplate( w, formatStats, v );
+    }
+  }
+  
+  renderTemplate( w, formatsFoot, NULL );
+  flushTemplates( w );
+}
+
+void taskValues( int i, TemplateValue *v )
+{
+  Task *t = &tasks[i];
+  
+  v[0].text   = t->name;
+  v[1].number = t->period;
+  v[2].number = t->priority;
+  v[3].number = t->misses;
+  v[4].number = t->run_time_max;
+  v[5].number = t->gap_max;
+  v[6].number = taskCostPercentile( t, 50 );
+  v[7].number = taskCostPercentile( t, 99 );
+}
+
+void tasksHeadValues( TemplateValue *v )
+{
+  v[0].number = scheduler_load;
+  v[1].number = web_requests;
+  v[2].number = web_service_max;
+  v[3].number = light_commands_received;
+  v[4].number = light_commands_applied;
+}
+
+void getTasksCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_TASKS );
+  
+  unsigned long cycles = profileStart();
+  
+  TemplateWriter w;
+  TemplateValue v[8];
+  
+  // getTasks?reset starts the worst cases over, e.g. between two load tests
+  //
+  if ( NULL != strstr( url_tail, "reset" ) )
+  {
+    resetTasks();
+    web_service_max = 0;
+  }
+  
+  tasksHeadValues( v );
+  
+  int length = templateLength( tasksHead, v ) + templateLength( tasksFoot, NULL );
+  
+  for ( int i = 0; i < nr_tasks; ++i)
+  {
+    taskValues( i, v );
+    length += templateLength( task, v );
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  
+  tasksHeadValues( v );
+  renderTemplate( w, tasksHead, v );
+  
+  for ( int i = 0; i < nr_tasks; ++i)
+  {
+    taskValues( i, v );
+    renderTemplate( w, task, v );
+  }
+  
+  renderTemplate( w, tasksFoot, NULL );
+  flushTemplates( w );
+  
+  profileStop( PROFILE_TASKS_XML, cycles );
+}
+
+void profileValues( int i, TemplateValue *v, char *name, char *status )
+{
+  strncpy_P( name, (const char *)profileName( i ), 24 );
+  name[23] = '\0';
+  
+  strcpy_P( status, (const char *)profileStatusName( i ) );
+  
+  v[0].text   = name;
+  v[1].number = profile_points[i].runs;
+  v[2].number = profileMean( i );
+  v[3].number = profile_points[i].cycles_max;
+  v[4].number = profileBaseline( i );
+  v[5].text   = status;
+}
+
+void getProfileCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_PROFILE );
+  
+  TemplateWriter w;
+  TemplateValue v[6];
+  char name[24];
+  char status[12];
+  
+  v[0].number = PROFILE_TOLERANCE;
+  
+  int length = templateLength( profileHead, v ) + templateLength( profileFoot, NULL );
+  
+  for ( int i = 0; i < NR_PROFILE_POINTS; ++i)
+  {
+    profileValues( i, v, name, status );
+    length += templateLength( profilePoint, v );
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  
+  v[0].number = PROFILE_TOLERANCE;
+  renderTemplate( w, profileHead, v );
+  
+  for ( int i = 0; i < NR_PROFILE_POINTS; ++i)
+  {
+    profileValues( i, v, name, status );
+    renderTemplate( w, profilePoint, v );
+  }
+  
+  renderTemplate( w, profileFoot, NULL );
+  flushTemplates( w );
+}
+
+void groupValues( int i, TemplateValue *v )
+{
+  v[0].number = i;
+  v[1].text   = groups[i].name;
+  v[2].number = groupAnyOn( i ) ? 1 : 0;
+}
+
+void getGroupsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_GROUPS );
+  
+  TemplateWriter w;
+  TemplateValue v[3];
+  
+  int length = templateLength( groupsHead, NULL ) + templateLength( groupsFoot, NULL );
+  
+  for ( int i = 0; i < nr_groups; ++i)
+  {
+    groupValues( i, v );
+    length += templateLength( group, v );
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  renderTemplate( w, groupsHead, NULL );
+  
+  for ( int i = 0; i < nr_groups; ++i)
+  {
+    groupValues( i, v );
+    renderTemplate( w, group, v );
+  }
+  
+  renderTemplate( w, groupsFoot, NULL );
+  flushTemplates( w );
+}
+
+void energyLightValues( int i, TemplateValue *v )
+{
+  v[0].number = i;
+  v[1].number = l_channels[i].on_time;
+  v[2].number = l_channels[i].energy;
+}
+
+void energySwitchValues( int i, TemplateValue *v )
+{
+  v[0].number = i;
+  v[1].number = sw_channels[i].on_time;
+}
+
+// On time in seconds and energy in seconds at full output per channel
+//
+void getEnergyCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_ENERGY );
+  
+  TemplateWriter w;
+  TemplateValue v[3];
+  
+  // Count up to now, a channel that is on has not been counted since it changed
+  //
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; ++i)
+  {
+    accountLight( &l_channels[i] );
+  }
+  
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; ++i)
+  {
+    accountSwitch( &sw_channels[i] );
+  }
+  
+  int length = templateLength( energyHead, NULL ) + templateLength( energyFoot, NULL );
+  
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; ++i)
+  {
+    energyLightValues( i, v );
+    length += templateLength( energyLight, v );
+  }
+  
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; ++i)
+  {
+    energySwitchValues( i, v );
+    length += templateLength( energySwitch, v );
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  renderTemplate( w, energyHead, NULL );
   
-  server << 
-  "<?xml version='1.0'?>"
-  "<Channels>";
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; ++i)
+  {
+    energyLightValues( i, v );
+    renderTemplate( w, energyLight, v );
+  }
   
-  for ( int i = 0; i <= NR_SWITCH_CHANNELS; ++i)
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; ++i)
   {
-    server << 
-    "<Channel nr='" << i << "'>" <<  
-    "<State>" << getSwitchTargetState( i ) << "</State>" <<
-    "</Channel>\n";
+    energySwitchValues( i, v );
+    renderTemplate( w, energySwitch, v );
   }
   
-  server << 
-  "</Channels>";  
+  renderTemplate( w, energyFoot, NULL );
+  flushTemplates( w );
+}
+
+// setGroup/<group>/<value>[/<speedFactor>], group by number or name. Answers 
+// like setLightCmd: nothing, a fail for anything but a GET
+//
+void setGroupCmd( WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete )
+{
+  webRequest( WEB_SET_GROUP );
+  
+  if ( type != WebServer::GET )
+  {
+    server.httpFail();
+  }
+  else
+  {
+    int g = findGroup( url_tail );
+    char *value_loc = strchr( url_tail, '/' );
+    
+    if ( 0 <= g && NULL != value_loc )
+    {
+      char *speed_loc;
+      int value       = strtol( value_loc + 1, &speed_loc, 10 );
+      int speedFactor = ( '/' == *speed_loc ) ? atoi( speed_loc + 1 ) : 2;
+      
+      if ( 0 <= value && MAX_LIGHT_VALUE >= value )
+      {
+        setGroup( g, value, speedFactor );
+      }
+    }
+  }
+}
+
+// toggleGroup/<group>, all off when any channel is on, all back on otherwise.
+// Answers like setLightCmd
+//
+void toggleGroupCmd( WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete )
+{
+  webRequest( WEB_TOGGLE_GROUP );
+  
+  if ( type != WebServer::GET )
+  {
+    server.httpFail();
+  }
+  else
+  {
+    int g = findGroup( url_tail );
+    
+    if ( 0 <= g )
+    {
+      toggleGroup( g );
+    }
+  }
+}
+
+void nodeValues( int i, TemplateValue *v )
+{
+  ClusterNode *n = &cluster_nodes[i];
+  
+  v[0].number = i;
+  v[1].ip     = n->ip;
+  v[2].number = now - n->last_seen;
+}
+
+void getClusterNodesCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_NODES );
+  
+  TemplateWriter w;
+  TemplateValue v[3];
+  
+  v[0].number = NODE_ID;
+  
+  int length = templateLength( nodesHead, v ) + templateLength( nodesFoot, NULL );
+  
+  for ( int i = 0; i < CLUSTER_MAX_NODES; ++i)
+  {
+    if ( !cluster_nodes[i].alive ) { continue; }
+    
+    nodeValues( i, v );
+    length += templateLength( clusterNode, v );
+  }
+  
+  templateSuccess( server, "text/xml", length );
+  
+  beginTemplates( w, server );
+  
+  v[0].number = NODE_ID;
+  renderTemplate( w, nodesHead, v );
+  
+  for ( int i = 0; i < CLUSTER_MAX_NODES; ++i)
+  {
+    if ( !cluster_nodes[i].alive ) { continue; }
+    
+    nodeValues( i, v );
+    renderTemplate( w, clusterNode, v );
+  }
+  
+  renderTemplate( w, nodesFoot, NULL );
+  flushTemplates( w );
+}
+
+void sendClock( WebServer &server )
+{
+  TemplateValue v[2];
+  
+  v[0].number = clock_seconds;
+  v[1].number = next_rule_time;
+  
+  sendTemplate( server, "text/xml", clockInfo, v );
+}
+
+void getClockCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_CLOCK );
+  
+  sendClock( server );
+}
+
+void setClockCmd( WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete )
+{
+  webRequest( WEB_SET_CLOCK );
+  
+  if ( type != WebServer::GET )
+  {
+    server.httpFail();
+  }  
+  else
+  {
+    unsigned long seconds = strtoul( url_tail, NULL, 10 );
+    
+    if ( 0 < seconds )
+    {
+      setClock( seconds );
+    }
+    
+    sendClock( server );
+  }
+}
+
+void getNetworkCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
+{
+  webRequest( WEB_GET_NETWORK );
+  
+  TemplateValue v[3];
+  
+  v[0].ip     = ip;
+  v[1].number = dhcp_state;
+  v[2].number = first_request_time;
+  
+  sendTemplate( server, "text/xml", networkInfo, v );
 }
 
 void setLightCmd( WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete )
 {
+  webRequest( WEB_SET_LIGHT );
+  
   if ( type != WebServer::GET )
   {
     server.httpFail();
@@ -76,6 +858,8 @@ void setLightCmd( WebServer &server, WebServer::ConnectionType type, char *url_t
     
     boolean done = false;
     
+    unsigned long cycles = profileStart();
+    
     do
     {
       sl_loc = strchr( url_tail, '/' );
@@ -112,18 +896,22 @@ void setLightCmd( WebServer &server, WebServer::ConnectionType type, char *url_t
       part++;
     } while ( false == done && 0 != strlen( url_tail ));
     
+    profileStop( PROFILE_SET_LIGHT_URL, cycles );
+    
 //    Serial << "C: " << channel << " V: " << value << " S: " << speedFactor << "\n";
     
-    if ( 0 <= channel && 12  >= channel &&
+    if ( 0 <= channel && NR_LIGHT_CHANNELS > channel &&
          0 <= value   && 255 >= value )
     {
-      setLightTargetValue( channel, value, speedFactor );
+      commandLightValue( channel, value, speedFactor );
     }
   }
 }
 
 void setSwitchCmd( WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete )
 {
+  webRequest( WEB_SET_SWITCH );
+  
   if ( type != WebServer::GET )
   {
     server.httpFail();
@@ -145,6 +933,8 @@ void setSwitchCmd( WebServer &server, WebServer::ConnectionType type, char *url_
     
     boolean done = false;
     
+    unsigned long cycles = profileStart();
+    
     do
     {
       sl_loc = strchr( url_tail, '/' );
@@ -182,9 +972,11 @@ void setSwitchCmd( WebServer &server, WebServer::ConnectionType type, char *url_
       part++;
     } while ( false == done && 0 != strlen( url_tail ));
     
+    profileStop( PROFILE_SET_SWITCH_URL, cycles );
+    
     Serial << "C: " << channel << " S: " << state << "\n";
     
-    if ( 0 <= channel && 9  >= channel &&
+    if ( 0 <= channel && NR_SWITCH_CHANNELS > channel &&
          0 <= state  && 1 >= state &&
          0 <= start_delay && 999 >= start_delay &&
          0 <= duration && 999 >= duration
@@ -197,19 +989,30 @@ void setSwitchCmd( WebServer &server, WebServer::ConnectionType type, char *url_
 
 void defaultCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
 {   
-    server.httpSuccess( "text/html", false );    
-    server.printP(index);
+    webRequest( WEB_INDEX );
+  
+    byte chunk[WEBUI_CHUNK_LENGTH];
     
-    server << "\n";  
+    server.printP( webuiHeaders );
+    server.print( WEBUI_LENGTH );
+    server.printCRLF();
+    server.printCRLF();
+    
+    for ( int i = 0; i < WEBUI_LENGTH; i += WEBUI_CHUNK_LENGTH )
+    {
+      int length = min( WEBUI_LENGTH - i, WEBUI_CHUNK_LENGTH );
+      
+      memcpy_P( chunk, &webui[i], length );
+      server.write( chunk, length );
+    }
 }
 
 
 void crossdomainCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete)
 {      
-    server.httpSuccess( "text/xml", false );    
-    server.printP(crossdomain);
-    
-    server << "\n";
+    webRequest( WEB_CROSSDOMAIN );
+  
+    sendTemplate( server, "text/xml", crossdomain, NULL );
 }
 
 void setupWeb()
@@ -222,12 +1025,26 @@ void setupWeb()
   webserver.begin();
   
   webserver.setDefaultCommand(&defaultCmd);
+  webserver.setFailureCommand(&snapshotSuffixCmd);
 
   webserver.addCommand("getLightChannels", &getAllLightsCmd);
   webserver.addCommand("getSwitchChannels", &getAllSwitchesCmd);
+  webserver.addCommand("getTasks", &getTasksCmd);
+  webserver.addCommand("getProfile", &getProfileCmd);
+  webserver.addCommand("getClusterNodes", &getClusterNodesCmd);
+  webserver.addCommand("getClock", &getClockCmd);
+  webserver.addCommand("getNetwork", &getNetworkCmd);
   
   webserver.addCommand("setLightChannel", &setLightCmd);
   webserver.addCommand("setSwitchChannel", &setSwitchCmd);
+  webserver.addCommand("setClock", &setClockCmd);
+  
+  webserver.addCommand("getGroups", &getGroupsCmd);
+  webserver.addCommand("setGroup", &setGroupCmd);
+  webserver.addCommand("toggleGroup", &toggleGroupCmd);
+  
+  webserver.addCommand("getEnergy", &getEnergyCmd);
+  webserver.addCommand("getFormats", &getFormatsCmd);
   
   webserver.addCommand( "crossdomain.xml", &crossdomainCmd );
   
@@ -238,7 +1055,17 @@ void setupWeb()
 
 void loopWeb()
 {
+  unsigned long requests = web_requests;
+  unsigned long start = micros();
+  
   webserver.processConnection();
+  
+  // Time from reading the request to the last byte of the response
+  //
+  if ( requests != web_requests )
+  {
+    web_service_max = max( web_service_max, micros() - start );
+  }
 }
 
 
@@ -0,0 +1,534 @@
+/*
+ *  WebSocket control
+ *
+ *  webduino closes the connection after every command, so WebSockets get their own
+ *  server on WEBSOCKET_PORT. One client at a time, the W5100 only has 4 sockets.
+ *
+ *  After the upgrade all traffic is binary frames:
+ *
+ *  - client => DoDuino, one command per frame:
+ *      0, channel, value, speed factor     set light channel
+ *      1, channel, state                   set switch channel
+ *
+ *  - DoDuino => client, entries of 3 bytes, all changes of a tick in one frame
+ *    (and all channels right after the upgrade):
+ *      0, channel, value                   output of light channel
+ *      1, channel, state                   output of switch channel
+ *
+ *  Frames are parsed in place in ws_buffer. Fragmented frames and frames that don't
+ *  fit the buffer close the connection, commands are a few bytes. Ping is answered,
+ *  text frames are ignored.
+ */
+
+// ----------------------------------------------------------------- //
+
+#define WEBSOCKET_PORT          81
+#define WS_LINE_LENGTH          80      // longest request line kept during the upgrade
+#define WS_BUFFER_LENGTH        16      // longest payload of a received frame
+#define WS_HANDSHAKE_TIMEOUT    2000    // ms to complete the upgrade
+#define WS_MAX_ENTRIES          32      // entries in a single state frame
+
+#define WS_OPCODE_TEXT          0x1
+#define WS_OPCODE_BINARY        0x2
+#define WS_OPCODE_CLOSE         0x8
+#define WS_OPCODE_PING          0x9
+#define WS_OPCODE_PONG          0xA
+#define WS_FIN                  0x80
+#define WS_MASK                 0x80
+
+#define WS_LIGHT                0       // Kind of command and state entry
+#define WS_SWITCH               1
+
+enum WS_STATE {
+  WS_CLOSED,                            // no client
+  WS_HANDSHAKE,                         // reading the upgrade request
+  WS_OPEN
+};
+
+enum WS_READ_STATE {
+  WS_READ_OPCODE,
+  WS_READ_LENGTH,
+  WS_READ_MASK,
+  WS_READ_DATA
+};
+
+P( wsResponse ) =
+  "HTTP/1.1 101 Switching Protocols\r\n"
+  "Upgrade: websocket\r\n"
+  "Connection: Upgrade\r\n"
+  "Sec-WebSocket-Accept: ";
+
+P( wsGuid ) = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// ----------------------------------------------------------------- //
+
+Server wsServer( WEBSOCKET_PORT );
+Client ws_client( MAX_SOCK_NUM );
+
+enum WS_STATE ws_state = WS_CLOSED;
+unsigned long ws_connect_time = 0;
+
+// Upgrade request
+//
+char ws_line[ WS_LINE_LENGTH ];
+int  ws_line_length = 0;
+char ws_key[ 32 ];
+
+// Received frame
+//
+enum WS_READ_STATE ws_read_state = WS_READ_OPCODE;
+byte ws_opcode;
+byte ws_length;
+byte ws_received;
+byte ws_mask[4];
+byte ws_buffer[ WS_BUFFER_LENGTH ];
+
+// Channels with a changed output that still have to be sent
+//
+boolean ws_dirty_lights[   NR_LIGHT_CHANNELS  ];
+boolean ws_dirty_switches[ NR_SWITCH_CHANNELS ];
+int     ws_nr_dirty = 0;
+
+unsigned long ws_frames_received = 0;
+unsigned long ws_frames_sent     = 0;
+
+// -------------------------------------------------------- //
+
+uint32_t sha1Rotate( uint32_t x, int n )
+{
+  return ( x << n ) | ( x >> ( 32 - n ) );
+}
+
+// -------------------------------------------------------- //
+
+void sha1Block( uint32_t *h, const byte *block )
+{
+  uint32_t w[16];
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+  for ( int i = 0; i < 16; i++ )
+  {
+    w[i] = (uint32_t)block[4*i] << 24 | (uint32_t)block[4*i + 1] << 16 | (uint32_t)block[4*i + 2] << 8 | block[4*i + 3];
+  }
+
+  // The 80 words of the schedule are kept in a ring of 16
+  //
+  for ( int i = 0; i < 80; i++ )
+  {
+    if ( 16 <= i )
+    {
+      w[i & 15] = sha1Rotate( w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1 );
+    }
+
+    uint32_t f, k;
+
+    if      ( 20 > i ) { f = ( b & c ) | ( ~b & d );           k = 0x5A827999UL; }
+    else if ( 40 > i ) { f = b ^ c ^ d;                        k = 0x6ED9EBA1UL; }
+    else if ( 60 > i ) { f = ( b & c ) | ( b & d ) | ( c & d ); k = 0x8F1BBCDCUL; }
+    else               { f = b ^ c ^ d;                        k = 0xCA62C1D6UL; }
+
+    uint32_t t = sha1Rotate( a, 5 ) + f + e + k + w[i & 15];
+
+    e = d;
+    d = c;
+    c = sha1Rotate( b, 30 );
+    b = a;
+    a = t;
+  }
+
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+// -------------------------------------------------------- //
+
+// SHA1 of a short message (less than 8 kB)
+//
+void sha1( const byte *data, int length, byte *digest )
+{
+  uint32_t h[5] = { 0x67452301UL, 0xEFCDAB89UL, 0x98BADCFEUL, 0x10325476UL, 0xC3D2E1F0UL };
+  byte block[64];
+  int i = 0;
+
+  for ( ; i + 64 <= length; i += 64 )
+  {
+    sha1Block( h, &data[i] );
+  }
+
+  int rest = length - i;
+
+  memset( block, 0, 64 );
+  memcpy( block, &data[i], rest );
+  block[rest] = 0x80;
+
+  if ( 56 < rest + 1 )
+  {
+    sha1Block( h, block );
+    memset( block, 0, 64 );
+  }
+
+  block[62] = ( length * 8 ) >> 8;
+  block[63] = length * 8;
+
+  sha1Block( h, block );
+
+  for ( i = 0; i < 20; i++ )
+  {
+    digest[i] = h[i / 4] >> ( 24 - 8 * ( i % 4 ) );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void base64( const byte *data, int length, char *out )
+{
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  for ( int i = 0; i < length; i += 3 )
+  {
+    uint32_t v = (uint32_t)data[i] << 16;
+
+    if ( i + 1 < length ) { v |= (uint32_t)data[i + 1] << 8; }
+    if ( i + 2 < length ) { v |= data[i + 2]; }
+
+    *out++ = digits[ ( v >> 18 ) & 0x3F ];
+    *out++ = digits[ ( v >> 12 ) & 0x3F ];
+    *out++ = ( i + 1 < length ) ? digits[ ( v >> 6 ) & 0x3F ] : '=';
+    *out++ = ( i + 2 < length ) ? digits[ v & 0x3F ] : '=';
+  }
+
+  *out = '\0';
+}
+
+// -------------------------------------------------------- //
+
+// Change listener, remember what to send
+//
+void wsChanged( int kind, int id, int value )
+{
+  boolean *dirty = ( CHANGE_LIGHT == kind ) ? &ws_dirty_lights[id] : &ws_dirty_switches[id];
+
+  if ( !*dirty )
+  {
+    *dirty = true;
+    ws_nr_dirty++;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void wsClose()
+{
+  ws_client.stop();
+  ws_state = WS_CLOSED;
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "WebSocket closed\n";
+}
+
+// -------------------------------------------------------- //
+
+// Send a frame, payloads are always shorter than 126 bytes
+//
+void wsSend( byte opcode, const byte *data, int length )
+{
+  byte header[2] = { (byte)( WS_FIN | opcode ), (byte)length };
+
+  ws_client.write( header, 2 );
+
+  if ( 0 < length )
+  {
+    ws_client.write( data, length );
+  }
+
+  ws_frames_sent++;
+}
+
+// -------------------------------------------------------- //
+
+// Answer the upgrade request, Sec-WebSocket-Accept is the base64 of the SHA1
+// of the key followed by the GUID of the protocol
+//
+void wsAccept()
+{
+  byte text[ sizeof( ws_key ) + 36 ];
+  byte digest[20];
+  char accept[32];
+
+  int length = strlen( ws_key );
+
+  memcpy( text, ws_key, length );
+  strcpy_P( (char *)&text[length], (const char *)wsGuid );
+
+  sha1( text, length + 36, digest );
+  base64( digest, 20, accept );
+
+  char response[ sizeof( wsResponse ) ];
+
+  strcpy_P( response, (const char *)wsResponse );
+
+  ws_client.write( response );
+  ws_client.write( accept );
+  ws_client.write( "\r\n\r\n" );
+
+  ws_state      = WS_OPEN;
+  ws_read_state = WS_READ_OPCODE;
+
+  // Start with the state of all channels
+  //
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    wsChanged( CHANGE_LIGHT, i, 0 );
+  }
+
+  for ( int i = 0; i < NR_SWITCH_CHANNELS; i++ )
+  {
+    wsChanged( CHANGE_SWITCH, i, 0 );
+  }
+
+  if ( NETWORK_SERIAL_DEBUGGING )
+    Serial << "WebSocket open\n";
+}
+
+// -------------------------------------------------------- //
+
+// Read the upgrade request a line at a time, only the key is of interest
+//
+void wsHandshake()
+{
+  while ( ws_client.available() )
+  {
+    char ch = ws_client.read();
+
+    if ( '\r' == ch ) { continue; }
+
+    if ( '\n' != ch )
+    {
+      if ( WS_LINE_LENGTH - 1 > ws_line_length )
+      {
+        ws_line[ws_line_length++] = ch;
+      }
+
+      continue;
+    }
+
+    ws_line[ws_line_length] = '\0';
+
+    // Empty line ends the request
+    //
+    if ( 0 == ws_line_length )
+    {
+      if ( '\0' == ws_key[0] )
+      {
+        ws_client.write( "HTTP/1.1 400 Bad Request\r\n\r\n" );
+        wsClose();
+      }
+      else
+      {
+        wsAccept();
+      }
+
+      return;
+    }
+
+    if ( 0 == strncasecmp( ws_line, "Sec-WebSocket-Key:", 18 ) )
+    {
+      char *key = &ws_line[18];
+
+      while ( ' ' == *key ) { key++; }
+
+      strncpy( ws_key, key, sizeof( ws_key ) - 1 );
+      ws_key[ sizeof( ws_key ) - 1 ] = '\0';
+    }
+
+    ws_line_length = 0;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void wsCommand( byte *data, int length )
+{
+  if ( 3 > length ) { return; }
+
+  int channel = data[1];
+  int value   = data[2];
+
+  if ( WS_LIGHT == data[0] && NR_LIGHT_CHANNELS > channel && 4 <= length )
+  {
+    commandLightValue( channel, value, data[3] );
+  }
+  else if ( WS_SWITCH == data[0] && NR_SWITCH_CHANNELS > channel && 1 >= value )
+  {
+    setSwitchState( channel, value, 0, 0 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void wsFrame()
+{
+  ws_frames_received++;
+
+  for ( int i = 0; i < ws_length; i++ )
+  {
+    ws_buffer[i] ^= ws_mask[i & 3];
+  }
+
+  switch ( ws_opcode & 0x0F )
+  {
+    case ( WS_OPCODE_BINARY ):
+      wsCommand( ws_buffer, ws_length );
+      break;
+
+    case ( WS_OPCODE_PING ):
+      wsSend( WS_OPCODE_PONG, ws_buffer, ws_length );
+      break;
+
+    case ( WS_OPCODE_CLOSE ):
+      wsSend( WS_OPCODE_CLOSE, NULL, 0 );
+      wsClose();
+      break;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void wsReceive()
+{
+  while ( WS_OPEN == ws_state && ws_client.available() )
+  {
+    byte b = ws_client.read();
+
+    switch ( ws_read_state )
+    {
+      case ( WS_READ_OPCODE ):
+        ws_opcode     = b;
+        ws_read_state = WS_READ_LENGTH;
+
+        if ( 0 == ( b & WS_FIN ) ) { wsClose(); }
+        break;
+
+      case ( WS_READ_LENGTH ):
+        ws_length     = b & 0x7F;
+        ws_received   = 0;
+        ws_read_state = WS_READ_MASK;
+
+        // Clients always mask their frames
+        //
+        if ( 0 == ( b & WS_MASK ) || WS_BUFFER_LENGTH < ws_length ) { wsClose(); }
+        break;
+
+      case ( WS_READ_MASK ):
+        ws_mask[ws_received++] = b;
+
+        if ( 4 == ws_received )
+        {
+          ws_received   = 0;
+          ws_read_state = WS_READ_DATA;
+
+          if ( 0 < ws_length ) { break; }
+
+          wsFrame();
+          ws_read_state = WS_READ_OPCODE;
+        }
+        break;
+
+      case ( WS_READ_DATA ):
+        ws_buffer[ws_received++] = b;
+
+        if ( ws_received == ws_length )
+        {
+          wsFrame();
+          ws_read_state = WS_READ_OPCODE;
+        }
+        break;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// All changed outputs in one frame
+//
+void wsSendChanges()
+{
+  byte frame[ WS_MAX_ENTRIES * 3 ];
+  int length = 0;
+
+  for ( int i = 0; 0 < ws_nr_dirty && i < NR_LIGHT_CHANNELS && (int)sizeof( frame ) > length; i++ )
+  {
+    if ( !ws_dirty_lights[i] ) { continue; }
+
+    frame[length++] = WS_LIGHT;
+    frame[length++] = i;
+    frame[length++] = l_channels[i].light_value;
+
+    ws_dirty_lights[i] = false;
+    ws_nr_dirty--;
+  }
+
+  for ( int i = 0; 0 < ws_nr_dirty && i < NR_SWITCH_CHANNELS && (int)sizeof( frame ) > length; i++ )
+  {
+    if ( !ws_dirty_switches[i] ) { continue; }
+
+    frame[length++] = WS_SWITCH;
+    frame[length++] = i;
+    frame[length++] = sw_channels[i].state;
+
+    ws_dirty_switches[i] = false;
+    ws_nr_dirty--;
+  }
+
+  wsSend( WS_OPCODE_BINARY, frame, length );
+}
+
+// -------------------------------------------------------- //
+
+void setupWebSocket()
+{
+  wsServer.begin();
+
+  addChangeListener( &wsChanged );
+}
+
+// -------------------------------------------------------- //
+
+void loopWebSocket()
+{
+  if ( WS_CLOSED != ws_state && !ws_client.connected() )
+  {
+    wsClose();
+  }
+
+  if ( WS_CLOSED == ws_state )
+  {
+    Client client = wsServer.available();
+
+    if ( !client ) { return; }
+
+    ws_client       = client;
+    ws_state        = WS_HANDSHAKE;
+    ws_connect_time = now;
+    ws_line_length  = 0;
+    ws_key[0]       = '\0';
+  }
+
+  if ( WS_HANDSHAKE == ws_state )
+  {
+    wsHandshake();
+
+    if ( WS_HANDSHAKE == ws_state && WS_HANDSHAKE_TIMEOUT <= now - ws_connect_time )
+    {
+      wsClose();
+    }
+
+    return;
+  }
+
+  wsReceive();
+
+  if ( WS_OPEN == ws_state && 0 < ws_nr_dirty )
+  {
+    wsSendChanges();
+  }
+}
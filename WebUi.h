@@ -0,0 +1,71 @@
+// Generated by webui/embed.py from webui/index.html, do not edit
+//
+// 2118 bytes of html, 995 bytes gzipped
+//
+#define WEBUI_LENGTH  995
+
+P(webui) = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x9d,0x56,0xef,0x6f,0xdb,0x36,
+  0x10,0xfd,0xae,0xbf,0x42,0x75,0x81,0x52,0x42,0x6c,0xf9,0xc7,0xea,0x61,0x93,0x2c,
+  0x17,0x6b,0x12,0xac,0x05,0xd2,0x6d,0x58,0x83,0x61,0x43,0x90,0x0f,0x0c,0x75,0xb2,
+  0x89,0xd2,0x94,0x4a,0x52,0x8e,0x3d,0x41,0xff,0xfb,0x8e,0x94,0x14,0xcb,0x45,0xb3,
+  0x15,0xfb,0x62,0x49,0xd4,0x7b,0x8f,0x77,0xf7,0xee,0x28,0xaf,0x5e,0x5c,0xfd,0x7a,
+  0x79,0xfb,0xd7,0x6f,0xd7,0xfe,0xd6,0xec,0xc4,0xda,0x5b,0xf5,0x17,0xa0,0x19,0x5e,
+  0x76,0x60,0xa8,0xcf,0xb6,0x54,0x69,0x30,0xe9,0xa8,0x32,0xf9,0xe4,0x87,0x51,0xbf,
+  0x2c,0xe9,0x0e,0xd2,0xd1,0x9e,0xc3,0x63,0x59,0x28,0x33,0xf2,0x59,0x21,0x0d,0x48,
+  0x84,0x3d,0xf2,0xcc,0x6c,0xd3,0x0c,0xf6,0x9c,0xc1,0xc4,0x3d,0x8c,0xb9,0xe4,0x86,
+  0x53,0x31,0xd1,0x8c,0x0a,0x48,0xe7,0x56,0xc3,0x70,0x23,0x60,0x7d,0x55,0x5c,0x55,
+  0x5c,0x16,0xab,0x69,0xfb,0xe8,0xad,0xb4,0x39,0xda,0xeb,0x43,0x91,0x1d,0xeb,0x1c,
+  0x15,0x27,0x39,0xdd,0x71,0x71,0x8c,0x35,0x95,0x7a,0xa2,0x41,0xf1,0x3c,0xd9,0x51,
+  0xb5,0xe1,0x32,0x9e,0xc3,0x2e,0x79,0xa0,0xec,0xd3,0x46,0x15,0x95,0xcc,0xe2,0x97,
+  0x8b,0xc5,0x22,0x61,0x85,0x28,0x54,0xfc,0x12,0x00,0x1a,0x6f,0xbb,0x68,0x05,0x34,
+  0xff,0x1b,0xe2,0x79,0x64,0xe1,0x27,0xa6,0x3f,0xf3,0xa3,0x25,0xec,0x1a,0x2f,0xe3,
+  0xfb,0x3a,0xe3,0xba,0x14,0xf4,0x18,0xe7,0x02,0x0e,0x09,0x15,0x7c,0x23,0x27,0xdc,
+  0xc0,0x4e,0xc7,0x0c,0xf3,0x01,0xd5,0xd3,0xa2,0xef,0x2c,0xaf,0xf1,0x04,0x7d,0x00,
+  0x51,0xbb,0xc4,0xe2,0xef,0xad,0x06,0x97,0x65,0x65,0xee,0xcc,0xb1,0x84,0x54,0x51,
+  0xb9,0x81,0xfb,0xda,0x2a,0xc5,0xf3,0xc6,0xd3,0x25,0x95,0x1d,0x12,0xc9,0x89,0x81,
+  0x83,0x99,0xb8,0x0d,0x62,0xc5,0x37,0x5b,0xd3,0x78,0x0f,0x95,0x31,0x85,0xac,0x77,
+  0x5c,0xb6,0x95,0x8a,0x31,0xa8,0xa4,0xa4,0x59,0xc6,0xe5,0x26,0x8e,0x5e,0xdb,0x14,
+  0x0b,0x95,0x81,0x8a,0x67,0xdd,0xcd,0x44,0xd1,0x8c,0x57,0x3a,0x7e,0x5d,0x1e,0xce,
+  0xb2,0x5f,0x2e,0x97,0x67,0xd9,0xb7,0xc2,0x11,0x6a,0x0f,0x51,0xf0,0xe3,0xac,0x47,
+  0xcd,0x66,0x98,0xca,0x6a,0xda,0xd5,0x7b,0x35,0xed,0x1c,0xb7,0x85,0xb7,0xfe,0x2f,
+  0xd6,0x37,0x36,0x42,0x8d,0x2f,0x16,0xeb,0x95,0x06,0x66,0x78,0x21,0x7d,0x9e,0xa5,
+  0x23,0xe1,0xd6,0x47,0x6b,0xe4,0xb6,0xab,0x2d,0xfc,0xe3,0x23,0x37,0x6c,0x0b,0x5f,
+  0x21,0xe8,0xee,0xcd,0x39,0x45,0x33,0xc5,0x4b,0xb3,0xf6,0xf2,0x4a,0xb6,0xd0,0x0d,
+  0x98,0xa0,0x1a,0xe7,0x61,0xbd,0xa7,0xca,0x57,0xa9,0x84,0x47,0xff,0xcf,0x0f,0x37,
+  0xef,0x8c,0x29,0x7f,0x87,0xcf,0x15,0x68,0x13,0x84,0x89,0xc2,0x84,0x44,0x41,0xb3,
+  0xb4,0x67,0x05,0x61,0x9d,0xbf,0x7a,0x95,0x07,0x2a,0x52,0xa0,0xcb,0x42,0x6a,0x40,
+  0x4e,0xd8,0x58,0x60,0x09,0x32,0x20,0x3f,0x5f,0xdf,0x92,0x71,0x65,0x89,0x1a,0x64,
+  0x16,0x84,0xcd,0x69,0xbf,0x3d,0x15,0x01,0x1b,0x9b,0xb0,0x56,0x60,0x2a,0x25,0x7d,
+  0x16,0x61,0x04,0xd7,0x02,0x76,0x68,0xba,0x7e,0x7b,0xbc,0xa5,0x9b,0x5f,0xb0,0xc3,
+  0x03,0x13,0xde,0xcd,0xee,0x23,0xeb,0xdc,0x65,0xdb,0xe0,0x03,0x09,0xa0,0x6c,0x1b,
+  0x1c,0xfa,0x98,0x59,0x7a,0xf8,0xba,0x04,0xb9,0xdc,0x52,0x29,0x41,0x90,0x30,0xc9,
+  0x0b,0x15,0x58,0x2c,0x4f,0x67,0x09,0x5f,0xb1,0x48,0x80,0xdc,0x98,0x6d,0xc2,0x2f,
+  0x2e,0xc2,0x3c,0x60,0x77,0xfc,0xde,0x2a,0xfc,0x64,0x8c,0xe2,0x68,0x20,0x32,0xa5,
+  0x22,0xe1,0xd8,0xae,0x63,0xe4,0x96,0xf7,0x50,0xe9,0x63,0x5a,0x37,0xc9,0x29,0x06,
+  0x67,0x47,0x20,0xc7,0xfb,0xb0,0xf6,0x7c,0xdf,0x62,0x20,0xcd,0x0a,0x56,0xd9,0x18,
+  0x06,0xe1,0xbc,0x3d,0xbe,0xcf,0x02,0x22,0xc8,0x85,0x0c,0x13,0xc4,0xf1,0x3c,0x78,
+  0x01,0x8e,0xe1,0x0f,0xf1,0x4c,0x01,0x35,0xd0,0x51,0x02,0x82,0xc3,0x81,0x31,0x43,
+  0x84,0x2e,0x3a,0x6a,0xd2,0xe2,0x23,0x8e,0xd9,0xa8,0x77,0xb7,0x1f,0x6e,0x52,0xb2,
+  0x72,0xd3,0xd0,0x36,0x8b,0x8f,0x90,0x0b,0xb2,0x9a,0xb6,0x4b,0x2b,0x37,0x16,0xfe,
+  0x69,0x2c,0xfc,0x1d,0x3d,0xa4,0x8b,0xe5,0x12,0xbb,0x03,0xc7,0xc2,0x36,0x83,0xbd,
+  0x90,0x5e,0x94,0x6d,0xb9,0xc8,0x14,0xc8,0xbb,0xf9,0x3d,0xba,0xec,0xc8,0x43,0x9b,
+  0x07,0x80,0xc5,0x99,0x1f,0xa9,0xd9,0x72,0x1d,0xa1,0x9b,0x15,0x24,0xb6,0x3c,0x77,
+  0xf2,0x3e,0x9d,0xb7,0xa2,0xbe,0x6b,0x2a,0x82,0x87,0x97,0x8b,0xaf,0xb3,0x61,0xea,
+  0xc2,0xc4,0xdf,0x13,0x71,0x3c,0xd8,0xa8,0xd7,0x98,0x35,0xd8,0x47,0x4e,0xe6,0xf9,
+  0x72,0xba,0x51,0x20,0x61,0x44,0x4b,0xec,0xb6,0xec,0xd2,0x06,0x18,0x80,0x2b,0x70,
+  0xd3,0x15,0xb9,0x53,0x3b,0x8b,0x1f,0x13,0x74,0xbb,0xa6,0xfb,0xe4,0xf9,0xac,0xf6,
+  0x8d,0x37,0xe8,0x34,0xfd,0x88,0x16,0xeb,0x6f,0xb1,0x58,0xff,0x7f,0x8b,0xf5,0xbf,
+  0x5a,0xdc,0x0e,0xf8,0x17,0x1e,0xb7,0xc7,0x0c,0x7a,0xd9,0xdd,0x3c,0xe3,0x26,0x13,
+  0x9c,0x7d,0x1a,0xba,0xd9,0xfb,0xd2,0x8a,0x7e,0x69,0x4c,0xe0,0x9c,0x61,0x82,0x6a,
+  0x6d,0x07,0xe8,0xcd,0x2c,0x9e,0x87,0xf8,0x62,0x36,0x9d,0x91,0x71,0x59,0x08,0xf1,
+  0x9f,0xc6,0xf4,0x47,0xce,0xb3,0xd6,0x9c,0x07,0xf8,0xb4,0x53,0xaa,0xd3,0x94,0xcc,
+  0xc9,0x1b,0x52,0x48,0x12,0x13,0x92,0x9c,0xc3,0x86,0xf6,0x9c,0x01,0x8b,0x3c,0xc7,
+  0xc4,0x07,0x76,0xd9,0x20,0x03,0x57,0x7b,0x97,0xe8,0xe6,0xbc,0x01,0x35,0x39,0xf5,
+  0xdb,0x01,0x3b,0xa3,0x3b,0x45,0xfa,0x25,0x39,0x66,0x61,0xfd,0x34,0xd6,0xee,0x94,
+  0x22,0x7f,0xd8,0x7e,0x21,0x61,0x88,0x3d,0xe9,0x72,0xe8,0x65,0xcf,0xea,0xf7,0x2d,
+  0xba,0xae,0x91,0x3a,0xd1,0x8f,0x06,0x3b,0xe1,0x49,0xb4,0xf1,0xda,0xa8,0x13,0xb4,
+  0xe5,0xbd,0xfd,0xee,0x59,0x94,0x5d,0x1a,0x2f,0xf1,0x5b,0x81,0x00,0x1c,0xd8,0xee,
+  0xcc,0x46,0xbb,0xdb,0xcf,0xc4,0xb4,0xfd,0xbb,0xf0,0x0f,0x71,0xeb,0x4b,0x30,0x46,
+  0x08,0x00,0x00
+};
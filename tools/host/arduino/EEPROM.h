@@ -0,0 +1,19 @@
+/*
+ *  EEPROM in RAM, erased (0xFF) at start like a new board
+ */
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+class EEPROMClass
+{
+  public:
+    uint8_t read( int address );
+    void write( int address, uint8_t value );
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ *  Ethernet library of Arduino 0022 on top of the socket table of the host W5100
+ *
+ *  Servers take a socket like on the chip and see the connections the harness
+ *  opens with hal_tcp_open, except the web server, it is reached through
+ *  hal_web_request instead. A Client on a socket the sketch connected talks to
+ *  the harness, see hal_tcp_accept.
+ */
+
+#ifndef Ethernet_h
+#define Ethernet_h
+
+#include "WProgram.h"
+
+#define MAX_SOCK_NUM 4
+
+typedef uint8_t SOCKET;
+
+class Client : public Print
+{
+  public:
+    Client( uint8_t sock );
+    Client( uint8_t *ip, uint16_t port );
+
+    uint8_t status();
+    uint8_t connect();
+    virtual void write( uint8_t );
+    virtual void write( const char *str );
+    virtual void write( const uint8_t *buf, size_t size );
+    int available();
+    int read();
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+
+  private:
+    uint8_t _sock;
+    uint16_t _port;
+};
+
+class Server : public Print
+{
+  public:
+    Server( uint16_t port );
+
+    Client available();
+    void begin();
+    virtual void write( uint8_t );
+
+  private:
+    uint16_t _port;
+};
+
+class EthernetClass
+{
+  public:
+    void begin( uint8_t *mac, uint8_t *ip );
+    void begin( uint8_t *mac, uint8_t *ip, uint8_t *gateway );
+    void begin( uint8_t *mac, uint8_t *ip, uint8_t *gateway, uint8_t *subnet );
+};
+
+extern EthernetClass Ethernet;
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ *  Stand-in for the Arduino core on the host, see tools/host/hal.cpp
+ *
+ *  Only what the sketch uses. Time, pins and the network are driven by the
+ *  harness through hal.h instead of hardware.
+ */
+
+#ifndef WProgram_h
+#define WProgram_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "avr/pgmspace.h"
+#include "avr/io.h"
+#include "avr/interrupt.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+#define NOT_ON_TIMER 0
+#define TIMER0A 1
+#define TIMER0B 2
+#define TIMER1A 3
+#define TIMER1B 4
+#define TIMER2  5
+#define TIMER2A 6
+#define TIMER2B 7
+#define TIMER3A 8
+#define TIMER3B 9
+#define TIMER3C 10
+#define TIMER4A 11
+#define TIMER4B 12
+#define TIMER4C 13
+#define TIMER5A 15
+#define TIMER5B 16
+#define TIMER5C 17
+
+#define NOT_A_PORT 0
+
+uint8_t digitalPinToPort( int pin );
+uint8_t digitalPinToBitMask( int pin );
+uint8_t digitalPinToTimer( int pin );
+volatile uint8_t *portOutputRegister( uint8_t port );
+
+unsigned long millis();
+unsigned long micros();
+void delay( unsigned long ms );
+void delayMicroseconds( unsigned int us );
+
+void pinMode( int pin, int mode );
+int  digitalRead( int pin );
+void digitalWrite( int pin, int value );
+void analogWrite( int pin, int value );
+int  analogRead( int pin );
+long map( long x, long in_min, long in_max, long out_min, long out_max );
+
+char *itoa( int value, char *s, int base );
+char *ltoa( long value, char *s, int base );
+char *ultoa( unsigned long value, char *s, int base );
+
+class Print
+{
+  public:
+    virtual void write( uint8_t ) = 0;
+    virtual void write( const char *str );
+    virtual void write( const uint8_t *buffer, size_t size );
+
+    void print( const char[] );
+    void print( char, int = 0 );
+    void print( unsigned char, int = 0 );
+    void print( int, int = DEC );
+    void print( unsigned int, int = DEC );
+    void print( long, int = DEC );
+    void print( unsigned long, int = DEC );
+    void print( double, int = 2 );
+
+    void println( const char[] );
+    void println( int, int = DEC );
+    void println();
+};
+
+class HardwareSerial : public Print
+{
+  public:
+    void begin( long );
+    int available();
+    int read();
+    void flush();
+    virtual void write( uint8_t );
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// The sketch has a global named index, which clashes with the one of strings.h
+//
+#define index doduino_index
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ *  Webduino interface on the host
+ *
+ *  processConnection serves the requests queued with hal_web_request, one per
+ *  call like a single client would, and keeps the response for the harness.
+ *
+ *  Like Webduino only WEBDUINO_COMMANDS_COUNT commands are kept, 8 unless the
+ *  sketch defines it before the include, and addCommand drops the rest. The
+ *  constructor is inline so it takes the count of the sketch, hal.o keeps room
+ *  for HAL_COMMANDS_COUNT.
+ */
+
+#ifndef WEBDUINO_H_
+#define WEBDUINO_H_
+
+#include "Ethernet.h"
+
+#define P( name ) static const prog_uchar name[] PROGMEM
+
+#ifndef WEBDUINO_COMMANDS_COUNT
+#define WEBDUINO_COMMANDS_COUNT 8
+#endif
+
+#define HAL_COMMANDS_COUNT      32
+
+class WebServer : public Print
+{
+  public:
+    enum ConnectionType { INVALID, GET, HEAD, POST };
+
+    typedef void Command( WebServer &server, ConnectionType type, char *url_tail, bool tail_complete );
+
+    WebServer( const char *urlPrefix = "/", int port = 80 ) :
+      m_server( port ), m_urlPrefix( urlPrefix ), m_defaultCmd( 0 ), m_failureCmd( 0 ),
+      m_cmdCount( 0 ), m_cmdLimit( min( WEBDUINO_COMMANDS_COUNT, HAL_COMMANDS_COUNT ) )
+    {
+    }
+
+    void begin();
+    void processConnection();
+    void processConnection( char *buff, int *bufflen );
+
+    void setDefaultCommand( Command *cmd );
+    void setFailureCommand( Command *cmd );
+    void addCommand( const char *verb, Command *cmd );
+
+    void printP( const prog_uchar *str );
+    void printCRLF();
+
+    virtual void write( uint8_t );
+    virtual void write( const char *str );
+    virtual void write( const uint8_t *buf, size_t size );
+
+    void httpFail();
+    void httpSuccess( const char *contentType = "text/html; charset=utf-8", const char *extraHeaders = 0 );
+    void httpSuccess( const char *contentType, bool noExtraHeaders );
+
+  private:
+    Server m_server;
+    const char *m_urlPrefix;
+    Command *m_defaultCmd;
+    Command *m_failureCmd;
+    const char *m_verbs[ HAL_COMMANDS_COUNT ];
+    Command *m_commands[ HAL_COMMANDS_COUNT ];
+    int m_cmdCount;
+    int m_cmdLimit;
+};
+
+#endif
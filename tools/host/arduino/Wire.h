@@ -0,0 +1,24 @@
+/*
+ *  I2C without a bus, transmissions are kept for the harness and acknowledged
+ */
+
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include <stdint.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire
+{
+  public:
+    void begin();
+    void beginTransmission( uint8_t address );
+    uint8_t endTransmission();
+    void send( uint8_t data );
+    void send( uint8_t *data, uint8_t length );
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ *  No interrupts on the host, the handlers are plain functions the harness may call.
+ *  Those of the UART1 transmitter are called by hal.cpp as the clock moves, the
+ *  Timer5 overflow when SREG is read
+ */
+
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#define ISR( vector ) extern "C" void vector( void )
+
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ *  Registers of the ATmega1280/2560 the sketch touches, plain variables on the host
+ */
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#define F_CPU   16000000UL
+#define RAMEND  0x21FF
+#define E2END   0xFFF
+
+#define _BV(b) (1 << (b))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+
+// Reading SREG lets a pending Timer5 overflow interrupt run first, see hal.cpp
+//
+struct HalSreg
+{
+  uint8_t value;
+
+  operator uint8_t() volatile;
+  void operator=( uint8_t v ) volatile { value = v; }
+};
+
+extern volatile HalSreg SREG;
+
+extern volatile uint8_t  ADMUX, ADCSRA, ADCSRB, DIDR0, DIDR2, ADCL, ADCH;
+extern volatile uint16_t ADC;
+
+extern volatile uint8_t  UCSR1A, UCSR1B, UCSR1C, UBRR1H, UBRR1L;
+extern volatile uint16_t UBRR1;
+
+// A byte written to UDR1 goes to the transmitter of UART1 in hal.cpp
+//
+struct HalUdr { void operator=( uint8_t data ) volatile; };
+
+extern volatile HalUdr UDR1;
+
+// Timer5 counts host ns at prescaler 1, for the profile of Profile.h
+//
+struct HalTcnt
+{
+  operator uint16_t() volatile;
+  void operator=( uint16_t count ) volatile;
+};
+
+extern volatile uint8_t  TCCR5A, TCCR5B, TIFR5, TIMSK5;
+extern volatile HalTcnt  TCNT5;
+
+extern volatile uint8_t  OCR0A, OCR0B, OCR2A, OCR2B;
+extern volatile uint16_t OCR1A, OCR1B, OCR3A, OCR3B, OCR3C, OCR4A, OCR4B, OCR4C, OCR5A, OCR5B, OCR5C;
+
+#define REFS0   6
+#define ADLAR   5
+#define MUX5    3
+#define ADEN    7
+#define ADSC    6
+#define ADATE   5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+
+#define U2X1    1
+#define TXC1    6
+#define UDRE1   5
+#define RXEN1   4
+#define TXEN1   3
+#define TXCIE1  6
+#define UDRIE1  5
+#define UCSZ11  2
+#define UCSZ10  1
+#define USBS1   3
+
+#define CS50    0
+#define TOV5    0
+#define TOIE5   0
+
+#endif
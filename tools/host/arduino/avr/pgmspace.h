@@ -0,0 +1,28 @@
+/*
+ *  Flash and RAM are one address space on the host
+ */
+
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR( s ) ( s )
+
+typedef unsigned char prog_uchar;
+typedef char prog_char;
+
+#define pgm_read_byte( p )  ( *(const uint8_t *)( p ) )
+#define pgm_read_word( p )  ( *(const uint16_t *)( p ) )
+#define pgm_read_dword( p ) ( *(const uint32_t *)( p ) )
+
+#define memcpy_P  memcpy
+#define strlen_P  strlen
+#define strcmp_P  strcmp
+#define strncmp_P strncmp
+#define strcpy_P  strcpy
+#define strncpy_P( d, s, n ) strncpy( d, (const char *)( s ), n )
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ *  Socket API of the Ethernet library, datagrams sent are kept for the harness,
+ *  connects wait for it
+ */
+
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+#include "w5100.h"
+
+typedef uint8_t SOCKET;
+
+uint8_t socket( SOCKET s, uint8_t protocol, uint16_t port, uint8_t flag );
+void close( SOCKET s );
+uint8_t connect( SOCKET s, uint8_t *addr, uint16_t port );
+uint16_t sendto( SOCKET s, const uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port );
+uint16_t recvfrom( SOCKET s, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port );
+
+#endif
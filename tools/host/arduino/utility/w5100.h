@@ -0,0 +1,57 @@
+/*
+ *  Socket registers of the W5100, a table of 4 sockets on the host
+ */
+
+#ifndef W5100_H_INCLUDED
+#define W5100_H_INCLUDED
+
+#include <stdint.h>
+
+class SnMR
+{
+  public:
+    static const uint8_t CLOSE  = 0x00;
+    static const uint8_t TCP    = 0x01;
+    static const uint8_t UDP    = 0x02;
+    static const uint8_t MULTI  = 0x80;
+};
+
+class SnSR
+{
+  public:
+    static const uint8_t CLOSED      = 0x00;
+    static const uint8_t INIT        = 0x13;
+    static const uint8_t LISTEN      = 0x14;
+    static const uint8_t SYNSENT     = 0x15;
+    static const uint8_t ESTABLISHED = 0x17;
+    static const uint8_t CLOSE_WAIT  = 0x1C;
+    static const uint8_t UDP         = 0x22;
+};
+
+enum SockCMD {
+  Sock_OPEN   = 0x01,
+  Sock_LISTEN = 0x02,
+  Sock_CLOSE  = 0x10,
+  Sock_SEND   = 0x20,
+  Sock_RECV   = 0x40
+};
+
+class W5100Class
+{
+  public:
+    void recv_data_processing( uint8_t s, uint8_t *data, uint16_t len, uint8_t peek = 0 );
+    uint16_t readSnRX_RD( uint8_t s );
+    void writeSnRX_RD( uint8_t s, uint16_t value );
+    void execCmdSn( uint8_t s, SockCMD cmd );
+    uint8_t readSnSR( uint8_t s );
+    uint16_t getRXReceivedSize( uint8_t s );
+
+    void setIPAddress( uint8_t *addr );
+    void getIPAddress( uint8_t *addr );
+    void setSubnetMask( uint8_t *addr );
+    void setGatewayIp( uint8_t *addr );
+};
+
+extern W5100Class W5100;
+
+#endif
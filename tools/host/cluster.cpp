@@ -0,0 +1,521 @@
+/*
+ *  Cluster of DoDuinos over the loopback, latency from a button to the output
+ *  on another node
+ *
+ *    build/node0/cluster [-p port] [-r presses] build/node1/cluster build/node2/cluster ...
+ *
+ *  Every node is the sketch in a process of its own, built with its NODE_ID and
+ *  one remote light and switch channel (see CLUSTER_FLAGS in the Makefile).
+ *  Node 0 starts the other nodes. Each node has a UDP socket on 127.0.0.1 at
+ *  port + NODE_ID: the cluster datagrams the sketch broadcasts are sent to the
+ *  sockets of all other nodes, what arrives on its own is delivered to the
+ *  sketch. The virtual clock follows the host clock, so the latency includes
+ *  the task periods, the loopback and the host scheduling the processes. The
+ *  clock starts at CLUSTER_HELLO_TIME for the first hello to go out right away.
+ *
+ *  The nodes:
+ *
+ *  - node 0:   button 0 on its remote light, button 1 on its remote switch,
+ *              both channel of node 1. Presses them in turn, every press
+ *              toggles the channel.
+ *  - node 1:   owns the light channel 0 and switch channel 2 the others point to
+ *  - node 2+:  remote channels on the same channels of node 1, follow its state
+ *
+ *  Every node but 0 reports the output it watches to node 0 when it changes: the
+ *  pins of the channels on node 1, the remote channels on the others. A press
+ *  counts from the press of the button on node 0 until the first report of the
+ *  change of a node, with the host clock all processes share.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - all nodes see each other
+ *  - every press reaches every node within SETTLE_TIMEOUT and they end up
+ *    with the value node 0 has
+ *  - a group toggle of both remote channels on node 0 goes out in one datagram
+ *  - the invariants of checkGesture in Dimmer.h hold on node 0
+ *
+ *  Per node the latency of lights and switches is printed, p50, p99 and max.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <algorithm>
+#include <chrono>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define PORT                    48266   // of node 0, the others follow
+#define PRESSES                 20
+#define HOLD_TIME               60      // ms a button is held
+#define QUIET_TIME              ( PULSE_TIME + 150 )    // ms between a release and the next press, no double taps
+#define SETTLE_TIMEOUT          2000    // ms for a press to reach all nodes
+#define JOIN_TIMEOUT            3000    // ms for the nodes to see each other
+#define RUN_TIMEOUT             120000  // ms a node waits for the quit of node 0
+
+#define OWNER                   1       // node of the channels
+#define OWNER_LIGHT             0
+#define OWNER_SWITCH            2       // a toggle switch on node 1
+
+#define REMOTE_LIGHT            NR_PWM_LIGHT_CHANNELS
+#define REMOTE_SWITCH           NR_RELAY_SWITCH_CHANNELS
+
+#define REPORT                  'R'     // harness datagrams, next to the 'D' of the cluster
+#define QUIT                    'Q'
+
+enum KIND { KIND_LIGHT, KIND_SWITCH, NR_KINDS };
+
+const char *kindNames[ NR_KINDS ] = { "light", "switch" };
+
+// Output a node watches, the last one reported and when
+//
+struct Watch
+{
+  int value;
+  unsigned long long time;              // us of the host clock
+};
+
+int nr_nodes = 1;
+int port     = PORT;
+int presses  = PRESSES;
+int fd;
+
+unsigned long long start;
+boolean quit = false;
+
+Watch watches[ CLUSTER_MAX_NODES ][ NR_KINDS ];         // node 0: reported by every node, others: its own
+
+unsigned long latencies[ CLUSTER_MAX_NODES ][ NR_KINDS ][ PRESSES ];
+int nr_latencies[ CLUSTER_MAX_NODES ][ NR_KINDS ];
+
+int setUpdates = 0;                     // update datagrams with set entries sent by node 0
+int setEntries = 0;                     // set entries in them
+
+unsigned long failures = 0;
+
+// -------------------------------------------------------- //
+
+unsigned long long hostMicros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void fail( const char *rule, int node, int press )
+{
+  failures++;
+
+  printf( "FAIL %s: node %d, press %d\n", rule, node, press );
+}
+
+void sendNode( int node, const byte *data, int length )
+{
+  struct sockaddr_in to;
+
+  memset( &to, 0, sizeof( to ) );
+  to.sin_family      = AF_INET;
+  to.sin_port        = htons( port + node );
+  to.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  sendto( fd, data, length, 0, (struct sockaddr *)&to, sizeof( to ) );
+}
+
+// -------------------------------------------------------- //
+
+// Cluster datagrams of the sketch to all other nodes
+//
+void forward()
+{
+  HalDatagram d;
+
+  while ( hal_udp_sent( &d ) )
+  {
+    if ( CLUSTER_PORT != d.port ) { continue; }
+
+    int sets = 0;
+
+    for ( int i = 0; CLUSTER_UPDATE == d.data[1] && i < d.data[3]; i++ )
+    {
+      if ( CLUSTER_STATE_LIGHT > d.data[ CLUSTER_HEADER_LENGTH + i * CLUSTER_ENTRY_LENGTH ] ) sets++;
+    }
+
+    if ( 0 < sets )
+    {
+      setUpdates++;
+      setEntries += sets;
+    }
+
+    for ( int n = 0; n < nr_nodes; n++ )
+    {
+      if ( NODE_ID != n ) sendNode( n, d.data, d.length );
+    }
+  }
+}
+
+// Datagrams of the other nodes, cluster ones go to the sketch from the address
+// of their node
+//
+void receive( int timeout )
+{
+  byte buf[ HAL_DATAGRAM_LENGTH ];
+  struct pollfd p = { fd, POLLIN, 0 };
+
+  if ( 0 >= poll( &p, 1, timeout ) ) { return; }
+
+  ssize_t n;
+
+  while ( 0 < ( n = recv( fd, buf, sizeof( buf ), MSG_DONTWAIT ) ) )
+  {
+    if ( CLUSTER_MAGIC == buf[0] && CLUSTER_HEADER_LENGTH <= n )
+    {
+      byte from[4] = { 192, 168, 0, (byte)( 10 + buf[2] ) };
+
+      hal_udp_deliver( CLUSTER_PORT, from, CLUSTER_PORT, buf, n );
+    }
+    else if ( REPORT == buf[0] && 4 + sizeof( unsigned long long ) <= (size_t)n && CLUSTER_MAX_NODES > buf[1] && NR_KINDS > buf[2] )
+    {
+      Watch *w = &watches[ buf[1] ][ buf[2] ];
+
+      w->value = buf[3];
+      memcpy( &w->time, &buf[4], sizeof( w->time ) );
+    }
+    else if ( QUIT == buf[0] )
+    {
+      quit = true;
+    }
+  }
+}
+
+// Report a change of the outputs this node watches to node 0
+//
+void report()
+{
+  int values[ NR_KINDS ];
+
+  if ( OWNER == NODE_ID )
+  {
+    values[ KIND_LIGHT ]  = hal_pwm( lightPins[ OWNER_LIGHT ] );
+    values[ KIND_SWITCH ] = hal_output( switchPins[ OWNER_SWITCH ] );
+  }
+  else
+  {
+    values[ KIND_LIGHT ]  = l_channels[ REMOTE_LIGHT ].light_value;
+    values[ KIND_SWITCH ] = sw_channels[ REMOTE_SWITCH ].state;
+  }
+
+  for ( int k = 0; k < NR_KINDS; k++ )
+  {
+    if ( values[k] == watches[ NODE_ID ][k].value ) { continue; }
+
+    unsigned long long time = hostMicros();
+    byte buf[ 4 + sizeof( time ) ] = { REPORT, NODE_ID, (byte)k, (byte)values[k] };
+
+    memcpy( &buf[4], &time, sizeof( time ) );
+    sendNode( 0, buf, sizeof( buf ) );
+
+    watches[ NODE_ID ][k].value = values[k];
+  }
+}
+
+// One run of the sketch on the host clock, the datagrams it sent go out, the
+// ones that arrived in the meantime are delivered
+//
+void step()
+{
+  hal_set_micros( hostMicros() - start + CLUSTER_HELLO_TIME * 1000UL );
+
+  loop();
+  forward();
+
+  if ( 0 != NODE_ID ) report();
+
+  receive( 1 );
+}
+
+void run( unsigned long ms )
+{
+  unsigned long long end = hostMicros() + ms * 1000;
+
+  while ( hostMicros() < end ) step();
+}
+
+// -------------------------------------------------------- //
+
+// The remote channels of node 0 on the buttons, the ones of the others only
+// follow node 1
+//
+void setupNode()
+{
+  remoteLights[0]   = CLUSTER_ADDRESS( OWNER, OWNER_LIGHT );
+  remoteSwitches[0] = CLUSTER_ADDRESS( OWNER, OWNER_SWITCH );
+
+  setup();
+
+  for ( int k = 0; k < NR_KINDS; k++ )
+  {
+    watches[ NODE_ID ][k].value = -1;
+  }
+
+  if ( 0 != NODE_ID ) { return; }
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    buttons[i].nr_l_channels  = 0;
+    buttons[i].nr_sw_channels = 0;
+  }
+
+  buttons[ KIND_LIGHT ].nr_l_channels = 1;
+  buttons[ KIND_LIGHT ].l_channels[0] = &l_channels[ REMOTE_LIGHT ];
+  l_channels[ REMOTE_LIGHT ].button     = &buttons[ KIND_LIGHT ];
+  l_channels[ REMOTE_LIGHT ].has_button = true;
+
+  buttons[ KIND_SWITCH ].nr_sw_channels = 1;
+  buttons[ KIND_SWITCH ].sw_channels[0] = &sw_channels[ REMOTE_SWITCH ];
+  sw_channels[ REMOTE_SWITCH ].button      = &buttons[ KIND_SWITCH ];
+  sw_channels[ REMOTE_SWITCH ].has_button  = true;
+  sw_channels[ REMOTE_SWITCH ].switch_type = SWITCH_TYPE_TOGGLE;
+
+  // A light that was on before, the first tap brings it back
+  //
+  l_channels[ REMOTE_LIGHT ].last_light_value = 200;
+}
+
+// -------------------------------------------------------- //
+
+// Wait until every node reports value, the latency of each is from the press
+// to its first report after it
+//
+boolean settle( int kind, int value, unsigned long long pressed, int press )
+{
+  boolean counted[ CLUSTER_MAX_NODES ] = { false };
+  unsigned long long end = hostMicros() + SETTLE_TIMEOUT * 1000UL;
+  int left = nr_nodes - 1;
+
+  while ( 0 < left && hostMicros() < end )
+  {
+    step();
+
+    for ( int n = 1; n < nr_nodes; n++ )
+    {
+      Watch *w = &watches[n][kind];
+
+      if ( counted[n] || w->time < pressed || w->value != value ) { continue; }
+
+      counted[n] = true;
+      left--;
+    }
+  }
+
+  for ( int n = 1; n < nr_nodes; n++ )
+  {
+    if ( !counted[n] ) { fail( "press reaches the node", n, press ); }
+  }
+
+  return 0 == left;
+}
+
+void pressAll()
+{
+  unsigned long long first[ CLUSTER_MAX_NODES ];
+
+  for ( int p = 0; p < presses; p++ )
+  {
+    int kind = p % NR_KINDS;
+    int button = kind;
+
+    for ( int n = 1; n < nr_nodes; n++ ) first[n] = watches[n][kind].time;
+
+    unsigned long long pressed = hostMicros();
+
+    hal_set_pin( buttonPins[ button ], HIGH );
+    run( HOLD_TIME );
+    hal_set_pin( buttonPins[ button ], LOW );
+
+    int value = ( KIND_LIGHT == kind ) ? l_channels[ REMOTE_LIGHT ].light_value : sw_channels[ REMOTE_SWITCH ].state;
+
+    settle( kind, value, pressed, p );
+
+    // The first report of every node since the press, a light may have
+    // taken a step or two on the owner before it reached the value
+    //
+    for ( int n = 1; n < nr_nodes; n++ )
+    {
+      if ( watches[n][kind].time != first[n] )
+      {
+        latencies[n][kind][ nr_latencies[n][kind]++ ] = watches[n][kind].time - pressed;
+      }
+    }
+
+    run( QUIET_TIME );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Both remote channels in a group, one toggle goes out as one update. The state
+// of the local channels that follow (the floor led) may come in one of its own
+//
+void groupFanOut()
+{
+  int group = addGroup( "remote" );
+
+  groupAddLight( group, REMOTE_LIGHT );
+  groupAddSwitch( group, REMOTE_SWITCH );
+
+  run( QUIET_TIME );
+
+  setUpdates = setEntries = 0;
+
+  toggleGroup( group );
+  run( QUIET_TIME );
+
+  if ( 1 != setUpdates || 2 != setEntries )
+  {
+    printf( "FAIL group toggle in one datagram: %d datagrams, %d set entries\n", setUpdates, setEntries );
+    failures++;
+  }
+}
+
+void printLatencies()
+{
+  printf( "node  kind     presses  p50 ms  p99 ms  max ms\n" );
+
+  for ( int n = 1; n < nr_nodes; n++ )
+  {
+    for ( int k = 0; k < NR_KINDS; k++ )
+    {
+      unsigned long *l = latencies[n][k];
+      int count = nr_latencies[n][k];
+
+      if ( 0 == count ) { continue; }
+
+      std::sort( l, l + count );
+
+      printf( "%-4d  %-7s  %7d  %6.1f  %6.1f  %6.1f\n", n, kindNames[k], count,
+              l[ count / 2 ] / 1000.0, l[ ( count * 99 ) / 100 ] / 1000.0, l[ count - 1 ] / 1000.0 );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Start the other nodes, each gets the nr of nodes and the port
+//
+boolean startNodes( char **paths, pid_t *pids )
+{
+  char nodes[ 16 ], ports[ 16 ];
+
+  snprintf( nodes, sizeof( nodes ), "%d", nr_nodes );
+  snprintf( ports, sizeof( ports ), "%d", port );
+
+  fflush( stdout );
+
+  for ( int n = 1; n < nr_nodes; n++ )
+  {
+    pids[n] = fork();
+
+    if ( 0 > pids[n] ) { perror( "fork" ); return false; }
+
+    if ( 0 == pids[n] )
+    {
+      execl( paths[ n - 1 ], paths[ n - 1 ], "-n", nodes, "-p", ports, (char *)NULL );
+      perror( paths[ n - 1 ] );
+      _exit( 2 );
+    }
+  }
+
+  return true;
+}
+
+int main( int argc, char **argv )
+{
+  char *paths[ CLUSTER_MAX_NODES ];
+  pid_t pids[ CLUSTER_MAX_NODES ];
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if      ( 0 == strcmp( argv[i], "-n" ) && i + 1 < argc ) nr_nodes = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-p" ) && i + 1 < argc ) port = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-r" ) && i + 1 < argc ) presses = atoi( argv[++i] );
+    else if ( 0 == NODE_ID && '-' != argv[i][0] && CLUSTER_MAX_NODES > nr_nodes ) paths[ nr_nodes++ - 1 ] = argv[i];
+    else
+    {
+      printf( "usage: %s [-p port] [-r presses] <nodes 1 ..>\n", argv[0] );
+      return 2;
+    }
+  }
+
+  presses = constrain( presses, 1, PRESSES );
+
+  if ( 0 == NODE_ID && OWNER >= nr_nodes )
+  {
+    printf( "node 0 needs node %d at least\n", OWNER );
+    return 2;
+  }
+
+  struct sockaddr_in addr;
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( port + NODE_ID );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  fd = socket( AF_INET, SOCK_DGRAM, 0 );
+
+  if ( 0 > fd || 0 != bind( fd, (struct sockaddr *)&addr, sizeof( addr ) ) ) { perror( "bind" ); return 2; }
+
+  start = hostMicros();
+
+  setupNode();
+
+  // The other nodes follow node 0 until it says quit
+  //
+  if ( 0 != NODE_ID )
+  {
+    unsigned long long end = start + RUN_TIMEOUT * 1000ULL;
+
+    while ( !quit && hostMicros() < end ) step();
+
+    return quit ? 0 : 1;
+  }
+
+  if ( !startNodes( paths, pids ) ) { return 2; }
+
+  unsigned long long end = hostMicros() + JOIN_TIMEOUT * 1000UL;
+
+  while ( nr_nodes - 1 > cluster_nodes_alive && hostMicros() < end ) step();
+
+  if ( nr_nodes - 1 > cluster_nodes_alive ) { fail( "nodes see each other", cluster_nodes_alive, 0 ); }
+  else
+  {
+    pressAll();
+    groupFanOut();
+  }
+
+  byte bye = QUIT;
+
+  for ( int n = 1; n < nr_nodes; n++ )
+  {
+    int status;
+
+    sendNode( n, &bye, 1 );
+    waitpid( pids[n], &status, 0 );
+
+    if ( !WIFEXITED( status ) || 0 != WEXITSTATUS( status ) ) { fail( "node ends", n, 0 ); }
+  }
+
+  if ( 0 != invariant_violations ) { fail( "gesture invariants", 0, invariant_violations ); }
+
+  printLatencies();
+
+  printf( "%d nodes, %d presses, %lu failures\n", nr_nodes, presses, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
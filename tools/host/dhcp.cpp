@@ -0,0 +1,400 @@
+/*
+ *  DHCP client of Network.h against a stand-in server
+ *
+ *    build/dhcp
+ *
+ *  The sketch runs setup() and its tasks, the virtual clock moves a ms per run
+ *  of loop(). The harness plays the server: it takes the datagrams the sketch
+ *  broadcasts to port 67 and answers on port 68 when the scenario says so.
+ *  A reboot restores the static config and runs setupNetwork() again, the
+ *  EEPROM keeps what the sketch cached in it.
+ *
+ *  Scenarios, every step checks the state, the messages sent and the address
+ *  in use. Any failure makes the exit code 1:
+ *
+ *  - SELECTING -> REQUESTING -> BOUND, the lease in EEPROM
+ *  - RENEWING answered, the lease confirmed without writing the EEPROM again
+ *  - RENEWING unanswered, back to BOUND with a retry, SELECTING once the lease
+ *    expired
+ *  - a nak while REQUESTING starts over, answers of another xid or mac are
+ *    ignored
+ *  - no server: FAILED on the static config, SELECTING after DHCP_RETRY_TIME
+ *  - REBOOTING on the cached lease: the ack binds it, a nak starts over, no
+ *    answer keeps it; a cache without magic is not used
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+const byte staticIp[4]      = { 192, 168, 0, 5 };
+const byte staticNetmask[4] = { 255, 255, 255, 0 };
+const byte staticGateway[4] = { 192, 168, 0, 1 };
+
+const byte serverIp[4]      = { 10, 0, 0, 1 };
+const byte leaseIp[4]       = { 10, 0, 0, 42 };
+const byte leaseNetmask[4]  = { 255, 255, 0, 0 };
+const byte leaseGateway[4]  = { 10, 0, 0, 254 };
+
+#define LEASE_TIME              600     // s
+
+const char *stateNames[] = { "SELECTING", "REQUESTING", "BOUND", "FAILED", "REBOOTING", "RENEWING" };
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+// Last message the sketch sent to the server
+//
+struct Message
+{
+  byte type;
+  unsigned long xid;
+  byte ciaddr[4];
+  byte requested[4];                    // option 50, zero when missing
+  byte server[4];                       // option 54, zero when missing
+};
+
+Message last;
+int sent = 0;                           // messages since the last take()
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, const char *detail = "" )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %s, state %s, %d sent\n", scenario, rule, detail, stateNames[ dhcp_state ], sent );
+}
+
+// Take the datagrams the sketch sent, the last DHCP message is kept in last
+//
+void take()
+{
+  HalDatagram d;
+
+  while ( hal_udp_sent( &d ) )
+  {
+    if ( DHCP_SERVER_PORT != d.port ) { continue; }
+
+    byte broadcast[4] = { 255, 255, 255, 255 };
+
+    check( DHCP_CLIENT_PORT == d.local_port && 0 == memcmp( d.ip, broadcast, 4 ), "broadcast from port 68" );
+    check( DHCP_HEADER_LENGTH < d.length && 1 == d.data[0] && 0 == memcmp( &d.data[28], mac, 6 ), "boot request of our mac" );
+
+    memset( &last, 0, sizeof( last ) );
+
+    last.xid = (unsigned long)d.data[4] << 24 | (unsigned long)d.data[5] << 16 | (unsigned long)d.data[6] << 8 | d.data[7];
+    memcpy( last.ciaddr, &d.data[12], 4 );
+
+    byte *data;
+
+    if (( data = dhcpFindOption( d.data, d.length, DHCP_OPT_MESSAGE_TYPE, 1 ))) { last.type = *data; }
+    if (( data = dhcpFindOption( d.data, d.length, DHCP_OPT_REQUESTED_IP, 4 ))) { memcpy( last.requested, data, 4 ); }
+    if (( data = dhcpFindOption( d.data, d.length, DHCP_OPT_SERVER_ID, 4 ))) { memcpy( last.server, data, 4 ); }
+
+    sent++;
+  }
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+  }
+
+  take();
+}
+
+// Run until the state changes, at most ms. Returns the ms it took
+//
+unsigned long runWhile( enum DHCP_STATE state, unsigned long ms )
+{
+  unsigned long start = now;
+
+  while ( state == dhcp_state && ms > now - start ) run( 10 );
+
+  return now - start;
+}
+
+// Answer the last message, xid and mac as they should be unless told otherwise
+//
+void answer( byte type, unsigned long xid, const byte *yiaddr, boolean otherMac = false )
+{
+  byte packet[ DHCP_HEADER_LENGTH + 32 ];
+  byte lease[4] = { 0, 0, LEASE_TIME >> 8, LEASE_TIME & 0xFF };
+
+  memset( packet, 0, sizeof( packet ) );
+
+  packet[0] = 2;                        // boot reply
+  packet[1] = 1;
+  packet[2] = 6;
+  packet[4] = xid >> 24;
+  packet[5] = xid >> 16;
+  packet[6] = xid >> 8;
+  packet[7] = xid;
+
+  memcpy( &packet[16], yiaddr, 4 );
+  memcpy( &packet[28], mac, 6 );
+
+  if ( otherMac ) packet[33] ^= 0xFF;
+
+  packet[236] = 99;
+  packet[237] = 130;
+  packet[238] = 83;
+  packet[239] = 99;
+
+  byte *p = dhcpOption( &packet[ DHCP_HEADER_LENGTH ], DHCP_OPT_MESSAGE_TYPE, 1, &type );
+
+  p = dhcpOption( p, DHCP_OPT_SERVER_ID, 4, serverIp );
+
+  if ( DHCP_NAK != type )
+  {
+    p = dhcpOption( p, DHCP_OPT_NETMASK, 4, leaseNetmask );
+    p = dhcpOption( p, DHCP_OPT_ROUTER, 4, leaseGateway );
+    p = dhcpOption( p, DHCP_OPT_LEASE_TIME, 4, lease );
+  }
+
+  *p++ = DHCP_OPT_END;
+
+  hal_udp_deliver( DHCP_CLIENT_PORT, serverIp, DHCP_SERVER_PORT, packet, p - packet );
+}
+
+// The state is reached within the time of a run of the network task
+//
+void expectState( enum DHCP_STATE state, const char *rule )
+{
+  run( 200 );
+
+  check( state == dhcp_state, rule, stateNames[ state ] );
+}
+
+void expectSent( byte type, const char *rule )
+{
+  char detail[ 32 ];
+
+  snprintf( detail, sizeof( detail ), "type %d, got %d", type, last.type );
+
+  check( 0 < sent && type == last.type && dhcp_xid == last.xid, rule, detail );
+
+  sent = 0;
+}
+
+// The W5100, the globals and the socket hold the config
+//
+void expectConfig( const byte *i, const byte *n, const byte *g, const char *rule )
+{
+  byte hi[4], hn[4], hg[4];
+
+  hal_address( hi, hn, hg );
+
+  check( 0 == memcmp( ip, i, 4 ) && 0 == memcmp( hi, i, 4 ) &&
+         0 == memcmp( netmask, n, 4 ) && 0 == memcmp( hn, n, 4 ) &&
+         0 == memcmp( gateway, g, 4 ) && 0 == memcmp( hg, g, 4 ), rule );
+}
+
+void expectCached( const byte *i, const char *rule )
+{
+  boolean ok = EEPROM_LEASE_MAGIC == EEPROM.read( EEPROM_LEASE );
+
+  for ( int k = 0; k < 4; k++ )
+  {
+    ok = ok && i[k] == EEPROM.read( EEPROM_LEASE + 1 + k );
+  }
+
+  check( ok, rule );
+}
+
+// Power cycle, only the EEPROM is kept
+//
+void reboot()
+{
+  close( dhcp_socket );
+  dhcp_socket = MAX_SOCK_NUM;
+
+  memcpy( ip, staticIp, 4 );
+  memcpy( netmask, staticNetmask, 4 );
+  memcpy( gateway, staticGateway, 4 );
+
+  sent = 0;
+  setupNetwork();
+  take();
+}
+
+// Discover, offer, request, ack
+//
+void bind()
+{
+  expectSent( DHCP_DISCOVER, "discover sent" );
+
+  answer( DHCP_OFFER, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_REQUESTING, "offer requested" );
+  expectSent( DHCP_REQUEST, "request sent" );
+
+  check( 0 == memcmp( last.requested, leaseIp, 4 ) && 0 == memcmp( last.server, serverIp, 4 ), "request names the offer and its server" );
+
+  answer( DHCP_ACK, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_BOUND, "ack binds" );
+}
+
+// -------------------------------------------------------- //
+
+void selecting()
+{
+  scenario = "selecting";
+
+  expectState( DHCP_STATE_SELECTING, "no cache, selecting at boot" );
+  expectConfig( staticIp, staticNetmask, staticGateway, "static config until bound" );
+
+  SOCKET s = dhcp_socket;
+
+  bind();
+
+  expectConfig( leaseIp, leaseNetmask, leaseGateway, "lease in use" );
+  expectCached( leaseIp, "lease cached" );
+  check( SnSR::CLOSED == W5100.readSnSR( s ) && MAX_SOCK_NUM == dhcp_socket, "socket freed once bound" );
+}
+
+void renewing()
+{
+  scenario = "renewing";
+
+  unsigned long writes = hal_eeprom_writes;
+
+  runWhile( DHCP_STATE_BOUND, LEASE_TIME * 1000UL );
+  check( DHCP_STATE_RENEWING == dhcp_state && LEASE_TIME * 500UL <= now - dhcp_bound_time &&
+         LEASE_TIME * 500UL + 200 > now - dhcp_bound_time, "renewing at half the lease" );
+  expectSent( DHCP_REQUEST, "renew request sent" );
+  check( 0 == memcmp( last.ciaddr, leaseIp, 4 ) && 0 == last.requested[0] && 0 == last.server[0], "renew names the address in ciaddr only" );
+
+  answer( DHCP_ACK, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_BOUND, "renew ack binds" );
+  check( writes == hal_eeprom_writes, "same lease not written again" );
+
+  // Unanswered, back to bound and retried until the lease expires
+  //
+  scenario = "renewing unanswered";
+
+  runWhile( DHCP_STATE_BOUND, LEASE_TIME * 1000UL );
+  expectSent( DHCP_REQUEST, "renew request sent" );
+
+  runWhile( DHCP_STATE_RENEWING, 2 * DHCP_RETRIES * DHCP_TIMEOUT );
+  check( DHCP_STATE_BOUND == dhcp_state && DHCP_RETRIES - 1 == sent, "bound again after the retries" );
+  expectConfig( leaseIp, leaseNetmask, leaseGateway, "lease kept while it lasts" );
+
+  unsigned long retry = runWhile( DHCP_STATE_BOUND, 2 * DHCP_RETRY_TIME );
+  check( DHCP_STATE_RENEWING == dhcp_state && DHCP_RETRY_TIME - 200 < retry && DHCP_RETRY_TIME + 200 > retry, "renew retried" );
+
+  while ( ( DHCP_STATE_BOUND == dhcp_state || DHCP_STATE_RENEWING == dhcp_state ) && dhcp_lease_time + 1000 > now - dhcp_bound_time )
+  {
+    run( 10 );
+  }
+
+  check( DHCP_STATE_SELECTING == dhcp_state && dhcp_lease_time <= now - dhcp_bound_time, "selecting once the lease expired" );
+  check( DHCP_DISCOVER == last.type, "discover for a new lease" );
+}
+
+void nak()
+{
+  scenario = "nak";
+
+  sent = 0;
+
+  answer( DHCP_OFFER, dhcp_xid + 1, leaseIp );
+  answer( DHCP_OFFER, dhcp_xid, leaseIp, true );
+  run( 200 );
+  check( DHCP_STATE_SELECTING == dhcp_state && 0 == sent, "offer of another xid or mac ignored" );
+
+  answer( DHCP_OFFER, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_REQUESTING, "offer requested" );
+  expectSent( DHCP_REQUEST, "request sent" );
+
+  answer( DHCP_NAK, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_SELECTING, "nak starts over" );
+
+  bind();
+}
+
+void failed()
+{
+  scenario = "failed";
+
+  EEPROM.write( EEPROM_LEASE, 0xFF );
+  reboot();
+
+  check( DHCP_STATE_SELECTING == dhcp_state, "cache without magic not used" );
+  expectSent( DHCP_DISCOVER, "discover sent" );
+
+  runWhile( DHCP_STATE_SELECTING, 2 * DHCP_RETRIES * DHCP_TIMEOUT );
+  check( DHCP_STATE_FAILED == dhcp_state && DHCP_RETRIES - 1 == sent, "failed after the retries" );
+  expectConfig( staticIp, staticNetmask, staticGateway, "static config kept" );
+  check( MAX_SOCK_NUM == dhcp_socket, "socket freed once failed" );
+
+  unsigned long failed = dhcp_time;
+
+  sent = 0;
+  runWhile( DHCP_STATE_FAILED, 2 * DHCP_RETRY_TIME );
+  check( DHCP_STATE_SELECTING == dhcp_state && DHCP_RETRY_TIME <= now - failed && DHCP_RETRY_TIME + 200 > now - failed, "selecting after the retry time" );
+
+  bind();
+  expectCached( leaseIp, "lease cached" );
+}
+
+void rebooting()
+{
+  scenario = "rebooting";
+
+  reboot();
+
+  check( DHCP_STATE_REBOOTING == dhcp_state, "cache used at boot" );
+  expectConfig( leaseIp, leaseNetmask, leaseGateway, "cached lease in use right away" );
+  expectSent( DHCP_REQUEST, "request of the cached lease" );
+  check( 0 == memcmp( last.requested, leaseIp, 4 ) && 0 == last.server[0] && 0 == last.ciaddr[0], "request names the cached address only" );
+
+  answer( DHCP_ACK, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_BOUND, "ack binds the cached lease" );
+
+  scenario = "rebooting nak";
+
+  reboot();
+  answer( DHCP_NAK, dhcp_xid, leaseIp );
+  expectState( DHCP_STATE_SELECTING, "nak starts over" );
+
+  bind();
+
+  scenario = "rebooting unanswered";
+
+  reboot();
+  runWhile( DHCP_STATE_REBOOTING, 2 * DHCP_RETRIES * DHCP_TIMEOUT );
+  check( DHCP_STATE_FAILED == dhcp_state, "failed after the retries" );
+  expectConfig( leaseIp, leaseNetmask, leaseGateway, "cached lease kept" );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  setup();
+  take();
+
+  selecting();
+  renewing();
+  nak();
+  failed();
+  rebooting();
+
+  printf( "%lu dhcp checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
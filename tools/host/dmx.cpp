@@ -0,0 +1,230 @@
+/*
+ *  DMX512 output of Dmx.h on the line
+ *
+ *    build/dmx/dmx
+ *
+ *  Built with DMX_ENABLED and NR_DMX_LIGHT_CHANNELS, see the Makefile. The
+ *  sketch runs setup() and its tasks, the virtual clock moves a ms per run of
+ *  loop(). The UART1 of the HAL calls the interrupt handlers of Dmx.h like the
+ *  ATmega does and hands every byte with its time and bit rate to the harness,
+ *  which takes the line apart the way a DMX receiver does.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - a frame is a break of a 0 at DMX_BREAK_BAUD (low for at least 92 us, a
+ *    mark after break of at least 12 us, the minimums of a DMX512-A
+ *    transmitter), then the start code and DMX_SLOTS slots at 250 kbaud 8N2
+ *    without a gap between them
+ *  - frames follow each other without a gap, at the rate that gives, dmx_frames
+ *    counts every one of them
+ *  - a light set over the web shows in the slot of its dmxLights entry, the
+ *    first slot, the last one and one in between, within an output tick and two
+ *    frames. No other slot changes
+ *
+ *  The latency of the changes, from the request to the end of the first frame
+ *  that carries the value, is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define FIRST_DMX_CHANNEL       ( NR_PWM_LIGHT_CHANNELS + NR_REMOTE_LIGHT_CHANNELS )
+#define FRAME_US                ( 9 * ( DMX_UBRR( DMX_BREAK_BAUD ) + 1 ) + 2 * ( DMX_UBRR( DMX_BREAK_BAUD ) + 1 ) + ( 1 + DMX_SLOTS ) * 11 * ( DMX_UBRR( DMX_BAUD ) + 1 ) )
+#define MAX_LATENCY             ( 10 + 5 + 2 * FRAME_US / 1000 + 2 )   // ms, output tick, web task and two frames
+
+const int slots[] = { 1, 256, DMX_SLOTS };   // dmxLights, the edges and one in between
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+// Frame as the receiver takes it in
+//
+byte frame[ 1 + DMX_SLOTS ];
+int  frame_length = -1;                 // -1 until the first break
+unsigned long frame_start = 0;          // us of the break
+unsigned long frame_end   = 0;          // us the last byte is out
+
+// Last complete frame
+//
+byte last[ 1 + DMX_SLOTS ];
+unsigned long last_end = 0;
+unsigned long frames   = 0;
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, long detail = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %ld\n", scenario, rule, detail );
+}
+
+// A frame is complete when the next break starts
+//
+void completed( unsigned long us )
+{
+  check( 1 + DMX_SLOTS == frame_length, "start code and every slot", frame_length );
+  check( DMX_START_CODE == frame[0], "start code", frame[0] );
+  check( FRAME_US == us - frame_start, "frame length in us", us - frame_start );
+
+  memcpy( last, frame, sizeof( last ) );
+  last_end = frame_end;
+  frames++;
+}
+
+// Take the bytes the UART sent so far apart
+//
+void receive()
+{
+  HalUartByte b;
+
+  while ( hal_uart_sent( &b ) )
+  {
+    if ( DMX_UBRR( DMX_BREAK_BAUD ) + 1 == b.bit_us )
+    {
+      check( 0 == b.data, "break is a 0", b.data );
+      check( 92 <= 9 * b.bit_us, "break of 92 us", 9 * b.bit_us );
+      check( 12 <= ( b.bits - 9 ) * b.bit_us, "mark after break of 12 us", ( b.bits - 9 ) * b.bit_us );
+
+      if ( 0 <= frame_length )
+      {
+        check( b.us == frame_end, "no gap after the last slot", b.us - frame_end );
+        completed( b.us );
+      }
+
+      frame_length = 0;
+      frame_start  = b.us;
+      frame_end    = b.us + b.bits * b.bit_us;
+      continue;
+    }
+
+    if ( 0 > frame_length ) { continue; }
+
+    check( DMX_UBRR( DMX_BAUD ) + 1 == b.bit_us && 11 == b.bits, "slot at 250 kbaud 8N2", b.bit_us );
+    check( b.us == frame_end, "no gap between slots", b.us - frame_end );
+
+    if ( 1 + DMX_SLOTS > frame_length ) frame[ frame_length ] = b.data;
+
+    frame_length++;
+    frame_end = b.us + b.bits * b.bit_us;
+  }
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+    receive();
+  }
+}
+
+// -------------------------------------------------------- //
+
+void line()
+{
+  scenario = "frames";
+
+  run( 100 );
+
+  unsigned long first = frames, sent = dmx_frames;
+
+  run( 2000 );
+
+  unsigned long expected = 2000000UL / FRAME_US;
+
+  check( expected <= frames - first && expected + 1 >= frames - first, "frame rate", frames - first );
+  check( frames - first == dmx_frames - sent, "dmx_frames counts them", dmx_frames - sent );
+  check( 0 == hal_uart_dropped, "no byte lost to the harness", hal_uart_dropped );
+
+  for ( int i = 1; i <= DMX_SLOTS; i++ )
+  {
+    if ( 0 != last[i] ) { check( false, "slots of lights off are 0", i ); break; }
+  }
+}
+
+// Set channel to value over the web, the ms until a frame carried it
+//
+unsigned long set( int channel, int value )
+{
+  char path[64];
+  unsigned long start = now * 1000UL;
+
+  snprintf( path, sizeof( path ), "setLightChannel/%d/%d/2", FIRST_DMX_CHANNEL + channel, value );
+  hal_web_request( path );
+
+  for ( int i = 0; i < 1000 && !( last_end > start && value == last[ slots[channel] ] ); i++ ) run( 1 );
+
+  check( value == last[ slots[channel] ], "slot of the channel", slots[channel] );
+
+  return ( last_end - start ) / 1000;
+}
+
+void levels()
+{
+  unsigned long latency[ 3 * 4 ];
+  int n = 0;
+  int values[] = { 1, 128, MAX_LIGHT_VALUE, 0 };
+
+  scenario = "levels";
+
+  for ( int v = 0; v < 4; v++ )
+  {
+    for ( int c = 0; c < 3; c++ )
+    {
+      latency[ n ] = set( c, values[v] );
+      check( MAX_LATENCY >= latency[ n ], "latency in ms", latency[ n ] );
+      n++;
+
+      for ( int i = 1; i <= DMX_SLOTS; i++ )
+      {
+        int expected = 0;
+
+        for ( int k = 0; k < 3; k++ )
+        {
+          if ( slots[k] == i ) expected = ( k <= c ) ? values[v] : ( 0 < v ? values[ v - 1 ] : 0 );
+        }
+
+        if ( expected != last[i] ) { check( false, "no other slot changes", i ); break; }
+      }
+    }
+  }
+
+  unsigned long sum = 0, max = 0;
+
+  for ( int i = 0; i < n; i++ )
+  {
+    sum += latency[i];
+    if ( max < latency[i] ) max = latency[i];
+  }
+
+  printf( "%d changes, latency mean %.1f ms, max %lu ms\n", n, (double)sum / n, max );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  for ( int c = 0; c < NR_DMX_LIGHT_CHANNELS && c < 3; c++ ) dmxLights[c] = slots[c];
+
+  setup();
+
+  line();
+  levels();
+
+  printf( "%lu frames of %d slots, %lu dmx checks, %lu failures\n", frames, DMX_SLOTS, checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
@@ -0,0 +1,777 @@
+/*
+ *  Fleet simulation, many DoDuinos with occupants using them at the same time
+ *
+ *    build/fleet [-i instances] [-j jobs] [-t seconds] [-o occupants] [-s seed]
+ *
+ *  Every instance is the sketch in a process of its own, so it has its own
+ *  globals and virtual clock. The sketch keeps its whole state in globals, so
+ *  two instances can't share an address space and there is no work-stealing
+ *  thread pool: the pool is jobs processes (default the nr of cores), a new
+ *  instance starts as soon as one ends, so no core idles while instances are
+ *  left. Each simulates seconds of virtual time (default 3600) in which the
+ *  occupants of the instance press buttons and use the web API:
+ *
+ *  - buttons:  taps, double and triple taps, long presses and tap and hold fades
+ *              on the buttons with something to do, one occupant per button
+ *  - web:      getLightChannels, getSwitchChannels and getTasks, setLightChannel,
+ *              setSwitchChannel and toggleGroup through the loopback of the HAL
+ *
+ *  Lights and groups are only set from the web while nobody uses their buttons,
+ *  and a button is only pressed while no other button on its lights is. The
+ *  invariants of checkGesture expect the taps to be the only change. Every
+ *  occupant waits 0.2 to 20 s between two actions. The clock jumps from one
+ *  due task, button edge or action to the next like in gestures.cpp.
+ *
+ *  Checks, counted per instance, any failure makes the exit code 1:
+ *
+ *  - the invariants of checkGesture in Dimmer.h (invariant_violations)
+ *  - targets and values of all light channels stay in range
+ *  - every button is back in GS_IDLE once its occupant let go
+ *  - a get answers 200 with a Content-Length that matches the body
+ *  - a set answers nothing (like setLightCmd) and a setLightChannel sets the
+ *    target, unless a button or group touched the channel before it settled
+ *
+ *  Per instance the events (button edges and web requests), the failures and
+ *  the host ns of every loop() that ran a task are printed, then the fleet
+ *  totals: events per second of virtual and of host time and the loop cost
+ *  over all instances.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <chrono>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define SAMPLE_TIME             5       // ms, period of the input task
+#define MARGIN                  40      // ms taps keep away from PULSE_TIME
+#define MAX_PENDING_EDGES       64
+#define MAX_REQUESTS            16      // in flight, the queue of the HAL
+#define MAX_CHECKS              32      // web sets waiting to settle
+#define SETTLE_TIME             100     // ms before the target of a web set is checked
+#define COST_BUCKETS            10000   // of 10 ns
+#define MAX_OCCUPANTS           32
+
+enum REQUEST_KIND { REQUEST_GET, REQUEST_SET, REQUEST_SET_LIGHT, REQUEST_TOGGLE };
+
+struct Edge
+{
+  unsigned long time;                   // ms
+  int button;
+  int level;
+};
+
+struct Request
+{
+  int kind;
+  unsigned long queued;                 // ms
+  int channel;                          // REQUEST_SET_LIGHT only
+  int value;
+};
+
+struct Check
+{
+  unsigned long due;                    // ms
+  unsigned long touched;                // channel_touched when the set was served
+  int channel;
+  int value;
+};
+
+struct Occupant
+{
+  unsigned long next;                   // ms of the next action
+  int button;                           // -1 for web only
+};
+
+// Sent from an instance to the fleet through a pipe
+//
+struct Result
+{
+  int instance;
+  unsigned long edges;
+  unsigned long requests;
+  unsigned long failures;
+  unsigned long violations;
+  unsigned long latency_max;            // ms from queueing a request to its answer
+  unsigned long loops;
+  unsigned long buckets[ COST_BUCKETS ];
+  unsigned long cost_max;               // ns
+  double wall;                          // s of host time
+};
+
+// A running instance, its result is read as it comes
+//
+struct Job
+{
+  pid_t pid;                            // 0 when the slot is free
+  int fd;
+  size_t got;                           // bytes of the result read so far
+  Result result;
+};
+
+// Instance state
+//
+Edge     edges[ MAX_PENDING_EDGES ];
+int      nr_edges = 0;
+Request  requests[ MAX_REQUESTS ];
+int      requests_first = 0;
+int      nr_requests = 0;
+Check    checks[ MAX_CHECKS ];
+int      nr_checks = 0;
+Occupant occupants[ MAX_OCCUPANTS ];
+int      nr_occupants = 0;
+
+unsigned long button_free[ NR_BUTTONS ];        // ms the occupant let go and the button is idle again
+unsigned long channel_touched[ NR_LIGHT_CHANNELS ];
+unsigned long touches = 0;
+
+int active[ NR_BUTTONS ];
+int nr_active = 0;
+
+Result result;
+
+// -------------------------------------------------------- //
+
+unsigned long long rnd_state = 88172645463325252ULL;
+
+unsigned long between( unsigned long low, unsigned long high )
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+
+  return low + (unsigned long)( rnd_state % ( high - low + 1 ) );
+}
+
+// -------------------------------------------------------- //
+
+void fail( const char *rule, int channel, const char *detail = "" )
+{
+  result.failures++;
+
+  if ( 3 >= result.failures )
+  {
+    printf( "instance %d FAIL %s: channel %d at %lu ms %s\n", result.instance, rule, channel, millis(), detail );
+  }
+}
+
+// -------------------------------------------------------- //
+
+// A button or group changed what a channel is heading for
+//
+void touchChannel( int channel )
+{
+  channel_touched[ channel ] = ++touches;
+}
+
+void touchAll()
+{
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ ) touchChannel( i );
+}
+
+void touchButton( int id )
+{
+  Button *b = &buttons[id];
+
+  if ( 0 <= b->group )
+  {
+    touchAll();
+    return;
+  }
+
+  for ( int i = 0; i < b->nr_l_channels; i++ ) touchChannel( b->l_channels[i] - l_channels );
+}
+
+// An occupant is using a button on the channel, or any button when channel is -1
+//
+boolean buttonBusy( int channel )
+{
+  for ( int i = 0; i < nr_active; i++ )
+  {
+    int id = active[i];
+
+    if ( 0 == button_free[id] ) { continue; }
+
+    if ( 0 > channel || 0 <= buttons[id].group ) { return true; }
+
+    for ( int j = 0; j < buttons[id].nr_l_channels; j++ )
+    {
+      if ( &l_channels[ channel ] == buttons[id].l_channels[j] ) { return true; }
+    }
+  }
+
+  return false;
+}
+
+// Another occupant is using a button on the lights of button id
+//
+boolean buttonShared( int id )
+{
+  Button *b = &buttons[id];
+
+  if ( 0 <= b->group ) { return buttonBusy( -1 ); }
+
+  for ( int i = 0; i < b->nr_l_channels; i++ )
+  {
+    if ( buttonBusy( b->l_channels[i] - l_channels ) ) { return true; }
+  }
+
+  return false;
+}
+
+// -------------------------------------------------------- //
+
+void addEdge( unsigned long time, int button, int level )
+{
+  if ( MAX_PENDING_EDGES <= nr_edges ) { return; }
+
+  int i = nr_edges++;
+
+  while ( 0 < i && edges[i - 1].time > time )
+  {
+    edges[i] = edges[i - 1];
+    i--;
+  }
+
+  edges[i].time   = time;
+  edges[i].button = button;
+  edges[i].level  = level;
+}
+
+unsigned long press( int button, unsigned long t, unsigned long duration )
+{
+  addEdge( t, button, HIGH );
+  addEdge( t + duration, button, LOW );
+
+  return t + duration;
+}
+
+// -------------------------------------------------------- //
+
+// A gesture on the button of occupant o, from ms t
+//
+void gesture( Occupant *o, unsigned long t )
+{
+  unsigned long tap = between( 2 * SAMPLE_TIME + 5, PULSE_TIME - MARGIN );
+
+  switch ( between( 0, 5 ) )
+  {
+    case ( 0 ):
+    case ( 1 ):                         // tap
+      t = press( o->button, t, tap );
+      break;
+
+    case ( 2 ):                         // double or triple tap
+    {
+      int taps = between( 2, 3 );
+
+      for ( int i = 0; i < taps; i++ )
+      {
+        t = press( o->button, t, tap ) + between( 2 * SAMPLE_TIME + 5, PULSE_TIME - MARGIN );
+      }
+      break;
+    }
+
+    case ( 3 ):                         // long press
+      t = press( o->button, t, between( LONG_PRESS_TIME + MARGIN, LONG_PRESS_TIME + 2000 ) );
+      break;
+
+    default:                            // tap and hold
+      t = press( o->button, t, tap ) + between( 2 * SAMPLE_TIME + 5, PULSE_TIME - MARGIN );
+      t = press( o->button, t, between( PULSE_TIME + MARGIN, 6000 ) );
+      break;
+  }
+
+  button_free[ o->button ] = t + PULSE_TIME + LONG_PRESS_TIME + MARGIN;
+}
+
+// -------------------------------------------------------- //
+
+void request( const char *path, int kind, int channel = -1, int value = -1 )
+{
+  if ( MAX_REQUESTS <= nr_requests ) { return; }
+
+  Request *r = &requests[ ( requests_first + nr_requests++ ) % MAX_REQUESTS ];
+
+  r->kind    = kind;
+  r->queued  = millis();
+  r->channel = channel;
+  r->value   = value;
+
+  hal_web_request( path );
+}
+
+// Lights are only set while nobody uses their buttons, the invariants of
+// checkGesture expect the taps of a gesture to be the only change
+//
+void webAction()
+{
+  char path[ 64 ];
+  int kind = between( 0, 9 );
+
+  if ( 9 == kind && buttonBusy( -1 ) ) { kind = 0; }
+
+  switch ( kind )
+  {
+    case ( 0 ):
+    case ( 1 ):
+    case ( 2 ): request( "getLightChannels", REQUEST_GET );  break;
+    case ( 3 ): request( "getSwitchChannels", REQUEST_GET ); break;
+    case ( 4 ): request( "getTasks", REQUEST_GET );          break;
+
+    case ( 5 ):
+    case ( 6 ):
+    case ( 7 ):
+    {
+      int channel = between( 0, NR_LIGHT_CHANNELS - 1 );
+      int value   = between( 0, MAX_LIGHT_VALUE );
+
+      if ( buttonBusy( channel ) )
+      {
+        request( "getLightChannels", REQUEST_GET );
+        break;
+      }
+
+      snprintf( path, sizeof( path ), "setLightChannel/%d/%d/2", channel, value );
+      request( path, REQUEST_SET_LIGHT, channel, value );
+      break;
+    }
+
+    case ( 8 ):
+      snprintf( path, sizeof( path ), "setSwitchChannel/%d/%d/0/0", (int)between( 0, NR_SWITCH_CHANNELS - 1 ), (int)between( 0, 1 ) );
+      request( path, REQUEST_SET );
+      break;
+
+    case ( 9 ):
+      snprintf( path, sizeof( path ), "toggleGroup/%d", (int)between( 0, nr_groups - 1 ) );
+      request( path, REQUEST_TOGGLE );
+      break;
+  }
+}
+
+// -------------------------------------------------------- //
+
+// The request in front was answered, check the response
+//
+void answered()
+{
+  Request *r = &requests[ requests_first ];
+  const char *response = hal_web_response();
+  int length = hal_web_response_length();
+
+  requests_first = ( requests_first + 1 ) % MAX_REQUESTS;
+  nr_requests--;
+
+  result.requests++;
+  result.latency_max = max( result.latency_max, millis() - r->queued );
+
+  if ( REQUEST_GET == r->kind )
+  {
+    const char *body = strstr( response, "\r\n\r\n" );
+    const char *header = strstr( response, "Content-Length: " );
+
+    if ( 0 != strncmp( response, "HTTP/1.0 200", 12 ) || NULL == body || NULL == header )
+    {
+      fail( "get answers 200 with a length", -1 );
+    }
+    else if ( HAL_RESPONSE_LENGTH > length && atoi( header + 16 ) != length - ( body + 4 - response ) )
+    {
+      char detail[ 64 ];
+
+      snprintf( detail, sizeof( detail ), "%d announced, %d sent", atoi( header + 16 ), (int)( length - ( body + 4 - response ) ) );
+      fail( "Content-Length matches the body", -1, detail );
+    }
+    return;
+  }
+
+  if ( 0 != length )
+  {
+    fail( "set answers nothing", r->channel );
+  }
+
+  if ( REQUEST_TOGGLE == r->kind ) touchAll();
+
+  if ( REQUEST_SET_LIGHT == r->kind && MAX_CHECKS > nr_checks )
+  {
+    touchChannel( r->channel );
+
+    Check *c = &checks[ nr_checks++ ];
+
+    c->due     = millis() + SETTLE_TIME;
+    c->touched = channel_touched[ r->channel ];
+    c->channel = r->channel;
+    c->value   = r->value;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void checkSettled()
+{
+  for ( int i = 0; i < nr_checks; )
+  {
+    Check *c = &checks[i];
+
+    if ( c->due > millis() ) { i++; continue; }
+
+    if ( c->touched == channel_touched[ c->channel ] && c->value != l_channels[ c->channel ].target_light_value )
+    {
+      char detail[ 64 ];
+
+      snprintf( detail, sizeof( detail ), "target %d expected, %d seen", c->value, l_channels[ c->channel ].target_light_value );
+      fail( "setLightChannel sets the target", c->channel, detail );
+    }
+
+    *c = checks[ --nr_checks ];
+  }
+}
+
+// -------------------------------------------------------- //
+
+void checkChannels()
+{
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    LightChannel *c = &l_channels[i];
+
+    if ( 0 > c->target_light_value || MAX_LIGHT_VALUE < c->target_light_value ||
+         0 > c->light_value || MAX_LIGHT_VALUE < c->light_value )
+    {
+      fail( "target in range", i );
+    }
+  }
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    if ( 0 != button_free[i] && button_free[i] <= millis() )
+    {
+      if ( GS_IDLE != buttons[i].state ) fail( "back in GS_IDLE after the occupant let go", -1 );
+
+      button_free[i] = 0;
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+boolean taskDue()
+{
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    if ( tasks[i].period <= millis() - tasks[i].last_run ) { return true; }
+  }
+
+  return false;
+}
+
+unsigned long nextDue()
+{
+  unsigned long next = millis() + 1000;
+
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    next = min( next, tasks[i].last_run + tasks[i].period );
+  }
+
+  return next;
+}
+
+// -------------------------------------------------------- //
+
+void timedLoop()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  loop();
+
+  unsigned long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+  result.loops++;
+  result.buckets[ min( ns / 10, (unsigned long)COST_BUCKETS - 1 ) ]++;
+  result.cost_max = max( result.cost_max, ns );
+}
+
+// -------------------------------------------------------- //
+
+void simulate( int instance, unsigned long seconds, int occupantCount, unsigned long long seed )
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  memset( &result, 0, sizeof( result ) );
+  result.instance = instance;
+
+  rnd_state ^= ( seed + instance ) * 0x9E3779B97F4A7C15ULL;
+
+  setup();
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    Button *b = &buttons[i];
+
+    if ( 0 < b->nr_l_channels || 0 < b->nr_sw_channels || 0 <= b->group ) active[ nr_active++ ] = i;
+  }
+
+  // One occupant per active button, the rest only uses the web
+  //
+  nr_occupants = min( occupantCount, MAX_OCCUPANTS );
+
+  for ( int i = 0; i < nr_occupants; i++ )
+  {
+    occupants[i].next   = millis() + between( 200, 20000 );
+    occupants[i].button = ( i < nr_active ) ? active[i] : -1;
+  }
+
+  unsigned long end = millis() + seconds * 1000;
+
+  while ( true )
+  {
+    unsigned long t = millis();
+
+    while ( 0 < nr_edges && edges[0].time <= t )
+    {
+      hal_set_pin( buttonPins[ edges[0].button ], edges[0].level );
+      touchButton( edges[0].button );
+      result.edges++;
+
+      memmove( &edges[0], &edges[1], --nr_edges * sizeof( Edge ) );
+    }
+
+    for ( int i = 0; i < nr_occupants; i++ )
+    {
+      Occupant *o = &occupants[i];
+
+      if ( o->next > t ) { continue; }
+
+      // Half of the actions of an occupant with a button are on the button, while
+      // its lights are in use or a request is on its way the web is taken
+      //
+      if ( 0 <= o->button && !buttonShared( o->button ) && 0 == nr_requests && 0 == between( 0, 1 ) )
+      {
+        gesture( o, t );
+      }
+      else
+      {
+        webAction();
+      }
+
+      o->next = t + between( 200, 20000 );
+    }
+
+    for ( int i = 0; i <= NR_TASKS && taskDue(); i++ )
+    {
+      timedLoop();
+
+      if ( nr_requests > hal_web_pending() ) answered();
+    }
+
+    checkChannels();
+    checkSettled();
+
+    if ( t >= end ) { break; }
+
+    unsigned long next = nextDue();
+
+    if ( 0 < nr_edges ) { next = min( next, edges[0].time ); }
+
+    for ( int i = 0; i < nr_occupants; i++ ) { next = min( next, occupants[i].next ); }
+
+    next = constrain( next, t + 1, end );
+
+    hal_set_micros( next * 1000 );
+  }
+
+  result.violations = invariant_violations;
+  result.failures  += invariant_violations;
+  result.wall       = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// -------------------------------------------------------- //
+
+unsigned long percentile( unsigned long *buckets, unsigned long runs, unsigned long worst, int percent )
+{
+  unsigned long count = 0;
+
+  for ( int i = 0; i < COST_BUCKETS; i++ )
+  {
+    count += buckets[i];
+
+    if ( 0 < count && count * 100 >= runs * percent ) { return i * 10; }
+  }
+
+  return worst;
+}
+
+void printResult( const char *name, Result *r, double seconds )
+{
+  printf( "%-10s %9lu %9lu %10.1f %8lu %8lu %8lu %9lu %9lu %8lu %8lu\n", name, r->edges, r->requests,
+          ( r->edges + r->requests ) / seconds, r->loops,
+          percentile( r->buckets, r->loops, r->cost_max, 50 ), percentile( r->buckets, r->loops, r->cost_max, 99 ), r->cost_max,
+          r->latency_max, r->violations, r->failures );
+}
+
+// -------------------------------------------------------- //
+
+void addResult( Result *total, Result *r )
+{
+  total->edges      += r->edges;
+  total->requests   += r->requests;
+  total->failures   += r->failures;
+  total->violations += r->violations;
+  total->loops      += r->loops;
+  total->latency_max = max( total->latency_max, r->latency_max );
+  total->cost_max    = max( total->cost_max, r->cost_max );
+  total->wall       += r->wall;
+
+  for ( int i = 0; i < COST_BUCKETS; i++ ) total->buckets[i] += r->buckets[i];
+}
+
+// -------------------------------------------------------- //
+
+// Fork the process of an instance, its result comes back through a pipe of its
+// own. A Result is far larger than PIPE_BUF, on a shared pipe the writes of two
+// instances could interleave
+//
+boolean startJob( Job *job, int instance, unsigned long seconds, int occupantCount, unsigned long long seed )
+{
+  int fds[2];
+
+  if ( 0 != pipe( fds ) ) { perror( "pipe" ); return false; }
+
+  fflush( stdout );
+
+  pid_t pid = fork();
+
+  if ( 0 > pid ) { perror( "fork" ); return false; }
+
+  if ( 0 == pid )
+  {
+    close( fds[0] );
+
+    simulate( instance, seconds, occupantCount, seed );
+
+    fflush( stdout );
+
+    for ( size_t sent = 0; sent < sizeof( result ); )
+    {
+      ssize_t n = write( fds[1], (const char *)&result + sent, sizeof( result ) - sent );
+
+      if ( 0 >= n ) { _exit( 2 ); }
+
+      sent += n;
+    }
+
+    _exit( 0 );
+  }
+
+  close( fds[1] );
+
+  job->pid = pid;
+  job->fd  = fds[0];
+  job->got = 0;
+
+  return true;
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  int instances = 16;
+  int jobs = sysconf( _SC_NPROCESSORS_ONLN );
+  unsigned long seconds = 3600;
+  int occupantCount = 12;
+  unsigned long long seed = 1;
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if      ( 0 == strcmp( argv[i], "-i" ) && i + 1 < argc ) instances = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-j" ) && i + 1 < argc ) jobs = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-t" ) && i + 1 < argc ) seconds = strtoul( argv[++i], NULL, 10 );
+    else if ( 0 == strcmp( argv[i], "-o" ) && i + 1 < argc ) occupantCount = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-s" ) && i + 1 < argc ) seed = strtoull( argv[++i], NULL, 10 );
+    else
+    {
+      printf( "usage: %s [-i instances] [-j jobs] [-t seconds] [-o occupants] [-s seed]\n", argv[0] );
+      return 2;
+    }
+  }
+
+  jobs = constrain( jobs, 1, instances );
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  static Result total;
+  Job *slots = (Job *)calloc( jobs, sizeof( Job ) );
+  struct pollfd *polls = (struct pollfd *)calloc( jobs, sizeof( struct pollfd ) );
+  int started = 0, done = 0;
+
+  printf( "instance       edges  requests   events/s    loops  p50 ns  p99 ns   max ns  max ms  violations failures\n" );
+
+  while ( done < instances )
+  {
+    for ( int j = 0; j < jobs && started < instances; j++ )
+    {
+      if ( 0 == slots[j].pid && !startJob( &slots[j], started++, seconds, occupantCount, seed ) ) { return 2; }
+    }
+
+    int nr_polls = 0;
+
+    for ( int j = 0; j < jobs; j++ )
+    {
+      if ( 0 == slots[j].pid ) { continue; }
+
+      polls[ nr_polls ].fd     = slots[j].fd;
+      polls[ nr_polls ].events = POLLIN;
+      nr_polls++;
+    }
+
+    if ( 0 > poll( polls, nr_polls, -1 ) ) { perror( "poll" ); return 2; }
+
+    for ( int j = 0; j < jobs; j++ )
+    {
+      Job *job = &slots[j];
+
+      if ( 0 == job->pid ) { continue; }
+
+      for ( int k = 0; k < nr_polls; k++ )
+      {
+        if ( polls[k].fd != job->fd || 0 == polls[k].revents ) { continue; }
+
+        ssize_t n = read( job->fd, (char *)&job->result + job->got, sizeof( Result ) - job->got );
+
+        if ( 0 >= n ) { fprintf( stderr, "instance lost its result\n" ); return 2; }
+
+        job->got += n;
+      }
+
+      if ( sizeof( Result ) == job->got )
+      {
+        close( job->fd );
+        waitpid( job->pid, NULL, 0 );
+        job->pid = 0;
+        done++;
+
+        char name[ 16 ];
+
+        snprintf( name, sizeof( name ), "%d", job->result.instance );
+        printResult( name, &job->result, seconds );
+        addResult( &total, &job->result );
+      }
+    }
+  }
+
+  double wall = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+  printResult( "fleet", &total, seconds );
+
+  printf( "%d instances of %lu s on %d jobs in %.1f s: %.0f events/s of host time, %.0fx real time per instance\n",
+          instances, seconds, jobs, wall, ( total.edges + total.requests ) / wall, seconds * instances / total.wall );
+
+  return ( 0 == total.failures ) ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/*
+ *  Run time of handleInput per button per tick, on the host clock
+ *
+ *    build/gesturebench [rounds]
+ *    make -C tools/host compare REV=<revision>     the same next to another revision
+ *
+ *  Only uses what every version of the sketch has (setup, buttons, handleInput,
+ *  processLightTarget), so it builds against older revisions to compare with.
+ *  Every round is a 5 ms tick in which handleInput runs for all buttons and the
+ *  light channels follow their targets. Three scenarios:
+ *
+ *  - idle:     all buttons released
+ *  - taps:     all buttons tapping, single and double taps, calls that saw a
+ *              press or release are counted as event, the rest as taps
+ *  - fade:     all buttons held after a tap, the calls while fading
+ *
+ *  Per call the mean, median and p99 in ns are printed, the overhead of reading
+ *  the clock is subtracted. Single calls are short next to the clock, compare
+ *  the medians of a few runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define TICK                    5       // ms per round
+
+enum BENCH_KIND { BENCH_IDLE, BENCH_TAPS, BENCH_EVENT, BENCH_FADE, NR_BENCH_KINDS };
+
+const char *benchKindNames[ NR_BENCH_KINDS ] = { "idle", "taps", "event", "fade" };
+
+std::vector<double> samples[ NR_BENCH_KINDS ];
+
+double clock_overhead = 0;
+
+// -------------------------------------------------------- //
+
+double timeCall( int id )
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  handleInput( id );
+
+  return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() - clock_overhead;
+}
+
+// -------------------------------------------------------- //
+
+void calibrate()
+{
+  std::vector<double> empty;
+
+  for ( int i = 0; i < 100000; i++ )
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    empty.push_back( std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() );
+  }
+
+  std::sort( empty.begin(), empty.end() );
+
+  clock_overhead = empty[ empty.size() / 2 ];
+}
+
+// -------------------------------------------------------- //
+
+// One tick, level is the level of all button pins, kind what the calls count as
+//
+void tick( int level, int kind )
+{
+  hal_advance_micros( TICK * 1000UL );
+  now = millis();
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    hal_set_pin( buttonPins[i], level );
+  }
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    int last = buttons[i].last_state;
+    double ns = timeCall( i );
+
+    if ( 0 > kind ) { continue; }
+
+    samples[ ( BENCH_TAPS == kind && last != buttons[i].last_state ) ? BENCH_EVENT : kind ].push_back( ns );
+  }
+
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    processLightTarget( i );
+  }
+}
+
+void ticks( int count, int level, int kind )
+{
+  for ( int i = 0; i < count; i++ ) tick( level, kind );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  int rounds = ( 1 < argc ) ? atoi( argv[1] ) : 1000;
+
+  setup();
+  calibrate();
+
+  for ( int r = 0; r < rounds; r++ )
+  {
+    ticks( 100, LOW, BENCH_IDLE );
+
+    // Single tap, released long enough for any timeout to pass
+    //
+    ticks( 10, HIGH, BENCH_TAPS );
+    ticks( 200, LOW, BENCH_TAPS );
+
+    // Double tap
+    //
+    ticks( 10, HIGH, BENCH_TAPS );
+    ticks( 10, LOW, BENCH_TAPS );
+    ticks( 10, HIGH, BENCH_TAPS );
+    ticks( 200, LOW, BENCH_TAPS );
+
+    // Tap and hold for 2 s, the first 100 ms after the tap don't fade yet
+    //
+    ticks( 10, HIGH, -1 );
+    ticks( 10, LOW, -1 );
+    ticks( 100, HIGH, -1 );
+    ticks( 400, HIGH, BENCH_FADE );
+    ticks( 200, LOW, -1 );
+  }
+
+  printf( "handleInput ns     calls     mean   median      p99\n" );
+
+  for ( int k = 0; k < NR_BENCH_KINDS; k++ )
+  {
+    std::vector<double> &s = samples[k];
+
+    if ( s.empty() ) { continue; }
+
+    std::sort( s.begin(), s.end() );
+
+    double total = 0;
+
+    for ( size_t i = 0; i < s.size(); i++ ) total += s[i];
+
+    printf( "%-10s %12lu %8.1f %8.1f %8.1f\n", benchKindNames[k], (unsigned long)s.size(), total / s.size(), s[ s.size() / 2 ], s[ s.size() * 99 / 100 ] );
+  }
+
+  return 0;
+}
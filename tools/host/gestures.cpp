@@ -0,0 +1,609 @@
+/*
+ *  Deterministic replay and property based fuzzing of the button gestures
+ *
+ *    build/gestures [-n sequences] [-s seed] generated edge sequences
+ *    build/gestures -r <file>                    recorded edge sequences
+ *
+ *  The sketch runs on the stand-in HAL with the scheduler and the tasks of
+ *  setup(). The virtual clock jumps from one due task or button edge to the
+ *  next, so a sequence of a few seconds costs a few hundred runs of the input
+ *  task and millions of sequences fit in minutes.
+ *
+ *  A generated sequence is a burst of taps, a long press, a tap and hold with
+ *  reverses, or noise with bounces shorter than the sample period, on one
+ *  button. Clean sequences keep away from the PULSE_TIME and LONG_PRESS_TIME
+ *  borders so the gestures they must give are known up front. After every
+ *  sequence the button is released long enough for the state to get back to
+ *  GS_IDLE.
+ *
+ *  A recorded file has a line per edge, "<ms> <button> <0|1>" with the ms from
+ *  the start. A line "expect <ms> <channel> <target>" checks the target of a
+ *  light channel at that time, '#' starts a comment.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - the invariants of checkGesture in Dimmer.h (invariant_violations)
+ *  - targets and values of all light channels stay in range
+ *  - a fade moves at most 1 per step, keeps moving and turns at the borders
+ *  - clean sequences give the gestures they must
+ *
+ *  Serial output of the sketch, like the rule of a violated invariant, goes to
+ *  stdout. The run time of every input task run is measured on the host clock and
+ *  printed per kind of run: idle, a button event, or a button fading.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define SAMPLE_TIME             5       // ms, period of the input task
+#define MARGIN                  40      // ms clean sequences keep away from the time borders
+#define MAX_EDGES               64      // per sequence
+#define MAX_FADE_STILL          ( 2 * STEP_TIME + 3 * SAMPLE_TIME )       // ms a fade may stand still on a steady input
+#define MAX_FADE_BORDER         ( 3 * 2 * STEP_TIME + 2 * SAMPLE_TIME )   // ms a fade may stay at a border
+#define COST_BUCKETS            10000   // of 10 ns
+
+enum RUN_KIND { RUN_IDLE, RUN_EVENT, RUN_FADE, NR_RUN_KINDS };
+
+const char *runKindNames[ NR_RUN_KINDS ] = { "idle", "event", "fade" };
+
+struct Edge
+{
+  unsigned long time;                   // ms
+  int button;
+  int level;
+};
+
+struct Sequence
+{
+  int button;
+  int nr_edges;
+  Edge edges[ MAX_EDGES ];
+  boolean clean;                        // expected holds the gestures it must give
+  unsigned int expected[ NR_GESTURES ];
+  unsigned long end;                    // ms, released and back in GS_IDLE
+};
+
+struct Cost
+{
+  unsigned long runs;
+  double total;                         // ns
+  unsigned long max;                    // ns
+  unsigned long buckets[ COST_BUCKETS ];
+};
+
+Cost costs[ NR_RUN_KINDS ];
+
+unsigned long failures = 0;
+
+// Fade tracking per light channel
+//
+int fade_last_target[ NR_LIGHT_CHANNELS ];
+unsigned long fade_last_move[ NR_LIGHT_CHANNELS ];
+unsigned long fade_border_since[ NR_LIGHT_CHANNELS ];
+boolean fading[ NR_LIGHT_CHANNELS ];
+
+// ms of the last edge per button, a bouncing input holds the fade
+//
+unsigned long last_edge[ NR_BUTTONS ];
+
+// -------------------------------------------------------- //
+
+unsigned long long rnd_state = 88172645463325252ULL;
+
+unsigned long between( unsigned long low, unsigned long high )
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+
+  return low + (unsigned long)( rnd_state % ( high - low + 1 ) );
+}
+
+// -------------------------------------------------------- //
+
+void fail( const char *rule, int channel, const char *detail = "" )
+{
+  failures++;
+
+  if ( 10 >= failures )
+  {
+    printf( "FAIL %s: channel %d at %lu ms %s\n", rule, channel, millis(), detail );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void countCost( int kind, unsigned long ns )
+{
+  Cost *c = &costs[ kind ];
+
+  c->runs++;
+  c->total += ns;
+  c->max = max( c->max, ns );
+  c->buckets[ min( ns / 10, (unsigned long)COST_BUCKETS - 1 ) ]++;
+}
+
+unsigned long costPercentile( Cost *c, int percent )
+{
+  unsigned long count = 0;
+
+  for ( int i = 0; i < COST_BUCKETS; i++ )
+  {
+    count += c->buckets[i];
+
+    if ( 0 < count && count * 100 >= c->runs * percent ) { return i * 10; }
+  }
+
+  return c->max;
+}
+
+// -------------------------------------------------------- //
+
+// Range and fade checks over all light channels, after every input task run
+//
+void checkChannels()
+{
+  for ( int i = 0; i < NR_LIGHT_CHANNELS; i++ )
+  {
+    LightChannel *c = &l_channels[i];
+
+    if ( 0 > c->target_light_value || MAX_LIGHT_VALUE < c->target_light_value ||
+         0 > c->light_value || MAX_LIGHT_VALUE < c->light_value )
+    {
+      fail( "target in range", i );
+    }
+
+    boolean fade = c->has_button && GS_FADE == c->button->state && ACTION_FADE == c->button->actions[ GESTURE_FADE ];
+
+    if ( !fade )
+    {
+      fading[i] = false;
+      continue;
+    }
+
+    int target = c->target_light_value;
+    boolean border = 0 == target || MAX_LIGHT_VALUE == target;
+
+    if ( !fading[i] )
+    {
+      fading[i] = true;
+      fade_last_target[i]  = target;
+      fade_last_move[i]    = now;
+      fade_border_since[i] = now;
+      continue;
+    }
+
+    if ( 1 < abs( target - fade_last_target[i] ) )
+    {
+      fail( "fade moves one step at a time", i );
+    }
+
+    if ( target != fade_last_target[i] )
+    {
+      fade_last_move[i] = now;
+
+      if ( !( 0 == fade_last_target[i] || MAX_LIGHT_VALUE == fade_last_target[i] ) )
+      {
+        fade_border_since[i] = now;
+      }
+    }
+    else if ( !border && MAX_FADE_STILL < now - max( fade_last_move[i], last_edge[ c->button - buttons ] ) )
+    {
+      fail( "fade keeps moving", i );
+      fade_last_move[i] = now;
+    }
+
+    if ( !border )
+    {
+      fade_border_since[i] = now;
+    }
+    else if ( MAX_FADE_BORDER < now - fade_border_since[i] )
+    {
+      fail( "fade turns at the borders", i );
+      fade_border_since[i] = now;
+    }
+
+    fade_last_target[i] = target;
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Replaces the input task, times it and checks the channels after it
+//
+void timedInput()
+{
+  unsigned long events = button_events;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  inputDimmer();
+
+  unsigned long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+  int kind = RUN_IDLE;
+
+  if ( events != button_events )
+  {
+    kind = RUN_EVENT;
+  }
+  else
+  {
+    for ( int i = 0; i < NR_BUTTONS; i++ )
+    {
+      if ( GS_FADE == buttons[i].state ) { kind = RUN_FADE; break; }
+    }
+  }
+
+  countCost( kind, ns );
+
+  checkChannels();
+}
+
+// -------------------------------------------------------- //
+
+boolean taskDue()
+{
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    if ( tasks[i].period <= millis() - tasks[i].last_run ) { return true; }
+  }
+
+  return false;
+}
+
+unsigned long nextDue()
+{
+  unsigned long next = millis() + 1000;
+
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    next = min( next, tasks[i].last_run + tasks[i].period );
+  }
+
+  return next;
+}
+
+// -------------------------------------------------------- //
+
+// Run the sketch up to ms end, with the edges of the sequence on the pins in time
+//
+void run( Sequence *s, unsigned long end )
+{
+  int e = 0;
+
+  while ( e < s->nr_edges && s->edges[e].time < millis() ) { e++; }
+
+  while ( true )
+  {
+    unsigned long t = millis();
+
+    while ( e < s->nr_edges && s->edges[e].time <= t )
+    {
+      hal_set_pin( buttonPins[ s->edges[e].button ], s->edges[e].level );
+      last_edge[ s->edges[e].button ] = t;
+      e++;
+    }
+
+    for ( int i = 0; i <= NR_TASKS && taskDue(); i++ )
+    {
+      loop();
+    }
+
+    if ( t >= end ) { break; }
+
+    unsigned long next = nextDue();
+
+    if ( e < s->nr_edges ) { next = min( next, s->edges[e].time ); }
+
+    next = constrain( next, t + 1, end );
+
+    hal_set_micros( next * 1000 );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void addEdge( Sequence *s, unsigned long time, int level )
+{
+  if ( MAX_EDGES <= s->nr_edges ) { return; }
+
+  Edge *e = &s->edges[ s->nr_edges++ ];
+
+  e->time   = time;
+  e->button = s->button;
+  e->level  = level;
+}
+
+// Press from t for duration ms, with a bounce after both edges now and then.
+// Returns the time of the release.
+//
+unsigned long press( Sequence *s, unsigned long t, unsigned long duration )
+{
+  addEdge( s, t, HIGH );
+
+  if ( 0 == between( 0, 3 ) && 20 < duration )
+  {
+    unsigned long bounce = t + between( 6, 12 );
+
+    addEdge( s, bounce, LOW );
+    addEdge( s, bounce + between( 1, SAMPLE_TIME - 2 ), HIGH );
+  }
+
+  addEdge( s, t + duration, LOW );
+
+  return t + duration;
+}
+
+// -------------------------------------------------------- //
+
+void generate( Sequence *s, int button, unsigned long t )
+{
+  memset( s, 0, sizeof( Sequence ) );
+
+  s->button = button;
+  s->clean  = true;
+
+  unsigned long shortMax = PULSE_TIME - MARGIN;
+
+  switch ( between( 0, 4 ) )
+  {
+    case ( 0 ):                         // 1 to 4 taps
+    {
+      int taps = between( 1, 4 );
+
+      for ( int i = 0; i < taps; i++ )
+      {
+        t = press( s, t, between( 2 * SAMPLE_TIME + 5, shortMax ) ) + between( 2 * SAMPLE_TIME + 5, shortMax );
+      }
+
+      s->expected[ GESTURE_PRESS ]  = taps;
+      s->expected[ GESTURE_DOUBLE ] = ( 2 <= taps ) ? 1 : 0;
+      s->expected[ GESTURE_TRIPLE ] = ( 3 <= taps ) ? 1 : 0;
+      break;
+    }
+
+    case ( 1 ):                         // long press
+      t = press( s, t, between( LONG_PRESS_TIME + MARGIN, LONG_PRESS_TIME + 3000 ) );
+
+      s->expected[ GESTURE_PRESS ] = 1;
+      s->expected[ GESTURE_LONG ]  = 1;
+      break;
+
+    case ( 2 ):                         // tap and hold, reverse a few times
+    case ( 3 ):
+    {
+      t = press( s, t, between( 2 * SAMPLE_TIME + 5, shortMax ) ) + between( 2 * SAMPLE_TIME + 5, shortMax );
+      t = press( s, t, between( PULSE_TIME + MARGIN, 14000 ) );
+
+      int reverses = between( 0, 3 );
+
+      for ( int i = 0; i < reverses; i++ )
+      {
+        t += between( 2 * SAMPLE_TIME + 5, shortMax );
+        t = press( s, t, between( PULSE_TIME, 6000 ) );
+      }
+
+      s->expected[ GESTURE_PRESS ]   = 2;
+      s->expected[ GESTURE_FADE ]    = 1;
+      s->expected[ GESTURE_REVERSE ] = reverses;
+      break;
+    }
+
+    case ( 4 ):                         // noise, edges from bounces to long presses
+    {
+      int edges = between( 2, MAX_EDGES / 2 ) & ~1;
+
+      s->clean = false;
+
+      for ( int i = 0; i < edges; i++ )
+      {
+        addEdge( s, t, ( 0 == i % 2 ) ? HIGH : LOW );
+        t += ( 0 == between( 0, 2 ) ) ? between( 1, 2 * SAMPLE_TIME ) : between( 1, 2 * LONG_PRESS_TIME );
+      }
+
+      addEdge( s, t, LOW );
+      break;
+    }
+  }
+
+  s->end = t + between( PULSE_TIME + MARGIN, 2000 );
+}
+
+// -------------------------------------------------------- //
+
+void printSequence( Sequence *s )
+{
+  printf( "# button %d\n", s->button );
+
+  for ( int i = 0; i < s->nr_edges; i++ )
+  {
+    printf( "%lu %d %d\n", s->edges[i].time, s->edges[i].button, s->edges[i].level );
+  }
+}
+
+// Run a sequence and check the gestures it gave, false on any failure
+//
+boolean runSequence( Sequence *s )
+{
+  unsigned long failuresBefore   = failures;
+  unsigned int  violationsBefore = invariant_violations;
+  unsigned int  counts[ NR_GESTURES ];
+
+  memcpy( counts, gesture_counts, sizeof( counts ) );
+
+  run( s, s->end );
+
+  if ( GS_IDLE != buttons[ s->button ].state )
+  {
+    fail( "back in GS_IDLE after the sequence", -1 );
+  }
+
+  if ( s->clean )
+  {
+    for ( int g = GESTURE_PRESS; g < NR_GESTURES; g++ )
+    {
+      if ( s->expected[g] != gesture_counts[g] - counts[g] )
+      {
+        char detail[ 64 ];
+
+        snprintf( detail, sizeof( detail ), "gesture %d: %u expected, %u seen", g, s->expected[g], gesture_counts[g] - counts[g] );
+        fail( "clean sequence gives its gestures", -1, detail );
+      }
+    }
+  }
+
+  failures += invariant_violations - violationsBefore;
+
+  return failuresBefore == failures;
+}
+
+// -------------------------------------------------------- //
+
+int replay( const char *file )
+{
+  FILE *f = fopen( file, "r" );
+
+  if ( NULL == f )
+  {
+    printf( "Can't open %s\n", file );
+    return 2;
+  }
+
+  static Sequence s;
+  char line[ 128 ];
+  unsigned long last = 0;
+
+  memset( &s, 0, sizeof( s ) );
+
+  while ( fgets( line, sizeof( line ), f ) )
+  {
+    unsigned long time;
+    int button, level, channel, target;
+
+    if ( 3 == sscanf( line, "expect %lu %d %d", &time, &channel, &target ) )
+    {
+      s.end = time;
+      run( &s, time );
+
+      if ( target != l_channels[ channel ].target_light_value )
+      {
+        char detail[ 64 ];
+
+        snprintf( detail, sizeof( detail ), "target %d expected, %d seen", target, l_channels[ channel ].target_light_value );
+        fail( "replay", channel, detail );
+      }
+    }
+    else if ( 3 == sscanf( line, "%lu %d %d", &time, &button, &level ) && MAX_EDGES > s.nr_edges )
+    {
+      s.edges[ s.nr_edges ].time   = time;
+      s.edges[ s.nr_edges ].button = button;
+      s.edges[ s.nr_edges ].level  = level;
+      s.nr_edges++;
+      last = max( last, time );
+    }
+  }
+
+  fclose( f );
+
+  run( &s, max( last + 2000, millis() ) );
+
+  failures += invariant_violations;
+
+  printf( "%s: %d edges, %lu failures\n", file, s.nr_edges, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
+
+// -------------------------------------------------------- //
+
+void printCosts()
+{
+  printf( "input task ns    runs        mean     p50     p99     max\n" );
+
+  for ( int k = 0; k < NR_RUN_KINDS; k++ )
+  {
+    Cost *c = &costs[k];
+
+    if ( 0 == c->runs ) { continue; }
+
+    printf( "%-10s %12lu %11.0f %7lu %7lu %7lu\n", runKindNames[k], c->runs, c->total / c->runs,
+            costPercentile( c, 50 ), costPercentile( c, 99 ), c->max );
+  }
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  unsigned long sequences = 10000;
+  unsigned long long seed = 1;
+  const char *file = NULL;
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if      ( 0 == strcmp( argv[i], "-n" ) && i + 1 < argc ) sequences = strtoul( argv[++i], NULL, 10 );
+    else if ( 0 == strcmp( argv[i], "-s" ) && i + 1 < argc ) seed = strtoull( argv[++i], NULL, 10 );
+    else if ( 0 == strcmp( argv[i], "-r" ) && i + 1 < argc ) file = argv[++i];
+    else
+    {
+      printf( "usage: %s [-n sequences] [-s seed] [-r file]\n", argv[0] );
+      return 2;
+    }
+  }
+
+  hal_serial_echo = 1;
+
+  setup();
+
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    if ( &inputDimmer == tasks[i].function ) tasks[i].function = &timedInput;
+  }
+
+  if ( NULL != file )
+  {
+    return replay( file );
+  }
+
+  rnd_state ^= seed * 0x9E3779B97F4A7C15ULL;
+
+  // Buttons handleInput does anything for
+  //
+  int active[ NR_BUTTONS ];
+  int nr_active = 0;
+
+  for ( int i = 0; i < NR_BUTTONS; i++ )
+  {
+    Button *b = &buttons[i];
+
+    if ( 0 < b->nr_l_channels || 0 < b->nr_sw_channels || 0 <= b->group ) active[ nr_active++ ] = i;
+  }
+
+  static Sequence s;
+  unsigned long failed = 0;
+
+  for ( unsigned long n = 0; n < sequences; n++ )
+  {
+    generate( &s, active[ between( 0, nr_active - 1 ) ], millis() + 1 );
+
+    if ( !runSequence( &s ) && 3 > failed++ )
+    {
+      printf( "sequence %lu (seed %llu) failed:\n", n, seed );
+      printSequence( &s );
+    }
+  }
+
+  printf( "%lu sequences, %lu ms virtual time, %lu failed, %lu failures, %u invariant violations\n",
+          sequences, millis(), failed, failures, invariant_violations );
+
+  printCosts();
+
+  return ( 0 == failures ) ? 0 : 1;
+}
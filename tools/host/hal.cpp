@@ -0,0 +1,1002 @@
+/*
+ *  Stand-in HAL, implementation of the Arduino core, libraries and registers
+ *  the sketch uses, see hal.h
+ *
+ *  Pins are spread over fake ports of 8 so the relais still go through port
+ *  registers, no pin has a timer so every PWM write takes analogWrite.
+ */
+
+#include <stdio.h>
+#include <chrono>
+
+#include "WProgram.h"
+#include "EEPROM.h"
+#include "Wire.h"
+#include "Ethernet.h"
+#include "WebServer.h"
+#include "utility/w5100.h"
+#include "utility/socket.h"
+
+#include "hal.h"
+
+#define HAL_NR_PORTS            ( HAL_NR_PINS / 8 + 2 )
+#define HAL_EEPROM_LENGTH       ( E2END + 1 )
+#define HAL_NR_REQUESTS         16      // web requests queued at most
+#define HAL_REQUEST_LENGTH      128
+#define HAL_SOCKET_BUFFER       2048    // receive memory of a socket on the W5100
+
+// ----------------------------------------------------------------- //
+
+volatile HalSreg  SREG;
+volatile uint8_t  ADMUX, ADCSRA, ADCSRB, DIDR0, DIDR2, ADCL, ADCH;
+volatile uint16_t ADC;
+volatile uint8_t  UCSR1A, UCSR1B, UCSR1C, UBRR1H, UBRR1L;
+volatile uint16_t UBRR1;
+volatile HalUdr   UDR1;
+volatile uint8_t  TCCR5A, TCCR5B, TIFR5, TIMSK5;
+volatile HalTcnt  TCNT5;
+volatile uint8_t  OCR0A, OCR0B, OCR2A, OCR2B;
+volatile uint16_t OCR1A, OCR1B, OCR3A, OCR3B, OCR3C, OCR4A, OCR4B, OCR4C, OCR5A, OCR5B, OCR5C;
+
+int  __heap_start;
+int *__brkval = 0;
+
+HardwareSerial Serial;
+EEPROMClass    EEPROM;
+TwoWire        Wire;
+EthernetClass  Ethernet;
+W5100Class     W5100;
+
+int hal_serial_echo = 0;
+
+unsigned long hal_datagrams         = 0;
+unsigned long hal_i2c_transmissions = 0;
+unsigned long hal_eeprom_writes     = 0;
+unsigned long hal_uart_dropped      = 0;
+
+static unsigned long hal_us = 0;
+
+static volatile uint8_t hal_ports[ HAL_NR_PORTS ];
+static int  hal_inputs[ HAL_NR_PINS ];
+static int  hal_pwms[ HAL_NR_PINS ];
+static byte hal_eeprom[ HAL_EEPROM_LENGTH ];
+static boolean hal_eeprom_erased = false;
+
+// Socket of the W5100. Sn_RX_RD is rx_read, the received size only drops when a
+// Sock_RECV says the bytes up to Sn_RX_RD were taken. A TCP socket keeps what
+// the sketch wrote in tx until the harness takes it, a close doesn't drop it as
+// send of Arduino 0022 only returns once the bytes are out
+//
+struct HalSocket
+{
+  byte     status;                      // SnSR
+  uint16_t port;
+  byte     ip[4];                       // of the other end of a connect
+  uint16_t remote_port;
+  byte     rx[ HAL_SOCKET_BUFFER ];
+  uint16_t rx_length;                   // bytes received
+  uint16_t rx_read;                     // Sn_RX_RD
+  uint16_t rx_done;                     // Sn_RX_RD of the last Sock_RECV
+  byte     tx[ HAL_SOCKET_BUFFER ];
+  uint16_t tx_length;
+};
+
+static HalSocket hal_sockets[ MAX_SOCK_NUM ];
+
+static HalDatagram hal_sent[ HAL_NR_DATAGRAMS ];
+static int hal_sent_first  = 0;
+static int hal_sent_length = 0;
+
+static byte hal_ip[4], hal_netmask[4], hal_gateway[4];
+
+// Transmitter of UART1, a byte in the shift register and one waiting in UDR1.
+// hal_uart_us is the time of the transmitter, it runs behind hal_us until
+// hal_advance_micros catches it up
+//
+extern "C" void USART1_UDRE_vect( void );
+extern "C" void USART1_TX_vect( void );
+
+// Timer5 at prescaler 1 counts host ns instead of CPU cycles. Its overflow
+// interrupt runs when SREG is read, the last instruction before the sketch
+// turns interrupts off, so the count of overflows and TCNT5 agree like on the
+// ATmega. An overflow between that read and the one of TCNT5 leaves TOV5 set
+//
+extern "C" void TIMER5_OVF_vect( void );
+
+static boolean hal_timer5_running              = false;
+static unsigned long long hal_timer5_start     = 0;   // host ns TCNT5 was 0
+static unsigned long long hal_timer5_ticks     = 0;   // since then, kept while stopped
+static unsigned long long hal_timer5_overflows = 0;   // interrupts run
+
+static unsigned long hal_uart_us     = 0;
+static boolean hal_uart_shifting     = false;
+static unsigned long hal_uart_end    = 0;   // us the stop bits of the shift register are out
+static boolean hal_uart_full         = false;
+static uint8_t hal_uart_data;               // UDR1
+static boolean hal_uart_complete     = false; // TXC1
+
+static HalUartByte hal_uart_sent_bytes[ HAL_NR_UART_BYTES ];
+static int hal_uart_first  = 0;
+static int hal_uart_length = 0;
+
+static HalTransmission hal_transmission;    // the one being sent
+static HalTransmission hal_transmissions[ HAL_NR_TRANSMISSIONS ];
+static int hal_transmissions_first  = 0;
+static int hal_transmissions_length = 0;
+
+static char hal_requests[ HAL_NR_REQUESTS ][ HAL_REQUEST_LENGTH ];
+static int  hal_requests_first  = 0;
+static int  hal_requests_length = 0;
+
+static char hal_response[ HAL_RESPONSE_LENGTH ];
+static int  hal_response_length = 0;
+
+// ----------------------------------------------------------------- //
+// Harness side
+
+static void halUartRun();
+
+void hal_set_micros( unsigned long us )     { hal_us = hal_uart_us = us; }
+void hal_advance_micros( unsigned long us ) { hal_us += us; halUartRun(); }
+
+void hal_set_pin( int pin, int level )
+{
+  if ( 0 <= pin && HAL_NR_PINS > pin ) hal_inputs[ pin ] = level;
+}
+
+int hal_output( int pin )
+{
+  return ( hal_ports[ digitalPinToPort( pin ) ] & digitalPinToBitMask( pin ) ) ? HIGH : LOW;
+}
+
+int hal_pwm( int pin )
+{
+  return ( 0 <= pin && HAL_NR_PINS > pin ) ? hal_pwms[ pin ] : 0;
+}
+
+void hal_web_request( const char *path )
+{
+  if ( HAL_NR_REQUESTS <= hal_requests_length ) { return; }
+
+  char *r = hal_requests[ ( hal_requests_first + hal_requests_length ) % HAL_NR_REQUESTS ];
+
+  strncpy( r, path, HAL_REQUEST_LENGTH - 1 );
+  r[ HAL_REQUEST_LENGTH - 1 ] = '\0';
+
+  hal_requests_length++;
+}
+
+int hal_web_pending()                { return hal_requests_length; }
+const char *hal_web_response()       { return hal_response; }
+int hal_web_response_length()        { return hal_response_length; }
+
+int hal_udp_sent( HalDatagram *datagram )
+{
+  if ( 0 == hal_sent_length ) { return 0; }
+
+  *datagram = hal_sent[ hal_sent_first ];
+
+  hal_sent_first = ( hal_sent_first + 1 ) % HAL_NR_DATAGRAMS;
+  hal_sent_length--;
+
+  return 1;
+}
+
+int hal_udp_deliver( uint16_t local_port, const uint8_t *ip, uint16_t port, const uint8_t *data, int length )
+{
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    HalSocket *h = &hal_sockets[s];
+
+    if ( SnSR::UDP != h->status || local_port != h->port ) { continue; }
+
+    if ( HAL_SOCKET_BUFFER < h->rx_length + 8 + length ) { return 0; }
+
+    byte *p = &h->rx[ h->rx_length ];
+
+    memcpy( p, ip, 4 );
+    p[4] = port >> 8;
+    p[5] = port;
+    p[6] = length >> 8;
+    p[7] = length;
+    memcpy( &p[8], data, length );
+
+    h->rx_length += 8 + length;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+int hal_tcp_connecting( uint8_t *ip, uint16_t *port )
+{
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    if ( SnSR::SYNSENT != hal_sockets[s].status ) { continue; }
+
+    memcpy( ip, hal_sockets[s].ip, 4 );
+    *port = hal_sockets[s].remote_port;
+
+    return s;
+  }
+
+  return -1;
+}
+
+int hal_tcp_open( uint16_t port )
+{
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    if ( SnSR::LISTEN != hal_sockets[s].status || port != hal_sockets[s].port ) { continue; }
+
+    hal_sockets[s].status = SnSR::ESTABLISHED;
+
+    return s;
+  }
+
+  return -1;
+}
+
+void hal_tcp_accept( int s )
+{
+  if ( 0 <= s && MAX_SOCK_NUM > s && SnSR::SYNSENT == hal_sockets[s].status ) hal_sockets[s].status = SnSR::ESTABLISHED;
+}
+
+void hal_tcp_close( int s )
+{
+  if ( 0 > s || MAX_SOCK_NUM <= s ) { return; }
+
+  HalSocket *h = &hal_sockets[s];
+
+  if      ( SnSR::ESTABLISHED == h->status ) h->status = SnSR::CLOSE_WAIT;
+  else if ( SnSR::SYNSENT == h->status )     close( s );
+}
+
+int hal_tcp_sent( int s, uint8_t *data, int length )
+{
+  if ( 0 > s || MAX_SOCK_NUM <= s ) { return 0; }
+
+  HalSocket *h = &hal_sockets[s];
+  int n = min( length, (int)h->tx_length );
+
+  memcpy( data, h->tx, n );
+  memmove( h->tx, &h->tx[n], h->tx_length - n );
+  h->tx_length -= n;
+
+  return n;
+}
+
+int hal_tcp_deliver( int s, const uint8_t *data, int length )
+{
+  if ( 0 > s || MAX_SOCK_NUM <= s ) { return 0; }
+
+  HalSocket *h = &hal_sockets[s];
+
+  if ( SnSR::ESTABLISHED != h->status || HAL_SOCKET_BUFFER < h->rx_length + length ) { return 0; }
+
+  memcpy( &h->rx[ h->rx_length ], data, length );
+  h->rx_length += length;
+
+  return 1;
+}
+
+int hal_uart_sent( HalUartByte *b )
+{
+  if ( 0 == hal_uart_length ) { return 0; }
+
+  *b = hal_uart_sent_bytes[ hal_uart_first ];
+
+  hal_uart_first = ( hal_uart_first + 1 ) % HAL_NR_UART_BYTES;
+  hal_uart_length--;
+
+  return 1;
+}
+
+int hal_i2c_sent( HalTransmission *t )
+{
+  if ( 0 == hal_transmissions_length ) { return 0; }
+
+  *t = hal_transmissions[ hal_transmissions_first ];
+
+  hal_transmissions_first = ( hal_transmissions_first + 1 ) % HAL_NR_TRANSMISSIONS;
+  hal_transmissions_length--;
+
+  return 1;
+}
+
+void hal_address( uint8_t *ip, uint8_t *netmask, uint8_t *gateway )
+{
+  memcpy( ip, hal_ip, 4 );
+  memcpy( netmask, hal_netmask, 4 );
+  memcpy( gateway, hal_gateway, 4 );
+}
+
+// ----------------------------------------------------------------- //
+// Core
+
+unsigned long millis()                   { return hal_us / 1000; }
+unsigned long micros()                   { return hal_us; }
+void delay( unsigned long ms )           { hal_advance_micros( ms * 1000 ); }
+void delayMicroseconds( unsigned int us ) { hal_advance_micros( us ); }
+
+uint8_t digitalPinToPort( int pin )      { return 1 + pin / 8; }
+uint8_t digitalPinToBitMask( int pin )   { return 1 << ( pin % 8 ); }
+uint8_t digitalPinToTimer( int pin )     { return NOT_ON_TIMER; }
+
+volatile uint8_t *portOutputRegister( uint8_t port )
+{
+  return ( HAL_NR_PORTS > port ) ? &hal_ports[ port ] : NULL;
+}
+
+void pinMode( int pin, int mode ) {}
+
+int digitalRead( int pin )
+{
+  return ( 0 <= pin && HAL_NR_PINS > pin ) ? hal_inputs[ pin ] : LOW;
+}
+
+void digitalWrite( int pin, int value )
+{
+  if ( 0 > pin || HAL_NR_PINS <= pin ) { return; }
+
+  if ( value ) hal_ports[ digitalPinToPort( pin ) ] |= digitalPinToBitMask( pin );
+  else         hal_ports[ digitalPinToPort( pin ) ] &= ~digitalPinToBitMask( pin );
+}
+
+void analogWrite( int pin, int value )
+{
+  if ( 0 > pin || HAL_NR_PINS <= pin ) { return; }
+
+  hal_pwms[ pin ] = value;
+  digitalWrite( pin, 0 < value );
+}
+
+int analogRead( int pin ) { return 0; }
+
+long map( long x, long in_min, long in_max, long out_min, long out_max )
+{
+  return ( x - in_min ) * ( out_max - out_min ) / ( in_max - in_min ) + out_min;
+}
+
+char *ultoa( unsigned long value, char *s, int base )
+{
+  char buf[ 8 * sizeof( long ) + 1 ];
+  int i = 0;
+
+  do
+  {
+    int d = value % base;
+    buf[ i++ ] = ( 10 > d ) ? '0' + d : 'a' + d - 10;
+    value /= base;
+  }
+  while ( 0 != value );
+
+  for ( int j = 0; j < i; j++ ) s[j] = buf[ i - 1 - j ];
+  s[i] = '\0';
+
+  return s;
+}
+
+char *ltoa( long value, char *s, int base )
+{
+  if ( 0 > value && 10 == base )
+  {
+    s[0] = '-';
+    ultoa( -(unsigned long)value, &s[1], base );
+    return s;
+  }
+
+  return ultoa( (unsigned long)value, s, base );
+}
+
+// int is 16 bits on the AVR, other bases print the 16 bit two's complement
+//
+char *itoa( int value, char *s, int base )
+{
+  return ( 10 == base ) ? ltoa( value, s, base ) : ultoa( (uint16_t)value, s, base );
+}
+
+// ----------------------------------------------------------------- //
+// Print
+
+void Print::write( const char *str )
+{
+  while ( *str ) write( (uint8_t)*str++ );
+}
+
+void Print::write( const uint8_t *buffer, size_t size )
+{
+  while ( size-- ) write( *buffer++ );
+}
+
+void Print::print( const char s[] )            { write( s ); }
+void Print::print( char c, int base )          { if ( 0 == base ) write( (uint8_t)c ); else print( (long)c, base ); }
+void Print::print( unsigned char b, int base ) { if ( 0 == base ) write( b ); else print( (unsigned long)b, base ); }
+void Print::print( int n, int base )           { print( (long)n, base ); }
+void Print::print( unsigned int n, int base )  { print( (unsigned long)n, base ); }
+
+void Print::print( long n, int base )
+{
+  char buf[ 8 * sizeof( long ) + 2 ];
+  write( ltoa( n, buf, base ) );
+}
+
+void Print::print( unsigned long n, int base )
+{
+  char buf[ 8 * sizeof( long ) + 1 ];
+  write( ultoa( n, buf, base ) );
+}
+
+void Print::print( double n, int digits )
+{
+  char buf[ 32 ];
+  snprintf( buf, sizeof( buf ), "%.*f", digits, n );
+  write( buf );
+}
+
+void Print::println( const char s[] )  { print( s ); println(); }
+void Print::println( int n, int base ) { print( n, base ); println(); }
+void Print::println()                  { write( "\r\n" ); }
+
+void HardwareSerial::begin( long baud ) {}
+int  HardwareSerial::available()        { return 0; }
+int  HardwareSerial::read()             { return -1; }
+void HardwareSerial::flush()            {}
+
+void HardwareSerial::write( uint8_t c )
+{
+  if ( hal_serial_echo ) putchar( c );
+}
+
+// ----------------------------------------------------------------- //
+// EEPROM and I2C
+
+uint8_t EEPROMClass::read( int address )
+{
+  if ( !hal_eeprom_erased )
+  {
+    memset( hal_eeprom, 0xFF, sizeof( hal_eeprom ) );
+    hal_eeprom_erased = true;
+  }
+
+  return ( 0 <= address && HAL_EEPROM_LENGTH > address ) ? hal_eeprom[ address ] : 0xFF;
+}
+
+void EEPROMClass::write( int address, uint8_t value )
+{
+  read( 0 );
+
+  if ( 0 <= address && HAL_EEPROM_LENGTH > address ) hal_eeprom[ address ] = value;
+
+  hal_eeprom_writes++;
+}
+
+// A byte is 8 bits and the acknowledge, start and stop take about a bit each
+//
+void TwoWire::begin() {}
+
+void TwoWire::beginTransmission( uint8_t address )
+{
+  hal_transmission.us      = hal_us;
+  hal_transmission.address = address;
+  hal_transmission.length  = 0;
+  hal_transmission.dropped = 0;
+}
+
+uint8_t TwoWire::endTransmission()
+{
+  HalTransmission *t = &hal_transmission;
+
+  t->bus_us = ( ( 1 + t->length ) * 9 + 2 ) * 1000000UL / HAL_I2C_CLOCK;
+
+  hal_advance_micros( t->bus_us );
+  hal_i2c_transmissions++;
+
+  if ( HAL_NR_TRANSMISSIONS <= hal_transmissions_length ) { return 0; }
+
+  hal_transmissions[ ( hal_transmissions_first + hal_transmissions_length++ ) % HAL_NR_TRANSMISSIONS ] = *t;
+
+  return 0;
+}
+
+void TwoWire::send( uint8_t data )
+{
+  if ( BUFFER_LENGTH > hal_transmission.length ) hal_transmission.data[ hal_transmission.length++ ] = data;
+  else hal_transmission.dropped++;
+}
+
+void TwoWire::send( uint8_t *data, uint8_t length )
+{
+  for ( int i = 0; i < length; i++ ) send( data[i] );
+}
+
+// ----------------------------------------------------------------- //
+// UART1, only the transmitter. A bit takes UBRR1 + 1 us at 16 MHz
+
+static void halUartShift( uint8_t data )
+{
+  HalUartByte *b = &hal_uart_sent_bytes[ ( hal_uart_first + hal_uart_length ) % HAL_NR_UART_BYTES ];
+
+  b->us     = hal_uart_us;
+  b->bit_us = UBRR1 + 1;
+  b->bits   = 1 + 8 + ( bit_is_set( UCSR1C, USBS1 ) ? 2 : 1 );
+  b->data   = data;
+
+  if ( HAL_NR_UART_BYTES > hal_uart_length ) hal_uart_length++;
+  else hal_uart_dropped++;
+
+  hal_uart_shifting = true;
+  hal_uart_end      = hal_uart_us + b->bits * b->bit_us;
+}
+
+void HalUdr::operator=( uint8_t data ) volatile
+{
+  if ( !bit_is_set( UCSR1B, TXEN1 ) ) { return; }
+
+  if ( !hal_uart_shifting ) { halUartShift( data ); }
+  else
+  {
+    hal_uart_data = data;
+    hal_uart_full = true;
+  }
+}
+
+// Ticks of Timer5 since TCNT5 was 0, it only runs at prescaler 1
+//
+static unsigned long long halTimer5()
+{
+  if ( _BV( CS50 ) != ( TCCR5B & 0x07 ) )
+  {
+    hal_timer5_running = false;
+    return hal_timer5_ticks;
+  }
+
+  unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+
+  if ( !hal_timer5_running )
+  {
+    hal_timer5_start   = ns - hal_timer5_ticks;
+    hal_timer5_running = true;
+  }
+
+  return hal_timer5_ticks = ns - hal_timer5_start;
+}
+
+HalSreg::operator uint8_t() volatile
+{
+  unsigned long long overflows = halTimer5() >> 16;
+
+  while ( bit_is_set( TIMSK5, TOIE5 ) && hal_timer5_overflows < overflows )
+  {
+    hal_timer5_overflows++;
+    TIFR5 &= ~_BV( TOV5 );
+    TIMER5_OVF_vect();
+  }
+
+  return value;
+}
+
+HalTcnt::operator uint16_t() volatile
+{
+  unsigned long long ticks = halTimer5();
+
+  if ( hal_timer5_overflows < ( ticks >> 16 ) ) TIFR5 |= _BV( TOV5 );
+
+  return ticks & 0xFFFF;
+}
+
+void HalTcnt::operator=( uint16_t count ) volatile
+{
+  hal_timer5_ticks     = count;
+  hal_timer5_running   = false;
+  hal_timer5_overflows = 0;
+}
+
+// Catch the transmitter up with hal_us, a handler runs at the time its flag is
+// set. Writing a 1 to TXC1 clears it, like it does on the ATmega
+//
+static void halUartRun()
+{
+  if ( !bit_is_set( UCSR1B, TXEN1 ) ) { hal_uart_us = hal_us; return; }
+
+  for ( ;; )
+  {
+    if ( bit_is_set( UCSR1A, TXC1 ) )
+    {
+      UCSR1A &= ~_BV( TXC1 );
+      hal_uart_complete = false;
+    }
+
+    if ( bit_is_set( UCSR1B, UDRIE1 ) && !hal_uart_full )
+    {
+      USART1_UDRE_vect();
+    }
+    else if ( bit_is_set( UCSR1B, TXCIE1 ) && hal_uart_complete )
+    {
+      hal_uart_complete = false;
+      USART1_TX_vect();
+    }
+    else if ( hal_uart_shifting && hal_us >= hal_uart_end )
+    {
+      hal_uart_us       = hal_uart_end;
+      hal_uart_shifting = false;
+
+      if ( hal_uart_full )
+      {
+        hal_uart_full = false;
+        halUartShift( hal_uart_data );
+      }
+      else hal_uart_complete = true;
+    }
+    else break;
+  }
+
+  hal_uart_us = hal_us;
+}
+
+// ----------------------------------------------------------------- //
+// W5100, UDP sockets take datagrams from hal_udp_deliver, TCP sockets connect
+// to the harness
+
+void W5100Class::recv_data_processing( uint8_t s, uint8_t *data, uint16_t len, uint8_t peek )
+{
+  if ( MAX_SOCK_NUM <= s ) { return; }
+
+  HalSocket *h = &hal_sockets[s];
+  int n = min( (int)len, h->rx_length - h->rx_read );
+
+  memcpy( data, &h->rx[ h->rx_read ], max( n, 0 ) );
+
+  if ( !peek ) h->rx_read += len;
+}
+
+uint16_t W5100Class::readSnRX_RD( uint8_t s )              { return ( MAX_SOCK_NUM > s ) ? hal_sockets[s].rx_read : 0; }
+void W5100Class::writeSnRX_RD( uint8_t s, uint16_t value ) { if ( MAX_SOCK_NUM > s ) hal_sockets[s].rx_read = value; }
+uint8_t W5100Class::readSnSR( uint8_t s )                  { return ( MAX_SOCK_NUM > s ) ? hal_sockets[s].status : SnSR::CLOSED; }
+
+uint16_t W5100Class::getRXReceivedSize( uint8_t s )
+{
+  return ( MAX_SOCK_NUM > s ) ? hal_sockets[s].rx_length - hal_sockets[s].rx_done : 0;
+}
+
+// A Sock_RECV frees what was read, the rest moves to the front of the buffer
+//
+void W5100Class::execCmdSn( uint8_t s, SockCMD cmd )
+{
+  if ( MAX_SOCK_NUM <= s ) { return; }
+
+  HalSocket *h = &hal_sockets[s];
+
+  if ( Sock_CLOSE == cmd ) close( s );
+
+  if ( Sock_RECV != cmd ) { return; }
+
+  uint16_t done = min( h->rx_read, h->rx_length );
+
+  memmove( h->rx, &h->rx[ done ], h->rx_length - done );
+
+  h->rx_length -= done;
+  h->rx_read   -= done;
+  h->rx_done    = h->rx_read;
+}
+
+void W5100Class::setIPAddress( uint8_t *addr )             { memcpy( hal_ip, addr, 4 ); }
+void W5100Class::getIPAddress( uint8_t *addr )             { memcpy( addr, hal_ip, 4 ); }
+void W5100Class::setSubnetMask( uint8_t *addr )            { memcpy( hal_netmask, addr, 4 ); }
+void W5100Class::setGatewayIp( uint8_t *addr )             { memcpy( hal_gateway, addr, 4 ); }
+
+uint8_t socket( SOCKET s, uint8_t protocol, uint16_t port, uint8_t flag )
+{
+  if ( MAX_SOCK_NUM <= s ) { return 0; }
+
+  close( s );
+
+  hal_sockets[s].status    = ( SnMR::UDP == ( protocol & 0x0F ) ) ? SnSR::UDP : SnSR::INIT;
+  hal_sockets[s].port      = port;
+  hal_sockets[s].tx_length = 0;
+
+  return 1;
+}
+
+// The socket waits for the SYN ACK until the harness accepts, see hal_tcp_accept
+//
+uint8_t connect( SOCKET s, uint8_t *addr, uint16_t port )
+{
+  if ( MAX_SOCK_NUM <= s ) { return 0; }
+
+  hal_sockets[s].status      = SnSR::SYNSENT;
+  hal_sockets[s].remote_port = port;
+  memcpy( hal_sockets[s].ip, addr, 4 );
+
+  return 1;
+}
+
+void close( SOCKET s )
+{
+  if ( MAX_SOCK_NUM <= s ) { return; }
+
+  hal_sockets[s].status    = SnSR::CLOSED;
+  hal_sockets[s].rx_length = 0;
+  hal_sockets[s].rx_read   = 0;
+  hal_sockets[s].rx_done   = 0;
+}
+
+uint16_t sendto( SOCKET s, const uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port )
+{
+  if ( MAX_SOCK_NUM <= s || SnSR::UDP != hal_sockets[s].status ) { return 0; }
+
+  hal_datagrams++;
+
+  if ( HAL_NR_DATAGRAMS <= hal_sent_length ) { return len; }
+
+  HalDatagram *d = &hal_sent[ ( hal_sent_first + hal_sent_length++ ) % HAL_NR_DATAGRAMS ];
+
+  d->local_port = hal_sockets[s].port;
+  memcpy( d->ip, addr, 4 );
+  d->port   = port;
+  d->length = min( (int)len, HAL_DATAGRAM_LENGTH );
+  memcpy( d->data, buf, d->length );
+
+  return len;
+}
+
+// Not used by the sketch, it reads with readUdp in Network.h
+//
+uint16_t recvfrom( SOCKET s, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port )
+{
+  return 0;
+}
+
+// ----------------------------------------------------------------- //
+// Ethernet
+
+void EthernetClass::begin( uint8_t *mac, uint8_t *ip )
+{
+  W5100.setIPAddress( ip );
+}
+
+void EthernetClass::begin( uint8_t *mac, uint8_t *ip, uint8_t *gateway )
+{
+  W5100.setIPAddress( ip );
+  W5100.setGatewayIp( gateway );
+}
+
+void EthernetClass::begin( uint8_t *mac, uint8_t *ip, uint8_t *gateway, uint8_t *subnet )
+{
+  W5100.setIPAddress( ip );
+  W5100.setGatewayIp( gateway );
+  W5100.setSubnetMask( subnet );
+}
+
+static SOCKET halFreeSocket()
+{
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    if ( SnSR::CLOSED == hal_sockets[s].status ) { return s; }
+  }
+
+  return MAX_SOCK_NUM;
+}
+
+Client::Client( uint8_t sock ) : _sock( sock ), _port( 0 ) {}
+Client::Client( uint8_t *ip, uint16_t port ) : _sock( MAX_SOCK_NUM ), _port( port ) {}
+
+uint8_t Client::status()  { return W5100.readSnSR( _sock ); }
+
+// Nobody listens on the host, the connect fails like it would after the timeout
+//
+uint8_t Client::connect() { return 0; }
+
+void Client::write( uint8_t b )
+{
+  if ( SnSR::ESTABLISHED != status() ) { return; }
+
+  HalSocket *h = &hal_sockets[ _sock ];
+
+  if ( HAL_SOCKET_BUFFER > h->tx_length ) h->tx[ h->tx_length++ ] = b;
+}
+
+void Client::write( const char *str )                 { Print::write( str ); }
+void Client::write( const uint8_t *buf, size_t size ) { Print::write( buf, size ); }
+
+int Client::available()
+{
+  uint8_t s = status();
+
+  return ( SnSR::ESTABLISHED == s || SnSR::CLOSE_WAIT == s ) ? W5100.getRXReceivedSize( _sock ) : 0;
+}
+
+int Client::read()
+{
+  if ( 0 == available() ) { return -1; }
+
+  byte b;
+
+  W5100.recv_data_processing( _sock, &b, 1 );
+  W5100.execCmdSn( _sock, Sock_RECV );
+
+  return b;
+}
+
+int Client::peek()
+{
+  if ( 0 == available() ) { return -1; }
+
+  byte b;
+
+  W5100.recv_data_processing( _sock, &b, 1, 1 );
+
+  return b;
+}
+
+void Client::flush()      { while ( 0 < available() ) read(); }
+void Client::stop()       { close( _sock ); _sock = MAX_SOCK_NUM; }
+
+// Like the Ethernet library, a socket closed by the other end stays connected
+// while there is data left to read
+//
+uint8_t Client::connected()
+{
+  if ( MAX_SOCK_NUM == _sock ) { return 0; }
+
+  uint8_t s = status();
+
+  return !( SnSR::LISTEN == s || SnSR::CLOSED == s || ( SnSR::CLOSE_WAIT == s && !available() ) );
+}
+
+Client::operator bool()   { return MAX_SOCK_NUM != _sock; }
+
+Server::Server( uint16_t port ) : _port( port ) {}
+
+// A listening socket is taken like on the W5100, so the socket budget is the same
+//
+void Server::begin()
+{
+  SOCKET s = halFreeSocket();
+
+  if ( MAX_SOCK_NUM == s ) { return; }
+
+  socket( s, SnMR::TCP, _port, 0 );
+  hal_sockets[s].status = SnSR::LISTEN;
+}
+
+// Like Arduino 0022 the listening socket becomes the connection, the server
+// listens again on the next free socket. Only a connection with something to
+// read is handed out, closed ones without are dropped
+//
+Client Server::available()
+{
+  boolean listening = false;
+
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    Client client( s );
+
+    if ( _port != hal_sockets[s].port ) { continue; }
+
+    if      ( SnSR::LISTEN == client.status() ) listening = true;
+    else if ( SnSR::CLOSE_WAIT == client.status() && !client.available() ) client.stop();
+  }
+
+  if ( !listening ) begin();
+
+  for ( SOCKET s = 0; s < MAX_SOCK_NUM; s++ )
+  {
+    Client client( s );
+
+    if ( _port != hal_sockets[s].port ) { continue; }
+
+    if ( ( SnSR::ESTABLISHED == client.status() || SnSR::CLOSE_WAIT == client.status() ) && client.available() )
+    {
+      return client;
+    }
+  }
+
+  return Client( MAX_SOCK_NUM );
+}
+
+void Server::write( uint8_t ) {}
+
+// ----------------------------------------------------------------- //
+// Webduino
+
+void WebServer::begin()                           { m_server.begin(); }
+void WebServer::setDefaultCommand( Command *cmd ) { m_defaultCmd = cmd; }
+void WebServer::setFailureCommand( Command *cmd ) { m_failureCmd = cmd; }
+
+void WebServer::addCommand( const char *verb, Command *cmd )
+{
+  if ( m_cmdLimit <= m_cmdCount ) { return; }
+
+  m_verbs[ m_cmdCount ]    = verb;
+  m_commands[ m_cmdCount ] = cmd;
+  m_cmdCount++;
+}
+
+void WebServer::printP( const prog_uchar *str ) { write( (const char *)str ); }
+void WebServer::printCRLF()                     { write( "\r\n" ); }
+
+void WebServer::write( uint8_t c )
+{
+  if ( HAL_RESPONSE_LENGTH - 1 > hal_response_length ) hal_response[ hal_response_length++ ] = c;
+
+  hal_response[ hal_response_length ] = '\0';
+}
+
+void WebServer::write( const char *str )                 { Print::write( str ); }
+void WebServer::write( const uint8_t *buf, size_t size ) { Print::write( buf, size ); }
+
+void WebServer::httpFail()
+{
+  write( "HTTP/1.0 400 Bad Request\r\nContent-Type: text/html\r\n\r\nEPIC FAIL" );
+}
+
+void WebServer::httpSuccess( const char *contentType, const char *extraHeaders )
+{
+  write( "HTTP/1.0 200 OK\r\nContent-Type: " );
+  write( contentType );
+  write( "\r\n" );
+
+  if ( extraHeaders ) write( extraHeaders );
+
+  write( "\r\n" );
+}
+
+// Older sketches pass false for no extra headers
+//
+void WebServer::httpSuccess( const char *contentType, bool noExtraHeaders )
+{
+  httpSuccess( contentType, (const char *)0 );
+}
+
+// Serve one queued request, the verb is the path up to '?' or '/' like Webduino
+// splits it, the rest is the url tail. The failure command gets the whole path
+//
+void WebServer::processConnection()
+{
+  if ( 0 == hal_requests_length ) { return; }
+
+  char request[ HAL_REQUEST_LENGTH ];
+
+  strcpy( request, hal_requests[ hal_requests_first ] );
+  hal_requests_first = ( hal_requests_first + 1 ) % HAL_NR_REQUESTS;
+  hal_requests_length--;
+
+  hal_response_length = 0;
+  hal_response[0] = '\0';
+
+  char *path = request;
+  size_t prefix = strlen( m_urlPrefix );
+
+  if ( '/' == *path ) path++;
+  if ( 0 == strncmp( path, m_urlPrefix, prefix ) ) path += prefix;
+  if ( '/' == *path ) path++;
+
+  if ( '\0' == *path )
+  {
+    if ( m_defaultCmd ) m_defaultCmd( *this, GET, path, true );
+    return;
+  }
+
+  size_t verb = strcspn( path, "?/" );
+  char *tail = ( '\0' == path[ verb ] ) ? &path[ verb ] : &path[ verb + 1 ];
+
+  for ( int i = 0; i < m_cmdCount; i++ )
+  {
+    if ( strlen( m_verbs[i] ) == verb && 0 == strncmp( m_verbs[i], path, verb ) )
+    {
+      path[ verb ] = '\0';
+      m_commands[i]( *this, GET, tail, true );
+      return;
+    }
+  }
+
+  if ( m_failureCmd ) m_failureCmd( *this, GET, request, true );
+  else httpFail();
+}
+
+void WebServer::processConnection( char *buff, int *bufflen )
+{
+  processConnection();
+}
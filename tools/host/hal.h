@@ -0,0 +1,136 @@
+/*
+ *  Stand-in HAL, the side the harness drives
+ *
+ *  The sketch runs unchanged on top of the headers in arduino/. Instead of
+ *  hardware the harness sets the virtual clock and the button pins, reads the
+ *  outputs back and talks to the web server over a loopback.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#define HAL_NR_PINS             70      // digital pins of the Mega
+#define HAL_RESPONSE_LENGTH     4096    // bytes of a web response kept for the harness
+
+// Virtual clock, millis() and micros() only move when the harness says so
+//
+void hal_set_micros( unsigned long us );
+void hal_advance_micros( unsigned long us );
+
+// Level of an input pin as digitalRead will see it
+//
+void hal_set_pin( int pin, int level );
+
+// Last level written to an output pin, directly or through its port register
+//
+int  hal_output( int pin );
+
+// Last value written with analogWrite
+//
+int  hal_pwm( int pin );
+
+// Queue a request ("setLightChannel?1=255") for the next processConnection
+//
+void hal_web_request( const char *path );
+int  hal_web_pending();
+
+// Response of the last request served, and its length
+//
+const char *hal_web_response();
+int  hal_web_response_length();
+
+// UDP. Datagrams sent are kept until the harness takes them, the oldest first,
+// when HAL_NR_DATAGRAMS are waiting more are only counted. A datagram delivered
+// to a port lands in the receive buffer of the UDP socket open on it, with the
+// header the W5100 puts in front, returns 0 when there is no such socket or the
+// buffer is full.
+//
+#define HAL_NR_DATAGRAMS        16
+#define HAL_DATAGRAM_LENGTH     512
+
+struct HalDatagram
+{
+  uint16_t local_port;                  // of the socket it was sent from
+  uint8_t  ip[4];                       // destination
+  uint16_t port;
+  int      length;                      // bytes past HAL_DATAGRAM_LENGTH are cut off
+  uint8_t  data[ HAL_DATAGRAM_LENGTH ];
+};
+
+int hal_udp_sent( HalDatagram *datagram );
+int hal_udp_deliver( uint16_t local_port, const uint8_t *ip, uint16_t port, const uint8_t *data, int length );
+
+// TCP. A connect of the sketch waits in SYNSENT until the harness accepts it or
+// refuses it with hal_tcp_close, hal_tcp_connecting returns such a socket, -1
+// when there is none. hal_tcp_open connects the harness to a Server of the
+// sketch listening on port and returns its socket, -1 when none listens. What
+// the sketch writes on an established socket is kept until the harness takes
+// it, hal_tcp_deliver hands it bytes to read and returns 0 when they don't fit.
+// hal_tcp_close on an established socket closes the other end, the sketch can
+// still read what is left.
+//
+int  hal_tcp_connecting( uint8_t *ip, uint16_t *port );
+int  hal_tcp_open( uint16_t port );
+void hal_tcp_accept( int s );
+void hal_tcp_close( int s );
+int  hal_tcp_sent( int s, uint8_t *data, int length );
+int  hal_tcp_deliver( int s, const uint8_t *data, int length );
+
+// UART1. The transmitter shifts out what is written to UDR1 at the rate of
+// UBRR1 while the virtual clock moves, and calls the UDRE and TX complete
+// handlers of the sketch when they are enabled, like the ATmega does. Every byte
+// is kept until the harness takes it, the oldest first, past HAL_NR_UART_BYTES
+// more are only counted.
+//
+#define HAL_NR_UART_BYTES       2048
+
+struct HalUartByte
+{
+  unsigned long us;                     // start bit goes out
+  unsigned int  bit_us;                 // length of a bit
+  int           bits;                   // start, data and stop bits
+  uint8_t       data;
+};
+
+int hal_uart_sent( HalUartByte *b );
+
+extern unsigned long hal_uart_dropped;
+
+// I2C. A transmission takes the bus for the time its bytes need at
+// HAL_I2C_CLOCK, endTransmission moves the virtual clock by that like the
+// Wire of Arduino waits for it. Every address is acknowledged. Transmissions
+// are kept until the harness takes them, the oldest first, past
+// HAL_NR_TRANSMISSIONS more are only counted.
+//
+#define HAL_I2C_CLOCK           100000  // Hz, TWI_FREQ of Wire
+#define HAL_NR_TRANSMISSIONS    64
+
+struct HalTransmission
+{
+  unsigned long us;                     // start condition
+  unsigned long bus_us;                 // start to stop
+  uint8_t address;
+  int     length;                       // bytes kept, Wire keeps BUFFER_LENGTH
+  int     dropped;                      // bytes sent past BUFFER_LENGTH
+  uint8_t data[ 32 ];
+};
+
+int hal_i2c_sent( HalTransmission *t );
+
+// Address, netmask and gateway the W5100 was last set to
+//
+void hal_address( uint8_t *ip, uint8_t *netmask, uint8_t *gateway );
+
+// Datagrams, I2C transmissions and EEPROM cells written since the start
+//
+extern unsigned long hal_datagrams;
+extern unsigned long hal_i2c_transmissions;
+extern unsigned long hal_eeprom_writes;
+
+// Serial output goes to stdout when set, else it is dropped
+//
+extern int hal_serial_echo;
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ *  Load test of the web API on the host build, the scenarios of loadtest.py
+ *
+ *    build/load [-t seconds] [scenario ...]
+ *
+ *  The sketch runs setup() and its tasks, the virtual clock moves a ms per run
+ *  of loop(). Clients queue requests on the loopback of the HAL, which serves one
+ *  per processConnection in the order they came, like the W5100 hands sockets to
+ *  the web task. Every scenario starts with resetTasks(), like getTasks?reset of
+ *  loadtest.py, and runs seconds of virtual time (default 20):
+ *
+ *  - idle:     no requests, the baseline of the input task
+ *  - poll:     3 clients polling getLightChannels / getSwitchChannels back to back
+ *  - burst:    2 sliders, setLightChannel steps with 10 ms between an answer and
+ *              the next step
+ *  - mixed:    2 pollers and a slider
+ *
+ *  The slow clients of loadtest.py can't be modelled, a request on the loopback
+ *  arrives whole.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - every request is served, a get answers 200 and a set answers nothing
+ *  - the input task never misses a run and the worst case gap between two of
+ *    its starts (gap_max) stays within a ms of its period, the ms of the clock
+ *
+ *  Per scenario the requests served per virtual second, the p50 / p99 / p999
+ *  latency from queueing a request to its answer, and gap_max and the misses of
+ *  the input task are printed. The clock only moves between runs of loop(), so
+ *  the virtual figures show the scheduling and not the cost of the code. That is
+ *  what the host gap is for: the host ns of the runs of loop() between two starts
+ *  of the input task, the worst case. It is host time and not AVR time, only
+ *  compare it between scenarios and revisions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define MAX_REQUESTS            16      // in flight, the queue of the HAL
+#define MAX_CLIENTS             4
+#define MAX_LATENCIES           100000
+#define SLIDER_PAUSE            10      // ms between the answer to a step and the next
+
+enum CLIENT_KIND { CLIENT_POLL, CLIENT_SLIDER };
+
+struct WebClient
+{
+  int kind;
+  int channel;                          // CLIENT_SLIDER only
+  int step;
+  unsigned long next;                   // ms the next request is due, 0 while one is in flight
+};
+
+struct Request
+{
+  int client;
+  unsigned long queued;                 // ms
+};
+
+struct Scenario
+{
+  const char *name;
+  int pollers;
+  int sliders;
+};
+
+const Scenario scenarios[] =
+{
+  { "idle",  0, 0 },
+  { "poll",  3, 0 },
+  { "burst", 0, 2 },
+  { "mixed", 2, 1 },
+};
+
+#define NR_SCENARIOS            ( sizeof( scenarios ) / sizeof( scenarios[0] ) )
+
+WebClient clients[ MAX_CLIENTS ];
+int nr_clients = 0;
+
+// The queue of the HAL as the clients see it, the oldest first
+//
+Request requests[ MAX_REQUESTS ];
+int requests_first  = 0;
+int requests_length = 0;
+
+unsigned long latencies[ MAX_LATENCIES ];
+unsigned long served = 0;
+unsigned long errors = 0;
+boolean stopped = false;                // the clients send nothing new
+
+// Host ns of the runs of loop() since the input task last started
+//
+unsigned long long loop_ns = 0;
+unsigned long long host_gap_max = 0;
+unsigned long input_start = 0;
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, long detail = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %ld\n", scenario, rule, detail );
+}
+
+Task *inputTask()
+{
+  for ( int i = 0; i < nr_tasks; i++ )
+  {
+    if ( 0 == strcmp( tasks[i].name, "input" ) ) { return &tasks[i]; }
+  }
+
+  return NULL;
+}
+
+// -------------------------------------------------------- //
+
+void queue( int client )
+{
+  WebClient *c = &clients[ client ];
+  char path[ 64 ];
+
+  if ( CLIENT_POLL == c->kind )
+  {
+    strcpy( path, ( 0 == c->step % 2 ) ? "getLightChannels" : "getSwitchChannels" );
+  }
+  else
+  {
+    // 20 steps of a slider, down again on the way back
+    //
+    int v = c->step % 40;
+
+    snprintf( path, sizeof( path ), "setLightChannel/%d/%d/2", c->channel, 13 * ( ( 20 > v ) ? v : 39 - v ) );
+  }
+
+  c->step++;
+  c->next = 0;
+
+  hal_web_request( path );
+
+  Request *r = &requests[ ( requests_first + requests_length++ ) % MAX_REQUESTS ];
+
+  r->client = client;
+  r->queued = millis();
+}
+
+// The oldest request was served, check the answer and let its client go on
+//
+void answered()
+{
+  Request *r = &requests[ requests_first ];
+  WebClient *c = &clients[ r->client ];
+  const char *response = hal_web_response();
+
+  requests_first = ( requests_first + 1 ) % MAX_REQUESTS;
+  requests_length--;
+
+  if ( MAX_LATENCIES > served ) latencies[ served ] = millis() - r->queued;
+  served++;
+
+  boolean ok = ( CLIENT_POLL == c->kind ) ? 0 == strncmp( response, "HTTP/1.0 200", 12 ) : 0 == hal_web_response_length();
+
+  if ( !ok ) errors++;
+
+  if ( !stopped ) c->next = millis() + ( ( CLIENT_SLIDER == c->kind ) ? SLIDER_PAUSE : 0 );
+}
+
+void run( unsigned long ms )
+{
+  Task *input = inputTask();
+
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+
+    for ( int k = 0; k < nr_clients; k++ )
+    {
+      if ( 0 < clients[k].next && millis() >= clients[k].next && MAX_REQUESTS > requests_length ) queue( k );
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    loop();
+
+    loop_ns += std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+    if ( input->last_start != input_start )
+    {
+      host_gap_max = max( host_gap_max, loop_ns );
+      input_start  = input->last_start;
+      loop_ns      = 0;
+    }
+
+    while ( requests_length > hal_web_pending() ) answered();
+  }
+}
+
+// -------------------------------------------------------- //
+
+int compare( const void *a, const void *b )
+{
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+  return ( x < y ) ? -1 : ( x > y ) ? 1 : 0;
+}
+
+unsigned long percentile( unsigned long n, double p )
+{
+  if ( 0 == n ) { return 0; }
+
+  return latencies[ min( n - 1, (unsigned long)( n * p ) ) ];
+}
+
+void simulate( const Scenario *s, unsigned long seconds )
+{
+  scenario = s->name;
+
+  nr_clients = 0;
+
+  for ( int i = 0; i < s->pollers; i++ ) clients[ nr_clients++ ] = (WebClient){ CLIENT_POLL, 0, i, 0 };
+  for ( int i = 0; i < s->sliders; i++ ) clients[ nr_clients++ ] = (WebClient){ CLIENT_SLIDER, 1 + i, 0, 0 };
+
+  served = errors = 0;
+  stopped = false;
+  host_gap_max = loop_ns = 0;
+
+  resetTasks();
+  input_start = inputTask()->last_start;
+
+  for ( int k = 0; k < nr_clients; k++ ) queue( k );
+
+  run( seconds * 1000 );
+
+  // The requests still in the queue are not part of the figures, but have to be
+  // answered all the same
+  //
+  unsigned long counted = served;
+
+  stopped = true;
+
+  for ( int k = 0; k < nr_clients; k++ ) clients[k].next = 0;
+  for ( int i = 0; i < 1000 && 0 < requests_length; i++ ) run( 1 );
+
+  Task *input = inputTask();
+
+  check( 0 == requests_length, "every request served", requests_length );
+  check( 0 == errors, "get answers 200, set answers nothing", errors );
+  check( input->period + 1 >= input->gap_max, "input gap within a ms of its period", input->gap_max );
+  check( 0 == input->misses, "no misses of the input task", input->misses );
+
+  unsigned long n = min( counted, (unsigned long)MAX_LATENCIES );
+
+  qsort( latencies, n, sizeof( latencies[0] ), compare );
+
+  printf( "%-8s %8.1f req/s  p50 %4lu ms  p99 %4lu ms  p999 %4lu ms  errors %4lu  input gap %3lu ms  misses %4u  host gap %6.1f us\n",
+          s->name, (double)counted / seconds, percentile( n, 0.5 ), percentile( n, 0.99 ), percentile( n, 0.999 ),
+          errors, input->gap_max, input->misses, host_gap_max / 1000.0 );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  unsigned long seconds = 20;
+  const char *names[ NR_SCENARIOS ];
+  int nr_names = 0;
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if ( 0 == strcmp( argv[i], "-t" ) && i + 1 < argc ) seconds = strtoul( argv[++i], NULL, 10 );
+    else if ( '-' != argv[i][0] && (int)NR_SCENARIOS > nr_names ) names[ nr_names++ ] = argv[i];
+    else
+    {
+      printf( "usage: %s [-t seconds] [idle|poll|burst|mixed ...]\n", argv[0] );
+      return 2;
+    }
+  }
+
+  setup();
+
+  // Past the setup, the first runs of the tasks are not under load
+  //
+  run( 1000 );
+
+  for ( unsigned int i = 0; i < NR_SCENARIOS; i++ )
+  {
+    boolean selected = 0 == nr_names;
+
+    for ( int k = 0; k < nr_names; k++ ) selected |= 0 == strcmp( names[k], scenarios[i].name );
+
+    if ( selected ) simulate( &scenarios[i], seconds );
+  }
+
+  printf( "%lu load checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+/*
+ *  Metrics of Metrics.h against a stand-in statsd collector
+ *
+ *    build/metrics/metrics
+ *
+ *  Built with METRICS_ENABLED, see the Makefile. The sketch runs setup() and
+ *  its tasks, the virtual clock moves a ms per run of loop(). The harness takes
+ *  the datagrams the sketch sends to metricsserver from the UDP of the HAL and
+ *  parses the statsd lines in them, pressing buttons and serving web requests in
+ *  between to have something to count.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - a push every METRICS_INTERVAL from METRICS_LOCAL_PORT to METRICS_PORT, the
+ *    socket closed again in between
+ *  - every line "doduino.<node>.<name>:<value>|c" or "|g", none split over two
+ *    datagrams, no datagram past METRICS_BUFFER_LENGTH, a single one for a
+ *    quiet node
+ *  - the gauges always, loops as many as the runs of loop() since the last push.
+ *    Only the line of freeRam is checked, the host has no AVR memory layout
+ *  - buttons, gesture.<name> and http.<command> count what happened since the
+ *    last push, the last two left out while 0, all of them start over after a
+ *    push
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define MAX_LINES               64
+#define TAP_TIME                100     // ms a button is held for a press
+
+struct Line
+{
+  char name[ METRICS_LINE_LENGTH ];
+  long value;
+  char type;
+};
+
+// A push, the lines of all its datagrams
+//
+struct Push
+{
+  unsigned long time;
+  unsigned long loops;                  // runs of loop() since the last push
+  int  datagrams;
+  int  nr_lines;
+  Line lines[ MAX_LINES ];
+};
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+unsigned long loops = 0;                // runs of loop() since the last push
+unsigned long last_push = 0;            // ms
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, const char *detail = "", long value = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %s %ld\n", scenario, rule, detail, value );
+}
+
+// -------------------------------------------------------- //
+
+// Take a datagram apart into lines
+//
+void parse( Push *push, HalDatagram *d )
+{
+  char prefix[ 16 ];
+
+  snprintf( prefix, sizeof( prefix ), "doduino.%d.", NODE_ID );
+
+  check( METRICS_LOCAL_PORT == d->local_port && 0 == memcmp( d->ip, metricsserver, 4 ), "sent to metricsserver" );
+  check( METRICS_BUFFER_LENGTH >= d->length, "datagram fits the buffer", "", d->length );
+  check( 0 < d->length && '\n' == d->data[ d->length - 1 ], "datagram ends with a whole line" );
+
+  push->datagrams++;
+
+  char text[ HAL_DATAGRAM_LENGTH + 1 ];
+
+  memcpy( text, d->data, d->length );
+  text[ d->length ] = '\0';
+
+  for ( char *line = strtok( text, "\n" ); NULL != line; line = strtok( NULL, "\n" ) )
+  {
+    char *colon = strchr( line, ':' ), *bar = strchr( line, '|' );
+    boolean ok = 0 == strncmp( line, prefix, strlen( prefix ) ) && NULL != colon && NULL != bar && colon < bar
+                 && ( 0 == strcmp( bar, "|c" ) || 0 == strcmp( bar, "|g" ) );
+
+    check( ok, "statsd line", line );
+
+    if ( !ok || MAX_LINES <= push->nr_lines ) { continue; }
+
+    Line *l = &push->lines[ push->nr_lines++ ];
+    int length = min( (int)( colon - line - strlen( prefix ) ), METRICS_LINE_LENGTH - 1 );
+
+    memcpy( l->name, line + strlen( prefix ), length );
+    l->name[ length ] = '\0';
+    l->value = atol( colon + 1 );
+    l->type  = bar[1];
+  }
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+    loops++;
+  }
+}
+
+// Run until the next push, its datagrams all go out in the same run
+//
+boolean next( Push *push )
+{
+  HalDatagram d;
+
+  memset( push, 0, sizeof( *push ) );
+
+  for ( unsigned long i = 0; i < 2 * METRICS_INTERVAL && 0 == push->datagrams; i++ )
+  {
+    run( 1 );
+
+    // DHCP keeps asking for an address next to it
+    //
+    while ( hal_udp_sent( &d ) )
+    {
+      if ( METRICS_PORT == d.port ) parse( push, &d );
+    }
+  }
+
+  push->time  = now;
+  push->loops = loops;
+  loops = 0;
+
+  check( 0 < push->datagrams, "pushed" );
+
+  if ( 0 == push->datagrams ) { return false; }
+
+  if ( 0 < last_push )
+  {
+    check( METRICS_INTERVAL - 50 <= push->time - last_push && METRICS_INTERVAL + 50 >= push->time - last_push, "every METRICS_INTERVAL", "", push->time - last_push );
+  }
+
+  last_push = push->time;
+
+  byte none[1] = { 0 };
+
+  check( 0 == hal_udp_deliver( METRICS_LOCAL_PORT, metricsserver, METRICS_PORT, none, 1 ), "socket closed after the push" );
+
+  return true;
+}
+
+// Value of name in a push, -1 and a failure with type 0 when it isn't there
+//
+long value( Push *push, const char *name, char type )
+{
+  int found = 0;
+  long v = -1;
+
+  for ( int i = 0; i < push->nr_lines; i++ )
+  {
+    if ( 0 != strcmp( push->lines[i].name, name ) ) { continue; }
+
+    found++;
+    v = push->lines[i].value;
+
+    check( type == push->lines[i].type, "type of", name );
+  }
+
+  check( ( 0 == type ) ? 0 == found : 1 == found, ( 0 == type ) ? "left out while 0" : "line once", name, found );
+
+  return v;
+}
+
+// Lines of a push starting with prefix
+//
+int count( Push *push, const char *prefix )
+{
+  int n = 0;
+
+  for ( int i = 0; i < push->nr_lines; i++ )
+  {
+    if ( 0 == strncmp( push->lines[i].name, prefix, strlen( prefix ) ) ) n++;
+  }
+
+  return n;
+}
+
+void gauges( Push *push )
+{
+  value( push, "loopMax", 'g' );
+  value( push, "load", 'g' );
+  value( push, "switchQueue", 'g' );
+  value( push, "switchQueueMax", 'g' );
+
+  // Stack and heap are far apart on the host, the value says nothing here
+  //
+  value( push, "freeRam", 'g' );
+}
+
+// -------------------------------------------------------- //
+
+void quiet()
+{
+  Push push;
+
+  scenario = "quiet";
+
+  // The first push counts the setup
+  //
+  next( &push );
+
+  if ( !next( &push ) ) { return; }
+
+  check( 1 == push.datagrams, "a single datagram", "", push.datagrams );
+  check( 1 >= labs( (long)push.loops - value( &push, "loops", 'c' ) ), "loops", "", push.loops );
+  check( 0 == value( &push, "buttons", 'c' ), "no buttons" );
+  check( 0 == count( &push, "gesture." ) && 0 == count( &push, "http." ), "counters of 0 left out" );
+
+  gauges( &push );
+}
+
+void activity()
+{
+  Push push;
+
+  scenario = "activity";
+
+  hal_set_pin( buttonPins[0], HIGH );
+  run( TAP_TIME );
+  hal_set_pin( buttonPins[0], LOW );
+  run( 2 * PULSE_TIME );
+
+  for ( int i = 0; i < 3; i++ ) hal_web_request( "getLightChannels" );
+  hal_web_request( "getSwitchChannels" );
+
+  if ( !next( &push ) ) { return; }
+
+  check( 1 >= labs( (long)push.loops - value( &push, "loops", 'c' ) ), "loops", "", push.loops );
+  check( 2 == value( &push, "buttons", 'c' ), "press and release" );
+  check( 1 == value( &push, "gesture.press", 'c' ) && 1 == count( &push, "gesture." ), "a press" );
+  check( 3 == value( &push, "http.getLightChannels", 'c' ), "getLightChannels requests" );
+  check( 1 == value( &push, "http.getSwitchChannels", 'c' ), "getSwitchChannels requests" );
+  check( 2 == count( &push, "http." ), "only the commands requested" );
+
+  gauges( &push );
+
+  scenario = "start over";
+
+  if ( !next( &push ) ) { return; }
+
+  check( 1 >= labs( (long)push.loops - value( &push, "loops", 'c' ) ), "loops", "", push.loops );
+  check( 0 == value( &push, "buttons", 'c' ), "buttons start over" );
+  check( 0 == count( &push, "gesture." ) && 0 == count( &push, "http." ), "counters start over" );
+}
+
+// A request for every command, more lines than fit a datagram
+//
+void busy()
+{
+  Push push;
+  char name[ 32 ], metric[ 48 ];
+
+  scenario = "busy";
+
+  for ( int i = 0; i < NR_WEB_COMMANDS; i++ )
+  {
+    strcpy_P( name, (const char *)nameAt( webCommandNames, i ) );
+
+    hal_web_request( ( WEB_INDEX == i ) ? "" : ( WEB_CROSSDOMAIN == i ) ? "crossdomain.xml" : name );
+
+    for ( int k = 0; k < 100 && 0 < hal_web_pending(); k++ ) run( 1 );
+  }
+
+  if ( !next( &push ) ) { return; }
+
+  check( 1 < push.datagrams, "lines spread over datagrams", "", push.datagrams );
+
+  for ( int i = 0; i < NR_WEB_COMMANDS; i++ )
+  {
+    strcpy_P( name, (const char *)nameAt( webCommandNames, i ) );
+    snprintf( metric, sizeof( metric ), "http.%s", name );
+
+    check( 1 == value( &push, metric, 'c' ), "a request of every command", metric );
+  }
+
+  gauges( &push );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  setup();
+
+  quiet();
+  activity();
+  busy();
+
+  printf( "%lu metrics checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
@@ -0,0 +1,530 @@
+/*
+ *  MQTT client of Mqtt.h against a stand-in broker
+ *
+ *    build/mqtt/mqtt
+ *
+ *  Built with MQTT_ENABLED, see the Makefile. The sketch runs setup() and its
+ *  tasks, the virtual clock moves a ms per run of loop(). The harness plays the
+ *  broker on the TCP loopback of the HAL: it accepts (or refuses) the connect
+ *  of the sketch, reads the packets it writes and delivers packets to it. Only
+ *  what the client uses of MQTT 3.1.1 is spoken, there is no mosquitto on the
+ *  host this runs on.
+ *
+ *  Scenarios, any failure makes the exit code 1:
+ *
+ *  - connect to mqttserver:MQTT_PORT, CONNECT with a clean session, the keep
+ *    alive and the client id, after the CONNACK both subscriptions and a
+ *    retained publish of every channel
+ *  - a change made over the web is published once, for that channel only
+ *  - commands on the set topics reach the lights and switches, also at QoS 1 and
+ *    when delivered a byte per run. Commands for other nodes, channels or
+ *    values out of range are ignored, a message past MQTT_BUFFER_LENGTH is
+ *    skipped without losing the packets after it
+ *  - a PINGREQ after half the keep alive without packets
+ *  - the connection is dropped on a refused CONNACK or subscription, on a
+ *    missing CONNACK and when the broker closes it; the next attempt waits
+ *    MQTT_RETRY_TIME after the previous one
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define MAX_PACKET              256
+#define STREAM_LENGTH           4096
+
+struct Packet
+{
+  byte type;
+  int  length;
+  byte data[ MAX_PACKET ];
+};
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+int sock = -1;                          // socket of the sketch connected to the broker
+
+byte stream[ STREAM_LENGTH ];           // written by the sketch, not yet a whole packet
+int  stream_length = 0;
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, const char *detail = "" )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %s, state %d\n", scenario, rule, detail, mqtt_state );
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+  }
+}
+
+// Next packet the sketch wrote, false when there is no whole one
+//
+boolean next( Packet *p )
+{
+  if ( 0 <= sock ) stream_length += hal_tcp_sent( sock, &stream[ stream_length ], STREAM_LENGTH - stream_length );
+
+  int length = 0, shift = 0, i = 1;
+
+  for ( ; i < stream_length && i < 5; i++ )
+  {
+    length |= ( stream[i] & 0x7F ) << shift;
+    shift += 7;
+
+    if ( 0 == ( stream[i] & 0x80 ) ) break;
+  }
+
+  if ( i >= stream_length || i + 1 + length > stream_length ) { return false; }
+
+  p->type   = stream[0];
+  p->length = min( length, MAX_PACKET );
+  memcpy( p->data, &stream[ i + 1 ], p->length );
+
+  stream_length -= i + 1 + length;
+  memmove( stream, &stream[ i + 1 + length ], stream_length );
+
+  return true;
+}
+
+// Drop what the sketch wrote so far
+//
+void drain()
+{
+  Packet p;
+
+  while ( next( &p ) );
+}
+
+void deliver( const byte *data, int length )
+{
+  check( hal_tcp_deliver( sock, data, length ), "delivered" );
+}
+
+// Topic and payload of a publish as strings
+//
+boolean publishOf( Packet *p, char *topic, char *payload )
+{
+  if ( MQTT_PUBLISH != ( p->type & 0xF0 ) || 2 > p->length ) { return false; }
+
+  int t = ( p->data[0] << 8 ) | p->data[1];
+
+  if ( 2 + t > p->length || 64 <= t || 16 <= p->length - 2 - t ) { return false; }
+
+  memcpy( topic, &p->data[2], t );
+  topic[t] = '\0';
+
+  memcpy( payload, &p->data[ 2 + t ], p->length - 2 - t );
+  payload[ p->length - 2 - t ] = '\0';
+
+  return true;
+}
+
+// Publish of the broker to the sketch, with a packet id at QoS 1
+//
+int publish( byte *packet, const char *topic, const char *payload, int qos = 0 )
+{
+  byte *p = packet;
+  int t = strlen( topic ), l = strlen( payload );
+  int length = 2 + t + ( qos ? 2 : 0 ) + l;
+
+  *p++ = MQTT_PUBLISH | ( qos << 1 );
+
+  do
+  {
+    *p++ = ( length & 0x7F ) | ( 127 < length ? 0x80 : 0 );
+    length >>= 7;
+  }
+  while ( 0 < length );
+
+  *p++ = t >> 8;
+  *p++ = t;
+  memcpy( p, topic, t );
+  p += t;
+
+  if ( qos )
+  {
+    *p++ = 0;
+    *p++ = 7;
+  }
+
+  memcpy( p, payload, l );
+
+  return p + l - packet;
+}
+
+void command( const char *topic, const char *payload, int qos = 0 )
+{
+  byte packet[ MAX_PACKET ];
+
+  deliver( packet, publish( packet, topic, payload, qos ) );
+  run( 100 );
+}
+
+// Value published last for topic since the last drain, -1 for none. Counts the
+// publishes of other topics in others
+//
+int published( const char *topic, int *others = NULL )
+{
+  Packet p;
+  char t[64], payload[16];
+  int value = -1;
+
+  if ( others ) *others = 0;
+
+  while ( next( &p ) )
+  {
+    if ( !publishOf( &p, t, payload ) ) { continue; }
+
+    check( 0 != ( p.type & MQTT_RETAIN ), "publish retained", t );
+
+    if ( 0 == strcmp( t, topic ) ) value = atoi( payload );
+    else if ( others ) ( *others )++;
+  }
+
+  return value;
+}
+
+// -------------------------------------------------------- //
+
+// Wait for the connect of the sketch, at most ms. Returns the ms it took
+//
+unsigned long waitConnect( unsigned long ms )
+{
+  byte ip[4];
+  uint16_t port;
+  unsigned long start = now;
+
+  while ( 0 > ( sock = hal_tcp_connecting( ip, &port ) ) && ms > now - start ) run( 1 );
+
+  if ( 0 <= sock )
+  {
+    check( 0 == memcmp( ip, mqttserver, 4 ) && MQTT_PORT == port, "connect to mqttserver" );
+  }
+
+  stream_length = 0;
+
+  return now - start;
+}
+
+// Accept the connect, check the CONNECT and answer it with return code rc
+//
+void acceptConnect( byte rc )
+{
+  Packet p;
+  char id[ 32 ];
+  byte connack[] = { MQTT_CONNACK, 2, 0, rc };
+
+  hal_tcp_accept( sock );
+  run( 100 );
+
+  boolean ok = next( &p ) && MQTT_CONNECT == p.type && 12 < p.length;
+
+  check( ok && 0 == memcmp( p.data, "\0\4MQTT", 6 ) && 4 == p.data[6] && 0x02 == p.data[7], "CONNECT of MQTT 3.1.1 with a clean session" );
+  check( ok && 0 == p.data[8] && MQTT_KEEP_ALIVE == p.data[9], "keep alive" );
+
+  snprintf( id, sizeof( id ), "doduino-%d", NODE_ID );
+
+  check( ok && strlen( id ) == p.data[11] && 0 == memcmp( &p.data[12], id, strlen( id ) ), "client id" );
+
+  deliver( connack, sizeof( connack ) );
+  run( 100 );
+}
+
+// Connect, check the subscriptions and the publishes of all channels
+//
+void connect()
+{
+  Packet p;
+  char topic[64], payload[16], expected[64];
+  int subscriptions = 0;
+  int lights = 0, switches = 0;
+
+  waitConnect( MQTT_RETRY_TIME + 1000 );
+  check( 0 <= sock, "connect" );
+
+  if ( 0 > sock ) { return; }
+
+  acceptConnect( 0 );
+  check( MQTT_STATE_CONNECTED == mqtt_state, "connected after the CONNACK" );
+
+  while ( next( &p ) )
+  {
+    if ( MQTT_SUBSCRIBE == p.type )
+    {
+      snprintf( expected, sizeof( expected ), "doduino/%d/%s/+/set", NODE_ID, ( 0 == subscriptions ) ? "light" : "switch" );
+
+      int t = ( p.data[2] << 8 ) | p.data[3];
+
+      check( 4 + t + 1 == p.length && (int)strlen( expected ) == t && 0 == memcmp( &p.data[4], expected, t ) && 0 == p.data[ 4 + t ], "subscription", expected );
+
+      byte suback[] = { MQTT_SUBACK, 3, p.data[0], p.data[1], 0 };
+
+      deliver( suback, sizeof( suback ) );
+      subscriptions++;
+    }
+    else if ( publishOf( &p, topic, payload ) )
+    {
+      int channel, kind = ( 0 == strncmp( topic + 10, "light/", 6 ) ) ? CHANGE_LIGHT : CHANGE_SWITCH;
+
+      channel = atoi( strrchr( topic, '/' ) + 1 );
+
+      if ( CHANGE_LIGHT == kind && NR_LIGHT_CHANNELS > channel )
+      {
+        check( l_channels[ channel ].light_value == atoi( payload ), "publish of the light value", topic );
+        lights++;
+      }
+      else if ( NR_SWITCH_CHANNELS > channel )
+      {
+        check( sw_channels[ channel ].state == atoi( payload ), "publish of the switch state", topic );
+        switches++;
+      }
+    }
+  }
+
+  check( 2 == subscriptions, "both subscriptions" );
+  check( NR_LIGHT_CHANNELS == lights && NR_SWITCH_CHANNELS == switches, "every channel published" );
+
+  run( 100 );
+  check( MQTT_STATE_CONNECTED == mqtt_state, "subscriptions granted" );
+}
+
+// -------------------------------------------------------- //
+
+void changes()
+{
+  char topic[ 64 ];
+  int others;
+
+  scenario = "changes";
+
+  drain();
+
+  hal_web_request( "setLightChannel/3/100/2" );
+  run( 200 );
+
+  snprintf( topic, sizeof( topic ), "doduino/%d/light/3", NODE_ID );
+  check( 100 == published( topic, &others ), "change published", topic );
+
+  // The floor led follows the lights, see setupDimmer
+  //
+  check( 1 >= others, "only the changed channels published" );
+
+  run( 200 );
+  check( -1 == published( topic ), "published once" );
+}
+
+void commands()
+{
+  char topic[ 64 ], set[ 64 ];
+
+  scenario = "commands";
+
+  snprintf( set, sizeof( set ), "doduino/%d/light/4/set", NODE_ID );
+  snprintf( topic, sizeof( topic ), "doduino/%d/light/4", NODE_ID );
+
+  drain();
+  command( set, "77" );
+  check( 77 == l_channels[4].light_value, "light set" );
+  check( 77 == published( topic ), "light set published" );
+
+  snprintf( set, sizeof( set ), "doduino/%d/switch/2/set", NODE_ID );
+  snprintf( topic, sizeof( topic ), "doduino/%d/switch/2", NODE_ID );
+
+  command( set, "1" );
+  check( 1 == sw_channels[2].state, "switch set" );
+  check( 1 == published( topic ), "switch set published" );
+
+  // Ignored
+  //
+  snprintf( set, sizeof( set ), "doduino/%d/light/4/set", NODE_ID + 1 );
+  command( set, "10" );
+  snprintf( set, sizeof( set ), "doduino/%d/light/4/set", NODE_ID );
+  command( set, "300" );
+  snprintf( set, sizeof( set ), "doduino/%d/light/%d/set", NODE_ID, NR_LIGHT_CHANNELS );
+  command( set, "10" );
+  snprintf( set, sizeof( set ), "doduino/%d/switch/2/set", NODE_ID );
+  command( set, "2" );
+
+  check( 77 == l_channels[4].light_value && 1 == sw_channels[2].state, "commands out of range ignored" );
+
+  // QoS 1 has a packet id in front of the payload
+  //
+  snprintf( set, sizeof( set ), "doduino/%d/light/6/set", NODE_ID );
+  command( set, "55", 1 );
+  check( 55 == l_channels[6].light_value, "QoS 1 command" );
+
+  // A byte per run
+  //
+  byte packet[ MAX_PACKET ];
+  int length;
+
+  snprintf( set, sizeof( set ), "doduino/%d/light/6/set", NODE_ID );
+  length = publish( packet, set, "66" );
+
+  for ( int i = 0; i < length; i++ )
+  {
+    deliver( &packet[i], 1 );
+    run( 20 );
+  }
+
+  run( 100 );
+  check( 66 == l_channels[6].light_value, "command a byte at a time" );
+
+  // Too long for the buffer, the command after it still counts
+  //
+  char payload[ 2 * MQTT_BUFFER_LENGTH ];
+
+  memset( payload, '1', sizeof( payload ) - 1 );
+  payload[ sizeof( payload ) - 1 ] = '\0';
+
+  snprintf( set, sizeof( set ), "doduino/%d/light/7/set", NODE_ID );
+  length = publish( packet, set, payload );
+
+  snprintf( set, sizeof( set ), "doduino/%d/light/8/set", NODE_ID );
+  length += publish( &packet[ length ], set, "9" );
+
+  deliver( packet, length );
+  run( 100 );
+
+  check( 0 == l_channels[7].light_value && 9 == l_channels[8].light_value, "message past the buffer skipped" );
+}
+
+void keepAlive()
+{
+  Packet p;
+
+  scenario = "keep alive";
+
+  // Start counting at a publish seen the ms it was written
+  //
+  run( 100 );
+  drain();
+
+  hal_web_request( "setLightChannel/3/120/2" );
+
+  unsigned long quiet = now;
+  boolean ping = false;
+
+  while ( !next( &p ) && 1000 > now - quiet ) run( 1 );
+
+  quiet = now;
+
+  while ( !ping && 2 * MQTT_KEEP_ALIVE * 1000UL > now - quiet )
+  {
+    run( 1 );
+
+    while ( next( &p ) )
+    {
+      if ( MQTT_PINGREQ == p.type && 0 == p.length ) { ping = true; }
+      else { quiet = now; }
+    }
+  }
+
+  check( ping && MQTT_KEEP_ALIVE * 500UL <= now - quiet && MQTT_KEEP_ALIVE * 500UL + 100 > now - quiet, "PINGREQ at half the keep alive" );
+}
+
+// -------------------------------------------------------- //
+
+void drops()
+{
+  scenario = "broker closes";
+
+  hal_tcp_close( sock );
+  run( 100 );
+  check( MQTT_STATE_IDLE == mqtt_state || MQTT_STATE_CONNECTING == mqtt_state, "connection lost" );
+
+  connect();
+
+  scenario = "refused";
+
+  drain();
+  hal_tcp_close( sock );
+  waitConnect( MQTT_RETRY_TIME );
+  acceptConnect( 5 );
+  check( MQTT_STATE_IDLE == mqtt_state && SnSR::CLOSED == W5100.readSnSR( sock ), "refused connection dropped" );
+
+  unsigned long took = waitConnect( 2 * MQTT_RETRY_TIME );
+  check( 0 <= sock && MQTT_RETRY_TIME - 300 <= took && MQTT_RETRY_TIME >= took, "next attempt after MQTT_RETRY_TIME" );
+
+  scenario = "no connack";
+
+  hal_tcp_accept( sock );
+  run( 100 );
+  drain();
+
+  unsigned long attempt = now;
+
+  while ( MQTT_STATE_CONNACK == mqtt_state && 2 * MQTT_CONNECT_TIMEOUT > now - attempt ) run( 10 );
+
+  check( MQTT_STATE_IDLE == mqtt_state && MQTT_CONNECT_TIMEOUT - 200 <= now - attempt, "dropped without connack" );
+
+  scenario = "not accepted";
+
+  waitConnect( 2 * MQTT_RETRY_TIME );
+  attempt = now;
+
+  while ( MQTT_STATE_CONNECTING == mqtt_state && 2 * MQTT_CONNECT_TIMEOUT > now - attempt ) run( 10 );
+
+  check( MQTT_STATE_IDLE == mqtt_state && MQTT_CONNECT_TIMEOUT - 100 <= now - attempt && SnSR::CLOSED == W5100.readSnSR( sock ), "connect given up" );
+
+  scenario = "subscription refused";
+
+  waitConnect( 2 * MQTT_RETRY_TIME );
+  acceptConnect( 0 );
+
+  Packet p;
+
+  while ( next( &p ) )
+  {
+    if ( MQTT_SUBSCRIBE != p.type ) { continue; }
+
+    byte suback[] = { MQTT_SUBACK, 3, p.data[0], p.data[1], 0x80 };
+
+    deliver( suback, sizeof( suback ) );
+    break;
+  }
+
+  run( 100 );
+  check( MQTT_STATE_IDLE == mqtt_state, "refused subscription dropped" );
+
+  scenario = "reconnect";
+
+  connect();
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  setup();
+
+  scenario = "connect";
+  connect();
+
+  changes();
+  commands();
+  keepAlive();
+  drops();
+
+  printf( "%lu mqtt checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
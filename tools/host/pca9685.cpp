@@ -0,0 +1,344 @@
+/*
+ *  PCA9685 expanders of Pca9685.h on a simulated I2C bus
+ *
+ *    build/pca9685/pca9685
+ *
+ *  Built with PCA9685_ENABLED and NR_I2C_LIGHT_CHANNELS, see the Makefile. The
+ *  sketch runs setup() and its tasks, the virtual clock moves a ms per run of
+ *  loop() and by the bus time of every transmission. The harness plays the
+ *  chips: it keeps their registers from the transmissions the Wire of the HAL
+ *  hands it, with the auto increment of MODE1 and the prescaler only taking
+ *  while asleep, like the PCA9685 does.
+ *
+ *  The channels are spread over 2 chips with a hole in the outputs of the first,
+ *  so the flushes have runs to cut. The first chip starts asleep as after power
+ *  up, the second awake as after a reset of the Arduino alone.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - setup: the prescaler for PCA9685_PWM_FREQUENCY written while asleep, auto
+ *    increment on and awake, totem pole outputs, 500 us for the oscillator
+ *    before the first output is written, every output fully off
+ *  - no transmission past the BUFFER_LENGTH of Wire, only chips in use addressed
+ *  - after every output tick the output of every channel is its light value in
+ *    12 bits, fully on and fully off with their own bit
+ *  - a flush takes a transmission per run of neighbouring changed outputs on a
+ *    chip, cut at PCA9685_BURST, pca9685_bytes and pca9685_transactions count
+ *    them and pca9685_flush_time_max is at least the bus time of the largest
+ *
+ *  The bus time of a flush of every channel in bursts and with a write per
+ *  output is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define NR_CHIPS                2
+#define OUTPUT_TICK             10      // ms of the output task
+
+struct Chip
+{
+  byte regs[ 256 ];
+  byte prescale_awake;                  // PRESCALE written while awake, it doesn't take
+  unsigned long woken;                  // us of the write clearing SLEEP
+  unsigned long first_output;           // us of the first write of an output register, 0 for none
+};
+
+Chip chips[ NR_CHIPS ];
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+// Transmissions of the last bus run
+//
+unsigned long transmissions = 0;
+unsigned long bytes         = 0;        // address included
+unsigned long bus_us        = 0;
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, long detail = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %ld\n", scenario, rule, detail );
+}
+
+// -------------------------------------------------------- //
+
+// Output of a chip in counts of 4096 of the PWM period
+//
+int output( Chip *c, int i )
+{
+  byte *led = &c->regs[ PCA9685_LED0_ON_L + 4 * i ];
+
+  if ( led[1] & PCA9685_FULL ) { return 4096; }
+  if ( led[3] & PCA9685_FULL ) { return 0; }
+
+  int on  = ( ( led[1] & 0x0F ) << 8 ) | led[0];
+  int off = ( ( led[3] & 0x0F ) << 8 ) | led[2];
+
+  return ( off - on + 4096 ) % 4096;
+}
+
+// What a light value should give
+//
+int expected( int value )
+{
+  if ( MAX_LIGHT_VALUE == value ) { return 4096; }
+
+  return ( value << 4 ) | ( value >> 4 );
+}
+
+// Take the transmissions of the HAL into the chips
+//
+void bus()
+{
+  HalTransmission t;
+
+  while ( hal_i2c_sent( &t ) )
+  {
+    int chip = t.address - PCA9685_BASE_ADDRESS;
+
+    check( 0 <= chip && pca9685_nr_chips > chip, "address of a chip in use", t.address );
+    check( 0 == t.dropped && BUFFER_LENGTH >= t.length, "fits the buffer of Wire", t.length + t.dropped );
+
+    transmissions++;
+    bytes  += 1 + t.length;
+    bus_us += t.bus_us;
+
+    if ( 0 > chip || NR_CHIPS <= chip || 1 > t.length ) { continue; }
+
+    Chip *c = &chips[ chip ];
+    int reg = t.data[0];
+
+    for ( int i = 1; i < t.length; i++ )
+    {
+      if ( PCA9685_PRESCALE == reg && !( c->regs[ PCA9685_MODE1 ] & PCA9685_SLEEP ) )
+      {
+        c->prescale_awake = 1;
+      }
+      else
+      {
+        if ( PCA9685_MODE1 == reg && ( c->regs[ reg ] & PCA9685_SLEEP ) && !( t.data[i] & PCA9685_SLEEP ) ) c->woken = t.us;
+        if ( PCA9685_LED0_ON_L <= reg && PCA9685_PRESCALE > reg && 0 == c->first_output ) c->first_output = t.us;
+
+        c->regs[ reg ] = t.data[i];
+      }
+
+      if ( c->regs[ PCA9685_MODE1 ] & PCA9685_AI ) reg = ( reg + 1 ) & 0xFF;
+    }
+  }
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+    bus();
+  }
+}
+
+// Every channel shows its light value
+//
+void outputs( const char *rule )
+{
+  for ( int i = 0; i < NR_I2C_LIGHT_CHANNELS; i++ )
+  {
+    LightChannel *l = &l_channels[ NR_LIGHT_CHANNELS - NR_I2C_LIGHT_CHANNELS + i ];
+    int chip = PCA9685_CHIP( i2cLights[i] ), o = PCA9685_OUTPUT( i2cLights[i] );
+
+    if ( expected( l->light_value ) != output( &chips[ chip ], o ) ) { check( false, rule, i ); return; }
+  }
+
+  check( true, rule );
+}
+
+// Runs of neighbouring outputs in mask, cut at PCA9685_BURST
+//
+int runs( word mask )
+{
+  int n = 0;
+
+  for ( int i = 0; i < PCA9685_OUTPUTS; )
+  {
+    if ( !bitRead( mask, i ) ) { i++; continue; }
+
+    int count = 1;
+
+    while ( i + count < PCA9685_OUTPUTS && PCA9685_BURST > count && bitRead( mask, i + count ) ) count++;
+
+    n++;
+    i += count;
+  }
+
+  return n;
+}
+
+// -------------------------------------------------------- //
+
+void startup()
+{
+  scenario = "setup";
+
+  // Chip 0 just powered up, chip 1 kept running over a reset of the Arduino
+  //
+  for ( int chip = 0; chip < NR_CHIPS; chip++ )
+  {
+    Chip *c = &chips[ chip ];
+
+    memset( c->regs, 0, sizeof( c->regs ) );
+    c->regs[ PCA9685_MODE1 ] = ( 0 == chip ) ? PCA9685_SLEEP : PCA9685_AI;
+  }
+
+  setup();
+  bus();
+
+  check( NR_CHIPS == pca9685_nr_chips, "chips in use", pca9685_nr_chips );
+
+  for ( int chip = 0; chip < NR_CHIPS; chip++ )
+  {
+    Chip *c = &chips[ chip ];
+
+    check( 0 == c->prescale_awake, "prescaler written asleep", chip );
+    check( 25000000L / ( 4096L * PCA9685_PWM_FREQUENCY ) - 1 == c->regs[ PCA9685_PRESCALE ], "prescaler", c->regs[ PCA9685_PRESCALE ] );
+    check( PCA9685_AI == c->regs[ PCA9685_MODE1 ], "awake with auto increment", c->regs[ PCA9685_MODE1 ] );
+    check( PCA9685_OUTDRV == c->regs[ PCA9685_MODE2 ], "totem pole outputs", c->regs[ PCA9685_MODE2 ] );
+    check( 0 < c->first_output && 500 <= c->first_output - c->woken, "500 us for the oscillator", c->first_output - c->woken );
+
+    for ( int o = 0; o < PCA9685_OUTPUTS; o++ )
+    {
+      if ( c->regs[ PCA9685_LED0_ON_L + 4 * o + 3 ] != PCA9685_FULL ) { check( false, "output fully off", o ); break; }
+    }
+  }
+}
+
+// Set n light channels of the chips from first to value over the web
+//
+void set( int first, int n, int value )
+{
+  char path[64];
+
+  for ( int i = first; i < first + n; i++ )
+  {
+    snprintf( path, sizeof( path ), "setLightChannel/%d/%d/2", NR_LIGHT_CHANNELS - NR_I2C_LIGHT_CHANNELS + i, value );
+    hal_web_request( path );
+
+    for ( int k = 0; k < 100 && 0 < hal_web_pending(); k++ ) run( 1 );
+  }
+}
+
+// Changes only go out at the end of an output tick, wait for it to pass
+//
+void settle()
+{
+  run( 2 * OUTPUT_TICK );
+}
+
+void levels()
+{
+  scenario = "levels";
+
+  int values[] = { 1, 15, 16, 100, 128, 254, MAX_LIGHT_VALUE, 0 };
+
+  for ( unsigned int v = 0; v < sizeof( values ) / sizeof( values[0] ); v++ )
+  {
+    set( 0, NR_I2C_LIGHT_CHANNELS, values[v] );
+    settle();
+    outputs( "every channel at its value" );
+  }
+
+  srand( 1 );
+
+  for ( int i = 0; i < 200; i++ )
+  {
+    set( rand() % NR_I2C_LIGHT_CHANNELS, 1, rand() % ( MAX_LIGHT_VALUE + 1 ) );
+
+    if ( 0 == i % 5 )
+    {
+      settle();
+      outputs( "random changes" );
+    }
+  }
+}
+
+// Flush of every channel at once, and of a single one
+//
+void bursts()
+{
+  scenario = "bursts";
+
+  word masks[ NR_CHIPS ] = { 0, 0 };
+
+  for ( int i = 0; i < NR_I2C_LIGHT_CHANNELS; i++ ) masks[ PCA9685_CHIP( i2cLights[i] ) ] |= _BV( PCA9685_OUTPUT( i2cLights[i] ) );
+
+  int expected_runs = runs( masks[0] ) + runs( masks[1] );
+
+  settle();
+
+  // Light channel changes all go out in the same tick when set between two
+  //
+  for ( int i = 0; i < NR_I2C_LIGHT_CHANNELS; i++ ) commandLightValue( NR_LIGHT_CHANNELS - NR_I2C_LIGHT_CHANNELS + i, 200, 2 );
+
+  unsigned long start_transactions = pca9685_transactions, start_bytes = pca9685_bytes;
+
+  transmissions = bytes = bus_us = 0;
+  settle();
+
+  check( expected_runs == (int)transmissions, "a transmission per run", transmissions );
+  check( (unsigned long)expected_runs == pca9685_transactions - start_transactions, "pca9685_transactions", pca9685_transactions - start_transactions );
+  check( bytes == pca9685_bytes - start_bytes, "pca9685_bytes", pca9685_bytes - start_bytes );
+  check( 2 * expected_runs + 4 * NR_I2C_LIGHT_CHANNELS == (int)bytes, "4 bytes per output", bytes );
+  check( bus_us <= pca9685_flush_time_max, "pca9685_flush_time_max", pca9685_flush_time_max );
+
+  outputs( "every channel after the burst" );
+
+  // What a write per output would take, 6 bytes each
+  //
+  unsigned long separate = NR_I2C_LIGHT_CHANNELS * ( ( 6 * 9 + 2 ) * 1000000UL / HAL_I2C_CLOCK );
+
+  printf( "flush of %d outputs: %lu transmissions, %lu bytes, %lu us on the bus, %lu us with a write per output\n",
+          NR_I2C_LIGHT_CHANNELS, transmissions, bytes, bus_us, separate );
+
+  check( bus_us < separate, "bursts beat a write per output", bus_us );
+
+  commandLightValue( NR_LIGHT_CHANNELS - 1, 10, 2 );
+  transmissions = bytes = bus_us = 0;
+  settle();
+
+  check( 1 == transmissions && 6 == bytes, "single change, single transmission", bytes );
+  outputs( "single change" );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  // Chip 0 has all but output 10, chip 1 the first outputs
+  //
+  for ( int i = 0; i < NR_I2C_LIGHT_CHANNELS; i++ )
+  {
+    i2cLights[i] = ( 15 > i ) ? PCA9685_ADDRESS( 0, ( 10 > i ) ? i : i + 1 ) : PCA9685_ADDRESS( 1, i - 15 );
+  }
+
+  startup();
+  levels();
+  bursts();
+
+  printf( "%lu pca9685 checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
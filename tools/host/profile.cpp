@@ -0,0 +1,206 @@
+/*
+ *  Profile points of Profile.h on the host build
+ *
+ *    build/profile/profile [-n rounds] [-o file]
+ *    make -C tools/host profile [BASELINE=file]
+ *
+ *  Built with PROFILE_ENABLED and without the invariant checks, see the Makefile.
+ *  Timer5 of the HAL counts host ns instead of CPU cycles, so every point
+ *  measures the code of the sketch on the host clock. The sketch runs setup() and
+ *  its tasks, the virtual clock moves a ms per run of loop(). Every round hits
+ *  every point:
+ *
+ *  - buttons:  all buttons idle, tapping and fading after a tap and hold
+ *  - switches: 3 switches with a delayed stop of 1 to 3 s, so the queue holds 3,
+ *              2, 1 and no switches
+ *  - web:      setLightChannel and setSwitchChannel, the lights, switches and
+ *              tasks XML, through the loopback of the HAL
+ *
+ *  getProfile is written to file (default stdout), tools/profile.py --xml reads
+ *  it to save a baseline of the host or to compare with one. The means are host
+ *  ns, a baseline of the host only compares with the same host, never with the
+ *  cycles of the board. A read of the host clock costs some 20 ns, next to the
+ *  cycles of the board that is a large part of the short points.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - Timer5 with its overflow count follows the host clock over many overflows
+ *  - the queued switches go off after their duration and leave the queue, the
+ *    ones behind a removed switch stay in it
+ *  - every point ran, getProfile answers 200
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, long detail = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  fprintf( stderr, "FAIL %s: %s %ld\n", scenario, rule, detail );
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+  }
+}
+
+void press( int level, unsigned long ms )
+{
+  for ( int i = 0; i < NR_BUTTONS; i++ ) hal_set_pin( buttonPins[i], level );
+
+  run( ms );
+}
+
+void request( const char *path )
+{
+  hal_web_request( path );
+
+  for ( int k = 0; k < 100 && 0 < hal_web_pending(); k++ ) run( 1 );
+}
+
+// -------------------------------------------------------- //
+
+// Spin on the host clock for 10 ms, 150 overflows of Timer5
+//
+void timer()
+{
+  scenario = "timer";
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  unsigned long cycles = profileCycles();
+
+  while ( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( 10 ) ) profileCycles();
+
+  unsigned long spent = profileCycles() - cycles;
+  unsigned long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+  check( spent <= ns && spent + 100000 >= ns, "Timer5 follows the host clock", (long)ns - (long)spent );
+}
+
+void round()
+{
+  char path[ 64 ];
+
+  scenario = "buttons";
+
+  press( LOW, 100 );
+
+  // Single tap, double tap, tap and hold for 2 s
+  //
+  press( HIGH, 50 );
+  press( LOW, 1000 );
+  press( HIGH, 50 );
+  press( LOW, 50 );
+  press( HIGH, 50 );
+  press( LOW, 1000 );
+  press( HIGH, 50 );
+  press( LOW, 50 );
+  press( HIGH, 2000 );
+  press( LOW, 1000 );
+
+  scenario = "switches";
+
+  for ( int c = 0; c < 3; c++ )
+  {
+    snprintf( path, sizeof( path ), "setSwitchChannel/%d/1/0/%d", c, 1 + c );
+    request( path );
+  }
+
+  check( 3 == queued_sw_channels_length, "3 switches queued", queued_sw_channels_length );
+
+  run( 4000 );
+
+  check( 0 == queued_sw_channels_length, "every switch left the queue", queued_sw_channels_length );
+
+  for ( int c = 0; c < 3; c++ ) check( LOW == sw_channels[c].target_state, "switch off after its duration", c );
+
+  scenario = "web";
+
+  for ( int v = 0; v < 256; v += 51 )
+  {
+    snprintf( path, sizeof( path ), "setLightChannel/1/%d/2", v );
+    request( path );
+  }
+
+  request( "getLightChannels" );
+  request( "getSwitchChannels" );
+  request( "getTasks" );
+  run( 1000 );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  int rounds = 10;
+  const char *file = NULL;
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if      ( 0 == strcmp( argv[i], "-n" ) && i + 1 < argc ) rounds = atoi( argv[++i] );
+    else if ( 0 == strcmp( argv[i], "-o" ) && i + 1 < argc ) file = argv[++i];
+    else
+    {
+      printf( "usage: %s [-n rounds] [-o file]\n", argv[0] );
+      return 2;
+    }
+  }
+
+  setup();
+
+  timer();
+
+  // Only what the rounds measure
+  //
+  memset( profile_points, 0, sizeof( profile_points ) );
+
+  for ( int r = 0; r < rounds; r++ ) round();
+
+  scenario = "profile";
+
+  for ( int i = 0; i < NR_PROFILE_POINTS; i++ ) check( 0 < profile_points[i].runs, "point ran", i );
+
+  request( "getProfile" );
+
+  const char *response = hal_web_response();
+  const char *body = strstr( response, "\r\n\r\n" );
+
+  check( 0 == strncmp( response, "HTTP/1.0 200", 12 ) && NULL != body, "getProfile answers 200" );
+
+  if ( NULL != body )
+  {
+    FILE *f = ( NULL == file ) ? stdout : fopen( file, "w" );
+
+    if ( NULL == f ) { perror( file ); return 1; }
+
+    fprintf( f, "%s\n", body + 4 );
+
+    if ( stdout != f ) fclose( f );
+  }
+
+  fprintf( stderr, "%lu profile checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+/*
+ *  Web API checks on the loopback of the HAL
+ *
+ *    build/web
+ *
+ *  The sketch runs setup() and its tasks, every request is queued with
+ *  hal_web_request and served by the next runs of the web task.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - every command of WEB_COMMAND in Web.h is served by its own command, one
+ *    Webduino dropped (see WEBDUINO_COMMANDS_COUNT) never counts its request
+ *  - getLightChannels and getSwitchChannels in every format and every way to ask
+ *    for one (.json, /json, ?json, ...): 200, the content type of the format, a
+ *    Content-Length that matches the body and a body of the format with all
+ *    channels in it
+ *  - a suffix that is no format, or one on another verb, answers 400
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define MAX_LOOPS               100     // runs of loop() a request may take to be served
+
+unsigned long failures = 0;
+
+// -------------------------------------------------------- //
+
+void fail( const char *rule, const char *path, const char *detail = "" )
+{
+  failures++;
+
+  printf( "FAIL %s: %s %s\n", rule, path, detail );
+}
+
+// -------------------------------------------------------- //
+
+// Serve path, the response is in hal_web_response
+//
+boolean serve( const char *path )
+{
+  hal_web_request( path );
+
+  for ( int i = 0; i < MAX_LOOPS && 0 < hal_web_pending(); i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+  }
+
+  if ( 0 < hal_web_pending() )
+  {
+    fail( "served", path );
+    return false;
+  }
+
+  return true;
+}
+
+// Value of a response header, up to the end of its line
+//
+boolean header( const char *name, char *value, int length )
+{
+  const char *response = hal_web_response();
+  const char *end      = strstr( response, "\r\n\r\n" );
+  const char *h        = strstr( response, name );
+
+  if ( NULL == h || NULL == end || h > end ) { return false; }
+
+  h += strlen( name );
+
+  int n = min( (int)strcspn( h, "\r" ), length - 1 );
+
+  memcpy( value, h, n );
+  value[n] = '\0';
+
+  return true;
+}
+
+const char *body( int *length )
+{
+  const char *response = hal_web_response();
+  const char *end      = strstr( response, "\r\n\r\n" );
+
+  *length = 0;
+
+  if ( NULL == end ) { return NULL; }
+
+  *length = hal_web_response_length() - ( end + 4 - response );
+
+  return end + 4;
+}
+
+int count( const char *text, int length, const char *what )
+{
+  int n = 0;
+
+  for ( int i = 0; i + (int)strlen( what ) <= length; i++ )
+  {
+    if ( 0 == strncmp( &text[i], what, strlen( what ) ) ) n++;
+  }
+
+  return n;
+}
+
+// -------------------------------------------------------- //
+
+void checkCommands()
+{
+  char name[ 32 ];
+
+  for ( int i = 0; i < NR_WEB_COMMANDS; i++ )
+  {
+    strcpy_P( name, (const char *)nameAt( webCommandNames, i ) );
+
+    const char *path = ( WEB_INDEX == i ) ? "" : ( WEB_CROSSDOMAIN == i ) ? "crossdomain.xml" : name;
+    unsigned int requests = web_command_requests[i];
+
+    if ( serve( path ) && requests == web_command_requests[i] )
+    {
+      fail( "command is registered", name );
+    }
+  }
+}
+
+// -------------------------------------------------------- //
+
+// Ways to ask for a format, with the verb filled in
+//
+const char *formatPaths[ NR_SNAPSHOT_FORMATS ][4] = {
+  { "%s",      "%s.xml",  "%s/xml",  "%s?xml" },
+  { "%s.json", "%s/json", "%s?json", "%s.json?x=1" },
+  { "%s.bin",  "%s/bin",  "%s?bin",  "%s.bin?x=1" }
+};
+
+void checkSnapshot( int kind, int format, const char *path )
+{
+  int channels = ( CHANGE_LIGHT == kind ) ? NR_LIGHT_CHANNELS : NR_SWITCH_CHANNELS;
+  char value[ 64 ];
+  char detail[ 64 ];
+  int length;
+
+  if ( !serve( path ) ) { return; }
+
+  if ( 0 != strncmp( hal_web_response(), "HTTP/1.0 200", 12 ) )
+  {
+    fail( "snapshot answers 200", path );
+    return;
+  }
+
+  if ( !header( "Content-Type: ", value, sizeof( value ) ) || 0 != strcmp( value, snapshotTypes[format] ) )
+  {
+    fail( "content type of the format", path, value );
+  }
+
+  const char *b = body( &length );
+
+  if ( !header( "Content-Length: ", value, sizeof( value ) ) || atoi( value ) != length )
+  {
+    snprintf( detail, sizeof( detail ), "%.32s announced, %d sent", value, length );
+    fail( "Content-Length matches the body", path, detail );
+  }
+
+  int found = -1;
+
+  switch ( format )
+  {
+    case ( SNAPSHOT_XML ):
+      if ( 0 == strncmp( b, "<?xml", 5 ) ) found = count( b, length, "<Channel " );
+      break;
+
+    case ( SNAPSHOT_JSON ):
+      if ( '[' == b[0] && ']' == b[ length - 1 ] ) found = ( CHANGE_LIGHT == kind ) ? count( b, length, "[" ) - 1 : count( b, length, "," ) + 1;
+      break;
+
+    case ( SNAPSHOT_BINARY ):
+      if ( 'D' == b[0] && ( ( CHANGE_LIGHT == kind ) ? 'L' : 'S' ) == b[1] &&
+           3 + channels * ( ( CHANGE_LIGHT == kind ) ? 2 : 1 ) == length ) found = (byte)b[2];
+      break;
+  }
+
+  if ( channels != found )
+  {
+    snprintf( detail, sizeof( detail ), "%d channels expected, %d found", channels, found );
+    fail( "body of the format", path, detail );
+  }
+}
+
+// -------------------------------------------------------- //
+
+void checkFails( const char *path )
+{
+  if ( serve( path ) && 0 != strncmp( hal_web_response(), "HTTP/1.0 400", 12 ) )
+  {
+    fail( "answers 400", path );
+  }
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  char path[ 64 ];
+  int checks = 0;
+
+  setup();
+
+  for ( int i = 0; i < 100; i++ )
+  {
+    hal_advance_micros( 1000 );
+    loop();
+  }
+
+  checkCommands();
+  checks += NR_WEB_COMMANDS;
+
+  for ( int kind = 0; kind < 2; kind++ )
+  {
+    for ( int format = 0; format < NR_SNAPSHOT_FORMATS; format++ )
+    {
+      for ( int i = 0; i < 4; i++ )
+      {
+        snprintf( path, sizeof( path ), formatPaths[format][i], snapshotVerbs[kind] );
+        checkSnapshot( kind, format, path );
+        checks++;
+      }
+    }
+  }
+
+  const char *fails[] = { "getLightChannels.foo", "getLightChannels.jsonx", "getTasks.json", "nothing.bin", "nothing" };
+
+  for ( unsigned int i = 0; i < sizeof( fails ) / sizeof( fails[0] ); i++ )
+  {
+    checkFails( fails[i] );
+    checks++;
+  }
+
+  printf( "%d web checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
@@ -0,0 +1,512 @@
+/*
+ *  WebSocket of WebSocket.h against the per-request HTTP path
+ *
+ *    build/websocket/websocket [-n commands]
+ *
+ *  Built with WEBSOCKET_ENABLED, see the Makefile. The sketch runs setup() and
+ *  its tasks, the virtual clock moves a ms per run of loop(). The harness is the
+ *  client: it connects to WEBSOCKET_PORT over the TCP of the HAL, upgrades and
+ *  sends masked frames, the HTTP path goes through hal_web_request.
+ *
+ *  Checks, any failure makes the exit code 1:
+ *
+ *  - the upgrade answers 101 with the Sec-WebSocket-Accept of RFC 6455 for its
+ *    example key, then frames with the state of every channel
+ *  - a light and a switch command are applied and pushed back in a frame, a
+ *    ping is answered with a pong of the same payload, a close is answered and
+ *    the server takes the next connection
+ *  - an upgrade without a key answers 400, an unmasked frame or one past
+ *    WS_BUFFER_LENGTH and an upgrade that takes longer than WS_HANDSHAKE_TIMEOUT
+ *    close the connection
+ *
+ *  Then commands (default 200) to random light values go both ways, each waits
+ *  for the last:
+ *
+ *  - http:       setLightChannel, then getLightChannels.bin until it has the value
+ *  - websocket:  a command frame, until the frame pushing the new output arrives
+ *
+ *  and the same commands again back to back. Per path the latency in virtual ms
+ *  (p50, p99, max), the commands per virtual second back to back, the host ns
+ *  of loop() per command and the bytes on the wire per command are printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "sketch.cpp"
+#include "hal.h"
+
+// ----------------------------------------------------------------- //
+
+#define COMMANDS                200
+#define TIMEOUT                 1000    // ms for a command to come back
+#define MAX_FRAME               256
+#define STREAM_LENGTH           4096
+#define REQUEST_OVERHEAD        40      // "GET /", " HTTP/1.1", Host and the empty line
+#define MAX_REQUESTS            16      // in flight, the queue of the HAL
+
+const char *rfcKey    = "dGhlIHNhbXBsZSBub25jZQ==";    // RFC 6455, 1.3
+const char *rfcAccept = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+unsigned long failures = 0;
+unsigned long checks   = 0;
+
+const char *scenario = "";
+
+int sock = -1;
+
+byte stream[ STREAM_LENGTH ];           // received from the sketch, not yet a whole frame
+int  stream_length = 0;
+
+unsigned long long loop_ns = 0;         // host time spent in loop()
+unsigned long wire_bytes = 0;           // both ways, of the path measured
+
+// -------------------------------------------------------- //
+
+void check( boolean ok, const char *rule, long detail = 0 )
+{
+  checks++;
+
+  if ( ok ) { return; }
+
+  failures++;
+
+  printf( "FAIL %s: %s %ld\n", scenario, rule, detail );
+}
+
+unsigned long long hostNanos()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void run( unsigned long ms )
+{
+  for ( unsigned long i = 0; i < ms; i++ )
+  {
+    hal_advance_micros( 1000 );
+
+    unsigned long long start = hostNanos();
+
+    loop();
+
+    loop_ns += hostNanos() - start;
+  }
+}
+
+// -------------------------------------------------------- //
+
+void receive()
+{
+  if ( 0 <= sock )
+  {
+    int n = hal_tcp_sent( sock, &stream[ stream_length ], STREAM_LENGTH - 1 - stream_length );
+
+    stream_length += n;
+    wire_bytes    += n;
+  }
+}
+
+void send( const byte *data, int length )
+{
+  check( hal_tcp_deliver( sock, data, length ), "delivered" );
+  wire_bytes += length;
+}
+
+// Masked frame of the client
+//
+void sendFrame( byte opcode, const byte *payload, int length, boolean masked = true )
+{
+  byte frame[ 2 + 4 + MAX_FRAME ];
+  byte mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+  int n = 0;
+
+  frame[n++] = WS_FIN | opcode;
+  frame[n++] = ( masked ? WS_MASK : 0 ) | length;
+
+  if ( masked )
+  {
+    memcpy( &frame[n], mask, 4 );
+    n += 4;
+  }
+
+  for ( int i = 0; i < length; i++ ) frame[n++] = payload[i] ^ ( masked ? mask[ i & 3 ] : 0 );
+
+  send( frame, n );
+}
+
+// Next frame of the sketch, false when there is no whole one
+//
+boolean nextFrame( byte *opcode, byte *payload, int *length )
+{
+  receive();
+
+  if ( 2 > stream_length || 2 + ( stream[1] & 0x7F ) > stream_length ) { return false; }
+
+  *opcode = stream[0];
+  *length = stream[1] & 0x7F;
+
+  check( 0 == ( stream[1] & WS_MASK ), "server frames unmasked" );
+
+  memcpy( payload, &stream[2], *length );
+
+  stream_length -= 2 + *length;
+  memmove( stream, &stream[ 2 + *length ], stream_length );
+
+  return true;
+}
+
+// Wait for a frame, at most ms
+//
+boolean waitFrame( byte *opcode, byte *payload, int *length, unsigned long ms )
+{
+  for ( unsigned long i = 0; i <= ms; i++ )
+  {
+    if ( nextFrame( opcode, payload, length ) ) { return true; }
+
+    run( 1 );
+  }
+
+  return false;
+}
+
+// Connect and send the upgrade request with key, NULL for none. Returns the
+// status of the response, 0 for none
+//
+int upgrade( const char *key, char *accept = NULL )
+{
+  char request[ 256 ];
+
+  stream_length = 0;
+  sock = hal_tcp_open( WEBSOCKET_PORT );
+  check( 0 <= sock, "server listens" );
+
+  if ( 0 > sock ) { return 0; }
+
+  snprintf( request, sizeof( request ),
+            "GET / HTTP/1.1\r\nHost: doduino\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n%s%s%sSec-WebSocket-Version: 13\r\n\r\n",
+            key ? "Sec-WebSocket-Key: " : "", key ? key : "", key ? "\r\n" : "" );
+
+  send( (const byte *)request, strlen( request ) );
+
+  for ( int i = 0; i < 100; i++ )
+  {
+    run( 1 );
+    receive();
+
+    stream[ stream_length ] = '\0';
+
+    char *end = strstr( (char *)stream, "\r\n\r\n" );
+
+    if ( NULL == end ) { continue; }
+
+    int status = atoi( (char *)stream + 9 );
+    char *a = strstr( (char *)stream, "Sec-WebSocket-Accept: " );
+
+    if ( accept && a && a < end ) sscanf( a + 22, "%31s", accept );
+
+    stream_length -= end + 4 - (char *)stream;
+    memmove( stream, end + 4, stream_length );
+
+    return status;
+  }
+
+  return 0;
+}
+
+boolean closed()
+{
+  SOCKET s = sock;
+
+  run( 20 );
+
+  return WS_CLOSED == ws_state && SnSR::ESTABLISHED != W5100.readSnSR( s );
+}
+
+// Light value pushed for channel in a state frame, -1 for none
+//
+int pushed( const byte *payload, int length, int kind, int channel )
+{
+  int value = -1;
+
+  for ( int i = 0; i + 2 < length; i += 3 )
+  {
+    if ( kind == payload[i] && channel == payload[ i + 1 ] ) value = payload[ i + 2 ];
+  }
+
+  return value;
+}
+
+// -------------------------------------------------------- //
+
+void protocol()
+{
+  char accept[ 32 ] = "";
+  byte opcode, payload[ MAX_FRAME ];
+  int length;
+
+  scenario = "upgrade";
+
+  check( 101 == upgrade( rfcKey, accept ), "101 Switching Protocols" );
+  check( 0 == strcmp( accept, rfcAccept ), "Sec-WebSocket-Accept" );
+
+  int lights = 0, switches = 0;
+
+  while ( waitFrame( &opcode, payload, &length, 20 ) )
+  {
+    check( ( WS_FIN | WS_OPCODE_BINARY ) == opcode && 0 == length % 3, "state frame" );
+
+    for ( int i = 0; i + 2 < length; i += 3 )
+    {
+      if ( WS_LIGHT == payload[i] ) { lights++; check( l_channels[ payload[ i + 1 ] ].light_value == payload[ i + 2 ], "light state" ); }
+      else { switches++; check( sw_channels[ payload[ i + 1 ] ].state == payload[ i + 2 ], "switch state" ); }
+    }
+  }
+
+  check( NR_LIGHT_CHANNELS == lights && NR_SWITCH_CHANNELS == switches, "state of every channel", lights + switches );
+
+  scenario = "commands";
+
+  byte light[] = { WS_LIGHT, 3, 90, 2 };
+  byte on[]    = { WS_SWITCH, 2, 1 };
+
+  sendFrame( WS_OPCODE_BINARY, light, sizeof( light ) );
+  check( waitFrame( &opcode, payload, &length, 100 ) && 90 == pushed( payload, length, WS_LIGHT, 3 ), "light pushed" );
+  check( 90 == l_channels[3].light_value, "light set" );
+
+  sendFrame( WS_OPCODE_BINARY, on, sizeof( on ) );
+
+  boolean seen = false;
+
+  while ( !seen && waitFrame( &opcode, payload, &length, 100 ) ) seen = 1 == pushed( payload, length, WS_SWITCH, 2 );
+
+  check( seen && 1 == sw_channels[2].state, "switch set and pushed" );
+
+  run( 100 );
+  while ( nextFrame( &opcode, payload, &length ) );
+
+  byte ping[] = { 'd', 'o', 'd' };
+
+  sendFrame( WS_OPCODE_PING, ping, sizeof( ping ) );
+  check( waitFrame( &opcode, payload, &length, 20 ) && ( WS_FIN | WS_OPCODE_PONG ) == opcode && 3 == length && 0 == memcmp( payload, ping, 3 ), "pong" );
+
+  scenario = "close";
+
+  sendFrame( WS_OPCODE_CLOSE, NULL, 0 );
+  check( waitFrame( &opcode, payload, &length, 20 ) && ( WS_FIN | WS_OPCODE_CLOSE ) == opcode, "close answered" );
+  check( closed(), "closed" );
+
+  scenario = "no key";
+
+  check( 400 == upgrade( NULL ), "400 without a key" );
+  check( closed(), "closed" );
+
+  scenario = "unmasked";
+
+  upgrade( rfcKey );
+  sendFrame( WS_OPCODE_BINARY, light, sizeof( light ), false );
+  check( closed(), "closed" );
+
+  scenario = "too long";
+
+  byte big[ WS_BUFFER_LENGTH + 1 ];
+
+  memset( big, 0, sizeof( big ) );
+
+  upgrade( rfcKey );
+  sendFrame( WS_OPCODE_BINARY, big, sizeof( big ) );
+  check( closed(), "closed" );
+
+  scenario = "slow upgrade";
+
+  sock = hal_tcp_open( WEBSOCKET_PORT );
+  send( (const byte *)"GET / HTTP/1.1\r\n", 16 );
+  run( WS_HANDSHAKE_TIMEOUT - 100 );
+  check( WS_HANDSHAKE == ws_state, "waits for the upgrade" );
+
+  run( 200 );
+  check( closed(), "closed after WS_HANDSHAKE_TIMEOUT" );
+}
+
+// -------------------------------------------------------- //
+
+struct Result
+{
+  std::vector<unsigned long> latency;
+  double per_second;                    // back to back
+  double ns;                            // host ns of loop() per command
+  double bytes;                         // on the wire per command
+};
+
+// Light value over HTTP as a client sees it
+//
+int httpValue( int channel )
+{
+  hal_web_request( "getLightChannels.bin" );
+
+  for ( int i = 0; i < 100 && 0 < hal_web_pending(); i++ ) run( 1 );
+
+  const char *body = strstr( hal_web_response(), "\r\n\r\n" );
+
+  wire_bytes += REQUEST_OVERHEAD + strlen( "getLightChannels.bin" ) + hal_web_response_length();
+
+  if ( NULL == body || 'L' != body[5] ) { return -1; }
+
+  return (byte)body[ 4 + 3 + 2 * channel ];
+}
+
+void httpSet( int channel, int value )
+{
+  char path[ 64 ];
+
+  snprintf( path, sizeof( path ), "setLightChannel/%d/%d/2", channel, value );
+  hal_web_request( path );
+
+  wire_bytes += REQUEST_OVERHEAD + strlen( path );
+}
+
+void http( Result *r, int commands )
+{
+  scenario = "http";
+
+  srand( 7 );
+  loop_ns = wire_bytes = 0;
+
+  for ( int i = 0; i < commands; i++ )
+  {
+    int channel = rand() % NR_PWM_LIGHT_CHANNELS, value = 1 + rand() % MAX_LIGHT_VALUE;
+    unsigned long start = now;
+
+    httpSet( channel, value );
+
+    for ( int k = 0; k < 100 && 0 < hal_web_pending(); k++ ) run( 1 );
+
+    wire_bytes += hal_web_response_length();
+
+    while ( value != httpValue( channel ) && TIMEOUT > now - start );
+
+    check( value == l_channels[ channel ].target_light_value, "set", i );
+    r->latency.push_back( now - start );
+  }
+
+  r->ns    = (double)loop_ns / commands;
+  r->bytes = (double)wire_bytes / commands;
+
+  // Back to back, the queue of the HAL kept full
+  //
+  unsigned long start = now;
+  int sent = 0;
+
+  while ( sent < commands || 0 < hal_web_pending() )
+  {
+    while ( sent < commands && MAX_REQUESTS > hal_web_pending() ) { httpSet( rand() % NR_PWM_LIGHT_CHANNELS, rand() % MAX_LIGHT_VALUE ); sent++; }
+
+    run( 1 );
+  }
+
+  r->per_second = 1000.0 * commands / max( now - start, 1UL );
+}
+
+void websocket( Result *r, int commands )
+{
+  byte opcode, payload[ MAX_FRAME ];
+  int length;
+
+  scenario = "websocket";
+
+  upgrade( rfcKey );
+  run( 50 );
+  while ( nextFrame( &opcode, payload, &length ) );
+
+  srand( 7 );
+  loop_ns = wire_bytes = 0;
+
+  for ( int i = 0; i < commands; i++ )
+  {
+    int channel = rand() % NR_PWM_LIGHT_CHANNELS, value = 1 + rand() % MAX_LIGHT_VALUE;
+    unsigned long start = now;
+    byte command[] = { WS_LIGHT, (byte)channel, (byte)value, 2 };
+
+    // The same value again is no change and never pushed
+    //
+    if ( value == l_channels[ channel ].light_value ) value = ( value % MAX_LIGHT_VALUE ) + 1, command[2] = value;
+
+    sendFrame( WS_OPCODE_BINARY, command, sizeof( command ) );
+
+    boolean seen = false;
+
+    while ( !seen && waitFrame( &opcode, payload, &length, TIMEOUT - ( now - start ) ) ) seen = value == pushed( payload, length, WS_LIGHT, channel );
+
+    check( seen, "pushed", i );
+    r->latency.push_back( now - start );
+  }
+
+  r->ns    = (double)loop_ns / commands;
+  r->bytes = (double)wire_bytes / commands;
+
+  // Back to back, the receive buffer of the socket kept full
+  //
+  unsigned long start = now, received = ws_frames_received;
+  byte mask[4] = { 0, 0, 0, 0 };
+  int sent = 0;
+
+  while ( sent < commands || 0 < ws_client.available() )
+  {
+    byte frame[] = { WS_FIN | WS_OPCODE_BINARY, WS_MASK | 4, mask[0], mask[1], mask[2], mask[3],
+                     WS_LIGHT, (byte)( rand() % NR_PWM_LIGHT_CHANNELS ), (byte)( rand() % MAX_LIGHT_VALUE ), 2 };
+
+    if ( sent < commands && hal_tcp_deliver( sock, frame, sizeof( frame ) ) ) { sent++; continue; }
+
+    run( 1 );
+    while ( nextFrame( &opcode, payload, &length ) );
+
+    if ( TIMEOUT < now - start ) { break; }
+  }
+
+  check( commands == (int)( ws_frames_received - received ) && WS_OPEN == ws_state, "every command taken", ws_frames_received - received );
+
+  r->per_second = 1000.0 * commands / max( now - start, 1UL );
+}
+
+void print( const char *path, Result *r )
+{
+  std::vector<unsigned long> l = r->latency;
+
+  std::sort( l.begin(), l.end() );
+
+  printf( "%-10s %8d %7lu %7lu %7lu %9.0f %11.0f %10.1f\n", path, (int)l.size(),
+          l[ l.size() / 2 ], l[ l.size() * 99 / 100 ], l.back(), r->per_second, r->ns, r->bytes );
+}
+
+// -------------------------------------------------------- //
+
+int main( int argc, char **argv )
+{
+  int commands = COMMANDS;
+
+  for ( int c; -1 != ( c = getopt( argc, argv, "n:" ) ); )
+  {
+    if ( 'n' == c ) commands = max( 1, atoi( optarg ) );
+  }
+
+  setup();
+  run( 100 );
+
+  protocol();
+
+  Result h, w;
+
+  http( &h, commands );
+  websocket( &w, commands );
+
+  printf( "path       commands  p50 ms  p99 ms  max ms  cmds/s   host ns/cmd  bytes/cmd\n" );
+  print( "http", &h );
+  print( "websocket", &w );
+
+  printf( "%lu websocket checks, %lu failures\n", checks, failures );
+
+  return ( 0 == failures ) ? 0 : 1;
+}
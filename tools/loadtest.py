@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+#
+# Load test the web API of a DoDuino
+#
+#   python3 tools/loadtest.py 192.168.0.5[,192.168.1.5 ...] [scenario ...] [--time 20]
+#
+# Scenarios:
+#
+#   poll        clients polling getLightChannels / getSwitchChannels back to back
+#   burst       bursts of setLightChannel, like a slider being dragged
+#   slow        clients that send their request a byte at a time
+#   mixed       pollers and bursts together
+#   ws          set commands over the WebSocket (WEBSOCKET_ENABLED), the latency is
+#               until the new value is pushed back, compare with burst for HTTP.
+#               tools/host/websocket.cpp compares both on the host build
+#
+# Per scenario the throughput and the p50 / p99 / p999 latency are printed. The
+# worst case gap between two runs of the input task and the worst case time the
+# device needed to serve a request come from getTasks, it is reset before every
+# scenario. The W5100 has 4 sockets, more clients than that mostly measure retries.
+#
+# With more than one host (a DoDuino per building) a scenario runs on all of them at
+# the same time, a line per host is printed and a total with the events per second
+# of the whole fleet. The p99 run time of the input task is the loop cost a button
+# sees under load, from the run time histogram of the scheduler (TASK_COST_ENABLED,
+# it is 0 without). Without the hardware, tools/host/load.cpp runs these scenarios
+# on the host build of the sketch and tools/host/fleet.cpp simulates a fleet with
+# occupants.
+#
+import argparse
+import base64
+import os
+import re
+import socket
+import threading
+import time
+
+TIMEOUT = 5
+WEBSOCKET_PORT = 81
+
+# -------------------------------------------------------- #
+
+def request( host, path, slow = False ):
+    start = time.time()
+
+    s = socket.create_connection( ( host, 80 ), timeout = TIMEOUT )
+
+    try:
+        data = ( 'GET /%s HTTP/1.0\r\n\r\n' % path ).encode()
+
+        if slow:
+            for i in range( len( data ) ):
+                s.send( data[i:i + 1] )
+                time.sleep( 0.05 )
+        else:
+            s.sendall( data )
+
+        response = b''
+
+        while True:
+            chunk = s.recv( 1024 )
+
+            if not chunk:
+                break
+
+            response += chunk
+    finally:
+        s.close()
+
+    if not response.startswith( b'HTTP/1.' ) or b' 200 ' not in response.split( b'\r\n' )[0]:
+        raise IOError( 'bad response' )
+
+    return time.time() - start, response
+
+# -------------------------------------------------------- #
+
+class Client( threading.Thread ):
+
+    def __init__( self, host, paths, until, pause = 0, slow = False ):
+        threading.Thread.__init__( self )
+
+        self.host      = host
+        self.paths     = paths
+        self.until     = until
+        self.pause     = pause
+        self.slow      = slow
+        self.latencies = []
+        self.errors    = 0
+
+    def run( self ):
+        i = 0
+
+        while time.time() < self.until:
+            try:
+                latency, response = request( self.host, self.paths[i % len( self.paths )], self.slow )
+                self.latencies.append( latency )
+            except ( IOError, OSError ):
+                self.errors += 1
+
+            i += 1
+
+            if self.pause:
+                time.sleep( self.pause )
+
+# -------------------------------------------------------- #
+
+class WsClient( threading.Thread ):
+
+    def __init__( self, host, channel, until ):
+        threading.Thread.__init__( self )
+
+        self.host      = host
+        self.channel   = channel
+        self.until     = until
+        self.latencies = []
+        self.errors    = 0
+        self.buffer    = b''
+
+    def connect( self ):
+        self.socket = socket.create_connection( ( self.host, WEBSOCKET_PORT ), timeout = TIMEOUT )
+
+        key = base64.b64encode( os.urandom( 16 ) ).decode()
+
+        self.socket.sendall( ( 'GET / HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                               'Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n' % ( self.host, key ) ).encode() )
+
+        while b'\r\n\r\n' not in self.buffer:
+            self.receive()
+
+        response, self.buffer = self.buffer.split( b'\r\n\r\n', 1 )
+
+        if b' 101 ' not in response.split( b'\r\n' )[0]:
+            raise IOError( 'upgrade refused' )
+
+    def receive( self ):
+        chunk = self.socket.recv( 1024 )
+
+        if not chunk:
+            raise IOError( 'connection closed' )
+
+        self.buffer += chunk
+
+    def send( self, payload ):
+        mask = os.urandom( 4 )
+
+        self.socket.sendall( bytes( [ 0x82, 0x80 | len( payload ) ] ) + mask + bytes( b ^ mask[i % 4] for i, b in enumerate( payload ) ) )
+
+    # Payload of the next frame, the DoDuino never masks and stays below 126 bytes
+    #
+    def frame( self ):
+        while len( self.buffer ) < 2 or len( self.buffer ) < 2 + ( self.buffer[1] & 0x7F ):
+            self.receive()
+
+        length  = self.buffer[1] & 0x7F
+        payload = self.buffer[2:2 + length]
+
+        self.buffer = self.buffer[2 + length:]
+
+        return payload
+
+    def run( self ):
+        try:
+            self.connect()
+        except ( IOError, OSError ):
+            self.errors += 1
+            return
+
+        value = 0
+
+        while time.time() < self.until:
+            value = ( value + 13 ) % 256
+            start = time.time()
+
+            try:
+                self.send( bytes( [ 0, self.channel, value, 2 ] ) )
+
+                # Wait for the new value to be pushed back
+                #
+                while True:
+                    payload = self.frame()
+                    entries = [ tuple( payload[i:i + 3] ) for i in range( 0, len( payload ) - 2, 3 ) ]
+
+                    if ( 0, self.channel, value ) in entries:
+                        break
+
+                self.latencies.append( time.time() - start )
+            except ( IOError, OSError ):
+                self.errors += 1
+                return
+
+        self.socket.close()
+
+# -------------------------------------------------------- #
+
+def pollers( host, until, n ):
+    return [ Client( host, [ 'getLightChannels', 'getSwitchChannels' ], until ) for i in range( n ) ]
+
+def bursts( host, until, n ):
+    # 20 steps of a slider, then a rest
+    #
+    paths = [ 'setLightChannel/%d/%d/2' % ( 1 + i, v ) for i in range( n ) for v in range( 0, 256, 13 ) ]
+
+    return [ Client( host, paths, until, pause = 0.01 ) ]
+
+def slows( host, until, n ):
+    return [ Client( host, [ 'getLightChannels' ], until, slow = True ) for i in range( n ) ]
+
+def websockets( host, until, n ):
+    return [ WsClient( host, 1 + i, until ) for i in range( n ) ]
+
+SCENARIOS = {
+    'poll':  lambda host, until: pollers( host, until, 3 ),
+    'burst': lambda host, until: bursts( host, until, 2 ),
+    'slow':  lambda host, until: slows( host, until, 2 ),
+    'mixed': lambda host, until: pollers( host, until, 2 ) + bursts( host, until, 1 ),
+    'ws':    lambda host, until: websockets( host, until, 1 ),
+}
+
+# -------------------------------------------------------- #
+
+def percentile( values, p ):
+    if not values:
+        return 0
+
+    values = sorted( values )
+
+    return values[ min( len( values ) - 1, int( len( values ) * p ) ) ]
+
+def device( host, path ):
+    latency, response = request( host, path )
+
+    text = response.decode( 'utf-8', 'replace' )
+
+    gap     = re.search( r"<Task name='input'>.*?<MaxGap>(\d+)</MaxGap>", text, re.S )
+    cost    = re.search( r"<Task name='input'>.*?<RunTimeP99>(\d+)</RunTimeP99>", text, re.S )
+    service = re.search( r"maxService='(\d+)'", text )
+
+    return [ int( m.group( 1 ) ) if m else -1 for m in ( gap, cost, service ) ]
+
+def report( name, duration, clients, figures ):
+    latencies = [ l for c in clients for l in c.latencies ]
+    errors    = sum( c.errors for c in clients )
+
+    print( '%-15s %8.1f req/s  p50 %6.1f ms  p99 %6.1f ms  p999 %6.1f ms  errors %4d  input gap %4d ms  p99 %5d us  service %6d us' % tuple( [
+        name, len( latencies ) / duration,
+        percentile( latencies, 0.5 ) * 1000, percentile( latencies, 0.99 ) * 1000, percentile( latencies, 0.999 ) * 1000,
+        errors ] + figures ) )
+
+def run( hosts, name, duration ):
+    for host in hosts:
+        device( host, 'getTasks?reset' )
+
+    until   = time.time() + duration
+    clients = dict( ( host, SCENARIOS[name]( host, until ) ) for host in hosts )
+
+    for host in hosts:
+        for c in clients[host]:
+            c.start()
+
+    for host in hosts:
+        for c in clients[host]:
+            c.join()
+
+    # Worst case of the fleet for the device figures
+    #
+    worst = [ -1, -1, -1 ]
+
+    for host in hosts:
+        figures = device( host, 'getTasks' )
+        worst   = [ max( w, f ) for w, f in zip( worst, figures ) ]
+
+        report( '%s %s' % ( name, host ) if 1 < len( hosts ) else name, duration, clients[host], figures )
+
+    if 1 < len( hosts ):
+        report( '%s total' % name, duration, [ c for host in hosts for c in clients[host] ], worst )
+
+# -------------------------------------------------------- #
+
+parser = argparse.ArgumentParser( description = 'Load test the web API of a DoDuino' )
+parser.add_argument( 'hosts', help = 'one or more hosts, separated by commas' )
+parser.add_argument( 'scenarios', nargs = '*', default = [ 'poll', 'burst', 'slow', 'mixed' ] )
+parser.add_argument( '--time', type = float, default = 20, help = 'seconds per scenario' )
+
+args = parser.parse_args()
+
+for name in args.scenarios:
+    run( args.hosts.split( ',' ), name, args.time )
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+#
+# Cycle profile of a DoDuino against a baseline (PROFILE_ENABLED, see Profile.h)
+#
+#   python3 tools/profile.py 192.168.0.5 --save baseline.json      keep the means of a known good build
+#   python3 tools/profile.py 192.168.0.5 --compare baseline.json   check a build against them
+#   python3 tools/profile.py --header baseline.json                profileBaselines for Profile.h
+#
+# The profile is read from getProfile, or from a file saved from it with --xml.
+# Let the device run its usual load first, a point is only measured once it ran.
+#
+# --compare prints a line per point and exits with 1 when a mean is more than the
+# tolerance above its baseline, when a point has no baseline (missing or 0) or when
+# it didn't run. The tolerance is the one of the device unless --tolerance is given.
+#
+# make -C tools/host profile measures the same points on the host build, in host ns
+# instead of cycles. Its baselines only compare with the same host.
+#
+import argparse
+import json
+import socket
+import sys
+import xml.etree.ElementTree as ElementTree
+
+TIMEOUT = 5
+
+# -------------------------------------------------------- #
+
+def fetch( host ):
+    s = socket.create_connection( ( host, 80 ), timeout = TIMEOUT )
+
+    try:
+        s.sendall( b'GET /getProfile HTTP/1.0\r\n\r\n' )
+
+        response = b''
+
+        while True:
+            chunk = s.recv( 1024 )
+
+            if not chunk:
+                break
+
+            response += chunk
+    finally:
+        s.close()
+
+    head, _, body = response.partition( b'\r\n\r\n' )
+
+    if b' 200 ' not in head.split( b'\r\n' )[0]:
+        raise IOError( 'bad response from %s' % host )
+
+    return body.decode( 'utf-8', 'replace' )
+
+# -------------------------------------------------------- #
+
+def parse( text ):
+    root   = ElementTree.fromstring( text )
+    points = {}
+
+    for p in root.findall( 'Point' ):
+        points[ p.get( 'name' ) ] = {
+            'runs': int( p.findtext( 'Runs' ) ),
+            'mean': int( p.findtext( 'Mean' ) ),
+            'max':  int( p.findtext( 'Max' ) ),
+        }
+
+    return { 'tolerance': int( root.get( 'tolerance' ) ), 'points': points }
+
+# -------------------------------------------------------- #
+
+def compare( profile, baseline, tolerance ):
+    failed = 0
+
+    print( '%-18s %10s %10s %10s  %s' % ( 'point', 'runs', 'mean', 'baseline', 'status' ) )
+
+    for name, p in profile['points'].items():
+        base = baseline['points'].get( name, {} ).get( 'mean', 0 )
+
+        if 0 == base:
+            status = 'no baseline'
+        elif 0 == p['runs']:
+            status = 'no runs'
+        elif p['mean'] * 100 > base * ( 100 + tolerance ):
+            status = 'regression +%d%%' % ( ( p['mean'] - base ) * 100 // base )
+        else:
+            status = 'ok'
+
+        if 'ok' != status:
+            failed += 1
+
+        print( '%-18s %10d %10d %10d  %s' % ( name, p['runs'], p['mean'], base, status ) )
+
+    print( '%d of %d points failed, tolerance %d%%' % ( failed, len( profile['points'] ), tolerance ) )
+
+    return 0 == failed
+
+# -------------------------------------------------------- #
+
+# The points are in the order of getProfile, which is the order of PROFILE_POINT
+#
+def header( baseline ):
+    points = list( baseline['points'].items() )
+
+    print( 'const unsigned long profileBaselines[ NR_PROFILE_POINTS ] PROGMEM = {' )
+
+    for i, ( name, p ) in enumerate( points ):
+        print( '  %s%s   // %s' % ( p['mean'], ',' if i + 1 < len( points ) else ' ', name ) )
+
+    print( '};' )
+
+# -------------------------------------------------------- #
+
+parser = argparse.ArgumentParser( description = 'Cycle profile of a DoDuino against a baseline' )
+parser.add_argument( 'host', nargs = '?', help = 'device to read getProfile from' )
+parser.add_argument( '--xml', help = 'read the profile from a file instead' )
+parser.add_argument( '--save', metavar = 'FILE', help = 'write the profile as baseline' )
+parser.add_argument( '--compare', metavar = 'FILE', help = 'compare the profile with a baseline' )
+parser.add_argument( '--header', metavar = 'FILE', help = 'print profileBaselines of a baseline' )
+parser.add_argument( '--tolerance', type = int, help = 'percent, instead of the one of the device' )
+
+args = parser.parse_args()
+
+if args.header:
+    with open( args.header ) as f:
+        header( json.load( f ) )
+
+    sys.exit( 0 )
+
+if not args.host and not args.xml:
+    parser.error( 'a host or --xml is needed' )
+
+if args.xml:
+    with open( args.xml ) as f:
+        profile = parse( f.read() )
+else:
+    profile = parse( fetch( args.host ) )
+
+if args.save:
+    missing = [ name for name, p in profile['points'].items() if 0 == p['runs'] ]
+
+    if missing:
+        print( 'no runs, no baseline for: %s' % ', '.join( missing ) )
+
+    with open( args.save, 'w' ) as f:
+        json.dump( profile, f, indent = 2 )
+
+if args.compare:
+    with open( args.compare ) as f:
+        baseline = json.load( f )
+
+    tolerance = profile['tolerance'] if args.tolerance is None else args.tolerance
+
+    sys.exit( 0 if compare( profile, baseline, tolerance ) else 1 )
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+#
+# Compress the web UI and write it as a PROGMEM array to WebUi.h
+#
+# Run from the sketch directory after changing webui/index.html:
+#
+#   python3 webui/embed.py
+#
+import gzip
+import os
+
+here    = os.path.dirname( os.path.abspath( __file__ ) )
+source  = os.path.join( here, 'index.html' )
+target  = os.path.join( here, '..', 'WebUi.h' )
+
+with open( source, 'rb' ) as f:
+    html = f.read()
+
+# mtime 0 keeps the output the same for the same input
+#
+data = gzip.compress( html, compresslevel = 9, mtime = 0 )
+
+lines = []
+for i in range( 0, len( data ), 16 ):
+    lines.append( '  ' + ','.join( '0x%02x' % b for b in data[i:i + 16] ) )
+
+with open( target, 'w' ) as f:
+    f.write( '// Generated by webui/embed.py from webui/index.html, do not edit\n' )
+    f.write( '//\n' )
+    f.write( '// %d bytes of html, %d bytes gzipped\n' % ( len( html ), len( data ) ) )
+    f.write( '//\n' )
+    f.write( '#define WEBUI_LENGTH  %d\n\n' % len( data ) )
+    f.write( 'P(webui) = {\n' )
+    f.write( ',\n'.join( lines ) )
+    f.write( '\n};\n' )